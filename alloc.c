@@ -0,0 +1,487 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h>
+#include <windows.h>
+
+#include "alloc.h"
+#include "stats.h"
+
+/*
+ * With accounting every block starts with a header that remembers its
+ * size and the function it is counted for; the caller gets the memory
+ * after it. ALLOC_HEADER_SIZE keeps the alignment malloc() gives.
+ */
+#define ALLOC_HEADER_SIZE 16
+
+typedef struct
+{
+  size_t size;
+  int api;
+} alloc_header;
+
+static void *
+crt_malloc (size_t size, void *userdata)
+{
+  return malloc (size);
+}
+
+static void *
+crt_realloc (void *ptr, size_t size, void *userdata)
+{
+  return realloc (ptr, size);
+}
+
+static void
+crt_free (void *ptr, void *userdata)
+{
+  free (ptr);
+}
+
+static ntlink_allocator alloc_funcs = { crt_malloc, crt_realloc, crt_free, NULL };
+static int alloc_custom = 0;
+static int alloc_accounting = 0;
+/* Per thread: the function being counted + 1 and the nesting depth << 8 */
+static DWORD alloc_index = FLS_OUT_OF_INDEXES;
+static ntlink_alloc_counter alloc_api[NTLINK_API_COUNT + 1];
+static volatile LONGLONG alloc_live_bytes = 0;
+static volatile LONGLONG alloc_live_blocks = 0;
+static volatile LONGLONG alloc_peak_bytes = 0;
+
+/**
+ * ntlink_set_allocator:
+ * @allocator: the functions to use, or NULL for malloc(), realloc() and
+ *   free()
+ * @flags: a combination of one or more members of AllocatorFlags
+ *
+ * Makes the library allocate all its memory with @allocator, including
+ * the memory it returns to the caller, which must then be freed with
+ * ntlink_free() instead of free(). The simulator (fssim.c) stands for
+ * the operating system and keeps using the C runtime.
+ * Call this before any other function of the library and before other
+ * threads use it: blocks allocated earlier can't be freed afterwards.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set: EINVAL if a function is missing, ENOMEM if
+ *      there are no FLS slots left for accounting)
+ */
+int
+ntlink_set_allocator (const ntlink_allocator *allocator, AllocatorFlags flags)
+{
+  if (allocator != NULL && (allocator->malloc_func == NULL ||
+      allocator->realloc_func == NULL || allocator->free_func == NULL))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((flags & NTLINK_ALLOC_FLAG_ACCOUNTING) && alloc_index == FLS_OUT_OF_INDEXES)
+  {
+    alloc_index = FlsAlloc (NULL);
+    if (alloc_index == FLS_OUT_OF_INDEXES)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  if (allocator != NULL)
+    alloc_funcs = *allocator;
+  else
+  {
+    alloc_funcs.malloc_func = crt_malloc;
+    alloc_funcs.realloc_func = crt_realloc;
+    alloc_funcs.free_func = crt_free;
+    alloc_funcs.userdata = NULL;
+  }
+  alloc_custom = allocator != NULL;
+  alloc_accounting = (flags & NTLINK_ALLOC_FLAG_ACCOUNTING) != 0;
+  memset (alloc_api, 0, sizeof (alloc_api));
+  alloc_live_bytes = 0;
+  alloc_live_blocks = 0;
+  alloc_peak_bytes = 0;
+  return 0;
+}
+
+/**
+ * ntlink_alloc_current:
+ *
+ * Returns:
+ * the public function the calling thread is in (the outermost one),
+ * -1 if none or if accounting is disabled
+ */
+int
+ntlink_alloc_current (void)
+{
+  INT_PTR v;
+  if (!alloc_accounting)
+    return -1;
+  v = (INT_PTR) FlsGetValue (alloc_index);
+  if ((v >> 8) == 0)
+    return -1;
+  return (int) (v & 0xFF) - 1;
+}
+
+/**
+ * ntlink_alloc_enter:
+ * @api: a ntlink_stats_api value, or -1
+ *
+ * Counts the allocations the calling thread makes for @api, until the
+ * matching ntlink_alloc_leave(). Nested calls keep counting for the
+ * outermost function. Cheap when accounting is disabled.
+ */
+void
+ntlink_alloc_enter (int api)
+{
+  INT_PTR v;
+  DWORD lerr;
+  if (!alloc_accounting || api < 0)
+    return;
+  lerr = GetLastError ();
+  v = (INT_PTR) FlsGetValue (alloc_index);
+  if ((v >> 8) == 0)
+    v = api + 1;
+  v += 1 << 8;
+  FlsSetValue (alloc_index, (PVOID) v);
+  SetLastError (lerr);
+}
+
+/**
+ * ntlink_alloc_leave:
+ *
+ * Ends ntlink_alloc_enter(). Preserves the last Win32 error.
+ */
+void
+ntlink_alloc_leave (void)
+{
+  INT_PTR v;
+  DWORD lerr;
+  if (!alloc_accounting)
+    return;
+  lerr = GetLastError ();
+  v = (INT_PTR) FlsGetValue (alloc_index);
+  if ((v >> 8) > 0)
+    v -= 1 << 8;
+  if ((v >> 8) == 0)
+    v = 0;
+  FlsSetValue (alloc_index, (PVOID) v);
+  SetLastError (lerr);
+}
+
+static void
+alloc_add (volatile LONGLONG *counter, LONGLONG value)
+{
+  InterlockedExchangeAdd64 (counter, value);
+}
+
+static void
+alloc_count_new (alloc_header *h, size_t size)
+{
+  LONGLONG live, peak;
+  int api = ntlink_alloc_current ();
+  ntlink_alloc_counter *c;
+
+  h->size = size;
+  h->api = api >= 0 ? api : NTLINK_API_COUNT;
+  c = &alloc_api[h->api];
+  alloc_add ((volatile LONGLONG *) &c->allocs, 1);
+  alloc_add ((volatile LONGLONG *) &c->bytes, size);
+  alloc_add ((volatile LONGLONG *) &c->live_bytes, size);
+  alloc_add (&alloc_live_blocks, 1);
+  live = InterlockedExchangeAdd64 (&alloc_live_bytes, size) + size;
+  while ((peak = alloc_peak_bytes) < live &&
+      InterlockedCompareExchange64 (&alloc_peak_bytes, live, peak) != peak);
+}
+
+static void
+alloc_count_free (alloc_header *h)
+{
+  ntlink_alloc_counter *c = &alloc_api[h->api];
+  alloc_add ((volatile LONGLONG *) &c->frees, 1);
+  alloc_add ((volatile LONGLONG *) &c->live_bytes, -(LONGLONG) h->size);
+  alloc_add (&alloc_live_blocks, -1);
+  alloc_add (&alloc_live_bytes, -(LONGLONG) h->size);
+}
+
+/**
+ * ntlink_malloc:
+ * @size: number of bytes
+ *
+ * malloc() with the allocator set by ntlink_set_allocator().
+ *
+ * Returns:
+ * the memory, or NULL with errno set to ENOMEM
+ */
+void *
+ntlink_malloc (size_t size)
+{
+  alloc_header *h;
+
+  if (!alloc_accounting)
+  {
+    void *ptr = alloc_funcs.malloc_func (size, alloc_funcs.userdata);
+    if (ptr == NULL)
+      errno = ENOMEM;
+    return ptr;
+  }
+  if (size > (size_t) -1 - ALLOC_HEADER_SIZE)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  h = (alloc_header *) alloc_funcs.malloc_func (ALLOC_HEADER_SIZE + size, alloc_funcs.userdata);
+  if (h == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  alloc_count_new (h, size);
+  return (char *) h + ALLOC_HEADER_SIZE;
+}
+
+/**
+ * ntlink_calloc:
+ * @count: number of elements
+ * @size: size of an element
+ *
+ * calloc() with the allocator set by ntlink_set_allocator().
+ *
+ * Returns:
+ * zeroed memory, or NULL with errno set to ENOMEM
+ */
+void *
+ntlink_calloc (size_t count, size_t size)
+{
+  void *ptr;
+
+  if (!alloc_custom && !alloc_accounting)
+  {
+    ptr = calloc (count, size);
+    if (ptr == NULL)
+      errno = ENOMEM;
+    return ptr;
+  }
+  if (size != 0 && count > (size_t) -1 / size)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  ptr = ntlink_malloc (count * size);
+  if (ptr != NULL)
+    memset (ptr, 0, count * size);
+  return ptr;
+}
+
+/**
+ * ntlink_realloc:
+ * @ptr: memory from ntlink_malloc() and friends, or NULL
+ * @size: the new size
+ *
+ * realloc() with the allocator set by ntlink_set_allocator().
+ *
+ * Returns:
+ * the memory, or NULL with errno set to ENOMEM (@ptr is left alone then)
+ */
+void *
+ntlink_realloc (void *ptr, size_t size)
+{
+  alloc_header *h, *newh;
+  size_t oldsize;
+  ntlink_alloc_counter *c;
+
+  if (ptr == NULL)
+    return ntlink_malloc (size);
+  if (!alloc_accounting)
+  {
+    void *newptr = alloc_funcs.realloc_func (ptr, size, alloc_funcs.userdata);
+    if (newptr == NULL)
+      errno = ENOMEM;
+    return newptr;
+  }
+  if (size > (size_t) -1 - ALLOC_HEADER_SIZE)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  h = (alloc_header *) ((char *) ptr - ALLOC_HEADER_SIZE);
+  oldsize = h->size;
+  newh = (alloc_header *) alloc_funcs.realloc_func (h, ALLOC_HEADER_SIZE + size, alloc_funcs.userdata);
+  if (newh == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  /* Still counted for the function that allocated it */
+  c = &alloc_api[newh->api];
+  alloc_add ((volatile LONGLONG *) &c->reallocs, 1);
+  if (size > oldsize)
+    alloc_add ((volatile LONGLONG *) &c->bytes, size - oldsize);
+  alloc_add ((volatile LONGLONG *) &c->live_bytes, (LONGLONG) size - (LONGLONG) oldsize);
+  newh->size = size;
+  if (size > oldsize)
+  {
+    LONGLONG live, peak;
+    live = InterlockedExchangeAdd64 (&alloc_live_bytes, size - oldsize) + (size - oldsize);
+    while ((peak = alloc_peak_bytes) < live &&
+        InterlockedCompareExchange64 (&alloc_peak_bytes, live, peak) != peak);
+  }
+  else
+    alloc_add (&alloc_live_bytes, -(LONGLONG) (oldsize - size));
+  return (char *) newh + ALLOC_HEADER_SIZE;
+}
+
+/**
+ * ntlink_free:
+ * @ptr: memory from ntlink_malloc() and friends, or NULL
+ *
+ * free() with the allocator set by ntlink_set_allocator(). Use it for
+ * the memory the library returns. Preserves errno.
+ */
+void
+ntlink_free (void *ptr)
+{
+  alloc_header *h;
+  int err;
+
+  if (ptr == NULL)
+    return;
+  err = errno;
+  if (!alloc_accounting)
+    alloc_funcs.free_func (ptr, alloc_funcs.userdata);
+  else
+  {
+    h = (alloc_header *) ((char *) ptr - ALLOC_HEADER_SIZE);
+    alloc_count_free (h);
+    alloc_funcs.free_func (h, alloc_funcs.userdata);
+  }
+  errno = err;
+}
+
+/**
+ * ntlink_wcsdup:
+ * @s: a string
+ *
+ * wcsdup() with the allocator set by ntlink_set_allocator().
+ *
+ * Returns:
+ * a copy of @s, or NULL with errno set to ENOMEM
+ */
+wchar_t *
+ntlink_wcsdup (const wchar_t *s)
+{
+  size_t size = (wcslen (s) + 1) * sizeof (wchar_t);
+  wchar_t *copy = (wchar_t *) ntlink_malloc (size);
+  if (copy != NULL)
+    memcpy (copy, s, size);
+  return copy;
+}
+
+/**
+ * ntlink_strdup:
+ * @s: a string
+ *
+ * strdup() with the allocator set by ntlink_set_allocator().
+ *
+ * Returns:
+ * a copy of @s, or NULL with errno set to ENOMEM
+ */
+char *
+ntlink_strdup (const char *s)
+{
+  size_t size = strlen (s) + 1;
+  char *copy = (char *) ntlink_malloc (size);
+  if (copy != NULL)
+    memcpy (copy, s, size);
+  return copy;
+}
+
+/**
+ * ntlink_alloc_get_stats:
+ * @stats: receives the counters
+ *
+ * Copies the allocation counters. Allocations in progress in other
+ * threads may or may not be counted.
+ *
+ * Returns:
+ * 0 on success, -1 if accounting is disabled (@stats is zeroed)
+ */
+int
+ntlink_alloc_get_stats (ntlink_alloc_stats *stats)
+{
+  memset (stats, 0, sizeof (*stats));
+  if (!alloc_accounting)
+    return -1;
+  memcpy (stats->api, alloc_api, sizeof (alloc_api));
+  stats->live_bytes = alloc_live_bytes;
+  stats->live_blocks = alloc_live_blocks;
+  stats->peak_bytes = alloc_peak_bytes;
+  return 0;
+}
+
+/**
+ * ntlink_alloc_reset_peak:
+ *
+ * Starts measuring the peak from the memory in use now, e.g. before an
+ * operation whose peak is of interest.
+ */
+void
+ntlink_alloc_reset_peak (void)
+{
+  alloc_peak_bytes = alloc_live_bytes;
+}
+
+/**
+ * ntlink_alloc_print_stats:
+ * @f: a file to write to
+ *
+ * Writes a table of the allocations counted for each public function,
+ * and the memory in use and its peak. Works with both narrow and wide
+ * streams.
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int
+ntlink_alloc_print_stats (FILE *f)
+{
+  ntlink_alloc_stats stats;
+  ntlink_alloc_counter *c;
+  int i, r = 0;
+
+  if (ntlink_alloc_get_stats (&stats) != 0)
+    return -1;
+  r |= ntlink_stats_print_line (f, "%-40s %10s %10s %10s %12s %12s\n",
+      "allocated in", "allocs", "reallocs", "frees", "bytes", "live bytes");
+  for (i = 0; i <= NTLINK_API_COUNT; i++)
+  {
+    c = &stats.api[i];
+    if (c->allocs == 0)
+      continue;
+    r |= ntlink_stats_print_line (f, "%-40s %10llu %10llu %10llu %12llu %12lld\n",
+        i < NTLINK_API_COUNT ? ntlink_stats_api_name ((ntlink_stats_api) i) : "(other)",
+        c->allocs, c->reallocs, c->frees, c->bytes, c->live_bytes);
+  }
+  r |= ntlink_stats_print_line (f, "in use: %lld bytes in %lld blocks, peak %lld bytes\n",
+      stats.live_bytes, stats.live_blocks, stats.peak_bytes);
+  return r;
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_ALLOC_H__
+#define __NTLINK_ALLOC_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <wchar.h>
+#include <windows.h>
+
+#include "stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ntlink_allocator:
+ * @malloc_func: allocates @size bytes, returns NULL on failure
+ * @realloc_func: resizes a block (@ptr is never NULL), returns NULL on
+ *   failure and leaves the block alone then
+ * @free_func: frees a block (@ptr is never NULL)
+ * @userdata: passed to the functions
+ *
+ * Memory functions for the library, see ntlink_set_allocator(). They
+ * are called from any thread that uses the library.
+ */
+typedef struct
+{
+  void *(*malloc_func) (size_t size, void *userdata);
+  void *(*realloc_func) (void *ptr, size_t size, void *userdata);
+  void (*free_func) (void *ptr, void *userdata);
+  void *userdata;
+} ntlink_allocator;
+
+/**
+ * AllocatorFlags:
+ * @NTLINK_ALLOC_FLAG_NOTHING: default behaviour
+ * @NTLINK_ALLOC_FLAG_ACCOUNTING: count allocations and bytes per public
+ *   function and keep track of the memory in use and its peak, see
+ *   ntlink_alloc_get_stats()
+ */
+typedef enum
+{
+  NTLINK_ALLOC_FLAG_NOTHING    = 0x00000000,
+  NTLINK_ALLOC_FLAG_ACCOUNTING = 0x00000001
+} AllocatorFlags;
+
+/**
+ * ntlink_alloc_counter:
+ * @allocs: number of blocks allocated
+ * @reallocs: number of blocks resized
+ * @frees: number of blocks freed
+ * @bytes: bytes allocated, including what resizing added
+ * @live_bytes: bytes in blocks that are not freed yet
+ *
+ * Blocks are counted for the public function that was running in the
+ * thread when they were allocated (the outermost one, for nested calls),
+ * also when they are resized and freed later, elsewhere.
+ */
+typedef struct
+{
+  unsigned long long allocs;
+  unsigned long long reallocs;
+  unsigned long long frees;
+  unsigned long long bytes;
+  long long live_bytes;
+} ntlink_alloc_counter;
+
+/**
+ * ntlink_alloc_stats:
+ * @api: counters per public function, indexed by ntlink_stats_api;
+ *   @api[NTLINK_API_COUNT] has the blocks allocated outside of them
+ *   (narrow to wide conversions, ntlink_realpath_cache_new()...)
+ * @live_bytes: bytes in use
+ * @live_blocks: blocks in use
+ * @peak_bytes: the most bytes that were in use at once, since accounting
+ *   was enabled or ntlink_alloc_reset_peak() was called
+ */
+typedef struct
+{
+  ntlink_alloc_counter api[NTLINK_API_COUNT + 1];
+  long long live_bytes;
+  long long live_blocks;
+  long long peak_bytes;
+} ntlink_alloc_stats;
+
+int ntlink_set_allocator (const ntlink_allocator *allocator, AllocatorFlags flags);
+int ntlink_alloc_get_stats (ntlink_alloc_stats *stats);
+void ntlink_alloc_reset_peak (void);
+int ntlink_alloc_print_stats (FILE *f);
+
+void *ntlink_malloc (size_t size);
+void *ntlink_calloc (size_t count, size_t size);
+void *ntlink_realloc (void *ptr, size_t size);
+void ntlink_free (void *ptr);
+wchar_t *ntlink_wcsdup (const wchar_t *s);
+char *ntlink_strdup (const char *s);
+
+/* Used by the library to attribute allocations to the public functions */
+int ntlink_alloc_current (void);
+void ntlink_alloc_enter (int api);
+void ntlink_alloc_leave (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_ALLOC_H__ */
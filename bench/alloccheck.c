@@ -0,0 +1,266 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Custom allocator check.
+ *
+ * Run by "make check" (make -f Makefile.linux check on Linux). Usage:
+ *   alloccheck [<rounds>]
+ *
+ * Installs an allocator that tags and counts its blocks, with accounting,
+ * and then, in the simulator, creates links with ntlink_symlink_batchw(),
+ * resolves them with ntlink_realpathw(), reads them with ntlink_readlinkw()
+ * and ntlink_readlink() and removes the tree with ntlink_remove_treew(),
+ * on several threads. The strings the library returns are freed with
+ * ntlink_free(). A block that is freed with free() has the wrong address
+ * (and crashes), a block the hook did not allocate has the wrong tag, and
+ * a block that is not freed stays in use: after the first round (which
+ * starts the shared pool and the I/O queues) every round must end with
+ * the same number of blocks in use, both as the hook counts them and as
+ * ntlink_alloc_get_stats() does.
+ * Prints PASS or FAIL for every check, exits with 1 if any of them failed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <windows.h>
+
+#include "misc.h"
+#include "extra_string.h"
+#include "quasisymlink.h"
+#include "realpath.h"
+#include "removetree.h"
+#include "fsbackend.h"
+#include "fssim.h"
+#include "alloc.h"
+
+#define LINK_COUNT 32
+/* Keeps the alignment malloc() gives, like alloc.c */
+#define HOOK_HEADER_SIZE 16
+#define HOOK_TAG 0x4E544C4BUL
+
+typedef struct
+{
+  unsigned long tag;
+  size_t size;
+} hook_header;
+
+static volatile LONGLONG hook_allocs = 0;
+static volatile LONGLONG hook_frees = 0;
+static volatile LONGLONG hook_foreign = 0;
+static int failed = 0;
+
+static void *
+hook_malloc (size_t size, void *userdata)
+{
+  hook_header *h = (hook_header *) malloc (HOOK_HEADER_SIZE + size);
+  if (h == NULL)
+    return NULL;
+  h->tag = HOOK_TAG;
+  h->size = size;
+  InterlockedExchangeAdd64 (&hook_allocs, 1);
+  return (char *) h + HOOK_HEADER_SIZE;
+}
+
+static void *
+hook_realloc (void *ptr, size_t size, void *userdata)
+{
+  hook_header *h = (hook_header *) ((char *) ptr - HOOK_HEADER_SIZE);
+  if (h->tag != HOOK_TAG)
+  {
+    InterlockedExchangeAdd64 (&hook_foreign, 1);
+    return NULL;
+  }
+  h = (hook_header *) realloc (h, HOOK_HEADER_SIZE + size);
+  if (h == NULL)
+    return NULL;
+  h->size = size;
+  return (char *) h + HOOK_HEADER_SIZE;
+}
+
+static void
+hook_free (void *ptr, void *userdata)
+{
+  hook_header *h = (hook_header *) ((char *) ptr - HOOK_HEADER_SIZE);
+  if (h->tag != HOOK_TAG)
+  {
+    /* Not ours: leak it rather than corrupt the heap */
+    InterlockedExchangeAdd64 (&hook_foreign, 1);
+    return;
+  }
+  h->tag = 0;
+  InterlockedExchangeAdd64 (&hook_frees, 1);
+  free (h);
+}
+
+static void
+check (int ok, const char *what)
+{
+  printf ("%s: %s\n", ok ? "PASS" : "FAIL", what);
+  if (!ok)
+    failed = 1;
+}
+
+static int
+make_file (const wchar_t *path)
+{
+  HANDLE h = ntlink_fs->create_file (path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (h == INVALID_HANDLE_VALUE)
+    return -1;
+  ntlink_fs->close_handle (h);
+  return 0;
+}
+
+/*
+ * C:\check\tree\dir<i> - 4 directories with a file each
+ * C:\check\tree\links<i>\link<j> - links to them, made by the batch:
+ *   file symlinks, directory symlinks and junctions in turn
+ * Returns the number of calls that failed.
+ */
+static int
+round_trip (void)
+{
+  static wchar_t targets[LINK_COUNT][MAX_PATH];
+  static wchar_t links[LINK_COUNT][MAX_PATH];
+  SymlinkBatchItem items[LINK_COUNT];
+  ntlink_realpath_cache *cache;
+  RemoveTreeOptions options;
+  wchar_t buf[MAX_PATH + 1], *w;
+  char narrow[MAX_PATH + 1], *s;
+  int i, errors = 0;
+
+  errors += !ntlink_fs->create_directory (L"C:\\check\\tree", NULL);
+  for (i = 0; i < 4; i++)
+  {
+    _snwprintf (buf, MAX_PATH, L"C:\\check\\tree\\dir%d", i);
+    errors += !ntlink_fs->create_directory (buf, NULL);
+    _snwprintf (buf, MAX_PATH, L"C:\\check\\tree\\dir%d\\file", i);
+    errors += make_file (buf) != 0;
+  }
+  for (i = 0; i < LINK_COUNT; i++)
+  {
+    items[i].type = (SymlinkBlindType) (i % 3);
+    if (items[i].type == BLIND_SYMLINK_FILE)
+      _snwprintf (targets[i], MAX_PATH, L"..\\dir%d\\file", i % 4);
+    else if (items[i].type == BLIND_SYMLINK_DIR)
+      _snwprintf (targets[i], MAX_PATH, L"..\\dir%d", i % 4);
+    else
+      _snwprintf (targets[i], MAX_PATH, L"C:\\check\\tree\\dir%d", i % 4);
+    _snwprintf (links[i], MAX_PATH, L"C:\\check\\tree\\links%d\\link%d", i % 4, i);
+    items[i].target = targets[i];
+    items[i].linkpath = links[i];
+    items[i].status = -1;
+  }
+  errors += ntlink_symlink_batchw (items, LINK_COUNT, L"C:\\check", 4, SYMLINK_BATCH_FLAG_CREATE_PARENTS) != 0;
+
+  cache = ntlink_realpath_cache_new ();
+  errors += cache == NULL;
+  for (i = 0; i < LINK_COUNT; i++)
+  {
+    if (ntlink_realpathw (links[i], &w, i % 2 ? cache : NULL, REALPATH_FLAG_NOTHING) != 0)
+      errors += 1;
+    else
+      ntlink_free (w);
+    errors += ntlink_readlinkw (links[i], buf, MAX_PATH) < 0;
+  }
+  ntlink_realpath_cache_free (cache);
+
+  /* The narrow wrappers and the helpers that return strings */
+  errors += ntlink_readlink ("C:\\check\\tree\\links0\\link0", narrow, MAX_PATH) < 0;
+  if (strtowchar ("C:\\check\\tree\\links1", &w, CP_THREAD_ACP) < 0)
+    errors += 1;
+  else
+  {
+    if (wchartostr (w, &s, CP_THREAD_ACP) < 0)
+      errors += 1;
+    else
+      ntlink_free (s);
+    ntlink_free (w);
+  }
+  if (GetAbsNameW (L"links2\\..\\dir2", &w, L"C:\\check\\tree", 2) != 0)
+    errors += 1;
+  else
+    ntlink_free (w);
+  if (GetRelNameW (L"C:\\check\\tree\\dir3", &w, L"C:\\check\\tree\\links3") < 0)
+    errors += 1;
+  else
+    ntlink_free (w);
+
+  memset (&options, 0, sizeof (options));
+  options.nthreads = 4;
+  errors += ntlink_remove_treew (L"C:\\check\\tree", &options) != 0;
+  return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  ntlink_allocator allocator = { hook_malloc, hook_realloc, hook_free, NULL };
+  ntlink_alloc_stats stats;
+  ntlink_fssim *sim;
+  long long live_blocks = 0, live_bytes = 0;
+  int rounds = 4, i;
+  char what[128];
+
+  if (argc > 1)
+    rounds = atoi (argv[1]);
+  check (ntlink_set_allocator (&allocator, NTLINK_ALLOC_FLAG_ACCOUNTING) == 0, "install the allocator");
+
+  sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+  if (sim == NULL)
+  {
+    fprintf (stderr, "Failed to create a simulator\n");
+    return 1;
+  }
+  ntlink_fssim_install (sim);
+  if (!ntlink_fs->create_directory (L"C:\\check", NULL))
+  {
+    fprintf (stderr, "Failed to create C:\\check\n");
+    return 1;
+  }
+
+  for (i = 0; i < rounds; i++)
+  {
+    snprintf (what, sizeof (what), "round %d: batch, realpath, readlink and remove tree", i + 1);
+    check (round_trip () == 0, what);
+    ntlink_alloc_get_stats (&stats);
+    snprintf (what, sizeof (what), "round %d: %lld blocks in use, the hook has %lld",
+        i + 1, stats.live_blocks, (long long) (hook_allocs - hook_frees));
+    check (stats.live_blocks == hook_allocs - hook_frees, what);
+    if (i == 0)
+    {
+      live_blocks = stats.live_blocks;
+      live_bytes = stats.live_bytes;
+      continue;
+    }
+    snprintf (what, sizeof (what), "round %d: %lld blocks and %lld bytes in use, %lld and %lld after round 1",
+        i + 1, stats.live_blocks, stats.live_bytes, live_blocks, live_bytes);
+    check (stats.live_blocks == live_blocks && stats.live_bytes == live_bytes, what);
+  }
+  snprintf (what, sizeof (what), "%lld blocks allocated and %lld freed by the hook, %lld foreign",
+      (long long) hook_allocs, (long long) hook_frees, (long long) hook_foreign);
+  check (hook_allocs > 0 && hook_frees > 0 && hook_foreign == 0, what);
+
+  ntlink_fssim_install (NULL);
+  ntlink_fssim_free (sim);
+  return failed;
+}
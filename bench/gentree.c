@@ -0,0 +1,128 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Makes a synthetic tree with files, directories, symlink chains,
+ * junction points and hard links, see treegen.c.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <windows.h>
+
+#include "misc.h"
+#include "extra_string.h"
+#include "alloc.h"
+#include "fssim.h"
+#include "treegen.h"
+
+static void
+usage (const char *name)
+{
+  fwprintf (stderr, L"\
+Usage: %hs <directory> [option value ...]\n\
+Makes a tree under <directory>, which must not exist, and prints what\n\
+was made as a JSON object.\n\
+  o <filename> - make the tree in an empty simulated filesystem instead,\n\
+  and save it to <filename> (load it with NTLINK_FSSIM_TREE=<filename>)\n\
+", name);
+  treegen_print_usage (stderr);
+}
+
+int
+main (int argc, char **argv)
+{
+  treegen_params params;
+  treegen_stats stats;
+  ntlink_fssim *sim = NULL;
+  const char *output = NULL;
+  wchar_t *root = NULL, *absroot = NULL;
+  int i, r;
+
+  treegen_defaults (&params);
+  if (argc < 2 || argc % 2 != 0)
+  {
+    usage (argv[0]);
+    return 1;
+  }
+  for (i = 2; i < argc; i += 2)
+  {
+    if (strcmp (argv[i], "o") == 0)
+      output = argv[i + 1];
+    else if ((r = treegen_option (&params, argv[i], argv[i + 1])) <= 0)
+    {
+      fwprintf (stderr, r == 0 ? L"Unknown option `%hs'\n" : L"Invalid value for option `%hs'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (output != NULL)
+  {
+    sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+    if (sim == NULL)
+    {
+      fwprintf (stderr, L"Out of memory\n");
+      return 2;
+    }
+    ntlink_fssim_install (sim);
+  }
+
+  if (strtowchar (argv[1], &root, CP_THREAD_ACP) < 0 ||
+      GetAbsNameW (root, &absroot, NULL, 2) != 0)
+  {
+    fwprintf (stderr, L"Invalid directory name `%hs'\n", argv[1]);
+    return 1;
+  }
+  r = treegen_create (absroot, &params, &stats);
+  if (r == -1)
+    fwprintf (stderr, L"Failed to create `%hs': %lu\n", argv[1], (unsigned long) GetLastError ());
+  else if (r == -2)
+    fwprintf (stderr, L"Out of memory\n");
+  else
+  {
+    fwprintf (stdout, L"{");
+    treegen_print_params (stdout, &params);
+    fwprintf (stdout, L",\"made\":{\"dirs\":%lu,\"files\":%lu,\"symlinks\":%lu,\"junctions\":%lu,\"hardlinks\":%lu,\"failed\":%lu}}\n",
+        stats.dirs, stats.files, stats.symlinks, stats.junctions, stats.hardlinks, stats.failed);
+  }
+
+  if (r == 0 && sim != NULL)
+  {
+    FILE *f = fopen (output, "wb");
+    if (f == NULL || ntlink_fssim_save (sim, f) != 0)
+    {
+      fwprintf (stderr, L"Failed to save the tree to `%hs'\n", output);
+      r = -1;
+    }
+    if (f != NULL)
+      fclose (f);
+  }
+  if (sim != NULL)
+  {
+    ntlink_fssim_install (NULL);
+    ntlink_fssim_free (sim);
+  }
+  ntlink_free (root);
+  ntlink_free (absroot);
+  if (r != 0)
+    return 2;
+  return stats.failed > 0 ? 3 : 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Text manifest throughput benchmark.
+ *
+ * Built and run by "make bench" (make -f Makefile.linux bench on Linux).
+ * Needs only manifest_text.c and no windows.h, so it also builds by hand:
+ *   cc -O2 -I.. -o manifest_parse manifest_parse.c ../manifest_text.c
+ * Usage:
+ *   manifest_parse [number of records]
+ *
+ * Note that wchar_t is 4 bytes wide on Linux, so the manifest generated
+ * there is twice as big as on Windows for the same records.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "manifest_text.h"
+
+#ifdef _WIN32
+#include <windows.h>
+static double
+now (void)
+{
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter (&c);
+  QueryPerformanceFrequency (&f);
+  return (double) c.QuadPart / (double) f.QuadPart;
+}
+#else
+#include <time.h>
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+/* The way restore_links() used to read a manifest: one fread per character */
+static int
+legacy_read_record (FILE *f, wchar_t **link, wchar_t **target)
+{
+  wchar_t magic[6];
+  size_t linklen = 0, targetlen = 0;
+  magic[5] = L'\0';
+  if (fread (magic, sizeof (wchar_t), 5, f) != 5)
+    return 0;
+  if (wcscmp (magic, L"link ") != 0 || fread (magic, sizeof (wchar_t), 2, f) != 2)
+    return -1;
+  while (fread (magic, sizeof (wchar_t), 1, f) == 1 && magic[0] >= L'0' && magic[0] <= L'9')
+    linklen = linklen * 10 + (magic[0] - L'0');
+  *link = malloc (sizeof (wchar_t) * (linklen + 1));
+  if (fread (*link, sizeof (wchar_t), linklen + 1, f) != linklen + 1)
+    return -1;
+  while (fread (magic, sizeof (wchar_t), 1, f) == 1 && magic[0] >= L'0' && magic[0] <= L'9')
+    targetlen = targetlen * 10 + (magic[0] - L'0');
+  *target = malloc (sizeof (wchar_t) * (targetlen + 1));
+  if (fread (*target, sizeof (wchar_t), targetlen + 1, f) != targetlen + 1)
+    return -1;
+  return 1;
+}
+
+static void
+report (const char *what, size_t records, size_t bytes, double seconds)
+{
+  printf ("%-24s %10.3f s %12.0f records/s %10.1f MB/s\n", what, seconds,
+      records / seconds, bytes / seconds / (1024.0 * 1024.0));
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t nrecords = 2000000, i, n, bytes, used, pos;
+  wchar_t link[64], target[96];
+  manifest_writer writer;
+  manifest_reader reader;
+  manifest_entry e;
+  wchar_t *data;
+  double t;
+  FILE *f;
+
+  if (argc > 1)
+    nrecords = strtoul (argv[1], NULL, 10);
+
+  f = tmpfile ();
+  if (f == NULL || manifest_writer_init (&writer, f) != 0)
+  {
+    fprintf (stderr, "Failed to create a temporary manifest\n");
+    return 1;
+  }
+
+  t = now ();
+  for (i = 0; i < nrecords; i++)
+  {
+    e.type = (i % 3) == 0 ? L'd' : (i % 3) == 1 ? L'f' : L'j';
+    e.linklen = swprintf (link, 64, L"src\\module%04lu\\include\\link%07lu", (unsigned long) (i / 500), (unsigned long) i);
+    e.targetlen = swprintf (target, 96, L"..\\..\\vendor\\package%05lu\\include\\target%07lu.h", (unsigned long) (i / 40), (unsigned long) i);
+    e.link = link;
+    e.target = target;
+    manifest_writer_add (&writer, &e);
+  }
+  if (manifest_writer_flush (&writer) != 0)
+  {
+    fprintf (stderr, "Failed to write the manifest\n");
+    return 1;
+  }
+  t = now () - t;
+  manifest_writer_free (&writer);
+  bytes = ftell (f);
+  report ("buffered write", nrecords, bytes, t);
+
+  rewind (f);
+  manifest_reader_init (&reader, f);
+  t = now ();
+  for (n = 0; manifest_reader_next (&reader, &e) > 0; n++);
+  t = now () - t;
+  manifest_reader_free (&reader);
+  if (n != nrecords)
+    fprintf (stderr, "Block reader: got %lu records instead of %lu\n", (unsigned long) n, (unsigned long) nrecords);
+  report ("block read + parse", n, bytes, t);
+
+  /* Parse from memory, as from a mapped file */
+  data = malloc (bytes);
+  rewind (f);
+  if (data == NULL || fread (data, 1, bytes, f) != bytes)
+  {
+    fprintf (stderr, "Failed to load the manifest\n");
+    return 1;
+  }
+  t = now ();
+  for (n = 0, pos = 0; manifest_text_parse (&data[pos], bytes / sizeof (wchar_t) - pos, &used, &e) > 0; n++)
+    pos += used;
+  t = now () - t;
+  free (data);
+  report ("in-memory parse", n, bytes, t);
+
+  rewind (f);
+  t = now ();
+  for (n = 0; ; n++)
+  {
+    wchar_t *l, *tg;
+    if (legacy_read_record (f, &l, &tg) <= 0)
+      break;
+    free (l);
+    free (tg);
+  }
+  t = now () - t;
+  report ("per-character fread", n, bytes, t);
+
+  fclose (f);
+  return 0;
+}
@@ -0,0 +1,462 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks for the hot paths of libntlink.
+ *
+ * Built and run by "make bench". Usage:
+ *   micro [<milliseconds per benchmark> [<name substring>]]
+ *
+ * All filesystem calls go to a simulator (fssim.c) that holds a small
+ * tree, so the numbers don't depend on the disk and the cache, and the
+ * calls can be counted. Prints one JSON object per benchmark and line:
+ *   {"benchmark":"GetAbsNameW","ops":1048576,"ns_per_op":85.2,
+ *    "allocs_per_op":2.00,"fs_calls_per_op":0.00}
+ * ops is the number of operations timed, allocs_per_op counts malloc(),
+ * calloc(), realloc(), strdup() and wcsdup() calls made by the library and
+ * fs_calls_per_op counts the calls it made into the filesystem backend.
+ *
+ * The link creation benchmarks make 64 file symlinks in C:\bench\links
+ * and delete them again, and count one op per link. The deletes are the
+ * same for all of them, so the numbers can be compared with each other:
+ * ntlink_symlinkw() in a loop, ntlink_blind_symlinkw() (no probes) in a
+ * loop and one ntlink_symlink_batchw() call in one thread. The direct
+ * path, which writes the reparse point itself instead of calling
+ * CreateSymbolicLinkW(), is measured with an ntlink_symlinkatw() loop on
+ * one directory handle and with ntlink_symlink_batchw() and
+ * SYMLINK_BATCH_FLAG_DIRECT.
+ *
+ * Allocations are counted by linking with
+ *   -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=strdup,--wrap=wcsdup
+ * and the static libntlink. On MinGW wcsdup() and strdup() are imported
+ * from msvcrt.dll and are not seen by --wrap, so their calls are missing
+ * from the count there.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <windows.h>
+
+#include "misc.h"
+#include "extra_string.h"
+#include "juncpoint.h"
+#include "walk.h"
+#include "quasisymlink.h"
+#include "fsbackend.h"
+#include "fssim.h"
+#include "alloc.h"
+
+#ifdef _WIN32
+static double
+now (void)
+{
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter (&c);
+  QueryPerformanceFrequency (&f);
+  return (double) c.QuadPart / (double) f.QuadPart;
+}
+#else
+#include <time.h>
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+static unsigned long allocs = 0;
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t count, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+char *__real_strdup (const char *s);
+wchar_t *__real_wcsdup (const wchar_t *s);
+
+void *
+__wrap_malloc (size_t size)
+{
+  allocs += 1;
+  return __real_malloc (size);
+}
+
+void *
+__wrap_calloc (size_t count, size_t size)
+{
+  allocs += 1;
+  return __real_calloc (count, size);
+}
+
+void *
+__wrap_realloc (void *ptr, size_t size)
+{
+  allocs += 1;
+  return __real_realloc (ptr, size);
+}
+
+char *
+__wrap_strdup (const char *s)
+{
+  allocs += 1;
+  return __real_strdup (s);
+}
+
+wchar_t *
+__wrap_wcsdup (const wchar_t *s)
+{
+  allocs += 1;
+  return __real_wcsdup (s);
+}
+
+/* Each benchmark does its operation at least once and returns how many
+ * times it did it.
+ */
+typedef size_t (*bench_func) (void);
+
+static ntlink_fssim *sim = NULL;
+static volatile size_t sink = 0;
+
+static size_t
+bench_simplify (void)
+{
+  wchar_t *r = SimplifyAbsNameW (L"C:\\src\\project\\.\\build\\..\\lib\\\\include\\..\\include\\x.h", 1);
+  sink += r != NULL ? r[0] : 0;
+  free (r);
+  return 1;
+}
+
+static size_t
+bench_getabsname (void)
+{
+  wchar_t *r = NULL;
+  if (GetAbsNameW (L"..\\lib\\.\\include\\x.h", &r, L"C:\\src\\project\\build", 2) == 0)
+    ntlink_free (r);
+  return 1;
+}
+
+static size_t
+bench_getrelname (void)
+{
+  wchar_t *r = NULL;
+  if (GetRelNameW (L"C:\\src\\project\\lib\\include\\x.h", &r, L"C:\\src\\project\\build\\out") == 0)
+    ntlink_free (r);
+  return 1;
+}
+
+/* "C:\Users\Jürgen\проекты\src\link.h" */
+static const char utf8_path[] = "C:\\Users\\J\xc3\xbcrgen\\\xd0\xbf\xd1\x80\xd0\xbe\xd0\xb5\xd0\xba\xd1\x82\xd1\x8b\\src\\link.h";
+static const wchar_t wide_path[] = L"C:\\Users\\J\x00fcrgen\\\x043f\x0440\x043e\x0435\x043a\x0442\x044b\\src\\link.h";
+
+static size_t
+bench_strtowchar (void)
+{
+  wchar_t *r = NULL;
+  if (strtowchar (utf8_path, &r, CP_UTF8) == 0)
+    ntlink_free (r);
+  return 1;
+}
+
+static size_t
+bench_wchartostr (void)
+{
+  char *r = NULL;
+  if (wchartostr (wide_path, &r, CP_UTF8) == 0)
+    ntlink_free (r);
+  return 1;
+}
+
+static size_t
+bench_wcstok_r (void)
+{
+  wchar_t buf[MAX_PATH];
+  wchar_t *token, *lasts = NULL;
+  wcscpy (buf, L"C:\\src\\project/lib\\include\\\\detail/x.h");
+  for (token = wcstok_r (buf, L"/\\", &lasts); token != NULL; token = wcstok_r (NULL, L"/\\", &lasts))
+    sink += token[0];
+  return 1;
+}
+
+static size_t
+bench_reparse_encode (void)
+{
+  BYTE *buf;
+  DWORD size;
+  if (EncodeReparseBufferW (L"\\??\\C:\\src\\project\\lib\\include", L"C:\\src\\project\\lib\\include", 1, 0, &buf, &size) == 0)
+    free (buf);
+  return 1;
+}
+
+static BYTE *reparse_buf = NULL;
+static DWORD reparse_size = 0;
+
+static size_t
+bench_reparse_decode (void)
+{
+  wchar_t *r = NULL;
+  int relative, linktype;
+  if (DecodeReparseBufferW (reparse_buf, reparse_size, &r, &relative, &linktype) == 0)
+    ntlink_free (r);
+  return 1;
+}
+
+/* One walk over C:\bench\tree, every walk_nextw() call is an op */
+static size_t
+bench_walk_nextw (void)
+{
+  walk_iteratorw *iter = walk_allocw (NULL, L"C:\\bench\\tree", WALK_FLAG_NONE);
+  size_t calls = 0;
+  while (iter != NULL)
+  {
+    calls += 1;
+    iter = walk_nextw (iter);
+  }
+  return calls > 0 ? calls : 1;
+}
+
+static size_t
+bench_lstatw (void)
+{
+  struct stat st;
+  if (ntlink_lstatw (L"C:\\bench\\flink", &st) == 0)
+    sink += st.st_mode;
+  return 1;
+}
+
+static size_t
+bench_readlinkw (void)
+{
+  wchar_t buf[MAX_PATH];
+  sink += ntlink_readlinkw (L"C:\\bench\\dlink", buf, MAX_PATH);
+  return 1;
+}
+
+#define LINK_COUNT 64
+
+static const wchar_t link_target[] = L"C:\\bench\\tree\\dir0\\sub0\\file0.h";
+static wchar_t link_paths[LINK_COUNT][MAX_PATH];
+static SymlinkBatchItem link_items[LINK_COUNT];
+
+static size_t
+remove_links (void)
+{
+  int i;
+  for (i = 0; i < LINK_COUNT; i++)
+    sink += ntlink_fs->delete_file (link_paths[i]);
+  return LINK_COUNT;
+}
+
+static size_t
+bench_symlinkw (void)
+{
+  int i;
+  for (i = 0; i < LINK_COUNT; i++)
+    sink += ntlink_symlinkw (link_target, link_paths[i]);
+  return remove_links ();
+}
+
+static size_t
+bench_blind_symlinkw (void)
+{
+  int i;
+  for (i = 0; i < LINK_COUNT; i++)
+    sink += ntlink_blind_symlinkw (link_target, link_paths[i], BLIND_SYMLINK_FILE, NULL);
+  return remove_links ();
+}
+
+static size_t
+bench_symlink_batchw (void)
+{
+  sink += ntlink_symlink_batchw (link_items, LINK_COUNT, NULL, 1, SYMLINK_BATCH_FLAG_NOTHING);
+  return remove_links ();
+}
+
+static size_t
+bench_symlinkatw (void)
+{
+  void *dirh = ntlink_opendirw (L"C:\\bench\\links");
+  int i;
+  for (i = 0; dirh != NULL && i < LINK_COUNT; i++)
+    sink += ntlink_symlinkatw (dirh, wcsrchr (link_paths[i], L'\\') + 1, link_target, BLIND_SYMLINK_FILE);
+  ntlink_closedirw (dirh);
+  return remove_links ();
+}
+
+static size_t
+bench_symlink_batchw_direct (void)
+{
+  sink += ntlink_symlink_batchw (link_items, LINK_COUNT, NULL, 1, SYMLINK_BATCH_FLAG_DIRECT);
+  return remove_links ();
+}
+
+typedef struct
+{
+  const char *name;
+  bench_func func;
+} bench;
+
+static const bench benchmarks[] =
+{
+  { "SimplifyAbsNameW", bench_simplify },
+  { "GetAbsNameW", bench_getabsname },
+  { "GetRelNameW", bench_getrelname },
+  { "strtowchar", bench_strtowchar },
+  { "wchartostr", bench_wchartostr },
+  { "wcstok_r", bench_wcstok_r },
+  { "EncodeReparseBufferW", bench_reparse_encode },
+  { "DecodeReparseBufferW", bench_reparse_decode },
+  { "walk_nextw", bench_walk_nextw },
+  { "ntlink_lstatw", bench_lstatw },
+  { "ntlink_readlinkw", bench_readlinkw },
+  { "ntlink_symlinkw", bench_symlinkw },
+  { "ntlink_blind_symlinkw", bench_blind_symlinkw },
+  { "ntlink_symlink_batchw", bench_symlink_batchw },
+  { "ntlink_symlinkatw", bench_symlinkatw },
+  { "ntlink_symlink_batchw/direct", bench_symlink_batchw_direct },
+};
+
+static unsigned long
+fs_calls (void)
+{
+  unsigned long counts[NTLINK_FS_OP_COUNT], total = 0;
+  int i;
+  ntlink_fssim_get_counts (sim, counts);
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+    total += counts[i];
+  return total;
+}
+
+/* Doubles the number of rounds until a run takes at least min_time */
+static void
+run (const bench *b, double min_time)
+{
+  size_t rounds = 1, ops, i;
+  unsigned long allocs0, calls0;
+  double t;
+
+  b->func ();
+  for (;;)
+  {
+    allocs0 = allocs;
+    calls0 = fs_calls ();
+    t = now ();
+    for (i = 0, ops = 0; i < rounds; i++)
+      ops += b->func ();
+    t = now () - t;
+    if (t >= min_time || rounds >= ((size_t) 1 << 30))
+      break;
+    rounds *= 2;
+  }
+  printf ("{\"benchmark\":\"%s\",\"ops\":%lu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"fs_calls_per_op\":%.2f}\n",
+      b->name, (unsigned long) ops, t * 1e9 / ops, (double) (allocs - allocs0) / ops,
+      (double) (fs_calls () - calls0) / ops);
+  fflush (stdout);
+}
+
+static int
+make_file (const wchar_t *path)
+{
+  HANDLE h = ntlink_fs->create_file (path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (h == INVALID_HANDLE_VALUE)
+    return -1;
+  ntlink_fs->close_handle (h);
+  return 0;
+}
+
+/*
+ * C:\bench\tree - 8 directories with 8 subdirectories with 4 files each
+ * C:\bench\flink - a file symlink
+ * C:\bench\dlink - a directory symlink
+ * C:\bench\links - an empty directory for the link creation benchmarks
+ */
+static int
+make_tree (void)
+{
+  wchar_t path[MAX_PATH];
+  int i, j, k, r = 0;
+
+  r |= !ntlink_fs->create_directory (L"C:\\bench", NULL);
+  r |= !ntlink_fs->create_directory (L"C:\\bench\\tree", NULL);
+  for (i = 0; i < 8; i++)
+  {
+    _snwprintf (path, MAX_PATH, L"C:\\bench\\tree\\dir%d", i);
+    r |= !ntlink_fs->create_directory (path, NULL);
+    for (j = 0; j < 8; j++)
+    {
+      _snwprintf (path, MAX_PATH, L"C:\\bench\\tree\\dir%d\\sub%d", i, j);
+      r |= !ntlink_fs->create_directory (path, NULL);
+      for (k = 0; k < 4; k++)
+      {
+        _snwprintf (path, MAX_PATH, L"C:\\bench\\tree\\dir%d\\sub%d\\file%d.h", i, j, k);
+        r |= make_file (path);
+      }
+    }
+  }
+  r |= !ntlink_fs->create_symbolic_link (L"C:\\bench\\flink", L"tree\\dir0\\sub0\\file0.h", 0);
+  r |= !ntlink_fs->create_symbolic_link (L"C:\\bench\\dlink", L"tree\\dir0", SYMBOLIC_LINK_FLAG_DIRECTORY);
+  r |= !ntlink_fs->create_directory (L"C:\\bench\\links", NULL);
+  for (i = 0; i < LINK_COUNT; i++)
+  {
+    _snwprintf (link_paths[i], MAX_PATH, L"C:\\bench\\links\\link%d", i);
+    link_items[i].target = link_target;
+    link_items[i].linkpath = link_paths[i];
+    link_items[i].type = BLIND_SYMLINK_FILE;
+  }
+  r |= EncodeReparseBufferW (L"\\??\\C:\\src\\project\\lib\\include", L"C:\\src\\project\\lib\\include", 1, 0, &reparse_buf, &reparse_size) != 0;
+  return r != 0 ? -1 : 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  double min_time = 0.2;
+  const char *filter = NULL;
+  size_t i;
+
+  if (argc > 1)
+    min_time = strtoul (argv[1], NULL, 10) / 1000.0;
+  if (argc > 2)
+    filter = argv[2];
+
+  sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+  if (sim == NULL)
+  {
+    fprintf (stderr, "Failed to create a simulator\n");
+    return 1;
+  }
+  ntlink_fssim_install (sim);
+  if (make_tree () != 0)
+  {
+    fprintf (stderr, "Failed to create the benchmark tree\n");
+    return 1;
+  }
+  ntlink_fssim_set_current_directory (sim, L"C:\\bench");
+
+  for (i = 0; i < sizeof (benchmarks) / sizeof (benchmarks[0]); i++)
+    if (filter == NULL || strstr (benchmarks[i].name, filter) != NULL)
+      run (&benchmarks[i], min_time);
+
+  ntlink_fssim_install (NULL);
+  ntlink_fssim_free (sim);
+  free (reparse_buf);
+  return 0;
+}
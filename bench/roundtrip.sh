@@ -0,0 +1,176 @@
+#!/bin/sh
+# This file is part of libntlink.
+# Copyright (c) 2011, LRN
+#
+# libntlink is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License
+# as published by the Free Software Foundation, either version 3
+# of the License, or (at your option) any later version.
+#
+# libntlink is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of
+# the GNU Lesser General Public License and the GNU General Public License
+# along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+
+# Backup, restore, verify and convert round trips of translink on a
+# synthetic tree (bench/gentree) in the simulator, and incremental backups,
+# deltas and merges of a tree changed with junc.
+#
+# Run by "make -f Makefile.linux check". Usage:
+#   roundtrip.sh [<directory with translink, junc and bench/gentree>]
+# Prints PASS or FAIL for every check, exits with 1 if any of them failed.
+
+top=${1:-.}
+translink=$top/translink
+junc=$top/junc
+gentree=$top/bench/gentree
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+# restore creates the links by their names in the manifest, which are
+# relative to the current directory, so run in the root of the tree
+unset NTLINK_FSSIM_TREE NTLINK_FSSIM_SAVE NTLINK_FSSIM_LATENCY NTLINK_FSSIM_STATS
+NTLINK_FSSIM_CWD='C:\w'
+export NTLINK_FSSIM_CWD
+
+# sim <tree> <tree to save or ""> <command> - runs <command> on
+# $tmp/<tree>; the manifests and other files it is given are host files
+sim ()
+{
+  tree=$1
+  save=$2
+  shift 2
+  NTLINK_FSSIM_TREE=$tmp/$tree NTLINK_FSSIM_SAVE=${save:+$tmp/$save} "$@"
+}
+
+# tl <tree> <tree to save or ""> <translink arguments>
+tl ()
+{
+  tree=$1
+  save=$2
+  shift 2
+  sim "$tree" "$save" "$translink" "$@"
+}
+
+# change <tree> <its manifest> <tree to save> <name> - adds the link
+# <name>, removes the first link of the manifest and retargets the second
+change ()
+{
+  tl "$1" "" r 'C:\w' 'C:\w' f "$tmp/$2" d | sed -n 's/^[fdj] \([^ ]*\) -> .*/\1/p' | head -2 |
+    awk -v OFS='\t' -v name="$4" 'NR == 1 { print "l", "d002", name; print "u", $0 }
+      NR == 2 { print "u", $0; print "l", "d003", $0 }' >"$tmp/ops"
+  check 0 "add $4 and change two links with junc" sim "$1" "$3" "$junc" b "$tmp/ops"
+}
+
+# check <exit status> <description> <command> - the command must exit
+# with <exit status>, its output is kept in $tmp/out
+check ()
+{
+  status=$1
+  what=$2
+  shift 2
+  "$@" >"$tmp/out" 2>&1
+  r=$?
+  if [ $r -eq "$status" ]; then
+    echo "PASS: $what"
+  else
+    echo "FAIL: $what (exit status $r, expected $status)"
+    cat "$tmp/out"
+    failed=1
+  fi
+}
+
+check 0 "gentree" "$gentree" 'C:\w' o "$tmp/t0.sim" n 2000
+
+# t1.sim is t0.sim with the links removed by the backup
+check 0 "backup into a text manifest" tl t0.sim t1.sim b 'C:\w' 'C:\w' r f "$tmp/m.txt"
+check 0 "backup into a binary manifest" tl t0.sim "" b 'C:\w' 'C:\w' r f "$tmp/m.bin" B
+check 0 "convert binary to text" tl t0.sim "" c 'C:\w' 'C:\w' f "$tmp/m.bin" o "$tmp/c.txt"
+check 0 "convert text to binary" tl t0.sim "" c 'C:\w' 'C:\w' f "$tmp/m.txt" o "$tmp/c.bin"
+
+for m in m.txt m.bin c.txt c.bin; do
+  check 0 "verify the original tree against $m" tl t0.sim "" v 'C:\w' 'C:\w' f "$tmp/$m"
+  check 4 "verify the backed up tree against $m" tl t1.sim "" v 'C:\w' 'C:\w' f "$tmp/$m"
+  check 0 "restore from $m" tl t1.sim r.sim r 'C:\w' 'C:\w' f "$tmp/$m"
+  check 0 "verify the tree restored from $m" tl r.sim "" v 'C:\w' 'C:\w' f "$tmp/m.txt"
+done
+
+# Partial restores must pick the same links from either kind of manifest.
+# d000\d001\d001 has l0000015, l0000028 and l0000039, but no l000001.
+check 0 "restore d000\\d001 from m.bin" tl t1.sim r.sim r 'C:\w' 'C:\w\d000\d001' f "$tmp/m.bin"
+check 0 "verify d000\\d001 restored from m.bin" tl r.sim "" v 'C:\w' 'C:\w\d000\d001' f "$tmp/m.txt"
+for name in 'd000\d001' 'd000\d001\d001' 'd000\d001\d001\l000001' 'd000\d001\d001\l0000015'; do
+  for m in m.txt m.bin; do
+    check 0 "dry run restore of $name from $m" tl t1.sim "" r 'C:\w' "C:\\w\\$name" f "$tmp/$m" d
+    sort "$tmp/out" >"$tmp/$m.out"
+  done
+  check 0 "same links restored from m.txt and m.bin for $name" cmp "$tmp/m.txt.out" "$tmp/m.bin.out"
+  case $name in
+  *l000001)
+    check 1 "no links restored for $name" grep -q . "$tmp/m.bin.out";;
+  *)
+    check 0 "links restored for $name" grep -q . "$tmp/m.bin.out";;
+  esac
+done
+
+# Hard link groups: all names but the first are recorded and removed by the
+# backup, verify compares their file IDs. copies.sim has plain copies in
+# place of those names, so they are not the same files.
+check 0 "backup with hard links" tl t0.sim th.sim b 'C:\w' 'C:\w' r h f "$tmp/h.txt"
+check 0 "verify the original tree with hard links" tl t0.sim "" v 'C:\w' 'C:\w' f "$tmp/h.txt"
+check 4 "verify the tree without the hard links" tl th.sim "" v 'C:\w' 'C:\w' f "$tmp/h.txt"
+cp "$tmp/out" "$tmp/v.out"
+check 0 "hard links are reported missing" grep -q '^missing h ' "$tmp/v.out"
+check 0 "restore the hard links" tl th.sim rh.sim r 'C:\w' 'C:\w' f "$tmp/h.txt"
+check 0 "verify the restored hard links" tl rh.sim "" v 'C:\w' 'C:\w' f "$tmp/h.txt"
+awk -F '\t' -v OFS='\t' '$1 == "h" { print "F", $2; next } { print }' "$tmp/t0.sim" >"$tmp/copies.sim"
+check 4 "verify copies in place of the hard links" tl copies.sim "" v 'C:\w' 'C:\w' f "$tmp/h.txt"
+cp "$tmp/out" "$tmp/v.out"
+check 0 "copies are reported as different files" grep -q '^retargeted h .*(not the same file)$' "$tmp/v.out"
+
+# junc batches: 'i' prints the target of a link, a malformed line and a
+# missing link fail without stopping the others, on any number of threads
+printf 'l\td000\tjl1\nl\td001\tjl2\ni\tjl1\nmalformed\nu\tjl2\ni\tjl2\n' >"$tmp/ops"
+printf '1 ok\n2 ok\n3 ok d000\n4 failed 22\n5 ok\n6 failed 2\n' >"$tmp/expected"
+for threads in 1 4; do
+  check 3 "junc batch on $threads threads" sim t0.sim "" "$junc" b "$tmp/ops" t $threads
+  sed 's/^\([0-9]* failed [0-9]*\) .*/\1/' "$tmp/out" | sort -n >"$tmp/junc.out"
+  check 0 "junc batch results on $threads threads" cmp "$tmp/junc.out" "$tmp/expected"
+done
+
+# Incremental backups against the full one: applied to it with 'c ... a'
+# they must give the full backup of the changed tree. The second one has
+# the directory state of the first, so unchanged directories are skipped.
+change t0.sim m.txt t2.sim newlink1
+check 0 "incremental backup" tl t2.sim "" b 'C:\w' 'C:\w' r f "$tmp/i1.txt" i "$tmp/m.txt" s "$tmp/state"
+check 0 "apply the incremental backup" tl t2.sim "" c 'C:\w' 'C:\w' f "$tmp/m.txt" a "$tmp/i1.txt" o "$tmp/m1.txt"
+check 0 "verify the changed tree against the applied manifest" tl t2.sim "" v 'C:\w' 'C:\w' f "$tmp/m1.txt"
+check 0 "full backup of the changed tree" tl t2.sim "" b 'C:\w' 'C:\w' r f "$tmp/n1.txt"
+check 0 "applied incremental backup is the full backup" cmp "$tmp/m1.txt" "$tmp/n1.txt"
+check 0 "incremental backup of the unchanged tree" tl t2.sim "" b 'C:\w' 'C:\w' r f "$tmp/i2.txt" i "$tmp/m1.txt" s "$tmp/state"
+check 1 "no links in it" test -s "$tmp/i2.txt"
+change t2.sim m1.txt t3.sim newlink2
+check 0 "incremental backup with the directory state" tl t3.sim "" b 'C:\w' 'C:\w' r f "$tmp/i3.txt" i "$tmp/m1.txt" s "$tmp/state"
+check 0 "apply it" tl t3.sim "" c 'C:\w' 'C:\w' f "$tmp/m1.txt" a "$tmp/i3.txt" o "$tmp/m2.txt"
+check 0 "full backup of the changed tree" tl t3.sim "" b 'C:\w' 'C:\w' r f "$tmp/n2.txt"
+check 0 "applied incremental backup is the full backup" cmp "$tmp/m2.txt" "$tmp/n2.txt"
+
+# 'd' and 'm' with 1 MB of memory on manifests that don't fit in it, so
+# that they are sorted in temporary files
+check 0 "gentree with 10000 symlinks" "$gentree" 'C:\w' o "$tmp/big.sim" n 40000 s 250 j 0 h 0
+check 0 "backup of the big tree" tl big.sim "" b 'C:\w' 'C:\w' r f "$tmp/b1.txt"
+check 0 "its manifest is bigger than 2 MB" test "$(wc -c <"$tmp/b1.txt")" -gt 2097152
+change big.sim b1.txt big2.sim newlink
+check 0 "backup of the changed big tree" tl big2.sim "" b 'C:\w' 'C:\w' r f "$tmp/b2.txt"
+check 0 "delta of the big manifests" tl big.sim "" d 'C:\w' 'C:\w' f "$tmp/b1.txt" n "$tmp/b2.txt" o "$tmp/bd.txt" m 1
+check 0 "merge of the delta" tl big.sim "" m 'C:\w' 'C:\w' f "$tmp/b1.txt" n "$tmp/bd.txt" o "$tmp/bm.txt" m 1
+check 0 "merged manifest is the new one" cmp "$tmp/bm.txt" "$tmp/b2.txt"
+check 0 "apply the delta" tl big.sim "" c 'C:\w' 'C:\w' f "$tmp/b1.txt" a "$tmp/bd.txt" o "$tmp/ba.txt"
+check 0 "applied manifest is the new one" cmp "$tmp/ba.txt" "$tmp/b2.txt"
+
+exit $failed
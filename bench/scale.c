@@ -0,0 +1,193 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput of ntlink_ctx_*() calls made by 1, 2, 4... threads at once,
+ * each thread with a context of its own.
+ *
+ * Built and run by "make bench". Usage:
+ *   scale [<milliseconds per step> [<max threads> [<latency, usec>]]]
+ *
+ * The calls go to a simulator (fssim.c). With a latency every filesystem
+ * call waits that long before it is served, the way a disk or a network
+ * share makes the caller wait; without one the numbers show what the
+ * library and the simulator cost in CPU. <max threads> defaults to the
+ * number of processors. Prints one JSON object per step and line:
+ *   {"benchmark":"ntlink_ctx_lstatw+readlinkw","threads":4,"latency_us":0,
+ *    "ops_per_sec":1234567,"speedup":3.91}
+ * speedup is ops_per_sec divided by that of one thread; with linear
+ * scaling it equals threads.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <windows.h>
+
+#include "ctx.h"
+#include "threadpool.h"
+#include "fsbackend.h"
+#include "fssim.h"
+
+#define SCALE_MAX_THREADS 256
+
+typedef struct
+{
+  HANDLE thread;
+  ntlink_ctx *ctx;
+  unsigned long long ops;
+  int failed;
+} scale_worker;
+
+static volatile LONG scale_stop = 0;
+static volatile size_t sink = 0;
+
+static DWORD WINAPI
+scale_run (LPVOID arg)
+{
+  scale_worker *w = (scale_worker *) arg;
+  wchar_t buf[MAX_PATH];
+  struct stat st;
+
+  while (!scale_stop)
+  {
+    /* Relative names, resolved against the context */
+    if (ntlink_ctx_lstatw (w->ctx, L"flink", &st) != 0)
+      w->failed = 1;
+    sink += st.st_mode;
+    if (ntlink_ctx_readlinkw (w->ctx, L"tree\\dlink", buf, MAX_PATH) < 0)
+      w->failed = 1;
+    w->ops += 2;
+  }
+  return 0;
+}
+
+/* Returns operations per second, or a negative value on failure */
+static double
+scale_step (int nthreads, DWORD msec)
+{
+  scale_worker workers[SCALE_MAX_THREADS];
+  unsigned long long ops = 0;
+  int i, started, failed = 0;
+
+  memset (workers, 0, sizeof (workers));
+  scale_stop = 0;
+  for (started = 0; started < nthreads; started++)
+  {
+    workers[started].ctx = ntlink_ctx_new (L"C:\\bench");
+    if (workers[started].ctx == NULL)
+      break;
+    workers[started].thread = CreateThread (NULL, 0, scale_run, &workers[started], 0, NULL);
+    if (workers[started].thread == NULL)
+    {
+      ntlink_ctx_free (workers[started].ctx);
+      break;
+    }
+  }
+  Sleep (msec);
+  scale_stop = 1;
+  for (i = 0; i < started; i++)
+  {
+    WaitForSingleObject (workers[i].thread, INFINITE);
+    CloseHandle (workers[i].thread);
+    ntlink_ctx_free (workers[i].ctx);
+    ops += workers[i].ops;
+    failed |= workers[i].failed;
+  }
+  if (started < nthreads || failed)
+    return -1;
+  return ops * 1000.0 / msec;
+}
+
+static int
+make_file (const wchar_t *path)
+{
+  HANDLE h = ntlink_fs->create_file (path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (h == INVALID_HANDLE_VALUE)
+    return -1;
+  ntlink_fs->close_handle (h);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  DWORD msec = 300;
+  int maxthreads = ntlink_pool_default_size ();
+  unsigned int latency = 0;
+  ntlink_fssim *sim;
+  double base = 0, rate;
+  int n, r = 0;
+
+  if (argc > 1)
+    msec = strtoul (argv[1], NULL, 10);
+  if (argc > 2)
+    maxthreads = atoi (argv[2]);
+  if (argc > 3)
+    latency = strtoul (argv[3], NULL, 10);
+  if (maxthreads < 1)
+    maxthreads = 1;
+  if (maxthreads > SCALE_MAX_THREADS)
+    maxthreads = SCALE_MAX_THREADS;
+
+  sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+  if (sim == NULL)
+  {
+    fprintf (stderr, "Failed to create a simulator\n");
+    return 1;
+  }
+  ntlink_fssim_install (sim);
+  r |= !ntlink_fs->create_directory (L"C:\\bench", NULL);
+  r |= !ntlink_fs->create_directory (L"C:\\bench\\tree", NULL);
+  r |= make_file (L"C:\\bench\\tree\\file.h");
+  r |= !ntlink_fs->create_symbolic_link (L"C:\\bench\\flink", L"tree\\file.h", 0);
+  r |= !ntlink_fs->create_symbolic_link (L"C:\\bench\\tree\\dlink", L"..", SYMBOLIC_LINK_FLAG_DIRECTORY);
+  if (r != 0)
+  {
+    fprintf (stderr, "Failed to create the benchmark tree\n");
+    return 1;
+  }
+  if (latency > 0)
+    for (n = 0; n < NTLINK_FS_OP_COUNT; n++)
+      ntlink_fssim_set_latency (sim, (ntlink_fs_op) n, latency);
+
+  for (n = 1; n <= maxthreads; n = n < maxthreads && n * 2 > maxthreads ? maxthreads : n * 2)
+  {
+    rate = scale_step (n, msec);
+    if (rate < 0)
+    {
+      fprintf (stderr, "Calls failed with %d threads\n", n);
+      r = 1;
+      break;
+    }
+    if (n == 1)
+      base = rate;
+    printf ("{\"benchmark\":\"ntlink_ctx_lstatw+readlinkw\",\"threads\":%d,\"latency_us\":%u,\"ops_per_sec\":%.0f,\"speedup\":%.2f}\n",
+        n, latency, rate, base > 0 ? rate / base : 0.0);
+    fflush (stdout);
+    if (n == maxthreads)
+      break;
+  }
+
+  ntlink_fssim_install (NULL);
+  ntlink_fssim_free (sim);
+  return r;
+}
@@ -0,0 +1,485 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Synthetic tree generator, shared by bench/gentree.c and bench/workload.c.
+ *
+ * The tree is made level by level. Files are split between the depths by
+ * treegen_params.depths, and each depth gets just enough directories to
+ * hold its files, spread evenly over the directories one level up.
+ * Links are placed in directories above the deepest level, and directory
+ * links and junction points only point to directories at the deepest
+ * level, which hold nothing but files. That way a walker that follows
+ * links can't loop.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <windows.h>
+
+#include "misc.h"
+#include "juncpoint.h"
+#include "fsbackend.h"
+#include "alloc.h"
+#include "treegen.h"
+
+/**
+ * treegen_defaults:
+ * @p: parameters to fill
+ *
+ * 10000 files, 16 per directory, up to 8 subdirectories, most files at
+ * depth 3 and 4, 2% symlinks in chains of up to 3, 0.5% junction points
+ * and 50 hard link groups of 3 names.
+ */
+void
+treegen_defaults (treegen_params *p)
+{
+  memset (p, 0, sizeof (treegen_params));
+  p->files = 10000;
+  p->fanout = 8;
+  p->files_per_dir = 16;
+  p->ndepths = 5;
+  p->depths[0] = 1;
+  p->depths[1] = 2;
+  p->depths[2] = 4;
+  p->depths[3] = 8;
+  p->depths[4] = 8;
+  p->symlinks = 20;
+  p->junctions = 5;
+  p->chain = 3;
+  p->hardlink_groups = 50;
+  p->hardlink_size = 3;
+  p->seed = 1;
+}
+
+static int
+parse_depths (treegen_params *p, const char *value)
+{
+  unsigned int n = 0;
+  const char *s = value;
+  char *end;
+  while (*s != '\0')
+  {
+    unsigned long w = strtoul (s, &end, 10);
+    if (end == s || n == TREEGEN_MAX_DEPTH || (*end != ',' && *end != '\0'))
+      return -1;
+    p->depths[n++] = (unsigned int) w;
+    s = *end == ',' ? end + 1 : end;
+  }
+  if (n == 0)
+    return -1;
+  p->ndepths = n;
+  return 0;
+}
+
+/**
+ * treegen_option:
+ * @p: parameters to change
+ * @option: option letter (see treegen_print_usage())
+ * @value: option value
+ *
+ * Returns:
+ *  1 - @option was applied
+ *  0 - @option is not a generator option
+ * -1 - @value is invalid
+ */
+int
+treegen_option (treegen_params *p, const char *option, const char *value)
+{
+  char *end;
+  unsigned long v;
+
+  if (option[0] == '\0' || option[1] != '\0' || strchr ("nfwdsjchkr", option[0]) == NULL)
+    return 0;
+  if (value == NULL)
+    return -1;
+  if (option[0] == 'd')
+    return parse_depths (p, value) == 0 ? 1 : -1;
+  v = strtoul (value, &end, 10);
+  if (end == value || *end != '\0')
+    return -1;
+  switch (option[0])
+  {
+  case 'n':
+    p->files = v;
+    break;
+  case 'f':
+    if (v == 0)
+      return -1;
+    p->fanout = (unsigned int) v;
+    break;
+  case 'w':
+    if (v == 0)
+      return -1;
+    p->files_per_dir = (unsigned int) v;
+    break;
+  case 's':
+    p->symlinks = (unsigned int) v;
+    break;
+  case 'j':
+    p->junctions = (unsigned int) v;
+    break;
+  case 'c':
+    if (v == 0)
+      return -1;
+    p->chain = (unsigned int) v;
+    break;
+  case 'h':
+    p->hardlink_groups = v;
+    break;
+  case 'k':
+    if (v < 2)
+      return -1;
+    p->hardlink_size = (unsigned int) v;
+    break;
+  case 'r':
+    p->seed = v;
+    break;
+  }
+  return 1;
+}
+
+void
+treegen_print_usage (FILE *f)
+{
+  fwprintf (f, L"\
+Tree options:\n\
+  n <number> - number of files (10000)\n\
+  f <number> - maximum number of subdirectories in a directory (8)\n\
+  w <number> - files per directory (16)\n\
+  d <w0,w1,...> - share of the files at each depth, 0 being the root (1,2,4,8,8)\n\
+  s <number> - symlinks per 1000 files (20)\n\
+  j <number> - junction points per 1000 files (5)\n\
+  c <number> - maximum length of a symlink chain (3)\n\
+  h <number> - number of hard link groups (50)\n\
+  k <number> - names in a hard link group (3)\n\
+  r <number> - random seed (1)\n");
+}
+
+/* Prints the parameters as JSON object members, without the braces.
+ * Wide output, as translink (that bench/workload.c runs) uses fwprintf().
+ */
+void
+treegen_print_params (FILE *f, const treegen_params *p)
+{
+  unsigned int i;
+  fwprintf (f, L"\"files\":%lu,\"fanout\":%u,\"files_per_dir\":%u,\"depths\":[",
+      p->files, p->fanout, p->files_per_dir);
+  for (i = 0; i < p->ndepths; i++)
+    fwprintf (f, i == 0 ? L"%u" : L",%u", p->depths[i]);
+  fwprintf (f, L"],\"symlinks\":%u,\"junctions\":%u,\"chain\":%u,\"hardlink_groups\":%lu,\"hardlink_size\":%u,\"seed\":%lu",
+      p->symlinks, p->junctions, p->chain, p->hardlink_groups, p->hardlink_size, p->seed);
+}
+
+typedef struct
+{
+  const treegen_params *p;
+  treegen_stats *stats;
+  unsigned long long rng;
+  /* directories at each depth */
+  unsigned long ndirs[TREEGEN_MAX_DEPTH];
+  wchar_t **dirs[TREEGEN_MAX_DEPTH];
+  /* files at each depth, and the global index of the first one */
+  unsigned long nfiles[TREEGEN_MAX_DEPTH];
+  unsigned long firstfile[TREEGEN_MAX_DEPTH];
+  /* the deepest depth with directories */
+  unsigned int leaf;
+  /* directories above the leaf level, where links go */
+  unsigned long nupper;
+} treegen;
+
+/* xorshift64* */
+static unsigned long
+treegen_rand (treegen *g, unsigned long limit)
+{
+  unsigned long long x = g->rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  g->rng = x;
+  return limit > 0 ? (unsigned long) ((x * 0x2545F4914F6CDD1DULL) >> 11) % limit : 0;
+}
+
+static wchar_t *
+treegen_path (const wchar_t *dir, const wchar_t *format, unsigned long n, unsigned int m)
+{
+  wchar_t name[32];
+  size_t dirlen = wcslen (dir), namelen;
+  wchar_t *path;
+  _snwprintf (name, 32, format, n, m);
+  name[31] = L'\0';
+  namelen = wcslen (name);
+  path = (wchar_t *) malloc ((dirlen + 1 + namelen + 1) * sizeof (wchar_t));
+  if (path == NULL)
+    return NULL;
+  memcpy (path, dir, dirlen * sizeof (wchar_t));
+  path[dirlen] = L'\\';
+  memcpy (&path[dirlen + 1], name, (namelen + 1) * sizeof (wchar_t));
+  return path;
+}
+
+/* Name of the file with global index n */
+static wchar_t *
+treegen_file (treegen *g, unsigned long n)
+{
+  unsigned int k;
+  for (k = 0; k + 1 < g->p->ndepths && n >= g->firstfile[k] + g->nfiles[k]; k++);
+  return treegen_path (g->dirs[k][(n - g->firstfile[k]) % g->ndirs[k]], L"f%07lu.dat", n, 0);
+}
+
+static const wchar_t *
+treegen_upper_dir (treegen *g)
+{
+  unsigned long n = treegen_rand (g, g->nupper);
+  unsigned int k;
+  for (k = 0; k < g->leaf && n >= g->ndirs[k]; k++)
+    n -= g->ndirs[k];
+  return g->dirs[k][n];
+}
+
+static int
+treegen_result (treegen *g, BOOL ok, unsigned long *counter)
+{
+  if (ok)
+    *counter += 1;
+  else
+    g->stats->failed += 1;
+  return ok ? 0 : -1;
+}
+
+/* Number of directories each depth needs, and their names */
+static int
+treegen_layout (treegen *g, const wchar_t *root)
+{
+  const treegen_params *p = g->p;
+  unsigned long long total = 0, done = 0, capacity = 1;
+  unsigned int k;
+
+  for (k = 0; k < p->ndepths; k++)
+    total += p->depths[k];
+  for (k = 0; k < p->ndepths; k++)
+  {
+    unsigned long long before = total > 0 ? done * p->files / total : 0;
+    done += p->depths[k];
+    g->nfiles[k] = (unsigned long) ((total > 0 ? done * p->files / total : (k == 0 ? p->files : 0)) - before);
+    g->firstfile[k] = k > 0 ? g->firstfile[k - 1] + g->nfiles[k - 1] : 0;
+    g->ndirs[k] = (g->nfiles[k] + p->files_per_dir - 1) / p->files_per_dir;
+    if (g->ndirs[k] > capacity)
+      g->ndirs[k] = (unsigned long) capacity;
+    if (capacity < 0x100000000ULL)
+      capacity *= p->fanout;
+  }
+  /* Every directory needs a parent */
+  g->ndirs[0] = 1;
+  for (k = p->ndepths; k-- > 1; )
+  {
+    unsigned long parents = (g->ndirs[k] + p->fanout - 1) / p->fanout;
+    if (g->ndirs[k - 1] < parents)
+      g->ndirs[k - 1] = parents;
+  }
+  for (k = 0; k < p->ndepths && g->ndirs[k] > 0; k++)
+    g->leaf = k;
+  for (k = 0; k < g->leaf; k++)
+    g->nupper += g->ndirs[k];
+
+  for (k = 0; k <= g->leaf; k++)
+  {
+    unsigned long j;
+    g->dirs[k] = (wchar_t **) calloc (g->ndirs[k], sizeof (wchar_t *));
+    if (g->dirs[k] == NULL)
+      return -1;
+    for (j = 0; j < g->ndirs[k]; j++)
+    {
+      if (k == 0)
+        g->dirs[k][j] = wcsdup (root);
+      else
+        g->dirs[k][j] = treegen_path (g->dirs[k - 1][j % g->ndirs[k - 1]], L"d%03lu", j / g->ndirs[k - 1], 0);
+      if (g->dirs[k][j] == NULL)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+static int
+treegen_symlink (treegen *g, const wchar_t *link, const wchar_t *target, int isdir)
+{
+  wchar_t *linkdir, *rel = NULL, *sep;
+  BOOL ok = FALSE;
+  linkdir = wcsdup (link);
+  if (linkdir == NULL)
+    return treegen_result (g, FALSE, &g->stats->symlinks);
+  sep = wcsrchr (linkdir, L'\\');
+  if (sep != NULL)
+    *sep = L'\0';
+  /* Links in source trees are mostly relative */
+  if (GetRelNameW ((wchar_t *) target, &rel, linkdir) == 0)
+  {
+    ok = ntlink_fs->create_symbolic_link (link, rel, isdir ? SYMBOLIC_LINK_FLAG_DIRECTORY : 0);
+    ntlink_free (rel);
+  }
+  free (linkdir);
+  return treegen_result (g, ok, &g->stats->symlinks);
+}
+
+/**
+ * treegen_create:
+ * @root: absolute name of the directory to create the tree in. It must
+ *   not exist.
+ * @p: tree parameters
+ * @stats: receives the numbers of objects that were made and that failed
+ *
+ * Makes a tree through ntlink_fs. Objects that can't be made are counted
+ * in @stats->failed and skipped.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to create @root (GetLastError() tells why)
+ * -2 - out of memory
+ */
+int
+treegen_create (const wchar_t *root, const treegen_params *p, treegen_stats *stats)
+{
+  treegen g;
+  unsigned long i, target, created;
+  unsigned int k, m;
+  int r = 0;
+
+  memset (&g, 0, sizeof (g));
+  memset (stats, 0, sizeof (treegen_stats));
+  g.p = p;
+  g.stats = stats;
+  g.rng = p->seed * 0x9E3779B97F4A7C15ULL + 0x2545F4914F6CDD1DULL;
+
+  if (treegen_layout (&g, root) != 0)
+  {
+    r = -2;
+    goto out;
+  }
+  if (!ntlink_fs->create_directory (root, NULL))
+  {
+    r = -1;
+    goto out;
+  }
+  stats->dirs += 1;
+
+  for (k = 1; k <= g.leaf; k++)
+    for (i = 0; i < g.ndirs[k]; i++)
+      treegen_result (&g, ntlink_fs->create_directory (g.dirs[k][i], NULL), &stats->dirs);
+
+  for (i = 0; i < p->files; i++)
+  {
+    wchar_t *path = treegen_file (&g, i);
+    HANDLE h;
+    if (path == NULL)
+    {
+      r = -2;
+      goto out;
+    }
+    h = ntlink_fs->create_file (path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h != INVALID_HANDLE_VALUE)
+      ntlink_fs->close_handle (h);
+    treegen_result (&g, h != INVALID_HANDLE_VALUE, &stats->files);
+    free (path);
+  }
+
+  /* Symlink chains: each link but the last points to the next one */
+  target = p->files * p->symlinks / 1000;
+  for (created = 0; created < target && p->files > 0; )
+  {
+    unsigned int len = 1 + treegen_rand (&g, p->chain);
+    int isdir = g.leaf > 0 && treegen_rand (&g, 2) == 0;
+    wchar_t *next;
+    if (len > target - created)
+      len = (unsigned int) (target - created);
+    if (isdir)
+      next = wcsdup (g.dirs[g.leaf][treegen_rand (&g, g.ndirs[g.leaf])]);
+    else
+      next = treegen_file (&g, treegen_rand (&g, p->files));
+    for (m = 0; m < len && next != NULL; m++)
+    {
+      wchar_t *link = treegen_path (treegen_upper_dir (&g), L"l%07lu", created + m, 0);
+      if (link != NULL)
+        treegen_symlink (&g, link, next, isdir);
+      free (next);
+      next = link;
+    }
+    free (next);
+    if (m < len)
+    {
+      r = -2;
+      goto out;
+    }
+    created += len;
+  }
+
+  target = g.leaf > 0 ? p->files * p->junctions / 1000 : 0;
+  for (i = 0; i < target; i++)
+  {
+    const wchar_t *dir = g.dirs[g.leaf][treegen_rand (&g, g.ndirs[g.leaf])];
+    wchar_t *link = treegen_path (treegen_upper_dir (&g), L"j%07lu", i, 0);
+    wchar_t *dest = (wchar_t *) malloc ((4 + wcslen (dir) + 1) * sizeof (wchar_t));
+    if (link == NULL || dest == NULL)
+    {
+      free (link);
+      free (dest);
+      r = -2;
+      goto out;
+    }
+    wcscpy (dest, L"\\??\\");
+    wcscat (dest, dir);
+    treegen_result (&g, SetJuncPointW (dest, link) == 0, &stats->junctions);
+    free (link);
+    free (dest);
+  }
+
+  for (i = 0; i < p->hardlink_groups && p->files > 0; i++)
+  {
+    wchar_t *existing = treegen_file (&g, treegen_rand (&g, p->files));
+    for (m = 1; m < p->hardlink_size && existing != NULL; m++)
+    {
+      unsigned int depth = treegen_rand (&g, g.leaf + 1);
+      wchar_t *link = treegen_path (g.dirs[depth][treegen_rand (&g, g.ndirs[depth])], L"h%07lu_%u.dat", i, m);
+      if (link == NULL)
+        break;
+      treegen_result (&g, ntlink_fs->create_hard_link (link, existing, NULL), &stats->hardlinks);
+      free (link);
+    }
+    free (existing);
+    if (existing == NULL || m < p->hardlink_size)
+    {
+      r = -2;
+      goto out;
+    }
+  }
+
+out:
+  for (k = 0; k <= g.leaf; k++)
+  {
+    if (g.dirs[k] == NULL)
+      continue;
+    for (i = 0; i < g.ndirs[k]; i++)
+      free (g.dirs[k][i]);
+    free (g.dirs[k]);
+  }
+  return r;
+}
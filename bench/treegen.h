@@ -0,0 +1,74 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_TREEGEN_H__
+#define __NTLINK_TREEGEN_H__
+
+#include <stdio.h>
+#include <windows.h>
+
+#define TREEGEN_MAX_DEPTH 16
+
+/**
+ * treegen_params:
+ * @files: number of regular files
+ * @fanout: maximum number of subdirectories of a directory
+ * @files_per_dir: files are spread over as many directories as this needs
+ * @ndepths: number of entries in @depths
+ * @depths: relative share of the files at each depth, the tree root
+ *   being depth 0
+ * @symlinks: symlinks per 1000 files
+ * @junctions: junction points per 1000 files
+ * @chain: maximum length of a symlink chain (a link to a link to ...)
+ * @hardlink_groups: number of files that get extra names
+ * @hardlink_size: number of names in each such group
+ * @seed: random seed, the same parameters and seed make the same tree
+ */
+typedef struct
+{
+  unsigned long files;
+  unsigned int fanout;
+  unsigned int files_per_dir;
+  unsigned int ndepths;
+  unsigned int depths[TREEGEN_MAX_DEPTH];
+  unsigned int symlinks;
+  unsigned int junctions;
+  unsigned int chain;
+  unsigned long hardlink_groups;
+  unsigned int hardlink_size;
+  unsigned long seed;
+} treegen_params;
+
+typedef struct
+{
+  unsigned long dirs;
+  unsigned long files;
+  unsigned long symlinks;
+  unsigned long junctions;
+  unsigned long hardlinks;
+  unsigned long failed;
+} treegen_stats;
+
+void treegen_defaults (treegen_params *p);
+int treegen_option (treegen_params *p, const char *option, const char *value);
+void treegen_print_params (FILE *f, const treegen_params *p);
+void treegen_print_usage (FILE *f);
+int treegen_create (const wchar_t *root, const treegen_params *p, treegen_stats *stats);
+
+#endif /* __NTLINK_TREEGEN_H__ */
@@ -0,0 +1,489 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * End-to-end workload benchmark.
+ *
+ * Runs a script of scenarios on a synthetic tree (see treegen.c), on the
+ * real filesystem or in the simulator, and prints one JSON object per
+ * scenario and line. Every line carries the tree parameters and the
+ * backend, so results of different runs and releases can be compared
+ * line by line. Backup, restore and verify run translink's own code
+ * (translink.c is built into this program with TRANSLINK_NO_MAIN), with
+ * the same arguments one would give to translink.exe.
+ *
+ * All output is wide, because translink's is.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <windows.h>
+
+#include "misc.h"
+#include "extra_string.h"
+#include "walk.h"
+#include "quasisymlink.h"
+#include "removetree.h"
+#include "throttle.h"
+#include "fsbackend.h"
+#include "fssim.h"
+#include "alloc.h"
+#include "manifest_text.h"
+#include "treegen.h"
+
+int translink_wmain (int argc, wchar_t **argv);
+
+#ifdef _WIN32
+static double
+now (void)
+{
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter (&c);
+  QueryPerformanceFrequency (&f);
+  return (double) c.QuadPart / (double) f.QuadPart;
+}
+#else
+#include <time.h>
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+typedef struct
+{
+  treegen_params params;
+  wchar_t *root;
+  char *manifest;
+  wchar_t *wmanifest;
+  wchar_t threads[16];
+  /* translink's 'L' and 'R' options, and the same for walk and remove */
+  int background;
+  wchar_t rate[64];
+  ntlink_throttle *throttle;
+  ntlink_fssim *sim;
+  /* the current directory to go back to after running translink */
+  wchar_t cwd[MAX_PATH];
+} workload;
+
+/* Returns 0 on success, or an error code that goes into "status" */
+typedef int (*scenario_func) (workload *w, unsigned long *items);
+
+static int
+scenario_generate (workload *w, unsigned long *items)
+{
+  treegen_stats stats;
+  int r = treegen_create (w->root, &w->params, &stats);
+  *items = stats.dirs + stats.files + stats.symlinks + stats.junctions + stats.hardlinks;
+  if (r == 0 && stats.failed > 0)
+    r = 3;
+  return r;
+}
+
+static int
+scenario_walk (workload *w, unsigned long *items)
+{
+  walk_iteratorw *iter = walk_allocw (NULL, w->root, WALK_FLAG_DONT_FOLLOW_SYMLINKS);
+  if (iter == NULL)
+    return errno;
+  walk_set_throttle (iter, w->throttle);
+  while ((iter = walk_nextw (iter)) != NULL)
+    *items += iter->nitems;
+  return 0;
+}
+
+/* Walks the tree and lstat()s everything in it */
+static int
+scenario_lstat (workload *w, unsigned long *items)
+{
+  walk_iteratorw *iter = walk_allocw (NULL, w->root, WALK_FLAG_DONT_FOLLOW_SYMLINKS);
+  wchar_t path[MAX_PATH * 2];
+  struct stat st;
+  int i, r = 0;
+  if (iter == NULL)
+    return errno;
+  while ((iter = walk_nextw (iter)) != NULL)
+  {
+    for (i = 0; i < iter->nitems; i++)
+    {
+      _snwprintf (path, MAX_PATH * 2, L"%ls\\%ls", iter->wdir, iter->items[i].cFileName);
+      path[MAX_PATH * 2 - 1] = L'\0';
+      if (ntlink_lstatw (path, &st) != 0)
+        r = errno;
+      else
+        *items += 1;
+    }
+  }
+  return r;
+}
+
+static int
+workload_chdir (workload *w, const wchar_t *path)
+{
+  if (w->sim != NULL)
+    return ntlink_fssim_set_current_directory (w->sim, path);
+#ifdef _WIN32
+  return SetCurrentDirectoryW (path) ? 0 : -1;
+#else
+  return -1;
+#endif
+}
+
+/* Runs translink in its base directory, as it expects */
+static int
+run_translink (workload *w, int argc, wchar_t **argv)
+{
+  int r;
+  if (workload_chdir (w, w->root) != 0)
+    return -1;
+  r = translink_wmain (argc, argv);
+  workload_chdir (w, w->cwd);
+  return r;
+}
+
+static unsigned long
+manifest_records (workload *w)
+{
+  manifest_reader reader;
+  manifest_entry e;
+  unsigned long n = 0;
+  FILE *f = fopen (w->manifest, "rb");
+  if (f == NULL)
+    return 0;
+  if (manifest_reader_init (&reader, f) == 0)
+  {
+    while (manifest_reader_next (&reader, &e) > 0)
+      n += 1;
+    manifest_reader_free (&reader);
+  }
+  fclose (f);
+  return n;
+}
+
+/* Appends the throttling options to argv, returns the new argc */
+static int
+throttle_args (workload *w, wchar_t **argv, int argc)
+{
+  if (w->background)
+    argv[argc++] = L"L";
+  if (w->rate[0] != L'\0')
+  {
+    argv[argc++] = L"R";
+    argv[argc++] = w->rate;
+  }
+  argv[argc] = NULL;
+  return argc;
+}
+
+static int
+scenario_backup (workload *w, unsigned long *items)
+{
+  wchar_t *argv[16] = { L"translink", L"b", w->root, w->root, L"r", L"h", L"f", w->wmanifest, L"t", w->threads, NULL };
+  FILE *f;
+  int r;
+  /* translink appends to the manifest */
+  f = fopen (w->manifest, "wb");
+  if (f == NULL)
+    return errno;
+  fclose (f);
+  r = run_translink (w, throttle_args (w, argv, 10), argv);
+  *items = manifest_records (w);
+  return r;
+}
+
+static int
+scenario_restore (workload *w, unsigned long *items)
+{
+  wchar_t *argv[] = { L"translink", L"r", w->root, w->root, L"f", w->wmanifest, L"t", w->threads, NULL };
+  int r = run_translink (w, 8, argv);
+  *items = manifest_records (w);
+  return r;
+}
+
+static int
+scenario_verify (workload *w, unsigned long *items)
+{
+  wchar_t *argv[16] = { L"translink", L"v", w->root, w->root, L"r", L"f", w->wmanifest, L"t", w->threads, NULL };
+  int r = run_translink (w, throttle_args (w, argv, 9), argv);
+  *items = manifest_records (w);
+  return r;
+}
+
+static int
+count_removed (const wchar_t *path, int isdir, void *userdata)
+{
+  InterlockedIncrement ((LONG *) userdata);
+  return 0;
+}
+
+static int
+scenario_remove (workload *w, unsigned long *items)
+{
+  RemoveTreeOptions options;
+  LONG removed = 0;
+  int r;
+  memset (&options, 0, sizeof (options));
+  options.nthreads = _wtoi (w->threads);
+  options.progress = count_removed;
+  options.userdata = &removed;
+  options.throttle = w->throttle;
+  r = ntlink_remove_treew (w->root, &options);
+  *items = removed;
+  return r != 0 ? errno : 0;
+}
+
+typedef struct
+{
+  const char *name;
+  scenario_func func;
+} scenario;
+
+static const scenario scenarios[] =
+{
+  { "generate", scenario_generate },
+  { "walk", scenario_walk },
+  { "lstat", scenario_lstat },
+  { "backup", scenario_backup },
+  { "restore", scenario_restore },
+  { "verify", scenario_verify },
+  { "remove", scenario_remove },
+};
+
+#define NSCENARIOS (sizeof (scenarios) / sizeof (scenarios[0]))
+
+static const scenario *
+find_scenario (const char *name)
+{
+  size_t i;
+  for (i = 0; i < NSCENARIOS; i++)
+    if (strcmp (scenarios[i].name, name) == 0)
+      return &scenarios[i];
+  return NULL;
+}
+
+static unsigned long
+fs_calls (workload *w)
+{
+  unsigned long counts[NTLINK_FS_OP_COUNT], total = 0;
+  int i;
+  ntlink_fssim_get_counts (w->sim, counts);
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+    total += counts[i];
+  return total;
+}
+
+static void
+run_scenario (workload *w, const scenario *s, int run)
+{
+  unsigned long items = 0, calls = 0;
+  double t;
+  int r;
+
+  if (w->sim != NULL)
+    calls = fs_calls (w);
+  t = now ();
+  r = s->func (w, &items);
+  t = now () - t;
+
+  fwprintf (stdout, L"{\"scenario\":\"%hs\",\"run\":%d,\"backend\":\"%hs\",", s->name, run, ntlink_fs->name);
+  treegen_print_params (stdout, &w->params);
+  fwprintf (stdout, L",\"threads\":%ls,\"status\":%d,\"ms\":%.3f,\"items\":%lu,\"items_per_s\":%.0f,",
+      w->threads, r, t * 1000.0, items, t > 0 ? items / t : 0.0);
+  if (w->sim != NULL)
+    fwprintf (stdout, L"\"fs_calls\":%lu}\n", fs_calls (w) - calls);
+  else
+    fwprintf (stdout, L"\"fs_calls\":null}\n");
+  fflush (stdout);
+}
+
+static void
+usage (const char *name)
+{
+  fwprintf (stderr, L"\
+Usage: %hs <directory> [option value | scenario ...]\n\
+Runs the scenarios in the order given on a tree in <directory>, and prints\n\
+one JSON object per scenario. Scenarios:\n\
+  generate - make the tree (<directory> must not exist)\n\
+  walk - walk it with walk_nextw()\n\
+  lstat - walk it and ntlink_lstatw() everything\n\
+  backup - translink b <directory> <directory> r h (removes the links)\n\
+  restore - translink r <directory> <directory>\n\
+  verify - translink v <directory> <directory> r\n\
+  remove - ntlink_remove_treew() it\n\
+Without scenarios runs all of them in this order.\n\
+Options:\n\
+  b <backend> - `fssim' to run in an empty simulated filesystem%ls\n\
+  t <number> - threads for translink and remove (0 - one per CPU, default)\n\
+  x <number> - run the scenarios this many times (1)\n\
+  m <filename> - manifest file for backup and restore (workload.manifest)\n\
+  L <0|1> - walk, back up, verify and remove in the background (0)\n\
+  R <ops>[:<bytes>] - rate limit for walk, backup, verify and remove, as for\n\
+  translink (none)\n\
+", name,
+#ifdef _WIN32
+      L", `win32'\n  (default) for the real one"
+#else
+      L" (the\n  only one here)"
+#endif
+      );
+  treegen_print_usage (stderr);
+}
+
+int
+main (int argc, char **argv)
+{
+  workload w;
+  const scenario *script[64];
+  size_t nscript = 0, i;
+  wchar_t *root = NULL;
+  int runs = 1, run, r;
+  ntlink_throttle_settings throttling;
+
+  memset (&w, 0, sizeof (w));
+  memset (&throttling, 0, sizeof (throttling));
+  treegen_defaults (&w.params);
+  w.manifest = "workload.manifest";
+  wcscpy (w.threads, L"0");
+#ifndef _WIN32
+  w.sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+#endif
+
+  if (argc < 2)
+  {
+    usage (argv[0]);
+    return 1;
+  }
+  for (r = 2; r < argc; r++)
+  {
+    const scenario *s = find_scenario (argv[r]);
+    int applied;
+    if (s != NULL)
+    {
+      if (nscript == sizeof (script) / sizeof (script[0]))
+      {
+        fwprintf (stderr, L"Too many scenarios\n");
+        return 1;
+      }
+      script[nscript++] = s;
+      continue;
+    }
+    if (r + 1 == argc)
+    {
+      fwprintf (stderr, L"Option `%hs' requires extra argument\n", argv[r]);
+      return 1;
+    }
+    if (strcmp (argv[r], "b") == 0)
+    {
+      if (strcmp (argv[r + 1], "fssim") == 0)
+      {
+        if (w.sim == NULL)
+          w.sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+      }
+#ifdef _WIN32
+      else if (strcmp (argv[r + 1], "win32") == 0)
+      {
+        if (w.sim != NULL)
+          ntlink_fssim_free (w.sim);
+        w.sim = NULL;
+      }
+#endif
+      else
+      {
+        fwprintf (stderr, L"Unknown backend `%hs'\n", argv[r + 1]);
+        return 1;
+      }
+    }
+    else if (strcmp (argv[r], "t") == 0)
+      _snwprintf (w.threads, 16, L"%d", atoi (argv[r + 1]));
+    else if (strcmp (argv[r], "x") == 0)
+      runs = atoi (argv[r + 1]);
+    else if (strcmp (argv[r], "m") == 0)
+      w.manifest = argv[r + 1];
+    else if (strcmp (argv[r], "L") == 0)
+      w.background = throttling.background = atoi (argv[r + 1]) != 0;
+    else if (strcmp (argv[r], "R") == 0)
+    {
+      char *end;
+      throttling.ops_per_sec = strtod (argv[r + 1], &end);
+      if (*end == ':')
+        throttling.bytes_per_sec = strtod (end + 1, &end);
+      if (*end != '\0' || throttling.ops_per_sec < 0 || throttling.bytes_per_sec < 0)
+      {
+        fwprintf (stderr, L"Invalid value for option `%hs'\n", argv[r]);
+        return 1;
+      }
+      _snwprintf (w.rate, 64, L"%hs", argv[r + 1]);
+    }
+    else if ((applied = treegen_option (&w.params, argv[r], argv[r + 1])) <= 0)
+    {
+      fwprintf (stderr, applied == 0 ? L"Unknown option `%hs'\n" : L"Invalid value for option `%hs'\n", argv[r]);
+      return 1;
+    }
+    r += 1;
+  }
+  if (nscript == 0)
+    for (i = 0; i < NSCENARIOS; i++)
+      script[nscript++] = &scenarios[i];
+  if (w.background || w.rate[0] != L'\0')
+  {
+    w.throttle = ntlink_throttle_new (&throttling);
+    if (w.throttle == NULL)
+    {
+      fwprintf (stderr, L"Failed to set up throttling\n");
+      return 2;
+    }
+  }
+
+  if (w.sim != NULL)
+    ntlink_fssim_install (w.sim);
+  if (strtowchar (argv[1], &root, CP_THREAD_ACP) < 0 ||
+      GetAbsNameW (root, &w.root, NULL, 2) != 0 ||
+      strtowchar (w.manifest, &w.wmanifest, CP_THREAD_ACP) < 0)
+  {
+    fwprintf (stderr, L"Invalid directory or file name\n");
+    return 1;
+  }
+  ntlink_free (root);
+  if (ntlink_fs->get_current_directory (MAX_PATH, w.cwd) == 0)
+  {
+    fwprintf (stderr, L"Failed to get the current directory\n");
+    return 2;
+  }
+
+  for (run = 1; run <= runs; run++)
+    for (i = 0; i < nscript; i++)
+      run_scenario (&w, script[i], run);
+
+  remove (w.manifest);
+  if (w.sim != NULL)
+  {
+    ntlink_fssim_install (NULL);
+    ntlink_fssim_free (w.sim);
+  }
+  ntlink_throttle_free (w.throttle);
+  ntlink_free (w.root);
+  ntlink_free (w.wmanifest);
+  return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* msvcrt low-level I/O: everything needed is in <windows.h> here */
+
+#ifndef __NTLINK_COMPAT_IO_H__
+#define __NTLINK_COMPAT_IO_H__
+
+#include <unistd.h>
+#include <windows.h>
+
+#endif /* __NTLINK_COMPAT_IO_H__ */
@@ -0,0 +1,36 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* msvcrt multibyte string functions */
+
+#ifndef __NTLINK_COMPAT_MBSTRING_H__
+#define __NTLINK_COMPAT_MBSTRING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+unsigned char *_mbschr (const unsigned char *str, unsigned int c);
+unsigned char *_mbsinc (const unsigned char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_COMPAT_MBSTRING_H__ */
@@ -0,0 +1,968 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The parts of Win32 and msvcrt declared in compat/windows.h, on top of
+ * POSIX. Only as much as libntlink, junc and translink use: see the
+ * comments on individual functions for what is not supported.
+ * All code pages are UTF-8.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <wctype.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+
+#include <windows.h>
+#include <mbstring.h>
+
+#include "fsbackend.h"
+
+static __thread DWORD compat_last_error = 0;
+
+DWORD
+GetLastError (void)
+{
+  return compat_last_error;
+}
+
+void
+SetLastError (DWORD err)
+{
+  compat_last_error = err;
+}
+
+static DWORD
+compat_errno_to_win32 (int err)
+{
+  switch (err)
+  {
+  case 0:
+    return ERROR_SUCCESS;
+  case ENOENT:
+    return ERROR_FILE_NOT_FOUND;
+  case ENOTDIR:
+    return ERROR_PATH_NOT_FOUND;
+  case EACCES:
+  case EPERM:
+  case EROFS:
+    return ERROR_ACCESS_DENIED;
+  case EEXIST:
+    return ERROR_FILE_EXISTS;
+  case ENOMEM:
+    return ERROR_NOT_ENOUGH_MEMORY;
+  case EMFILE:
+  case ENFILE:
+    return ERROR_TOO_MANY_OPEN_FILES;
+  case ENOSPC:
+    return ERROR_DISK_FULL;
+  case ENAMETOOLONG:
+    return ERROR_FILENAME_EXCED_RANGE;
+  case EBADF:
+    return ERROR_INVALID_HANDLE;
+  default:
+    return ERROR_INVALID_PARAMETER;
+  }
+}
+
+/*
+ * Strings
+ */
+
+/* Decodes one UTF-8 sequence. Returns its length, or -1 if it is invalid */
+static int
+compat_utf8_decode (const unsigned char *s, size_t avail, wchar_t *c)
+{
+  int len, i;
+  unsigned long v;
+  if (s[0] < 0x80)
+  {
+    *c = s[0];
+    return 1;
+  }
+  if ((s[0] & 0xE0) == 0xC0)
+  {
+    len = 2;
+    v = s[0] & 0x1F;
+  }
+  else if ((s[0] & 0xF0) == 0xE0)
+  {
+    len = 3;
+    v = s[0] & 0x0F;
+  }
+  else if ((s[0] & 0xF8) == 0xF0)
+  {
+    len = 4;
+    v = s[0] & 0x07;
+  }
+  else
+    return -1;
+  if ((size_t) len > avail)
+    return -1;
+  for (i = 1; i < len; i++)
+  {
+    if ((s[i] & 0xC0) != 0x80)
+      return -1;
+    v = (v << 6) | (s[i] & 0x3F);
+  }
+  if (v > 0x10FFFF || (v >= 0xD800 && v <= 0xDFFF) ||
+      (len == 2 && v < 0x80) || (len == 3 && v < 0x800) || (len == 4 && v < 0x10000))
+    return -1;
+  *c = (wchar_t) v;
+  return len;
+}
+
+static int
+compat_utf8_encode (wchar_t c, char *out)
+{
+  unsigned long v = (unsigned long) c;
+  if (v < 0x80)
+  {
+    out[0] = (char) v;
+    return 1;
+  }
+  if (v < 0x800)
+  {
+    out[0] = (char) (0xC0 | (v >> 6));
+    out[1] = (char) (0x80 | (v & 0x3F));
+    return 2;
+  }
+  if (v >= 0xD800 && v <= 0xDFFF)
+    v = 0xFFFD;
+  if (v < 0x10000)
+  {
+    out[0] = (char) (0xE0 | (v >> 12));
+    out[1] = (char) (0x80 | ((v >> 6) & 0x3F));
+    out[2] = (char) (0x80 | (v & 0x3F));
+    return 3;
+  }
+  if (v > 0x10FFFF)
+    return compat_utf8_encode (0xFFFD, out);
+  out[0] = (char) (0xF0 | (v >> 18));
+  out[1] = (char) (0x80 | ((v >> 12) & 0x3F));
+  out[2] = (char) (0x80 | ((v >> 6) & 0x3F));
+  out[3] = (char) (0x80 | (v & 0x3F));
+  return 4;
+}
+
+/* Only MB_ERR_INVALID_CHARS behaviour: invalid input is an error */
+int
+MultiByteToWideChar (UINT cp, DWORD flags, LPCSTR str, int len, LPWSTR wstr, int wlen)
+{
+  const unsigned char *s = (const unsigned char *) str;
+  size_t slen = len < 0 ? strlen (str) + 1 : (size_t) len;
+  size_t i = 0;
+  int n = 0;
+
+  while (i < slen)
+  {
+    wchar_t c;
+    int l = compat_utf8_decode (&s[i], slen - i, &c);
+    if (l < 0)
+    {
+      SetLastError (ERROR_NO_UNICODE_TRANSLATION);
+      return 0;
+    }
+    if (wlen > 0)
+    {
+      if (n >= wlen)
+      {
+        SetLastError (ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+      }
+      wstr[n] = c;
+    }
+    n++;
+    i += l;
+  }
+  return n;
+}
+
+int
+WideCharToMultiByte (UINT cp, DWORD flags, LPCWSTR wstr, int wlen, LPSTR str, int len, LPCSTR defchar, BOOL *useddef)
+{
+  size_t slen = wlen < 0 ? wcslen (wstr) + 1 : (size_t) wlen;
+  size_t i;
+  int n = 0;
+
+  if (useddef != NULL)
+    *useddef = FALSE;
+  for (i = 0; i < slen; i++)
+  {
+    char buf[4];
+    int l = compat_utf8_encode (wstr[i], buf);
+    if (len > 0)
+    {
+      if (n + l > len)
+      {
+        SetLastError (ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+      }
+      memcpy (&str[n], buf, l);
+    }
+    n += l;
+  }
+  return n;
+}
+
+static char *
+compat_to_utf8 (const wchar_t *wstr)
+{
+  int len = WideCharToMultiByte (CP_UTF8, 0, wstr, -1, NULL, 0, NULL, NULL);
+  char *str = malloc (len);
+  if (str == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  WideCharToMultiByte (CP_UTF8, 0, wstr, -1, str, len, NULL, NULL);
+  return str;
+}
+
+int
+_wcsicmp (const wchar_t *a, const wchar_t *b)
+{
+  return _wcsnicmp (a, b, (size_t) -1);
+}
+
+int
+_wcsnicmp (const wchar_t *a, const wchar_t *b, size_t n)
+{
+  for (; n > 0; a++, b++, n--)
+  {
+    wint_t ca = towlower (*a), cb = towlower (*b);
+    if (ca != cb)
+      return ca < cb ? -1 : 1;
+    if (ca == L'\0')
+      break;
+  }
+  return 0;
+}
+
+int
+_wtoi (const wchar_t *s)
+{
+  return (int) wcstol (s, NULL, 10);
+}
+
+int
+_vsnwprintf (wchar_t *buf, size_t count, const wchar_t *format, va_list ap)
+{
+  return vswprintf (buf, count, format, ap);
+}
+
+int
+_snwprintf (wchar_t *buf, size_t count, const wchar_t *format, ...)
+{
+  va_list ap;
+  int r;
+  va_start (ap, format);
+  r = vswprintf (buf, count, format, ap);
+  va_end (ap);
+  return r;
+}
+
+/* vswprintf() can't tell how long the output would be, so grow until it fits */
+int
+_vscwprintf (const wchar_t *format, va_list ap)
+{
+  size_t size = 256;
+  int r = -1;
+  while (size <= 16 * 1024 * 1024)
+  {
+    wchar_t *buf = malloc (size * sizeof (wchar_t));
+    va_list copy;
+    if (buf == NULL)
+      return -1;
+    va_copy (copy, ap);
+    r = vswprintf (buf, size, format, copy);
+    va_end (copy);
+    free (buf);
+    if (r >= 0)
+      break;
+    size *= 2;
+  }
+  return r;
+}
+
+int
+_vscprintf (const char *format, va_list ap)
+{
+  va_list copy;
+  int r;
+  va_copy (copy, ap);
+  r = vsnprintf (NULL, 0, format, copy);
+  va_end (copy);
+  return r;
+}
+
+unsigned char *
+_mbschr (const unsigned char *str, unsigned int c)
+{
+  return (unsigned char *) strchr ((const char *) str, (int) c);
+}
+
+unsigned char *
+_mbsinc (const unsigned char *str)
+{
+  wchar_t c;
+  int l = compat_utf8_decode (str, 4, &c);
+  return (unsigned char *) str + (l > 0 ? l : 1);
+}
+
+/*
+ * Handles: threads, host files and file mappings share CloseHandle()
+ */
+
+#define COMPAT_HANDLE_THREAD  1
+#define COMPAT_HANDLE_FILE    2
+#define COMPAT_HANDLE_MAPPING 3
+
+typedef struct
+{
+  int type;
+  /* Threads */
+  pthread_t thread;
+  int joined;
+  LPTHREAD_START_ROUTINE func;
+  LPVOID arg;
+  /* Files and mappings */
+  int fd;
+} compat_handle;
+
+static void *
+compat_thread_start (void *arg)
+{
+  compat_handle *h = arg;
+  h->func (h->arg);
+  return NULL;
+}
+
+/* Stack size and creation flags are ignored */
+HANDLE
+CreateThread (LPSECURITY_ATTRIBUTES sa, SIZE_T stack, LPTHREAD_START_ROUTINE func, LPVOID arg, DWORD flags, LPDWORD id)
+{
+  compat_handle *h = calloc (1, sizeof (compat_handle));
+  int r;
+  if (h == NULL)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  h->type = COMPAT_HANDLE_THREAD;
+  h->func = func;
+  h->arg = arg;
+  r = pthread_create (&h->thread, NULL, compat_thread_start, h);
+  if (r != 0)
+  {
+    free (h);
+    SetLastError (compat_errno_to_win32 (r));
+    return NULL;
+  }
+  if (id != NULL)
+    *id = 0;
+  return (HANDLE) h;
+}
+
+/* Small numbers, in the order threads first ask for them */
+DWORD
+GetCurrentThreadId (void)
+{
+  static LONG next_id = 0;
+  static __thread DWORD id = 0;
+  if (id == 0)
+    id = (DWORD) __sync_add_and_fetch (&next_id, 1);
+  return id;
+}
+
+/* The pseudo handle, SetThreadPriority() only works on it */
+HANDLE
+GetCurrentThread (void)
+{
+  return (HANDLE) (LONG_PTR) -2;
+}
+
+/*
+ * Only the background mode, which is the idle I/O priority class here
+ * (ioprio_set(), see ioprio(2)); the CPU priority is left alone.
+ */
+#define COMPAT_IOPRIO_WHO_PROCESS 1
+#define COMPAT_IOPRIO_CLASS_SHIFT 13
+#define COMPAT_IOPRIO_CLASS_IDLE  3
+
+BOOL
+SetThreadPriority (HANDLE thread, int priority)
+{
+  static __thread int background = 0;
+  int ioprio;
+
+  if (thread != GetCurrentThread () ||
+      (priority != THREAD_MODE_BACKGROUND_BEGIN && priority != THREAD_MODE_BACKGROUND_END))
+  {
+    SetLastError (ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  if (background == (priority == THREAD_MODE_BACKGROUND_BEGIN))
+  {
+    SetLastError (background ? ERROR_THREAD_MODE_ALREADY_BACKGROUND : ERROR_THREAD_MODE_NOT_BACKGROUND);
+    return FALSE;
+  }
+  background = priority == THREAD_MODE_BACKGROUND_BEGIN;
+  /* Class "none" goes back to the priority derived from the nice value */
+  ioprio = background ? COMPAT_IOPRIO_CLASS_IDLE << COMPAT_IOPRIO_CLASS_SHIFT : 0;
+#ifdef SYS_ioprio_set
+  syscall (SYS_ioprio_set, COMPAT_IOPRIO_WHO_PROCESS, 0, ioprio);
+#else
+  (void) ioprio;
+#endif
+  return TRUE;
+}
+
+/* Only waits for threads, and only forever */
+DWORD
+WaitForSingleObject (HANDLE handle, DWORD timeout)
+{
+  compat_handle *h = (compat_handle *) handle;
+  if (h == NULL || h->type != COMPAT_HANDLE_THREAD || timeout != INFINITE)
+  {
+    SetLastError (ERROR_INVALID_PARAMETER);
+    return WAIT_FAILED;
+  }
+  if (!h->joined)
+  {
+    pthread_join (h->thread, NULL);
+    h->joined = 1;
+  }
+  return WAIT_OBJECT_0;
+}
+
+BOOL
+CloseHandle (HANDLE handle)
+{
+  compat_handle *h = (compat_handle *) handle;
+  if (h == NULL || handle == INVALID_HANDLE_VALUE)
+  {
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  switch (h->type)
+  {
+  case COMPAT_HANDLE_THREAD:
+    if (!h->joined)
+      pthread_detach (h->thread);
+    break;
+  case COMPAT_HANDLE_FILE:
+    close (h->fd);
+    break;
+  case COMPAT_HANDLE_MAPPING:
+    break;
+  default:
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  free (h);
+  return TRUE;
+}
+
+/* Opens a host file. Share modes, attributes and flags are ignored */
+HANDLE
+CreateFileW (LPCWSTR path, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES sa, DWORD disposition, DWORD flags, HANDLE templ)
+{
+  compat_handle *h;
+  char *name;
+  int oflags = 0, fd;
+
+  if ((access & GENERIC_READ) && (access & GENERIC_WRITE))
+    oflags = O_RDWR;
+  else if (access & GENERIC_WRITE)
+    oflags = O_WRONLY;
+  else
+    oflags = O_RDONLY;
+  switch (disposition)
+  {
+  case CREATE_NEW:
+    oflags |= O_CREAT | O_EXCL;
+    break;
+  case CREATE_ALWAYS:
+    oflags |= O_CREAT | O_TRUNC;
+    break;
+  case OPEN_ALWAYS:
+    oflags |= O_CREAT;
+    break;
+  case TRUNCATE_EXISTING:
+    oflags |= O_TRUNC;
+    break;
+  default:
+    break;
+  }
+  name = compat_to_utf8 (path);
+  if (name == NULL)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return INVALID_HANDLE_VALUE;
+  }
+  fd = open (name, oflags | O_CLOEXEC, 0666);
+  free (name);
+  if (fd < 0)
+  {
+    SetLastError (compat_errno_to_win32 (errno));
+    return INVALID_HANDLE_VALUE;
+  }
+  h = calloc (1, sizeof (compat_handle));
+  if (h == NULL)
+  {
+    close (fd);
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return INVALID_HANDLE_VALUE;
+  }
+  h->type = COMPAT_HANDLE_FILE;
+  h->fd = fd;
+  return (HANDLE) h;
+}
+
+BOOL
+GetFileSizeEx (HANDLE handle, LARGE_INTEGER *size)
+{
+  compat_handle *h = (compat_handle *) handle;
+  struct stat st;
+  if (h == NULL || handle == INVALID_HANDLE_VALUE || h->type != COMPAT_HANDLE_FILE)
+  {
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  if (fstat (h->fd, &st) != 0)
+  {
+    SetLastError (compat_errno_to_win32 (errno));
+    return FALSE;
+  }
+  size->QuadPart = st.st_size;
+  return TRUE;
+}
+
+/* Read-only mappings of whole files */
+HANDLE
+CreateFileMappingW (HANDLE file, LPSECURITY_ATTRIBUTES sa, DWORD protect, DWORD sizehigh, DWORD sizelow, LPCWSTR name)
+{
+  compat_handle *f = (compat_handle *) file;
+  compat_handle *h;
+  if (f == NULL || file == INVALID_HANDLE_VALUE || f->type != COMPAT_HANDLE_FILE ||
+      protect != PAGE_READONLY || sizehigh != 0 || sizelow != 0 || name != NULL)
+  {
+    SetLastError (ERROR_INVALID_PARAMETER);
+    return NULL;
+  }
+  h = calloc (1, sizeof (compat_handle));
+  if (h == NULL)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  h->type = COMPAT_HANDLE_MAPPING;
+  h->fd = f->fd;
+  return (HANDLE) h;
+}
+
+/* munmap() needs the size, so views remember it in front of the data */
+typedef struct
+{
+  size_t size;
+  size_t pad;
+} compat_view;
+
+LPVOID
+MapViewOfFile (HANDLE mapping, DWORD access, DWORD offhigh, DWORD offlow, SIZE_T size)
+{
+  compat_handle *h = (compat_handle *) mapping;
+  struct stat st;
+  void *p;
+  size_t len, header;
+
+  if (h == NULL || h->type != COMPAT_HANDLE_MAPPING || offhigh != 0 || offlow != 0)
+  {
+    SetLastError (ERROR_INVALID_PARAMETER);
+    return NULL;
+  }
+  if (fstat (h->fd, &st) != 0)
+  {
+    SetLastError (compat_errno_to_win32 (errno));
+    return NULL;
+  }
+  len = size != 0 ? size : (size_t) st.st_size;
+  /* The header takes a whole page, so that the data is page-aligned */
+  header = (size_t) sysconf (_SC_PAGESIZE);
+  p = mmap (NULL, header + len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  if (len > 0 && mmap ((char *) p + header, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, h->fd, 0) == MAP_FAILED)
+  {
+    SetLastError (compat_errno_to_win32 (errno));
+    munmap (p, header + len);
+    return NULL;
+  }
+  ((compat_view *) p)->size = header + len;
+  mprotect (p, header, PROT_READ);
+  return (char *) p + header;
+}
+
+BOOL
+UnmapViewOfFile (LPCVOID addr)
+{
+  size_t header = (size_t) sysconf (_SC_PAGESIZE);
+  compat_view *v = (compat_view *) ((char *) addr - header);
+  munmap (v, v->size);
+  return TRUE;
+}
+
+DWORD
+GetTempPathW (DWORD size, LPWSTR buf)
+{
+  const char *tmp = getenv ("TMPDIR");
+  wchar_t path[MAX_PATH + 1];
+  size_t len;
+  if (tmp == NULL || tmp[0] == '\0')
+    tmp = "/tmp";
+  len = mbstowcs (path, tmp, MAX_PATH - 1);
+  if (len == (size_t) -1 || len >= MAX_PATH - 1)
+    return 0;
+  if (path[len - 1] != L'/')
+    path[len++] = L'/';
+  path[len] = L'\0';
+  if (size <= len)
+    return len + 1;
+  wcscpy (buf, path);
+  return len;
+}
+
+/* Creates a unique empty file, like GetTempFileNameW() with unique == 0 */
+UINT
+GetTempFileNameW (LPCWSTR dir, LPCWSTR prefix, UINT unique, LPWSTR buf)
+{
+  char *udir, *uprefix, *name;
+  size_t len;
+  int fd;
+
+  udir = compat_to_utf8 (dir);
+  uprefix = compat_to_utf8 (prefix);
+  if (udir == NULL || uprefix == NULL)
+  {
+    free (udir);
+    free (uprefix);
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return 0;
+  }
+  len = strlen (udir) + 1 + strlen (uprefix) + 6 + 4 + 1;
+  name = malloc (len);
+  if (name == NULL)
+  {
+    free (udir);
+    free (uprefix);
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return 0;
+  }
+  snprintf (name, len, "%s%s%sXXXXXX", udir, udir[0] != '\0' && udir[strlen (udir) - 1] != '/' ? "/" : "", uprefix);
+  free (udir);
+  free (uprefix);
+  fd = mkstemp (name);
+  if (fd < 0)
+  {
+    SetLastError (compat_errno_to_win32 (errno));
+    free (name);
+    return 0;
+  }
+  close (fd);
+  if (mbstowcs (buf, name, MAX_PATH) >= MAX_PATH)
+  {
+    unlink (name);
+    free (name);
+    SetLastError (ERROR_FILENAME_EXCED_RANGE);
+    return 0;
+  }
+  free (name);
+  return 1;
+}
+
+/* Modes are as in fopen(), plus 'D' (delete when closed) */
+FILE *
+_wfopen (const wchar_t *name, const wchar_t *mode)
+{
+  char *uname, umode[16];
+  size_t i, j;
+  int temporary = 0;
+  FILE *f;
+
+  for (i = 0, j = 0; mode[i] != L'\0' && j < sizeof (umode) - 1; i++)
+  {
+    if (mode[i] == L'D')
+      temporary = 1;
+    else if (wcschr (L"rwab+tx", mode[i]) != NULL)
+      umode[j++] = (char) mode[i];
+  }
+  umode[j] = '\0';
+  uname = compat_to_utf8 (name);
+  if (uname == NULL)
+    return NULL;
+  f = fopen (uname, umode);
+  /* The file is gone when the last descriptor is closed */
+  if (f != NULL && temporary)
+    unlink (uname);
+  free (uname);
+  return f;
+}
+
+int
+_setmode (int fd, int mode)
+{
+  return _O_BINARY;
+}
+
+/* Stats a path in the tree (not a host file) */
+int
+_wstat (const wchar_t *path, struct stat *buf)
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!ntlink_fs->get_file_attributes_ex (path, GetFileExInfoStandard, &data))
+  {
+    DWORD err = GetLastError ();
+    errno = err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND ? ENOENT : EACCES;
+    return -1;
+  }
+  memset (buf, 0, sizeof (struct stat));
+  buf->st_mode = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? (S_IFDIR | 0755) :
+      (S_IFREG | ((data.dwFileAttributes & FILE_ATTRIBUTE_READONLY) ? 0444 : 0644));
+  buf->st_nlink = 1;
+  buf->st_size = ((off_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+  /* 100ns intervals since 1601 to seconds since 1970 */
+  buf->st_mtime = (time_t) (((((ULONGLONG) data.ftLastWriteTime.dwHighDateTime) << 32 |
+      data.ftLastWriteTime.dwLowDateTime) - 116444736000000000ULL) / 10000000);
+  buf->st_atime = buf->st_mtime;
+  buf->st_ctime = buf->st_mtime;
+  return 0;
+}
+
+/*
+ * Synchronization
+ */
+
+static void
+compat_init_recursive_mutex (pthread_mutex_t *mutex)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (mutex, &attr);
+  pthread_mutexattr_destroy (&attr);
+}
+
+void
+InitializeCriticalSection (LPCRITICAL_SECTION cs)
+{
+  compat_init_recursive_mutex (&cs->impl);
+}
+
+void
+DeleteCriticalSection (LPCRITICAL_SECTION cs)
+{
+  pthread_mutex_destroy (&cs->impl);
+}
+
+void
+EnterCriticalSection (LPCRITICAL_SECTION cs)
+{
+  pthread_mutex_lock (&cs->impl);
+}
+
+void
+LeaveCriticalSection (LPCRITICAL_SECTION cs)
+{
+  pthread_mutex_unlock (&cs->impl);
+}
+
+void
+InitializeSRWLock (PSRWLOCK lock)
+{
+  pthread_rwlock_init (&lock->impl, NULL);
+}
+
+void
+AcquireSRWLockExclusive (PSRWLOCK lock)
+{
+  pthread_rwlock_wrlock (&lock->impl);
+}
+
+void
+ReleaseSRWLockExclusive (PSRWLOCK lock)
+{
+  pthread_rwlock_unlock (&lock->impl);
+}
+
+void
+AcquireSRWLockShared (PSRWLOCK lock)
+{
+  pthread_rwlock_rdlock (&lock->impl);
+}
+
+void
+ReleaseSRWLockShared (PSRWLOCK lock)
+{
+  pthread_rwlock_unlock (&lock->impl);
+}
+
+void
+InitializeConditionVariable (PCONDITION_VARIABLE cv)
+{
+  pthread_cond_init (&cv->impl, NULL);
+}
+
+/* @cs must be entered exactly once */
+BOOL
+SleepConditionVariableCS (PCONDITION_VARIABLE cv, LPCRITICAL_SECTION cs, DWORD timeout)
+{
+  int r;
+  if (timeout == INFINITE)
+    r = pthread_cond_wait (&cv->impl, &cs->impl);
+  else
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000;
+    ts.tv_nsec += (long) (timeout % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+      ts.tv_sec += 1;
+      ts.tv_nsec -= 1000000000;
+    }
+    r = pthread_cond_timedwait (&cv->impl, &cs->impl, &ts);
+  }
+  if (r != 0)
+  {
+    SetLastError (r == ETIMEDOUT ? ERROR_TIMEOUT : ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void
+WakeConditionVariable (PCONDITION_VARIABLE cv)
+{
+  pthread_cond_signal (&cv->impl);
+}
+
+void
+WakeAllConditionVariable (PCONDITION_VARIABLE cv)
+{
+  pthread_cond_broadcast (&cv->impl);
+}
+
+/* Fiber-local storage, which is thread-local here; the callback runs at
+ * thread exit, for non-NULL values only, as in Win32.
+ */
+DWORD
+FlsAlloc (PFLS_CALLBACK_FUNCTION callback)
+{
+  pthread_key_t key;
+  if (pthread_key_create (&key, callback) != 0)
+    return FLS_OUT_OF_INDEXES;
+  return (DWORD) key;
+}
+
+PVOID
+FlsGetValue (DWORD index)
+{
+  return pthread_getspecific ((pthread_key_t) index);
+}
+
+BOOL
+FlsSetValue (DWORD index, PVOID value)
+{
+  return pthread_setspecific ((pthread_key_t) index, value) == 0;
+}
+
+BOOL
+FlsFree (DWORD index)
+{
+  return pthread_key_delete ((pthread_key_t) index) == 0;
+}
+
+/*
+ * System
+ */
+
+void
+GetSystemInfo (SYSTEM_INFO *info)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  memset (info, 0, sizeof (SYSTEM_INFO));
+  info->dwPageSize = (DWORD) sysconf (_SC_PAGESIZE);
+  info->dwAllocationGranularity = 65536;
+  info->dwNumberOfProcessors = n > 0 ? (DWORD) n : 1;
+}
+
+void
+Sleep (DWORD msec)
+{
+  struct timespec ts;
+  ts.tv_sec = msec / 1000;
+  ts.tv_nsec = (long) (msec % 1000) * 1000000;
+  while (nanosleep (&ts, &ts) != 0 && errno == EINTR);
+}
+
+BOOL
+QueryPerformanceCounter (LARGE_INTEGER *count)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  count->QuadPart = (LONGLONG) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  return TRUE;
+}
+
+BOOL
+QueryPerformanceFrequency (LARGE_INTEGER *freq)
+{
+  freq->QuadPart = 1000000000;
+  return TRUE;
+}
+
+/* There is no ntdll: callers fall back to what they do on old Windows */
+HMODULE
+GetModuleHandleW (LPCWSTR name)
+{
+  SetLastError (ERROR_FILE_NOT_FOUND);
+  return NULL;
+}
+
+FARPROC
+GetProcAddress (HMODULE module, LPCSTR name)
+{
+  SetLastError (ERROR_INVALID_HANDLE);
+  return NULL;
+}
+
+HANDLE
+LocalFree (HANDLE mem)
+{
+  free (mem);
+  return NULL;
+}
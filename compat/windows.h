@@ -0,0 +1,478 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Just enough of the Win32 API and of msvcrt for libntlink, junc and
+ * translink to build on POSIX systems (see Makefile.linux), where all
+ * filesystem calls go to the simulator (fssim.c). Synchronization,
+ * threads, host files and string conversion are implemented in
+ * compat/win32.c. Functions that work on the tree are not provided:
+ * they are called through ntlink_fs.
+ * wchar_t is 32-bit here, so WCHAR strings are UTF-32.
+ */
+
+#ifndef __NTLINK_COMPAT_WINDOWS_H__
+#define __NTLINK_COMPAT_WINDOWS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <errno.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WINAPI
+#define NTAPI
+#define CALLBACK
+#define _ANONYMOUS_UNION
+#define DUMMYUNIONNAME
+#define FIELD_OFFSET(t, f) ((LONG) offsetof (t, f))
+
+typedef int BOOL;
+typedef unsigned char BOOLEAN;
+typedef uint8_t BYTE;
+typedef uint8_t UCHAR;
+typedef uint16_t WORD;
+typedef uint16_t USHORT;
+typedef uint32_t DWORD;
+typedef uint32_t ULONG;
+typedef int32_t LONG;
+typedef unsigned int UINT;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef uint64_t DWORD64;
+typedef uintptr_t ULONG_PTR;
+typedef intptr_t INT_PTR;
+typedef intptr_t LONG_PTR;
+typedef ULONG_PTR SIZE_T;
+typedef ULONG ACCESS_MASK;
+typedef wchar_t WCHAR;
+typedef void *PVOID;
+typedef void *LPVOID;
+typedef const void *LPCVOID;
+typedef void *HANDLE;
+typedef HANDLE HMODULE;
+typedef void *FARPROC;
+typedef DWORD *LPDWORD;
+typedef LONG *PLONG;
+typedef ULONG *PULONG;
+typedef char *LPSTR;
+typedef const char *LPCSTR;
+typedef wchar_t *LPWSTR;
+typedef const wchar_t *LPCWSTR;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define MAXDWORD 0xFFFFFFFF
+#define INFINITE 0xFFFFFFFF
+#define LOWORD(x) ((WORD) ((x) & 0xFFFF))
+#define HIWORD(x) ((WORD) (((x) >> 16) & 0xFFFF))
+
+typedef union
+{
+  struct
+  {
+    DWORD LowPart;
+    LONG HighPart;
+  };
+  LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef union
+{
+  struct
+  {
+    DWORD LowPart;
+    DWORD HighPart;
+  };
+  ULONGLONG QuadPart;
+} ULARGE_INTEGER;
+
+typedef struct
+{
+  DWORD dwLowDateTime;
+  DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct
+{
+  DWORD nLength;
+  LPVOID lpSecurityDescriptor;
+  BOOL bInheritHandle;
+} SECURITY_ATTRIBUTES, *LPSECURITY_ATTRIBUTES;
+
+typedef struct
+{
+  ULONG_PTR Internal;
+  ULONG_PTR InternalHigh;
+  DWORD Offset;
+  DWORD OffsetHigh;
+  HANDLE hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+typedef struct
+{
+  DWORD dwFileAttributes;
+  FILETIME ftCreationTime;
+  FILETIME ftLastAccessTime;
+  FILETIME ftLastWriteTime;
+  DWORD nFileSizeHigh;
+  DWORD nFileSizeLow;
+  DWORD dwReserved0;
+  DWORD dwReserved1;
+  WCHAR cFileName[MAX_PATH];
+  WCHAR cAlternateFileName[14];
+} WIN32_FIND_DATAW, *LPWIN32_FIND_DATAW;
+
+typedef struct
+{
+  DWORD dwFileAttributes;
+  FILETIME ftCreationTime;
+  FILETIME ftLastAccessTime;
+  FILETIME ftLastWriteTime;
+  DWORD nFileSizeHigh;
+  DWORD nFileSizeLow;
+} WIN32_FILE_ATTRIBUTE_DATA;
+
+typedef struct
+{
+  DWORD dwFileAttributes;
+  FILETIME ftCreationTime;
+  FILETIME ftLastAccessTime;
+  FILETIME ftLastWriteTime;
+  DWORD dwVolumeSerialNumber;
+  DWORD nFileSizeHigh;
+  DWORD nFileSizeLow;
+  DWORD nNumberOfLinks;
+  DWORD nFileIndexHigh;
+  DWORD nFileIndexLow;
+} BY_HANDLE_FILE_INFORMATION, *LPBY_HANDLE_FILE_INFORMATION;
+
+typedef struct
+{
+  LARGE_INTEGER CreationTime;
+  LARGE_INTEGER LastAccessTime;
+  LARGE_INTEGER LastWriteTime;
+  LARGE_INTEGER ChangeTime;
+  DWORD FileAttributes;
+} FILE_BASIC_INFO;
+
+typedef struct
+{
+  LARGE_INTEGER AllocationSize;
+  LARGE_INTEGER EndOfFile;
+  DWORD NumberOfLinks;
+  BOOLEAN DeletePending;
+  BOOLEAN Directory;
+} FILE_STANDARD_INFO;
+
+typedef struct
+{
+  BOOLEAN DeleteFile;
+} FILE_DISPOSITION_INFO;
+
+typedef enum
+{
+  FileBasicInfo = 0,
+  FileStandardInfo = 1,
+  FileNameInfo = 2,
+  FileRenameInfo = 3,
+  FileDispositionInfo = 4,
+  FileAllocationInfo = 5,
+  FileEndOfFileInfo = 6,
+  FileStreamInfo = 7,
+  FileCompressionInfo = 8,
+  FileAttributeTagInfo = 9,
+  FileIdBothDirectoryInfo = 10,
+  FileIdBothDirectoryRestartInfo = 11,
+  FileIoPriorityHintInfo = 12,
+  FileRemoteProtocolInfo = 13,
+  MaximumFileInfoByHandleClass = 14
+} FILE_INFO_BY_HANDLE_CLASS;
+
+typedef enum
+{
+  GetFileExInfoStandard = 0,
+  GetFileExMaxInfoLevel
+} GET_FILEEX_INFO_LEVELS;
+
+typedef enum
+{
+  FindExInfoStandard = 0,
+  FindExInfoBasic,
+  FindExInfoMaxInfoLevel
+} FINDEX_INFO_LEVELS;
+
+typedef enum
+{
+  FindExSearchNameMatch = 0,
+  FindExSearchLimitToDirectories,
+  FindExSearchLimitToDevices,
+  FindExSearchMaxSearchOp
+} FINDEX_SEARCH_OPS;
+
+typedef struct
+{
+  WORD wProcessorArchitecture;
+  WORD wReserved;
+  DWORD dwPageSize;
+  LPVOID lpMinimumApplicationAddress;
+  LPVOID lpMaximumApplicationAddress;
+  ULONG_PTR dwActiveProcessorMask;
+  DWORD dwNumberOfProcessors;
+  DWORD dwProcessorType;
+  DWORD dwAllocationGranularity;
+  WORD wProcessorLevel;
+  WORD wProcessorRevision;
+} SYSTEM_INFO;
+
+/* Synchronization objects embed their pthread objects, so nothing has to
+ * be freed with them. A zeroed pthread_rwlock_t or pthread_cond_t is the
+ * static initializer on glibc and musl, just as a zeroed SRWLOCK or
+ * CONDITION_VARIABLE is valid in Win32.
+ */
+typedef struct
+{
+  pthread_mutex_t impl;
+} CRITICAL_SECTION, *LPCRITICAL_SECTION;
+
+typedef struct
+{
+  pthread_rwlock_t impl;
+} SRWLOCK, *PSRWLOCK;
+
+typedef struct
+{
+  pthread_cond_t impl;
+} CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE) (LPVOID);
+typedef void (WINAPI *PFLS_CALLBACK_FUNCTION) (PVOID);
+#define FLS_OUT_OF_INDEXES ((DWORD) 0xFFFFFFFF)
+
+#define INVALID_HANDLE_VALUE ((HANDLE) (LONG_PTR) -1)
+#define INVALID_FILE_ATTRIBUTES ((DWORD) -1)
+
+#define FILE_ATTRIBUTE_READONLY      0x00000001
+#define FILE_ATTRIBUTE_HIDDEN        0x00000002
+#define FILE_ATTRIBUTE_SYSTEM        0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY     0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE       0x00000020
+#define FILE_ATTRIBUTE_DEVICE        0x00000040
+#define FILE_ATTRIBUTE_NORMAL        0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY     0x00000100
+#define FILE_ATTRIBUTE_SPARSE_FILE   0x00000200
+#define FILE_ATTRIBUTE_REPARSE_POINT 0x00000400
+
+#define FILE_FLAG_WRITE_THROUGH      0x80000000
+#define FILE_FLAG_SEQUENTIAL_SCAN    0x08000000
+#define FILE_FLAG_DELETE_ON_CLOSE    0x04000000
+#define FILE_FLAG_BACKUP_SEMANTICS   0x02000000
+#define FILE_FLAG_OPEN_REPARSE_POINT 0x00200000
+
+#define FILE_READ_DATA               0x00000001
+#define FILE_LIST_DIRECTORY          0x00000001
+#define FILE_WRITE_DATA              0x00000002
+#define FILE_ADD_FILE                0x00000002
+#define FILE_ADD_SUBDIRECTORY        0x00000004
+#define FILE_READ_ATTRIBUTES         0x00000080
+#define FILE_WRITE_ATTRIBUTES        0x00000100
+#define DELETE                       0x00010000
+#define SYNCHRONIZE                  0x00100000
+#define GENERIC_READ                 0x80000000
+#define GENERIC_WRITE                0x40000000
+
+#define FILE_SHARE_READ   0x00000001
+#define FILE_SHARE_WRITE  0x00000002
+#define FILE_SHARE_DELETE 0x00000004
+
+#define CREATE_NEW        1
+#define CREATE_ALWAYS     2
+#define OPEN_EXISTING     3
+#define OPEN_ALWAYS       4
+#define TRUNCATE_EXISTING 5
+
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
+#define MOVEFILE_COPY_ALLOWED     0x00000002
+#define MOVEFILE_WRITE_THROUGH    0x00000008
+
+#define SYMBOLIC_LINK_FLAG_DIRECTORY 0x1
+
+#define FILE_NAME_NORMALIZED 0x0
+#define FILE_NAME_OPENED     0x8
+#define VOLUME_NAME_DOS      0x0
+#define VOLUME_NAME_GUID     0x1
+#define VOLUME_NAME_NT       0x2
+#define VOLUME_NAME_NONE     0x4
+
+#define IO_REPARSE_TAG_MOUNT_POINT 0xA0000003
+#define IO_REPARSE_TAG_SYMLINK     0xA000000C
+#define MAXIMUM_REPARSE_DATA_BUFFER_SIZE (16 * 1024)
+
+#define PAGE_READONLY 0x02
+#define FILE_MAP_READ 0x04
+
+#define CP_ACP        0
+#define CP_THREAD_ACP 3
+#define CP_UTF8       65001
+
+#define THREAD_MODE_BACKGROUND_BEGIN 0x00010000
+#define THREAD_MODE_BACKGROUND_END   0x00020000
+
+#define WAIT_OBJECT_0 0
+#define WAIT_FAILED   ((DWORD) 0xFFFFFFFF)
+
+#define ERROR_SUCCESS               0
+#define ERROR_INVALID_FUNCTION      1
+#define ERROR_FILE_NOT_FOUND        2
+#define ERROR_PATH_NOT_FOUND        3
+#define ERROR_TOO_MANY_OPEN_FILES   4
+#define ERROR_ACCESS_DENIED         5
+#define ERROR_INVALID_HANDLE        6
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_OUTOFMEMORY           14
+#define ERROR_INVALID_DRIVE         15
+#define ERROR_CURRENT_DIRECTORY     16
+#define ERROR_NOT_SAME_DEVICE       17
+#define ERROR_NO_MORE_FILES         18
+#define ERROR_WRITE_PROTECT         19
+#define ERROR_SHARING_VIOLATION     32
+#define ERROR_LOCK_VIOLATION        33
+#define ERROR_HANDLE_EOF            38
+#define ERROR_NOT_SUPPORTED         50
+#define ERROR_BAD_NETPATH           53
+#define ERROR_FILE_EXISTS           80
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_BROKEN_PIPE           109
+#define ERROR_DISK_FULL             112
+#define ERROR_INSUFFICIENT_BUFFER   122
+#define ERROR_INVALID_NAME          123
+#define ERROR_NEGATIVE_SEEK         131
+#define ERROR_DIR_NOT_EMPTY         145
+#define ERROR_BAD_PATHNAME          161
+#define ERROR_ALREADY_EXISTS        183
+#define ERROR_THREAD_MODE_ALREADY_BACKGROUND 400
+#define ERROR_THREAD_MODE_NOT_BACKGROUND     401
+#define ERROR_FILENAME_EXCED_RANGE  206
+#define ERROR_MORE_DATA             234
+#define ERROR_DIRECTORY             267
+#define ERROR_NOT_A_REPARSE_POINT   4390
+#define ERROR_INVALID_REPARSE_DATA  4392
+#define ERROR_REPARSE_TAG_INVALID   4393
+#define ERROR_REPARSE_TAG_MISMATCH  4394
+#define ERROR_CANT_RESOLVE_FILENAME 1921
+#define ERROR_NO_UNICODE_TRANSLATION 1113
+#define ERROR_TIMEOUT               1460
+#define ERROR_TOO_MANY_LINKS        1142
+#define ERROR_PRIVILEGE_NOT_HELD    1314
+
+DWORD GetLastError (void);
+void SetLastError (DWORD err);
+
+/* Host files: manifests and temporary files, not the tree (see fsbackend.h) */
+HANDLE CreateFileW (LPCWSTR path, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES sa, DWORD disposition, DWORD flags, HANDLE templ);
+BOOL CloseHandle (HANDLE handle);
+BOOL GetFileSizeEx (HANDLE handle, LARGE_INTEGER *size);
+HANDLE CreateFileMappingW (HANDLE file, LPSECURITY_ATTRIBUTES sa, DWORD protect, DWORD sizehigh, DWORD sizelow, LPCWSTR name);
+LPVOID MapViewOfFile (HANDLE mapping, DWORD access, DWORD offhigh, DWORD offlow, SIZE_T size);
+BOOL UnmapViewOfFile (LPCVOID addr);
+DWORD GetTempPathW (DWORD size, LPWSTR buf);
+UINT GetTempFileNameW (LPCWSTR dir, LPCWSTR prefix, UINT unique, LPWSTR buf);
+
+int MultiByteToWideChar (UINT cp, DWORD flags, LPCSTR str, int len, LPWSTR wstr, int wlen);
+int WideCharToMultiByte (UINT cp, DWORD flags, LPCWSTR wstr, int wlen, LPSTR str, int len, LPCSTR defchar, BOOL *useddef);
+
+HMODULE GetModuleHandleW (LPCWSTR name);
+FARPROC GetProcAddress (HMODULE module, LPCSTR name);
+HANDLE LocalFree (HANDLE mem);
+
+HANDLE CreateThread (LPSECURITY_ATTRIBUTES sa, SIZE_T stack, LPTHREAD_START_ROUTINE func, LPVOID arg, DWORD flags, LPDWORD id);
+DWORD WaitForSingleObject (HANDLE handle, DWORD timeout);
+DWORD GetCurrentThreadId (void);
+HANDLE GetCurrentThread (void);
+BOOL SetThreadPriority (HANDLE thread, int priority);
+void Sleep (DWORD msec);
+void GetSystemInfo (SYSTEM_INFO *info);
+BOOL QueryPerformanceCounter (LARGE_INTEGER *count);
+BOOL QueryPerformanceFrequency (LARGE_INTEGER *freq);
+
+void InitializeCriticalSection (LPCRITICAL_SECTION cs);
+void DeleteCriticalSection (LPCRITICAL_SECTION cs);
+void EnterCriticalSection (LPCRITICAL_SECTION cs);
+void LeaveCriticalSection (LPCRITICAL_SECTION cs);
+void InitializeSRWLock (PSRWLOCK lock);
+void AcquireSRWLockExclusive (PSRWLOCK lock);
+void ReleaseSRWLockExclusive (PSRWLOCK lock);
+void AcquireSRWLockShared (PSRWLOCK lock);
+void ReleaseSRWLockShared (PSRWLOCK lock);
+void InitializeConditionVariable (PCONDITION_VARIABLE cv);
+BOOL SleepConditionVariableCS (PCONDITION_VARIABLE cv, LPCRITICAL_SECTION cs, DWORD timeout);
+void WakeConditionVariable (PCONDITION_VARIABLE cv);
+void WakeAllConditionVariable (PCONDITION_VARIABLE cv);
+DWORD FlsAlloc (PFLS_CALLBACK_FUNCTION callback);
+PVOID FlsGetValue (DWORD index);
+BOOL FlsSetValue (DWORD index, PVOID value);
+BOOL FlsFree (DWORD index);
+
+#define InterlockedIncrement(p) __sync_add_and_fetch ((p), 1)
+#define InterlockedDecrement(p) __sync_sub_and_fetch ((p), 1)
+#define InterlockedExchangeAdd(p, v) __sync_fetch_and_add ((p), (v))
+#define InterlockedExchange(p, v) __atomic_exchange_n ((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, x, c) __sync_val_compare_and_swap ((p), (c), (x))
+#define InterlockedCompareExchangePointer(p, x, c) __sync_val_compare_and_swap ((p), (c), (x))
+#define InterlockedExchangeAdd64(p, v) __sync_fetch_and_add ((p), (v))
+#define InterlockedCompareExchange64(p, x, c) __sync_val_compare_and_swap ((p), (c), (x))
+#define MemoryBarrier() __sync_synchronize ()
+
+/* msvcrt */
+#define _O_BINARY 0x8000
+#define _S_IFMT  S_IFMT
+#define _S_IFDIR S_IFDIR
+#define _S_IFCHR S_IFCHR
+#define _S_IFREG S_IFREG
+
+FILE *_wfopen (const wchar_t *name, const wchar_t *mode);
+int _wstat (const wchar_t *path, struct stat *buf);
+int _wtoi (const wchar_t *s);
+int _setmode (int fd, int mode);
+#define _fileno fileno
+#define _stricmp strcasecmp
+int _wcsicmp (const wchar_t *a, const wchar_t *b);
+int _wcsnicmp (const wchar_t *a, const wchar_t *b, size_t n);
+#define wcsnicmp _wcsnicmp
+int _snwprintf (wchar_t *buf, size_t count, const wchar_t *format, ...);
+int _vsnwprintf (wchar_t *buf, size_t count, const wchar_t *format, va_list ap);
+int _vscwprintf (const wchar_t *format, va_list ap);
+int _vscprintf (const char *format, va_list ap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_COMPAT_WINDOWS_H__ */
@@ -0,0 +1,432 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <windows.h>
+
+#include "ctx.h"
+#include "alloc.h"
+#include "misc.h"
+#include "fsbackend.h"
+
+struct _ntlink_ctx
+{
+  /* Absolute, without a trailing separator unless it is a root */
+  wchar_t *basedir;
+  /* Not owned */
+  ntlink_realpath_cache *realpath_cache;
+  /* NTLINK_API_COUNT counters, NULL while statistics are disabled */
+  ntlink_stats_counter *api;
+  LONGLONG freq;
+  int err;
+  DWORD lasterr;
+};
+
+/* Length of the root of @path: "C:" or "\\server\share", 0 if none */
+static size_t
+ctx_root_length (const wchar_t *path)
+{
+  size_t i;
+  int seps = 0;
+  if (path[0] != L'\0' && path[1] == L':')
+    return 2;
+  if ((path[0] != L'\\' && path[0] != L'/') || (path[1] != L'\\' && path[1] != L'/'))
+    return 0;
+  for (i = 2; path[i] != L'\0'; i++)
+    if ((path[i] == L'\\' || path[i] == L'/') && ++seps == 2)
+      break;
+  return i;
+}
+
+static wchar_t *
+ctx_basedir_dup (const wchar_t *basedir)
+{
+  wchar_t *copy;
+  size_t len, root;
+
+  if (basedir == NULL || !IsAbsName ((wchar_t *) basedir))
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  copy = ntlink_wcsdup (basedir);
+  if (copy == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  len = wcslen (copy);
+  root = ctx_root_length (copy);
+  /* Keep the separator of "C:\" */
+  if (copy[1] == L':')
+    root += 1;
+  while (len > root && (copy[len - 1] == L'\\' || copy[len - 1] == L'/'))
+    copy[--len] = L'\0';
+  return copy;
+}
+
+/**
+ * ntlink_ctx_new:
+ * @basedir: absolute name of the directory relative names are resolved
+ *   against, or NULL for the current directory (at the time of the call)
+ *
+ * Creates a context for the ntlink_ctx_*() functions, see ntlink_ctx.
+ * Free it with ntlink_ctx_free().
+ *
+ * Returns:
+ * NULL - failed (errno is set: EINVAL if @basedir is not absolute,
+ *   ENOMEM, or the error of GetCurrentDirectoryW())
+ * non-NULL - the context
+ */
+ntlink_ctx *
+ntlink_ctx_new (const wchar_t *basedir)
+{
+  ntlink_ctx *ctx;
+  wchar_t cwd[MAX_PATH];
+  LARGE_INTEGER freq;
+
+  if (basedir == NULL)
+  {
+    DWORD len = ntlink_fs->get_current_directory (MAX_PATH, cwd);
+    if (len == 0 || len >= MAX_PATH)
+    {
+      errno = len == 0 ? Win32ErrorToErrno (GetLastError ()) : ENAMETOOLONG;
+      return NULL;
+    }
+    basedir = cwd;
+  }
+
+  ctx = (ntlink_ctx *) ntlink_calloc (1, sizeof (ntlink_ctx));
+  if (ctx == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  ctx->basedir = ctx_basedir_dup (basedir);
+  if (ctx->basedir == NULL)
+  {
+    ntlink_free (ctx);
+    return NULL;
+  }
+  QueryPerformanceFrequency (&freq);
+  ctx->freq = freq.QuadPart > 0 ? freq.QuadPart : 1;
+  return ctx;
+}
+
+/**
+ * ntlink_ctx_free:
+ * @ctx: a context, can be NULL
+ *
+ * Frees @ctx. The realpath cache given to ntlink_ctx_set_realpath_cache()
+ * is not freed.
+ */
+void
+ntlink_ctx_free (ntlink_ctx *ctx)
+{
+  if (ctx == NULL)
+    return;
+  ntlink_free (ctx->basedir);
+  ntlink_free (ctx->api);
+  ntlink_free (ctx);
+}
+
+/**
+ * ntlink_ctx_set_basedir:
+ * @ctx: a context
+ * @basedir: absolute name of the new base directory
+ *
+ * Makes @ctx resolve relative names against @basedir, the equivalent of
+ * changing the current directory. The directory does not have to exist.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set: EINVAL if @ctx is NULL or @basedir is not
+ *      absolute, ENOMEM)
+ */
+int
+ntlink_ctx_set_basedir (ntlink_ctx *ctx, const wchar_t *basedir)
+{
+  wchar_t *copy;
+  if (ctx == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  copy = ctx_basedir_dup (basedir);
+  if (copy == NULL)
+    return -1;
+  ntlink_free (ctx->basedir);
+  ctx->basedir = copy;
+  return 0;
+}
+
+/**
+ * ntlink_ctx_get_basedir:
+ * @ctx: a context
+ *
+ * Returns:
+ * the base directory of @ctx, NULL for the default context
+ */
+const wchar_t *
+ntlink_ctx_get_basedir (const ntlink_ctx *ctx)
+{
+  return ctx != NULL ? ctx->basedir : NULL;
+}
+
+/**
+ * ntlink_ctx_set_realpath_cache:
+ * @ctx: a context
+ * @cache: a cache, or NULL for none
+ *
+ * Makes ntlink_ctx_realpathw() use @cache. Caches are thread-safe, so
+ * one cache can be given to the contexts of several threads. @ctx does
+ * not take ownership of @cache.
+ */
+void
+ntlink_ctx_set_realpath_cache (ntlink_ctx *ctx, ntlink_realpath_cache *cache)
+{
+  if (ctx != NULL)
+    ctx->realpath_cache = cache;
+}
+
+/**
+ * ntlink_ctx_get_realpath_cache:
+ * @ctx: a context
+ *
+ * Returns:
+ * the cache set with ntlink_ctx_set_realpath_cache(), or NULL
+ */
+ntlink_realpath_cache *
+ntlink_ctx_get_realpath_cache (const ntlink_ctx *ctx)
+{
+  return ctx != NULL ? ctx->realpath_cache : NULL;
+}
+
+/**
+ * ntlink_ctx_enable_stats:
+ * @ctx: a context
+ * @enable: non-zero to count the calls made through @ctx
+ *
+ * Starts or stops counting the calls made through @ctx, in addition to
+ * the process-wide counting of ntlink_stats_enable(). Stopping discards
+ * the counters.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set: EINVAL if @ctx is NULL, ENOMEM)
+ */
+int
+ntlink_ctx_enable_stats (ntlink_ctx *ctx, int enable)
+{
+  if (ctx == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!enable)
+  {
+    ntlink_free (ctx->api);
+    ctx->api = NULL;
+    return 0;
+  }
+  if (ctx->api != NULL)
+    return 0;
+  ctx->api = (ntlink_stats_counter *) ntlink_calloc (NTLINK_API_COUNT, sizeof (ntlink_stats_counter));
+  if (ctx->api == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * ntlink_ctx_get_stats:
+ * @ctx: a context
+ * @stats: receives the counters
+ *
+ * Copies the counters of the calls made through @ctx into @stats->api.
+ * Filesystem calls are only counted process-wide, @stats->os is zeroed.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - statistics are not enabled for @ctx (errno is EINVAL)
+ */
+int
+ntlink_ctx_get_stats (const ntlink_ctx *ctx, ntlink_stats *stats)
+{
+  if (ctx == NULL || ctx->api == NULL || stats == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  memset (stats, 0, sizeof (ntlink_stats));
+  memcpy (stats->api, ctx->api, sizeof (ntlink_stats_counter) * NTLINK_API_COUNT);
+  return 0;
+}
+
+/**
+ * ntlink_ctx_reset_stats:
+ * @ctx: a context
+ *
+ * Zeroes the counters of @ctx.
+ */
+void
+ntlink_ctx_reset_stats (ntlink_ctx *ctx)
+{
+  if (ctx != NULL && ctx->api != NULL)
+    memset (ctx->api, 0, sizeof (ntlink_stats_counter) * NTLINK_API_COUNT);
+}
+
+/**
+ * ntlink_ctx_errno:
+ * @ctx: a context
+ *
+ * Returns:
+ * errno after the last call through @ctx that failed, 0 if none did
+ */
+int
+ntlink_ctx_errno (const ntlink_ctx *ctx)
+{
+  return ctx != NULL ? ctx->err : 0;
+}
+
+/**
+ * ntlink_ctx_last_error:
+ * @ctx: a context
+ *
+ * Returns:
+ * the Win32 error after the last call through @ctx that failed
+ * (not every failure comes from Win32, see ntlink_ctx_errno())
+ */
+DWORD
+ntlink_ctx_last_error (const ntlink_ctx *ctx)
+{
+  return ctx != NULL ? ctx->lasterr : 0;
+}
+
+/**
+ * ntlink_ctx_begin:
+ * @ctx: a context or NULL
+ * @api: the function that is called
+ *
+ * ntlink_stats_begin() that also times the call when @ctx counts calls,
+ * and counts the memory allocated until ntlink_ctx_end() for @api.
+ *
+ * Returns:
+ * a value for ntlink_ctx_end() and ntlink_trace_call()
+ */
+LONGLONG
+ntlink_ctx_begin (ntlink_ctx *ctx, ntlink_stats_api api)
+{
+  LARGE_INTEGER now;
+  LONGLONG start = ntlink_stats_begin ();
+  ntlink_alloc_enter (api);
+  if (start != 0 || ctx == NULL || ctx->api == NULL)
+    return start;
+  QueryPerformanceCounter (&now);
+  return now.QuadPart;
+}
+
+/**
+ * ntlink_ctx_end:
+ * @ctx: a context or NULL
+ * @api: the function that was called
+ * @start: what ntlink_ctx_begin() returned
+ * @failed: non-zero if it failed
+ *
+ * ntlink_stats_end() that also counts the call in @ctx and remembers
+ * its error. Preserves errno and the last Win32 error.
+ */
+void
+ntlink_ctx_end (ntlink_ctx *ctx, ntlink_stats_api api, LONGLONG start, int failed)
+{
+  LARGE_INTEGER now;
+
+  ntlink_alloc_leave ();
+  ntlink_stats_end (api, start, failed);
+  if (ctx == NULL)
+    return;
+  if (failed)
+  {
+    ctx->err = errno;
+    ctx->lasterr = GetLastError ();
+  }
+  if (ctx->api == NULL || start == 0)
+    return;
+  QueryPerformanceCounter (&now);
+  ntlink_stats_counter_add (&ctx->api[api], now.QuadPart > start ?
+      (unsigned long long) (now.QuadPart - start) * 1000000000ULL / ctx->freq : 0, failed, 0);
+}
+
+/**
+ * ntlink_ctx_path:
+ * @ctx: a context or NULL
+ * @path: a name
+ * @allocated: receives the memory to ntlink_free() afterwards, or NULL
+ *
+ * Makes @path absolute by prepending the base directory of @ctx.
+ * "\name" is taken from the root of the base directory, and "X:name"
+ * from the base directory only if it is on drive X. Absolute names,
+ * other drive-relative names and all names given to the default context
+ * are returned as they are.
+ *
+ * Returns:
+ * the name to use, NULL if out of memory (errno is set)
+ */
+const wchar_t *
+ntlink_ctx_path (const ntlink_ctx *ctx, const wchar_t *path, wchar_t **allocated)
+{
+  size_t baselen, len;
+  wchar_t *result;
+
+  *allocated = NULL;
+  if (ctx == NULL || path == NULL || IsAbsName ((wchar_t *) path))
+    return path;
+
+  baselen = wcslen (ctx->basedir);
+  if (path[0] == L'\\' || path[0] == L'/')
+    baselen = ctx_root_length (ctx->basedir);
+  else if (path[0] != L'\0' && path[1] == L':')
+  {
+    if (ctx->basedir[1] != L':' || towupper (path[0]) != towupper (ctx->basedir[0]))
+      return path;
+    path += 2;
+  }
+
+  len = baselen + 1 + wcslen (path) + 1;
+  result = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * len);
+  if (result == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memcpy (result, ctx->basedir, sizeof (wchar_t) * baselen);
+  len = baselen;
+  if (path[0] != L'\\' && path[0] != L'/' && path[0] != L'\0' &&
+      (len == 0 || (result[len - 1] != L'\\' && result[len - 1] != L'/')))
+    result[len++] = L'\\';
+  wcscpy (&result[len], path);
+  *allocated = result;
+  return result;
+}
@@ -0,0 +1,90 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_CTX_H__
+#define __NTLINK_CTX_H__
+
+#include <windows.h>
+
+#include "quasisymlink.h"
+#include "realpath.h"
+#include "removetree.h"
+#include "walk.h"
+#include "stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ntlink_ctx:
+ *
+ * State for the ntlink_ctx_*() functions: the base directory relative
+ * names are resolved against (instead of the process current directory),
+ * a realpath cache, per-context call statistics and the error of the
+ * last failed call.
+ *
+ * A context must not be used by two threads at once; give each thread
+ * its own. Threads with their own contexts share nothing in the library
+ * (the process-wide statistics and the trace are kept per thread or
+ * appended under a short lock), so they only wait for each other in the
+ * filesystem.
+ *
+ * A NULL context is the default one: relative names are resolved against
+ * the process current directory, no cache is used unless asked for and
+ * nothing is recorded. The functions without a context use it, and can
+ * be called from any thread.
+ */
+typedef struct _ntlink_ctx ntlink_ctx;
+
+ntlink_ctx *ntlink_ctx_new (const wchar_t *basedir);
+void ntlink_ctx_free (ntlink_ctx *ctx);
+int ntlink_ctx_set_basedir (ntlink_ctx *ctx, const wchar_t *basedir);
+const wchar_t *ntlink_ctx_get_basedir (const ntlink_ctx *ctx);
+void ntlink_ctx_set_realpath_cache (ntlink_ctx *ctx, ntlink_realpath_cache *cache);
+ntlink_realpath_cache *ntlink_ctx_get_realpath_cache (const ntlink_ctx *ctx);
+int ntlink_ctx_enable_stats (ntlink_ctx *ctx, int enable);
+int ntlink_ctx_get_stats (const ntlink_ctx *ctx, ntlink_stats *stats);
+void ntlink_ctx_reset_stats (ntlink_ctx *ctx);
+int ntlink_ctx_errno (const ntlink_ctx *ctx);
+DWORD ntlink_ctx_last_error (const ntlink_ctx *ctx);
+
+int ntlink_ctx_symlinkw (ntlink_ctx *ctx, const wchar_t *path1, const wchar_t *path2);
+int ntlink_ctx_blind_symlinkw (ntlink_ctx *ctx, const wchar_t *path1, const wchar_t *path2, SymlinkBlindType blindtype);
+int ntlink_ctx_symlink_batchw (ntlink_ctx *ctx, SymlinkBatchItem *items, size_t nitems, int nthreads, SymlinkBatchFlags flags);
+int ntlink_ctx_linkw (ntlink_ctx *ctx, const wchar_t *path1, const wchar_t *path2);
+int ntlink_ctx_lstatw (ntlink_ctx *ctx, const wchar_t *path, struct stat *buf);
+int ntlink_ctx_statxw (ntlink_ctx *ctx, const wchar_t *path, StatxFlags flags, unsigned int mask, ntlink_statx *buf);
+ssize_t ntlink_ctx_readlinkw (ntlink_ctx *ctx, const wchar_t *path, wchar_t *buf, size_t bufsize);
+int ntlink_ctx_unlinkw (ntlink_ctx *ctx, const wchar_t *path);
+int ntlink_ctx_renamew (ntlink_ctx *ctx, const wchar_t *path1, const wchar_t *path2);
+int ntlink_ctx_realpathw (ntlink_ctx *ctx, const wchar_t *path, wchar_t **resolved, RealpathFlags flags);
+int ntlink_ctx_remove_treew (ntlink_ctx *ctx, const wchar_t *path, RemoveTreeOptions *options);
+walk_iteratorw *ntlink_ctx_walk_allocw (ntlink_ctx *ctx, wchar_t *wdir, unsigned flags);
+
+/* Used by the library to implement the functions above */
+LONGLONG ntlink_ctx_begin (ntlink_ctx *ctx, ntlink_stats_api api);
+void ntlink_ctx_end (ntlink_ctx *ctx, ntlink_stats_api api, LONGLONG start, int failed);
+const wchar_t *ntlink_ctx_path (const ntlink_ctx *ctx, const wchar_t *path, wchar_t **allocated);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_CTX_H__ */
@@ -0,0 +1,534 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <errno.h>
+
+#include "misc.h"
+#include "dircache.h"
+#include "fsbackend.h"
+#include "alloc.h"
+
+#ifndef FIND_FIRST_EX_LARGE_FETCH
+#define FIND_FIRST_EX_LARGE_FETCH 2
+#endif
+
+typedef enum
+{
+  DIRCACHE_UNKNOWN = 0,
+  /* listed, names are in the set */
+  DIRCACHE_LOADED,
+  /* does not exist, or is not a directory */
+  DIRCACHE_MISSING,
+  /* is a link, or there are links on the way to it */
+  DIRCACHE_LINKED,
+  /* could not be listed, see error */
+  DIRCACHE_FAILED
+} DircacheState;
+
+typedef struct
+{
+  /* NULL if the slot is free */
+  wchar_t *name;
+  size_t len;
+  ULONG hash;
+  DWORD attributes;
+} dircache_name;
+
+struct _dircache_dir
+{
+  struct _dircache_dir *next;
+  ULONG hash;
+  wchar_t *path;
+  size_t pathlen;
+  SRWLOCK lock;
+  DircacheState state;
+  int error;
+  /* Open addressing set of names, nslots is a power of 2 */
+  dircache_name *slots;
+  size_t nslots;
+  size_t nnames;
+};
+
+typedef struct _dircache_dir dircache_dir;
+
+struct _ntlink_dircache
+{
+  SRWLOCK lock;
+  size_t nbuckets;
+  size_t ndirs;
+  dircache_dir **buckets;
+};
+
+static ULONG
+dircache_hash (const wchar_t *s, size_t len)
+{
+  /* FNV-1a over upper-cased characters, names are case-insensitive */
+  ULONG h = 2166136261U;
+  size_t i;
+  for (i = 0; i < len; i++)
+  {
+    h ^= (ULONG) towupper (s[i]);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+static int
+dircache_equal (const wchar_t *a, size_t alen, const wchar_t *b, size_t blen)
+{
+  size_t i;
+  if (alen != blen)
+    return 0;
+  for (i = 0; i < alen; i++)
+    if (a[i] != b[i] && towupper (a[i]) != towupper (b[i]))
+      return 0;
+  return 1;
+}
+
+static int
+is_separator (wchar_t c)
+{
+  return c == L'\\' || c == L'/';
+}
+
+/*
+ * A directory that is not looked up in its parent: "" (the current
+ * directory), "X:", "X:\" and "\".
+ */
+static int
+is_root (const wchar_t *path, size_t len)
+{
+  if (len == 0 || is_separator (path[len - 1]))
+    return 1;
+  return len == 2 && path[1] == L':';
+}
+
+/*
+ * Splits @path (of @len characters) into the directory and the name.
+ * Trailing separators are ignored. The directory keeps its separator if
+ * it is a root ("C:\", "\").
+ */
+static void
+split_path (const wchar_t *path, size_t len, size_t *dirlen, size_t *nameoff, size_t *namelen)
+{
+  size_t k;
+  while (len > 0 && is_separator (path[len - 1]))
+    len--;
+  for (k = len; k > 0 && !is_separator (path[k - 1]); k--);
+  *nameoff = k;
+  *namelen = len - k;
+  if (k == 0)
+    *dirlen = 0;
+  else if (k == 1 || (k == 3 && path[1] == L':'))
+    *dirlen = k;
+  else
+    *dirlen = k - 1;
+}
+
+static int
+name_insert (dircache_dir *dir, const wchar_t *name, size_t len, DWORD attributes)
+{
+  ULONG hash = dircache_hash (name, len);
+  size_t slot;
+
+  if ((dir->nnames + 1) * 2 > dir->nslots)
+  {
+    size_t newslots = dir->nslots == 0 ? 16 : dir->nslots * 2, i;
+    dircache_name *slots = (dircache_name *) ntlink_calloc (newslots, sizeof (dircache_name));
+    if (slots == NULL)
+      return -1;
+    for (i = 0; i < dir->nslots; i++)
+    {
+      if (dir->slots[i].name == NULL)
+        continue;
+      for (slot = dir->slots[i].hash & (newslots - 1); slots[slot].name != NULL; slot = (slot + 1) & (newslots - 1));
+      slots[slot] = dir->slots[i];
+    }
+    ntlink_free (dir->slots);
+    dir->slots = slots;
+    dir->nslots = newslots;
+  }
+
+  for (slot = hash & (dir->nslots - 1); dir->slots[slot].name != NULL; slot = (slot + 1) & (dir->nslots - 1))
+  {
+    if (dir->slots[slot].hash == hash && dircache_equal (dir->slots[slot].name, dir->slots[slot].len, name, len))
+    {
+      dir->slots[slot].attributes = attributes;
+      return 0;
+    }
+  }
+  dir->slots[slot].name = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (len + 1));
+  if (dir->slots[slot].name == NULL)
+    return -1;
+  memcpy (dir->slots[slot].name, name, sizeof (wchar_t) * len);
+  dir->slots[slot].name[len] = L'\0';
+  dir->slots[slot].len = len;
+  dir->slots[slot].hash = hash;
+  dir->slots[slot].attributes = attributes;
+  dir->nnames += 1;
+  return 0;
+}
+
+static dircache_name *
+name_find (dircache_dir *dir, const wchar_t *name, size_t len)
+{
+  ULONG hash;
+  size_t slot;
+  if (dir->nslots == 0)
+    return NULL;
+  hash = dircache_hash (name, len);
+  for (slot = hash & (dir->nslots - 1); dir->slots[slot].name != NULL; slot = (slot + 1) & (dir->nslots - 1))
+    if (dir->slots[slot].hash == hash && dircache_equal (dir->slots[slot].name, dir->slots[slot].len, name, len))
+      return &dir->slots[slot];
+  return NULL;
+}
+
+/* Finds the entry of a directory, creating it if necessary */
+static dircache_dir *
+get_dir (ntlink_dircache *cache, const wchar_t *path, size_t len)
+{
+  ULONG hash = dircache_hash (path, len);
+  dircache_dir *dir;
+
+  AcquireSRWLockShared (&cache->lock);
+  for (dir = cache->buckets[hash & (cache->nbuckets - 1)]; dir != NULL; dir = dir->next)
+    if (dir->hash == hash && dircache_equal (dir->path, dir->pathlen, path, len))
+      break;
+  ReleaseSRWLockShared (&cache->lock);
+  if (dir != NULL)
+    return dir;
+
+  AcquireSRWLockExclusive (&cache->lock);
+  for (dir = cache->buckets[hash & (cache->nbuckets - 1)]; dir != NULL; dir = dir->next)
+    if (dir->hash == hash && dircache_equal (dir->path, dir->pathlen, path, len))
+      break;
+  if (dir == NULL)
+  {
+    if (cache->ndirs >= cache->nbuckets * 2)
+    {
+      size_t newbuckets = cache->nbuckets * 4, i;
+      dircache_dir **buckets = (dircache_dir **) ntlink_calloc (newbuckets, sizeof (dircache_dir *));
+      if (buckets != NULL)
+      {
+        for (i = 0; i < cache->nbuckets; i++)
+        {
+          while (cache->buckets[i] != NULL)
+          {
+            dircache_dir *d = cache->buckets[i];
+            cache->buckets[i] = d->next;
+            d->next = buckets[d->hash & (newbuckets - 1)];
+            buckets[d->hash & (newbuckets - 1)] = d;
+          }
+        }
+        ntlink_free (cache->buckets);
+        cache->buckets = buckets;
+        cache->nbuckets = newbuckets;
+      }
+    }
+    dir = (dircache_dir *) ntlink_calloc (1, sizeof (dircache_dir));
+    if (dir != NULL)
+      dir->path = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (len + 1));
+    if (dir == NULL || dir->path == NULL)
+    {
+      ntlink_free (dir);
+      dir = NULL;
+    }
+    else
+    {
+      memcpy (dir->path, path, sizeof (wchar_t) * len);
+      dir->path[len] = L'\0';
+      dir->pathlen = len;
+      dir->hash = hash;
+      InitializeSRWLock (&dir->lock);
+      dir->next = cache->buckets[hash & (cache->nbuckets - 1)];
+      cache->buckets[hash & (cache->nbuckets - 1)] = dir;
+      cache->ndirs += 1;
+    }
+  }
+  ReleaseSRWLockExclusive (&cache->lock);
+  return dir;
+}
+
+static int lookup (ntlink_dircache *cache, const wchar_t *dirpath, size_t dirlen, const wchar_t *name, size_t namelen, DWORD *attributes);
+
+/* Called with the exclusive lock of @dir held */
+static void
+load_dir (ntlink_dircache *cache, dircache_dir *dir)
+{
+  WIN32_FIND_DATAW finddata;
+  wchar_t *pattern;
+  HANDLE h;
+  size_t len = dir->pathlen;
+
+  /* A directory is trusted only if its parent is, and if it is
+   * a real directory in the parent's listing.
+   */
+  if (!is_root (dir->path, len))
+  {
+    size_t dirlen, nameoff, namelen;
+    DWORD attributes = 0;
+    int r;
+    split_path (dir->path, len, &dirlen, &nameoff, &namelen);
+    r = lookup (cache, dir->path, dirlen, &dir->path[nameoff], namelen, &attributes);
+    if (r == -2 || (r == 1 && (attributes & FILE_ATTRIBUTE_REPARSE_POINT)))
+    {
+      dir->state = DIRCACHE_LINKED;
+      return;
+    }
+    else if (r == 0 || (r == 1 && !(attributes & FILE_ATTRIBUTE_DIRECTORY)))
+    {
+      dir->state = DIRCACHE_MISSING;
+      return;
+    }
+    else if (r < 0)
+    {
+      dir->state = DIRCACHE_FAILED;
+      dir->error = errno;
+      return;
+    }
+  }
+
+  pattern = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (len + 3));
+  if (pattern == NULL)
+  {
+    dir->state = DIRCACHE_FAILED;
+    dir->error = ENOMEM;
+    return;
+  }
+  memcpy (pattern, dir->path, sizeof (wchar_t) * len);
+  if (len > 0 && !is_separator (dir->path[len - 1]) && dir->path[len - 1] != L':')
+    pattern[len++] = L'\\';
+  pattern[len++] = L'*';
+  pattern[len] = L'\0';
+
+  h = ntlink_fs->find_first_file_ex (pattern, FindExInfoBasic, &finddata, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+  /* Basic info and large fetches are not available before Windows 7 */
+  if (h == INVALID_HANDLE_VALUE && GetLastError () == ERROR_INVALID_PARAMETER)
+    h = ntlink_fs->find_first_file_ex (pattern, FindExInfoStandard, &finddata, FindExSearchNameMatch, NULL, 0);
+  ntlink_free (pattern);
+  if (h == INVALID_HANDLE_VALUE)
+  {
+    DWORD err = GetLastError ();
+    if (err == ERROR_FILE_NOT_FOUND)
+      dir->state = DIRCACHE_LOADED;
+    else if (err == ERROR_PATH_NOT_FOUND || err == ERROR_DIRECTORY)
+      dir->state = DIRCACHE_MISSING;
+    else
+    {
+      dir->state = DIRCACHE_FAILED;
+      dir->error = Win32ErrorToErrno (err);
+    }
+    return;
+  }
+  do
+  {
+    DWORD attributes = finddata.dwFileAttributes;
+    if (wcscmp (finddata.cFileName, L".") == 0 || wcscmp (finddata.cFileName, L"..") == 0)
+      continue;
+    /* Other reparse points (dedup, cloud files...) are ordinary files and directories here */
+    if ((attributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+        finddata.dwReserved0 != IO_REPARSE_TAG_SYMLINK && finddata.dwReserved0 != IO_REPARSE_TAG_MOUNT_POINT)
+      attributes &= ~FILE_ATTRIBUTE_REPARSE_POINT;
+    if (name_insert (dir, finddata.cFileName, wcslen (finddata.cFileName), attributes) != 0)
+    {
+      dir->state = DIRCACHE_FAILED;
+      dir->error = ENOMEM;
+      ntlink_fs->find_close (h);
+      return;
+    }
+  } while (ntlink_fs->find_next_file (h, &finddata));
+  ntlink_fs->find_close (h);
+  dir->state = DIRCACHE_LOADED;
+}
+
+/*
+ * Looks @name up in the directory @dirpath, listing the directory
+ * (and checking the directories on the way to it) the first time.
+ */
+static int
+lookup (ntlink_dircache *cache, const wchar_t *dirpath, size_t dirlen, const wchar_t *name, size_t namelen, DWORD *attributes)
+{
+  dircache_dir *dir = get_dir (cache, dirpath, dirlen);
+  dircache_name *n;
+  int r;
+
+  if (dir == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  AcquireSRWLockShared (&dir->lock);
+  if (dir->state == DIRCACHE_UNKNOWN)
+  {
+    ReleaseSRWLockShared (&dir->lock);
+    AcquireSRWLockExclusive (&dir->lock);
+    if (dir->state == DIRCACHE_UNKNOWN)
+      load_dir (cache, dir);
+    ReleaseSRWLockExclusive (&dir->lock);
+    AcquireSRWLockShared (&dir->lock);
+  }
+  switch (dir->state)
+  {
+  case DIRCACHE_LOADED:
+    n = name_find (dir, name, namelen);
+    r = n != NULL;
+    if (n != NULL && attributes != NULL)
+      *attributes = n->attributes;
+    break;
+  case DIRCACHE_LINKED:
+    r = -2;
+    break;
+  case DIRCACHE_MISSING:
+    r = 0;
+    break;
+  default:
+    errno = dir->error;
+    r = -1;
+    break;
+  }
+  ReleaseSRWLockShared (&dir->lock);
+  return r;
+}
+
+/**
+ * ntlink_dircache_new:
+ *
+ * Creates a cache of directory listings for ntlink_dircache_exists().
+ * Each directory is listed once, the first time a name in it is looked up.
+ * The cache is thread-safe. It only learns about changes made through
+ * ntlink_dircache_add(), so it is meant for short-lived jobs that create
+ * many files or links (e.g. a restore), not as a general-purpose cache.
+ *
+ * Returns:
+ * NULL - failed to allocate memory
+ * non-NULL - the cache, free it with ntlink_dircache_free()
+ */
+ntlink_dircache *
+ntlink_dircache_new (void)
+{
+  ntlink_dircache *cache = (ntlink_dircache *) ntlink_calloc (1, sizeof (ntlink_dircache));
+  if (cache == NULL)
+    return NULL;
+  cache->nbuckets = 64;
+  cache->buckets = (dircache_dir **) ntlink_calloc (cache->nbuckets, sizeof (dircache_dir *));
+  if (cache->buckets == NULL)
+  {
+    ntlink_free (cache);
+    return NULL;
+  }
+  InitializeSRWLock (&cache->lock);
+  return cache;
+}
+
+void
+ntlink_dircache_free (ntlink_dircache *cache)
+{
+  size_t i, j;
+  if (cache == NULL)
+    return;
+  for (i = 0; i < cache->nbuckets; i++)
+  {
+    while (cache->buckets[i] != NULL)
+    {
+      dircache_dir *dir = cache->buckets[i];
+      cache->buckets[i] = dir->next;
+      for (j = 0; j < dir->nslots; j++)
+        ntlink_free (dir->slots[j].name);
+      ntlink_free (dir->slots);
+      ntlink_free (dir->path);
+      ntlink_free (dir);
+    }
+  }
+  ntlink_free (cache->buckets);
+  ntlink_free (cache);
+}
+
+/**
+ * ntlink_dircache_exists:
+ * @cache: a cache
+ * @path: a path, absolute or relative to the current directory
+ * @attributes: receives the attributes of @path if it exists (can be NULL).
+ *   FILE_ATTRIBUTE_REPARSE_POINT is only set for symlinks and junctions.
+ *
+ * Same as PathExistsW (@path, ..., PATH_EXISTS_FLAG_DONT_FOLLOW_SYMLINKS),
+ * but the directory of @path is listed only once per @cache, and all checks
+ * after that (including the checks for links on the way to @path) are
+ * in-memory lookups. Names are compared case-insensitively.
+ *
+ * Returns:
+ * -2 - there are symlinks or junctions on the way to @path
+ * -1 - failed to list a directory (errno is set)
+ *  0 - @path does not exist
+ *  1 - @path exists
+ */
+int
+ntlink_dircache_exists (ntlink_dircache *cache, const wchar_t *path, DWORD *attributes)
+{
+  size_t len = wcslen (path), dirlen, nameoff, namelen;
+
+  split_path (path, len, &dirlen, &nameoff, &namelen);
+  if (namelen == 0)
+  {
+    /* A root, nothing to look it up in */
+    DWORD attrs = ntlink_fs->get_file_attributes (path);
+    if (attrs == INVALID_FILE_ATTRIBUTES)
+      return 0;
+    if (attributes != NULL)
+      *attributes = attrs;
+    return 1;
+  }
+  return lookup (cache, path, dirlen, &path[nameoff], namelen, attributes);
+}
+
+/**
+ * ntlink_dircache_add:
+ * @cache: a cache
+ * @path: a file, directory or link that was just created
+ * @attributes: its attributes (FILE_ATTRIBUTE_REPARSE_POINT for links,
+ *   plus FILE_ATTRIBUTE_DIRECTORY for directory links and junctions)
+ *
+ * Tells the cache about a new name. Does nothing if the directory
+ * of @path was not listed yet (it will be listed when it's needed).
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+ntlink_dircache_add (ntlink_dircache *cache, const wchar_t *path, DWORD attributes)
+{
+  size_t len = wcslen (path), dirlen, nameoff, namelen;
+  dircache_dir *dir;
+  int r = 0;
+
+  split_path (path, len, &dirlen, &nameoff, &namelen);
+  if (namelen == 0)
+    return 0;
+  dir = get_dir (cache, path, dirlen);
+  if (dir == NULL)
+    return -1;
+  AcquireSRWLockExclusive (&dir->lock);
+  if (dir->state == DIRCACHE_LOADED)
+    r = name_insert (dir, &path[nameoff], namelen, attributes);
+  ReleaseSRWLockExclusive (&dir->lock);
+  return r;
+}
@@ -0,0 +1,41 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_DIRCACHE_H__
+#define __NTLINK_DIRCACHE_H__
+
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _ntlink_dircache ntlink_dircache;
+
+ntlink_dircache *ntlink_dircache_new (void);
+void ntlink_dircache_free (ntlink_dircache *cache);
+
+int ntlink_dircache_exists (ntlink_dircache *cache, const wchar_t *path, DWORD *attributes);
+int ntlink_dircache_add (ntlink_dircache *cache, const wchar_t *path, DWORD attributes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_DIRCACHE_H__ */
@@ -0,0 +1,249 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsbackend.h"
+#include "fssim.h"
+#include "stats.h"
+
+static const char *ntlink_fs_op_names[NTLINK_FS_OP_COUNT] =
+{
+  "CreateFile",
+  "CreateFileAt",
+  "CloseHandle",
+  "DeviceIoControl",
+  "GetFileInformationByHandle",
+  "GetFileInformationByHandleEx",
+  "SetFileInformationByHandle",
+  "GetFinalPathNameByHandle",
+  "FindFirstFile",
+  "FindFirstFileEx",
+  "FindNextFile",
+  "FindClose",
+  "GetFileAttributes",
+  "GetFileAttributesEx",
+  "CreateDirectory",
+  "RemoveDirectory",
+  "DeleteFile",
+  "MoveFileEx",
+  "CreateHardLink",
+  "CreateSymbolicLink",
+  "GetFullPathName",
+  "GetCurrentDirectory",
+};
+
+/**
+ * ntlink_fs_op_name:
+ * @op: a member of ntlink_fs_op
+ *
+ * Returns:
+ * the name of the Win32 function @op stands for, or NULL if @op is invalid
+ */
+const char *
+ntlink_fs_op_name (ntlink_fs_op op)
+{
+  if ((int) op < 0 || op >= NTLINK_FS_OP_COUNT)
+    return NULL;
+  return ntlink_fs_op_names[op];
+}
+
+#ifdef _WIN32
+
+/* Native API bits that are not available in all MinGW flavours */
+typedef struct
+{
+  USHORT Length;
+  USHORT MaximumLength;
+  wchar_t *Buffer;
+} ntlink_unicode_string;
+
+typedef struct
+{
+  ULONG Length;
+  HANDLE RootDirectory;
+  ntlink_unicode_string *ObjectName;
+  ULONG Attributes;
+  PVOID SecurityDescriptor;
+  PVOID SecurityQualityOfService;
+} ntlink_object_attributes;
+
+typedef struct
+{
+  union
+  {
+    LONG Status;
+    PVOID Pointer;
+  } u;
+  ULONG_PTR Information;
+} ntlink_io_status_block;
+
+typedef LONG (NTAPI *NtCreateFile_func) (HANDLE *, ACCESS_MASK, ntlink_object_attributes *,
+    ntlink_io_status_block *, LARGE_INTEGER *, ULONG, ULONG, ULONG, ULONG, PVOID, ULONG);
+typedef ULONG (NTAPI *RtlNtStatusToDosError_func) (LONG);
+
+#define NTLINK_OBJ_CASE_INSENSITIVE        0x00000040
+#define NTLINK_FILE_CREATE                 0x00000002
+#define NTLINK_FILE_DIRECTORY_FILE         0x00000001
+#define NTLINK_FILE_NON_DIRECTORY_FILE     0x00000040
+#define NTLINK_FILE_SYNCHRONOUS_IO_NONALERT 0x00000020
+#define NTLINK_FILE_OPEN_REPARSE_POINT     0x00200000
+
+static NtCreateFile_func ntlink_NtCreateFile = NULL;
+static RtlNtStatusToDosError_func ntlink_RtlNtStatusToDosError = NULL;
+
+static int
+load_ntdll (void)
+{
+  HMODULE ntdll;
+  if (ntlink_NtCreateFile != NULL && ntlink_RtlNtStatusToDosError != NULL)
+    return 0;
+  ntdll = GetModuleHandleW (L"ntdll.dll");
+  if (ntdll == NULL)
+    return -1;
+  /* Racing threads will store the same values, that is harmless */
+  ntlink_RtlNtStatusToDosError = (RtlNtStatusToDosError_func) GetProcAddress (ntdll, "RtlNtStatusToDosError");
+  ntlink_NtCreateFile = (NtCreateFile_func) GetProcAddress (ntdll, "NtCreateFile");
+  if (ntlink_NtCreateFile == NULL || ntlink_RtlNtStatusToDosError == NULL)
+    return -1;
+  return 0;
+}
+
+static HANDLE WINAPI
+win32_create_file_at (HANDLE dirhandle, LPCWSTR name, DWORD access, BOOL directory)
+{
+  ntlink_unicode_string uname;
+  ntlink_object_attributes oa;
+  ntlink_io_status_block iosb;
+  HANDLE fileh = NULL;
+  LONG status;
+  size_t namelen;
+
+  namelen = wcslen (name);
+  if (namelen * sizeof (wchar_t) > 0xFFFF)
+  {
+    SetLastError (ERROR_FILENAME_EXCED_RANGE);
+    return INVALID_HANDLE_VALUE;
+  }
+  if (load_ntdll () != 0)
+  {
+    SetLastError (ERROR_NOT_SUPPORTED);
+    return INVALID_HANDLE_VALUE;
+  }
+
+  uname.Buffer = (wchar_t *) name;
+  uname.Length = namelen * sizeof (wchar_t);
+  uname.MaximumLength = uname.Length;
+  memset (&oa, 0, sizeof (oa));
+  oa.Length = sizeof (oa);
+  oa.RootDirectory = dirhandle;
+  oa.ObjectName = &uname;
+  oa.Attributes = NTLINK_OBJ_CASE_INSENSITIVE;
+
+  status = ntlink_NtCreateFile (&fileh, access | SYNCHRONIZE,
+      &oa, &iosb, NULL, FILE_ATTRIBUTE_NORMAL, 0, NTLINK_FILE_CREATE,
+      (directory ? NTLINK_FILE_DIRECTORY_FILE : NTLINK_FILE_NON_DIRECTORY_FILE) |
+      NTLINK_FILE_SYNCHRONOUS_IO_NONALERT | NTLINK_FILE_OPEN_REPARSE_POINT, NULL, 0);
+  if (status < 0)
+  {
+    SetLastError (ntlink_RtlNtStatusToDosError (status));
+    return INVALID_HANDLE_VALUE;
+  }
+  return fileh;
+}
+
+/* CreateSymbolicLinkW() returns BOOLEAN, not BOOL */
+static BOOL WINAPI
+win32_create_symbolic_link (LPCWSTR link, LPCWSTR target, DWORD flags)
+{
+  return CreateSymbolicLinkW (link, target, flags) != 0;
+}
+
+/* FindFirstFileW() and friends take non-const pointers in some headers */
+static HANDLE WINAPI
+win32_find_first_file (LPCWSTR pattern, LPWIN32_FIND_DATAW data)
+{
+  return FindFirstFileW (pattern, data);
+}
+
+const ntlink_fs_backend ntlink_fs_win32 =
+{
+  "win32",
+  CreateFileW,
+  win32_create_file_at,
+  CloseHandle,
+  DeviceIoControl,
+  GetFileInformationByHandle,
+  GetFileInformationByHandleEx,
+  SetFileInformationByHandle,
+  GetFinalPathNameByHandleW,
+  win32_find_first_file,
+  FindFirstFileExW,
+  FindNextFileW,
+  FindClose,
+  GetFileAttributesW,
+  GetFileAttributesExW,
+  CreateDirectoryW,
+  RemoveDirectoryW,
+  DeleteFileW,
+  MoveFileExW,
+  CreateHardLinkW,
+  win32_create_symbolic_link,
+  GetFullPathNameW,
+  GetCurrentDirectoryW,
+};
+
+const ntlink_fs_backend *ntlink_fs = &ntlink_fs_win32;
+
+#else
+
+/* There is nothing but the simulator to run against */
+const ntlink_fs_backend *ntlink_fs = &ntlink_fssim_backend;
+
+#endif
+
+/**
+ * ntlink_fs_set:
+ * @backend: the backend to use from now on, or NULL for the default one
+ *
+ * Switches all filesystem calls to @backend. Not synchronized with
+ * calls in progress: switch before starting any work, and close all
+ * handles obtained from the old backend first. While statistics are
+ * enabled (see ntlink_stats_enable()) calls go to @backend through
+ * a backend that counts them.
+ *
+ * Returns:
+ * the previous backend
+ */
+const ntlink_fs_backend *
+ntlink_fs_set (const ntlink_fs_backend *backend)
+{
+  const ntlink_fs_backend *old = ntlink_stats_unwrap_backend (ntlink_fs);
+  if (backend == NULL)
+  {
+#ifdef _WIN32
+    backend = &ntlink_fs_win32;
+#else
+    backend = &ntlink_fssim_backend;
+#endif
+  }
+  ntlink_fs = ntlink_stats_wrap_backend (backend);
+  return old;
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_FSBACKEND_H__
+#define __NTLINK_FSBACKEND_H__
+
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ntlink_fs_op:
+ *
+ * One value per member of ntlink_fs_backend, used to index call counters
+ * and latencies (see fssim.h).
+ */
+typedef enum
+{
+  NTLINK_FS_CREATE_FILE = 0,
+  NTLINK_FS_CREATE_FILE_AT,
+  NTLINK_FS_CLOSE_HANDLE,
+  NTLINK_FS_DEVICE_IO_CONTROL,
+  NTLINK_FS_GET_FILE_INFORMATION_BY_HANDLE,
+  NTLINK_FS_GET_FILE_INFORMATION_BY_HANDLE_EX,
+  NTLINK_FS_SET_FILE_INFORMATION_BY_HANDLE,
+  NTLINK_FS_GET_FINAL_PATH_NAME_BY_HANDLE,
+  NTLINK_FS_FIND_FIRST_FILE,
+  NTLINK_FS_FIND_FIRST_FILE_EX,
+  NTLINK_FS_FIND_NEXT_FILE,
+  NTLINK_FS_FIND_CLOSE,
+  NTLINK_FS_GET_FILE_ATTRIBUTES,
+  NTLINK_FS_GET_FILE_ATTRIBUTES_EX,
+  NTLINK_FS_CREATE_DIRECTORY,
+  NTLINK_FS_REMOVE_DIRECTORY,
+  NTLINK_FS_DELETE_FILE,
+  NTLINK_FS_MOVE_FILE_EX,
+  NTLINK_FS_CREATE_HARD_LINK,
+  NTLINK_FS_CREATE_SYMBOLIC_LINK,
+  NTLINK_FS_GET_FULL_PATH_NAME,
+  NTLINK_FS_GET_CURRENT_DIRECTORY,
+  NTLINK_FS_OP_COUNT
+} ntlink_fs_op;
+
+/**
+ * ntlink_fs_backend:
+ * @name: backend name, for diagnostics
+ * @create_file_at: creates a new file (or a directory, if @directory is
+ *   TRUE) named @name in the directory @dirhandle was opened on, without
+ *   following reparse points, and opens it with @access. Fails with
+ *   ERROR_ALREADY_EXISTS if the name is taken.
+ *
+ * Every filesystem call the library and the tools make goes through
+ * this table. Other members have the signatures and the error
+ * reporting (return value + SetLastError()) of the Win32 functions
+ * they are named after. Handles are only meaningful to the backend
+ * that returned them.
+ * Files that are not part of the tree being worked on (manifests,
+ * temporary files) are accessed directly.
+ */
+typedef struct _ntlink_fs_backend ntlink_fs_backend;
+
+struct _ntlink_fs_backend
+{
+  const char *name;
+  HANDLE (WINAPI *create_file) (LPCWSTR path, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES sa, DWORD disposition, DWORD flags, HANDLE templ);
+  HANDLE (WINAPI *create_file_at) (HANDLE dirhandle, LPCWSTR name, DWORD access, BOOL directory);
+  BOOL (WINAPI *close_handle) (HANDLE handle);
+  BOOL (WINAPI *device_io_control) (HANDLE handle, DWORD code, LPVOID in, DWORD insize, LPVOID out, DWORD outsize, LPDWORD returned, LPOVERLAPPED overlapped);
+  BOOL (WINAPI *get_file_information_by_handle) (HANDLE handle, LPBY_HANDLE_FILE_INFORMATION info);
+  BOOL (WINAPI *get_file_information_by_handle_ex) (HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size);
+  BOOL (WINAPI *set_file_information_by_handle) (HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size);
+  DWORD (WINAPI *get_final_path_name_by_handle) (HANDLE handle, LPWSTR buf, DWORD size, DWORD flags);
+  HANDLE (WINAPI *find_first_file) (LPCWSTR pattern, LPWIN32_FIND_DATAW data);
+  HANDLE (WINAPI *find_first_file_ex) (LPCWSTR pattern, FINDEX_INFO_LEVELS level, LPVOID data, FINDEX_SEARCH_OPS search, LPVOID filter, DWORD flags);
+  BOOL (WINAPI *find_next_file) (HANDLE handle, LPWIN32_FIND_DATAW data);
+  BOOL (WINAPI *find_close) (HANDLE handle);
+  DWORD (WINAPI *get_file_attributes) (LPCWSTR path);
+  BOOL (WINAPI *get_file_attributes_ex) (LPCWSTR path, GET_FILEEX_INFO_LEVELS level, LPVOID data);
+  BOOL (WINAPI *create_directory) (LPCWSTR path, LPSECURITY_ATTRIBUTES sa);
+  BOOL (WINAPI *remove_directory) (LPCWSTR path);
+  BOOL (WINAPI *delete_file) (LPCWSTR path);
+  BOOL (WINAPI *move_file_ex) (LPCWSTR from, LPCWSTR to, DWORD flags);
+  BOOL (WINAPI *create_hard_link) (LPCWSTR link, LPCWSTR existing, LPSECURITY_ATTRIBUTES sa);
+  BOOL (WINAPI *create_symbolic_link) (LPCWSTR link, LPCWSTR target, DWORD flags);
+  DWORD (WINAPI *get_full_path_name) (LPCWSTR path, DWORD size, LPWSTR buf, LPWSTR *filepart);
+  DWORD (WINAPI *get_current_directory) (DWORD size, LPWSTR buf);
+};
+
+/* The backend in use. Never NULL */
+extern const ntlink_fs_backend *ntlink_fs;
+
+const ntlink_fs_backend *ntlink_fs_set (const ntlink_fs_backend *backend);
+const char *ntlink_fs_op_name (ntlink_fs_op op);
+
+#ifdef _WIN32
+extern const ntlink_fs_backend ntlink_fs_win32;
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_FSBACKEND_H__ */
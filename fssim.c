@@ -0,0 +1,2930 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * An in-memory filesystem with NTFS semantics, behind the ntlink_fs_backend
+ * interface: case-insensitive, case-preserving names, directories listed
+ * in NTFS collation order, reparse points (symlink and mount point
+ * buffers) that are followed by path lookup, hard links, file IDs,
+ * POSIX and delete-on-close deletion. Paths are Win32 paths ("C:\dir",
+ * relative to the simulated current directory, "\\?\" prefixes).
+ * File contents are not stored, only sizes.
+ * Every call is counted, and can be made to take a fixed time.
+ *
+ * Not modelled: share modes, security, timestamps from a real clock
+ * (a counter that advances on every change is used instead), short
+ * names, UNC paths, alternate data streams.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include <winioctl.h>
+
+#include "fssim.h"
+
+#ifndef FIND_FIRST_EX_LARGE_FETCH
+#define FIND_FIRST_EX_LARGE_FETCH 2
+#endif
+#ifndef SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE
+#define SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE 0x2
+#endif
+#ifndef ERROR_REPARSE_TAG_MISMATCH
+#define ERROR_REPARSE_TAG_MISMATCH 4394
+#endif
+#ifndef ERROR_TOO_MANY_LINKS
+#define ERROR_TOO_MANY_LINKS 1142
+#endif
+
+/* Information classes and flags that older headers don't have */
+#define FSSIM_FileAttributeTagInfo ((FILE_INFO_BY_HANDLE_CLASS) 9)
+#define FSSIM_FileIdInfo ((FILE_INFO_BY_HANDLE_CLASS) 18)
+#define FSSIM_FileDispositionInfoEx ((FILE_INFO_BY_HANDLE_CLASS) 21)
+#define FSSIM_DISPOSITION_DELETE 0x00000001
+#define FSSIM_DISPOSITION_POSIX_SEMANTICS 0x00000002
+#define FSSIM_DISPOSITION_IGNORE_READONLY 0x00000010
+#define FSSIM_SYMLINK_FLAG_RELATIVE 0x00000001
+
+typedef struct
+{
+  ULONGLONG VolumeSerialNumber;
+  BYTE FileId[16];
+} fssim_file_id_info;
+
+typedef struct
+{
+  DWORD FileAttributes;
+  DWORD ReparseTag;
+} fssim_attribute_tag_info;
+
+/* Like NTFS */
+#define FSSIM_MAX_NAME 255
+#define FSSIM_MAX_LINKS 1024
+#define FSSIM_MAX_REPARSE_HOPS 63
+#define FSSIM_CLUSTER 4096
+
+/* 2011-01-01 00:00:00 UTC */
+#define FSSIM_EPOCH 129383136000000000LL
+/* The clock advances by 1ms on every change */
+#define FSSIM_TICK 10000
+
+#define FSSIM_HANDLE_FILE 0x454C4946
+#define FSSIM_HANDLE_FIND 0x444E4946
+
+typedef struct _fssim_node fssim_node;
+typedef struct _fssim_volume fssim_volume;
+
+typedef struct
+{
+  wchar_t *name;
+  fssim_node *node;
+} fssim_entry;
+
+struct _fssim_node
+{
+  fssim_volume *volume;
+  ULONGLONG id;
+  DWORD attributes;
+  ULONGLONG size;
+  LONGLONG btime;
+  LONGLONG atime;
+  LONGLONG mtime;
+  LONGLONG ctime;
+  /* Names in directories */
+  DWORD nlink;
+  /* Open handles */
+  LONG opens;
+  BYTE *reparse;
+  DWORD reparse_size;
+  /* Directories only: the containing directory (NULL for roots) and the
+   * entries, sorted with fssim_name_cmp()
+   */
+  fssim_node *parent;
+  fssim_entry *children;
+  size_t nchildren;
+  size_t capacity;
+  /* Used by ntlink_fssim_save() */
+  wchar_t *saved_as;
+};
+
+struct _fssim_volume
+{
+  wchar_t letter;
+  DWORD serial;
+  ULONGLONG next_id;
+  fssim_node *root;
+};
+
+struct _ntlink_fssim
+{
+  SRWLOCK lock;
+  FssimFlags flags;
+  fssim_volume *volumes[26];
+  wchar_t *cwd;
+  LONGLONG clock;
+  LONG handles;
+  LONG counts[NTLINK_FS_OP_COUNT];
+  unsigned int latency[NTLINK_FS_OP_COUNT];
+};
+
+typedef struct
+{
+  DWORD magic;
+  ntlink_fssim *sim;
+  /* File handles */
+  fssim_node *node;
+  fssim_node *dir;
+  wchar_t *name;
+  wchar_t *path;
+  int delete_on_close;
+  /* Find handles */
+  WIN32_FIND_DATAW *items;
+  size_t count;
+  size_t next;
+} fssim_handle;
+
+/* The result of fssim_lookup() */
+typedef struct
+{
+  /* The directory that holds the last component, NULL for roots */
+  fssim_node *dir;
+  /* Position of the last component in @dir, or where it would be inserted */
+  size_t index;
+  /* The object itself, NULL if the last component does not exist */
+  fssim_node *node;
+  /* The last component, with the on-disk case if it exists */
+  wchar_t *name;
+  /* The full path after following reparse points, with the on-disk case */
+  wchar_t *full;
+  fssim_volume *volume;
+} fssim_lookup_result;
+
+static ntlink_fssim *fssim_active = NULL;
+
+/*
+ * Helpers
+ */
+
+static int
+fssim_name_cmp (const wchar_t *a, const wchar_t *b)
+{
+  /* NTFS collates names by their upper-cased UTF-16 code units */
+  for (; *a != L'\0' && *b != L'\0'; a++, b++)
+  {
+    wint_t ca = towupper (*a), cb = towupper (*b);
+    if (ca != cb)
+      return ca < cb ? -1 : 1;
+  }
+  if (*a == *b)
+    return 0;
+  return *a == L'\0' ? -1 : 1;
+}
+
+static int
+fssim_valid_name (const wchar_t *name)
+{
+  size_t len = wcslen (name);
+  const wchar_t *p;
+  if (len == 0 || len > FSSIM_MAX_NAME)
+    return 0;
+  if (wcscmp (name, L".") == 0 || wcscmp (name, L"..") == 0)
+    return 0;
+  for (p = name; *p != L'\0'; p++)
+    if (*p < 32 || wcschr (L"<>:\"/\\|?*", *p) != NULL)
+      return 0;
+  return 1;
+}
+
+static int
+fssim_is_separator (wchar_t c)
+{
+  return c == L'\\' || c == L'/';
+}
+
+static void
+fssim_delay (unsigned int usec)
+{
+#ifdef _WIN32
+  Sleep ((usec + 999) / 1000);
+#else
+  struct timespec ts;
+  ts.tv_sec = usec / 1000000;
+  ts.tv_nsec = (long) (usec % 1000000) * 1000;
+  while (nanosleep (&ts, &ts) != 0 && errno == EINTR);
+#endif
+}
+
+static void
+fssim_filetime (LONGLONG t, FILETIME *ft)
+{
+  ft->dwLowDateTime = (DWORD) ((ULONGLONG) t & 0xFFFFFFFF);
+  ft->dwHighDateTime = (DWORD) ((ULONGLONG) t >> 32);
+}
+
+static DWORD
+fssim_reparse_tag (const fssim_node *node)
+{
+  DWORD tag = 0;
+  if (node->reparse != NULL)
+    memcpy (&tag, node->reparse, sizeof (tag));
+  return tag;
+}
+
+static USHORT
+fssim_get_ushort (const BYTE *buf, size_t off)
+{
+  USHORT v;
+  memcpy (&v, &buf[off], sizeof (v));
+  return v;
+}
+
+static void
+fssim_put_ushort (BYTE *buf, size_t off, size_t v)
+{
+  USHORT u = (USHORT) v;
+  memcpy (&buf[off], &u, sizeof (u));
+}
+
+/*
+ * Extracts the substitute and print names of a symlink or mount point
+ * reparse buffer. Either of @substitute and @print can be NULL.
+ * Returns 0 on success, -1 if the buffer is malformed or of another type,
+ * -2 if out of memory.
+ */
+static int
+fssim_reparse_names (const BYTE *buf, DWORD size, wchar_t **substitute, wchar_t **print, int *relative)
+{
+  DWORD tag;
+  size_t pathoff, suboff, sublen, printoff, printlen;
+
+  if (size < 16)
+    return -1;
+  memcpy (&tag, buf, sizeof (tag));
+  if ((size_t) fssim_get_ushort (buf, 4) + 8 != size)
+    return -1;
+  if (tag == IO_REPARSE_TAG_SYMLINK)
+  {
+    DWORD flags;
+    if (size < 20)
+      return -1;
+    memcpy (&flags, &buf[16], sizeof (flags));
+    if (relative != NULL)
+      *relative = (flags & FSSIM_SYMLINK_FLAG_RELATIVE) != 0;
+    pathoff = 20;
+  }
+  else if (tag == IO_REPARSE_TAG_MOUNT_POINT)
+  {
+    if (relative != NULL)
+      *relative = 0;
+    pathoff = 16;
+  }
+  else
+    return -1;
+
+  suboff = fssim_get_ushort (buf, 8);
+  sublen = fssim_get_ushort (buf, 10);
+  printoff = fssim_get_ushort (buf, 12);
+  printlen = fssim_get_ushort (buf, 14);
+  if ((suboff | sublen | printoff | printlen) % sizeof (wchar_t) != 0 ||
+      pathoff + suboff + sublen > size || pathoff + printoff + printlen > size ||
+      sublen == 0)
+    return -1;
+
+  if (substitute != NULL)
+  {
+    *substitute = malloc (sublen + sizeof (wchar_t));
+    if (*substitute == NULL)
+      return -2;
+    memcpy (*substitute, &buf[pathoff + suboff], sublen);
+    (*substitute)[sublen / sizeof (wchar_t)] = L'\0';
+  }
+  if (print != NULL)
+  {
+    *print = malloc (printlen + sizeof (wchar_t));
+    if (*print == NULL)
+    {
+      if (substitute != NULL)
+        free (*substitute);
+      return -2;
+    }
+    memcpy (*print, &buf[pathoff + printoff], printlen);
+    (*print)[printlen / sizeof (wchar_t)] = L'\0';
+  }
+  return 0;
+}
+
+/*
+ * Builds a reparse buffer the way CreateSymbolicLinkW() and SetJuncPointW()
+ * do: the substitute name, then the print name, each NUL-terminated.
+ */
+static BYTE *
+fssim_build_reparse (DWORD tag, const wchar_t *substitute, const wchar_t *print, int relative, DWORD *size)
+{
+  size_t sublen = wcslen (substitute) * sizeof (wchar_t);
+  size_t printlen = wcslen (print) * sizeof (wchar_t);
+  size_t pathoff = tag == IO_REPARSE_TAG_SYMLINK ? 20 : 16;
+  size_t total = pathoff + sublen + sizeof (wchar_t) + printlen + sizeof (wchar_t);
+  BYTE *buf;
+
+  if (total - 8 > 0xFFFF)
+    return NULL;
+  buf = malloc (total);
+  if (buf == NULL)
+    return NULL;
+  memset (buf, 0, total);
+  memcpy (buf, &tag, sizeof (tag));
+  fssim_put_ushort (buf, 4, total - 8);
+  fssim_put_ushort (buf, 8, 0);
+  fssim_put_ushort (buf, 10, sublen);
+  fssim_put_ushort (buf, 12, sublen + sizeof (wchar_t));
+  fssim_put_ushort (buf, 14, printlen);
+  if (tag == IO_REPARSE_TAG_SYMLINK)
+  {
+    DWORD flags = relative ? FSSIM_SYMLINK_FLAG_RELATIVE : 0;
+    memcpy (&buf[16], &flags, sizeof (flags));
+  }
+  memcpy (&buf[pathoff], substitute, sublen);
+  memcpy (&buf[pathoff + sublen + sizeof (wchar_t)], print, printlen);
+  *size = total;
+  return buf;
+}
+
+/*
+ * Nodes and directories
+ */
+
+static void
+fssim_touch (ntlink_fssim *sim, fssim_node *node)
+{
+  sim->clock += FSSIM_TICK;
+  node->mtime = node->ctime = node->atime = sim->clock;
+}
+
+static fssim_node *
+fssim_node_new (ntlink_fssim *sim, fssim_volume *volume, int directory)
+{
+  fssim_node *node = malloc (sizeof (fssim_node));
+  if (node == NULL)
+    return NULL;
+  memset (node, 0, sizeof (fssim_node));
+  node->volume = volume;
+  node->id = volume->next_id++;
+  node->attributes = directory ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+  sim->clock += FSSIM_TICK;
+  node->btime = node->atime = node->mtime = node->ctime = sim->clock;
+  return node;
+}
+
+static void
+fssim_node_release (fssim_node *node)
+{
+  if (node->nlink > 0 || node->opens > 0 || node->volume->root == node)
+    return;
+  free (node->reparse);
+  free (node->children);
+  free (node);
+}
+
+/*
+ * Finds @name in @dir. Returns 1 and its position if it is there,
+ * 0 and the position to insert it at otherwise.
+ */
+static int
+fssim_find (const fssim_node *dir, const wchar_t *name, size_t *index)
+{
+  size_t lo = 0, hi = dir->nchildren;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    int c = fssim_name_cmp (dir->children[mid].name, name);
+    if (c == 0)
+    {
+      *index = mid;
+      return 1;
+    }
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *index = lo;
+  return 0;
+}
+
+static DWORD
+fssim_link_at (ntlink_fssim *sim, fssim_node *dir, size_t index, const wchar_t *name, fssim_node *node)
+{
+  wchar_t *copy;
+  if (!fssim_valid_name (name))
+    return ERROR_INVALID_NAME;
+  if (node->nlink >= FSSIM_MAX_LINKS)
+    return ERROR_TOO_MANY_LINKS;
+  if (dir->nchildren == dir->capacity)
+  {
+    size_t capacity = dir->capacity == 0 ? 8 : dir->capacity * 2;
+    fssim_entry *children = realloc (dir->children, capacity * sizeof (fssim_entry));
+    if (children == NULL)
+      return ERROR_NOT_ENOUGH_MEMORY;
+    dir->children = children;
+    dir->capacity = capacity;
+  }
+  copy = wcsdup (name);
+  if (copy == NULL)
+    return ERROR_NOT_ENOUGH_MEMORY;
+  memmove (&dir->children[index + 1], &dir->children[index], (dir->nchildren - index) * sizeof (fssim_entry));
+  dir->children[index].name = copy;
+  dir->children[index].node = node;
+  dir->nchildren += 1;
+  node->nlink += 1;
+  if (node->attributes & FILE_ATTRIBUTE_DIRECTORY)
+    node->parent = dir;
+  else
+  {
+    sim->clock += FSSIM_TICK;
+    node->ctime = sim->clock;
+  }
+  fssim_touch (sim, dir);
+  return ERROR_SUCCESS;
+}
+
+static void
+fssim_unlink_at (ntlink_fssim *sim, fssim_node *dir, size_t index)
+{
+  fssim_node *node = dir->children[index].node;
+  free (dir->children[index].name);
+  memmove (&dir->children[index], &dir->children[index + 1], (dir->nchildren - index - 1) * sizeof (fssim_entry));
+  dir->nchildren -= 1;
+  node->nlink -= 1;
+  if (node->attributes & FILE_ATTRIBUTE_DIRECTORY)
+    node->parent = NULL;
+  fssim_touch (sim, dir);
+  fssim_node_release (node);
+}
+
+static fssim_volume *
+fssim_volume_get (ntlink_fssim *sim, wchar_t letter)
+{
+  letter = towupper (letter);
+  if (letter < L'A' || letter > L'Z')
+    return NULL;
+  return sim->volumes[letter - L'A'];
+}
+
+/*
+ * Paths
+ */
+
+/*
+ * Turns @path into a full "X:\a\b" path: makes it absolute, removes "."
+ * and ".." components, duplicate and trailing separators, like
+ * GetFullPathNameW() does. Returns ERROR_SUCCESS or an error code.
+ */
+static DWORD
+fssim_full_path (ntlink_fssim *sim, const wchar_t *path, wchar_t **result, int *trailing)
+{
+  const wchar_t *rest;
+  const wchar_t *base = NULL;
+  wchar_t drive;
+  wchar_t *buf, *out;
+  size_t len, i;
+
+  if (path == NULL || path[0] == L'\0')
+    return ERROR_PATH_NOT_FOUND;
+
+  if ((path[0] == L'\\' && (path[1] == L'\\' || path[1] == L'?') && path[2] == L'?' && path[3] == L'\\'))
+  {
+    path += 4;
+    if (_wcsnicmp (path, L"UNC\\", 4) == 0)
+      return ERROR_BAD_NETPATH;
+  }
+  else if (fssim_is_separator (path[0]) && fssim_is_separator (path[1]))
+    return ERROR_BAD_NETPATH;
+
+  if (path[0] != L'\0' && path[1] == L':')
+  {
+    drive = towupper (path[0]);
+    rest = &path[2];
+    if (!fssim_is_separator (rest[0]))
+      base = towupper (sim->cwd[0]) == drive ? sim->cwd : NULL;
+  }
+  else if (fssim_is_separator (path[0]))
+  {
+    drive = towupper (sim->cwd[0]);
+    rest = path;
+  }
+  else
+  {
+    drive = towupper (sim->cwd[0]);
+    rest = path;
+    base = sim->cwd;
+  }
+  if (drive < L'A' || drive > L'Z')
+    return ERROR_INVALID_NAME;
+
+  len = wcslen (rest);
+  if (trailing != NULL)
+    *trailing = len > 0 && fssim_is_separator (rest[len - 1]);
+  /* "X:" + "\" + base + "\" + rest */
+  buf = malloc ((3 + (base != NULL ? wcslen (base) : 0) + 1 + len + 1) * sizeof (wchar_t));
+  if (buf == NULL)
+    return ERROR_NOT_ENOUGH_MEMORY;
+  buf[0] = drive;
+  buf[1] = L':';
+  out = &buf[2];
+  *out = L'\0';
+
+  /* Components of the base (skipping its drive), then of the rest */
+  for (i = 0; i < 2; i++)
+  {
+    const wchar_t *p = i == 0 ? (base != NULL ? &base[2] : L"") : rest;
+    while (*p != L'\0')
+    {
+      const wchar_t *start;
+      size_t clen;
+      while (fssim_is_separator (*p))
+        p++;
+      start = p;
+      while (*p != L'\0' && !fssim_is_separator (*p))
+        p++;
+      clen = p - start;
+      if (clen == 0 || (clen == 1 && start[0] == L'.'))
+        continue;
+      if (clen == 2 && start[0] == L'.' && start[1] == L'.')
+      {
+        while (out > &buf[2] && *out != L'\\')
+          out--;
+        *out = L'\0';
+        continue;
+      }
+      while (*out != L'\0')
+        out++;
+      *out++ = L'\\';
+      memcpy (out, start, clen * sizeof (wchar_t));
+      out[clen] = L'\0';
+    }
+  }
+  if (buf[2] == L'\0')
+  {
+    buf[2] = L'\\';
+    buf[3] = L'\0';
+  }
+  *result = buf;
+  return ERROR_SUCCESS;
+}
+
+static void
+fssim_lookup_free (fssim_lookup_result *r)
+{
+  free (r->name);
+  free (r->full);
+  r->name = NULL;
+  r->full = NULL;
+}
+
+static wchar_t *
+fssim_join (const wchar_t *a, size_t alen, const wchar_t *b, const wchar_t *c)
+{
+  size_t blen = b != NULL ? wcslen (b) : 0;
+  size_t clen = c != NULL ? wcslen (c) : 0;
+  wchar_t *r = malloc ((alen + 1 + blen + 1 + clen + 1) * sizeof (wchar_t));
+  wchar_t *p = r;
+  if (r == NULL)
+    return NULL;
+  memcpy (p, a, alen * sizeof (wchar_t));
+  p += alen;
+  if (blen > 0)
+  {
+    *p++ = L'\\';
+    memcpy (p, b, blen * sizeof (wchar_t));
+    p += blen;
+  }
+  if (clen > 0)
+  {
+    *p++ = L'\\';
+    memcpy (p, c, clen * sizeof (wchar_t));
+    p += clen;
+  }
+  *p = L'\0';
+  return r;
+}
+
+/*
+ * Resolves @path. Reparse points (symlinks and mount points) on the way
+ * are followed, the last component is followed only if @follow is set.
+ * A missing last component is not an error (r->node is NULL then),
+ * a missing intermediate component is ERROR_PATH_NOT_FOUND.
+ * Returns ERROR_SUCCESS or an error code. On success free @r with
+ * fssim_lookup_free().
+ */
+static DWORD
+fssim_lookup (ntlink_fssim *sim, const wchar_t *path, int follow, fssim_lookup_result *r)
+{
+  wchar_t *work = NULL;
+  wchar_t *full = NULL;
+  DWORD err;
+  int hops = 0;
+
+  memset (r, 0, sizeof (fssim_lookup_result));
+  err = fssim_full_path (sim, path, &work, NULL);
+  if (err != ERROR_SUCCESS)
+    return err;
+
+restart:
+  {
+    fssim_volume *volume = fssim_volume_get (sim, work[0]);
+    fssim_node *node;
+    size_t fulllen;
+    wchar_t *p;
+
+    if (volume == NULL)
+    {
+      err = ERROR_PATH_NOT_FOUND;
+      goto fail;
+    }
+    node = volume->root;
+    free (full);
+    full = malloc ((wcslen (work) + 1) * sizeof (wchar_t));
+    if (full == NULL)
+    {
+      err = ERROR_NOT_ENOUGH_MEMORY;
+      goto fail;
+    }
+    full[0] = volume->letter;
+    full[1] = L':';
+    full[2] = L'\0';
+    fulllen = 2;
+    r->volume = volume;
+
+    if (work[3] == L'\0')
+    {
+      r->node = node;
+      r->name = wcsdup (L"");
+      full[2] = L'\\';
+      full[3] = L'\0';
+      r->full = full;
+      free (work);
+      if (r->name == NULL)
+      {
+        fssim_lookup_free (r);
+        return ERROR_NOT_ENOUGH_MEMORY;
+      }
+      return ERROR_SUCCESS;
+    }
+
+    p = &work[3];
+    while (1)
+    {
+      wchar_t *end = wcschr (p, L'\\');
+      int last = end == NULL;
+      size_t index;
+      fssim_node *child;
+      const wchar_t *name;
+
+      if (end != NULL)
+        *end = L'\0';
+      if (!(node->attributes & FILE_ATTRIBUTE_DIRECTORY))
+      {
+        err = ERROR_PATH_NOT_FOUND;
+        goto fail;
+      }
+      if (!fssim_find (node, p, &index))
+      {
+        if (!last)
+        {
+          err = ERROR_PATH_NOT_FOUND;
+          goto fail;
+        }
+        full[fulllen] = L'\\';
+        wcscpy (&full[fulllen + 1], p);
+        r->dir = node;
+        r->index = index;
+        r->node = NULL;
+        r->name = wcsdup (p);
+        r->full = full;
+        free (work);
+        if (r->name == NULL)
+        {
+          fssim_lookup_free (r);
+          return ERROR_NOT_ENOUGH_MEMORY;
+        }
+        return ERROR_SUCCESS;
+      }
+      child = node->children[index].node;
+      name = node->children[index].name;
+      full[fulllen] = L'\\';
+      wcscpy (&full[fulllen + 1], name);
+
+      if (child->reparse != NULL && (!last || follow))
+      {
+        wchar_t *target = NULL, *next;
+        int relative = 0;
+        int r2 = fssim_reparse_names (child->reparse, child->reparse_size, &target, NULL, &relative);
+        if (r2 == -2)
+        {
+          err = ERROR_NOT_ENOUGH_MEMORY;
+          goto fail;
+        }
+        /* Other reparse types are opaque */
+        if (r2 == 0)
+        {
+          if (++hops > FSSIM_MAX_REPARSE_HOPS)
+          {
+            free (target);
+            err = ERROR_CANT_RESOLVE_FILENAME;
+            goto fail;
+          }
+          if (relative)
+            next = fssim_join (full, fulllen, target, last ? NULL : end + 1);
+          else
+            next = fssim_join (target, wcslen (target), NULL, last ? NULL : end + 1);
+          free (target);
+          if (next == NULL)
+          {
+            err = ERROR_NOT_ENOUGH_MEMORY;
+            goto fail;
+          }
+          free (work);
+          work = NULL;
+          err = fssim_full_path (sim, next, &work, NULL);
+          free (next);
+          if (err != ERROR_SUCCESS)
+          {
+            /* A target that is not a local path can't be reached */
+            if (err == ERROR_INVALID_NAME)
+              err = ERROR_PATH_NOT_FOUND;
+            goto fail;
+          }
+          goto restart;
+        }
+      }
+
+      fulllen += 1 + wcslen (name);
+      if (last)
+      {
+        r->dir = node;
+        r->index = index;
+        r->node = child;
+        r->name = wcsdup (name);
+        r->full = full;
+        free (work);
+        if (r->name == NULL)
+        {
+          fssim_lookup_free (r);
+          return ERROR_NOT_ENOUGH_MEMORY;
+        }
+        return ERROR_SUCCESS;
+      }
+      node = child;
+      p = end + 1;
+    }
+  }
+
+fail:
+  free (work);
+  free (full);
+  memset (r, 0, sizeof (fssim_lookup_result));
+  return err;
+}
+
+/* Same as fssim_lookup(), but a missing last component is an error too */
+static DWORD
+fssim_lookup_existing (ntlink_fssim *sim, const wchar_t *path, int follow, fssim_lookup_result *r)
+{
+  DWORD err = fssim_lookup (sim, path, follow, r);
+  if (err == ERROR_SUCCESS && r->node == NULL)
+  {
+    fssim_lookup_free (r);
+    err = ERROR_FILE_NOT_FOUND;
+  }
+  return err;
+}
+
+/*
+ * Handles
+ */
+
+static fssim_handle *
+fssim_handle_new (ntlink_fssim *sim, DWORD magic)
+{
+  fssim_handle *h = malloc (sizeof (fssim_handle));
+  if (h == NULL)
+    return NULL;
+  memset (h, 0, sizeof (fssim_handle));
+  h->magic = magic;
+  h->sim = sim;
+  InterlockedIncrement (&sim->handles);
+  return h;
+}
+
+static fssim_handle *
+fssim_handle_get (HANDLE handle, DWORD magic)
+{
+  fssim_handle *h = (fssim_handle *) handle;
+  if (h == NULL || handle == INVALID_HANDLE_VALUE || h->magic != magic)
+    return NULL;
+  return h;
+}
+
+/* Opens a file handle on @r, which must name an existing object */
+static HANDLE
+fssim_open (ntlink_fssim *sim, fssim_lookup_result *r, int delete_on_close)
+{
+  fssim_handle *h = fssim_handle_new (sim, FSSIM_HANDLE_FILE);
+  if (h == NULL)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return INVALID_HANDLE_VALUE;
+  }
+  h->node = r->node;
+  h->dir = r->dir;
+  h->name = r->name;
+  h->path = r->full;
+  h->delete_on_close = delete_on_close;
+  r->name = NULL;
+  r->full = NULL;
+  h->node->opens += 1;
+  if (h->dir != NULL)
+    h->dir->opens += 1;
+  return (HANDLE) h;
+}
+
+static ntlink_fssim *fssim_current (void);
+
+/* Counts the call and waits for as long as it is supposed to take */
+static ntlink_fssim *
+fssim_enter (ntlink_fs_op op)
+{
+  ntlink_fssim *sim = fssim_current ();
+  if (sim == NULL)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  InterlockedIncrement (&sim->counts[op]);
+  if (sim->latency[op] > 0)
+    fssim_delay (sim->latency[op]);
+  return sim;
+}
+
+static BOOL
+fssim_fail (DWORD err)
+{
+  SetLastError (err);
+  return FALSE;
+}
+
+/*
+ * The operations. sim_*() functions expect the lock to be held.
+ */
+
+static BOOL
+sim_create_directory (ntlink_fssim *sim, LPCWSTR path)
+{
+  fssim_lookup_result r;
+  fssim_node *node;
+  DWORD err;
+
+  err = fssim_lookup (sim, path, FALSE, &r);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  if (r.node != NULL)
+  {
+    fssim_lookup_free (&r);
+    return fssim_fail (r.dir == NULL ? ERROR_ACCESS_DENIED : ERROR_ALREADY_EXISTS);
+  }
+  node = fssim_node_new (sim, r.volume, TRUE);
+  if (node == NULL)
+  {
+    fssim_lookup_free (&r);
+    return fssim_fail (ERROR_NOT_ENOUGH_MEMORY);
+  }
+  err = fssim_link_at (sim, r.dir, r.index, r.name, node);
+  fssim_lookup_free (&r);
+  if (err != ERROR_SUCCESS)
+  {
+    fssim_node_release (node);
+    return fssim_fail (err);
+  }
+  return TRUE;
+}
+
+static HANDLE
+sim_create_file (ntlink_fssim *sim, LPCWSTR path, DWORD access, DWORD disposition, DWORD flags)
+{
+  fssim_lookup_result r;
+  DWORD err;
+  HANDLE h;
+  int existed;
+
+  if (disposition < CREATE_NEW || disposition > TRUNCATE_EXISTING)
+  {
+    SetLastError (ERROR_INVALID_PARAMETER);
+    return INVALID_HANDLE_VALUE;
+  }
+  err = fssim_lookup (sim, path, !(flags & FILE_FLAG_OPEN_REPARSE_POINT), &r);
+  if (err != ERROR_SUCCESS)
+  {
+    SetLastError (err);
+    return INVALID_HANDLE_VALUE;
+  }
+
+  existed = r.node != NULL;
+  if (existed)
+  {
+    int isdir = (r.node->attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    err = ERROR_SUCCESS;
+    if (disposition == CREATE_NEW)
+      err = ERROR_FILE_EXISTS;
+    else if (isdir && !(flags & FILE_FLAG_BACKUP_SEMANTICS))
+      err = ERROR_ACCESS_DENIED;
+    else if (isdir && (disposition == CREATE_ALWAYS || disposition == TRUNCATE_EXISTING))
+      err = ERROR_ACCESS_DENIED;
+    else if ((r.node->attributes & FILE_ATTRIBUTE_READONLY) && !isdir &&
+        (access & (GENERIC_WRITE | FILE_WRITE_DATA)))
+      err = ERROR_ACCESS_DENIED;
+    if (err != ERROR_SUCCESS)
+    {
+      fssim_lookup_free (&r);
+      SetLastError (err);
+      return INVALID_HANDLE_VALUE;
+    }
+    if (disposition == CREATE_ALWAYS || disposition == TRUNCATE_EXISTING)
+    {
+      r.node->size = 0;
+      fssim_touch (sim, r.node);
+    }
+  }
+  else
+  {
+    fssim_node *node;
+    if (disposition == OPEN_EXISTING || disposition == TRUNCATE_EXISTING)
+    {
+      fssim_lookup_free (&r);
+      SetLastError (ERROR_FILE_NOT_FOUND);
+      return INVALID_HANDLE_VALUE;
+    }
+    node = fssim_node_new (sim, r.volume, FALSE);
+    if (node == NULL)
+    {
+      fssim_lookup_free (&r);
+      SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+      return INVALID_HANDLE_VALUE;
+    }
+    err = fssim_link_at (sim, r.dir, r.index, r.name, node);
+    if (err != ERROR_SUCCESS)
+    {
+      fssim_node_release (node);
+      fssim_lookup_free (&r);
+      SetLastError (err);
+      return INVALID_HANDLE_VALUE;
+    }
+    r.node = node;
+  }
+
+  h = fssim_open (sim, &r, (flags & FILE_FLAG_DELETE_ON_CLOSE) != 0);
+  fssim_lookup_free (&r);
+  if (h != INVALID_HANDLE_VALUE)
+    SetLastError (existed && (disposition == CREATE_ALWAYS || disposition == OPEN_ALWAYS) ? ERROR_ALREADY_EXISTS : ERROR_SUCCESS);
+  return h;
+}
+
+static HANDLE
+sim_create_file_at (ntlink_fssim *sim, HANDLE dirhandle, LPCWSTR name, BOOL directory)
+{
+  fssim_handle *dh = fssim_handle_get (dirhandle, FSSIM_HANDLE_FILE);
+  fssim_lookup_result r;
+  fssim_node *node;
+  size_t index;
+  DWORD err;
+  HANDLE h;
+
+  if (dh == NULL)
+  {
+    SetLastError (ERROR_INVALID_HANDLE);
+    return INVALID_HANDLE_VALUE;
+  }
+  if (!(dh->node->attributes & FILE_ATTRIBUTE_DIRECTORY) || (dh->node->nlink == 0 && dh->dir != NULL))
+  {
+    SetLastError (ERROR_DIRECTORY);
+    return INVALID_HANDLE_VALUE;
+  }
+  if (!fssim_valid_name (name))
+  {
+    SetLastError (ERROR_INVALID_NAME);
+    return INVALID_HANDLE_VALUE;
+  }
+  if (fssim_find (dh->node, name, &index))
+  {
+    SetLastError (ERROR_ALREADY_EXISTS);
+    return INVALID_HANDLE_VALUE;
+  }
+  node = fssim_node_new (sim, dh->node->volume, directory);
+  if (node == NULL)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return INVALID_HANDLE_VALUE;
+  }
+  err = fssim_link_at (sim, dh->node, index, name, node);
+  if (err != ERROR_SUCCESS)
+  {
+    fssim_node_release (node);
+    SetLastError (err);
+    return INVALID_HANDLE_VALUE;
+  }
+  memset (&r, 0, sizeof (r));
+  r.dir = dh->node;
+  r.node = node;
+  r.volume = node->volume;
+  r.name = wcsdup (name);
+  r.full = fssim_join (dh->path, wcslen (dh->path) - (dh->dir == NULL ? 1 : 0), name, NULL);
+  if (r.name == NULL || r.full == NULL)
+  {
+    fssim_lookup_free (&r);
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return INVALID_HANDLE_VALUE;
+  }
+  h = fssim_open (sim, &r, FALSE);
+  fssim_lookup_free (&r);
+  return h;
+}
+
+/* Removes the name @h was opened with, if it still refers to the same object */
+static void
+fssim_handle_unlink (ntlink_fssim *sim, fssim_handle *h)
+{
+  size_t index;
+  if (h->dir == NULL || h->node->nlink == 0)
+    return;
+  if (!fssim_find (h->dir, h->name, &index) || h->dir->children[index].node != h->node)
+    return;
+  if (h->node->nchildren > 0)
+    return;
+  fssim_unlink_at (sim, h->dir, index);
+}
+
+static BOOL
+sim_close_handle (ntlink_fssim *sim, HANDLE handle)
+{
+  fssim_handle *h = (fssim_handle *) handle;
+  if (h == NULL || handle == INVALID_HANDLE_VALUE || (h->magic != FSSIM_HANDLE_FILE && h->magic != FSSIM_HANDLE_FIND))
+    return fssim_fail (ERROR_INVALID_HANDLE);
+  if (h->magic == FSSIM_HANDLE_FILE)
+  {
+    if (h->delete_on_close)
+      fssim_handle_unlink (sim, h);
+    h->node->opens -= 1;
+    fssim_node_release (h->node);
+    if (h->dir != NULL)
+    {
+      h->dir->opens -= 1;
+      fssim_node_release (h->dir);
+    }
+  }
+  InterlockedDecrement (&h->sim->handles);
+  h->magic = 0;
+  free (h->items);
+  free (h->name);
+  free (h->path);
+  free (h);
+  return TRUE;
+}
+
+static BOOL
+sim_device_io_control (ntlink_fssim *sim, HANDLE handle, DWORD code, LPVOID in, DWORD insize, LPVOID out, DWORD outsize, LPDWORD returned)
+{
+  fssim_handle *h = fssim_handle_get (handle, FSSIM_HANDLE_FILE);
+  fssim_node *node;
+  DWORD tag;
+
+  if (h == NULL)
+    return fssim_fail (ERROR_INVALID_HANDLE);
+  node = h->node;
+  if (returned != NULL)
+    *returned = 0;
+
+  switch (code)
+  {
+  case FSCTL_GET_REPARSE_POINT:
+    if (node->reparse == NULL)
+      return fssim_fail (ERROR_NOT_A_REPARSE_POINT);
+    if (out == NULL || outsize < 8)
+      return fssim_fail (ERROR_INSUFFICIENT_BUFFER);
+    memcpy (out, node->reparse, outsize < node->reparse_size ? outsize : node->reparse_size);
+    if (returned != NULL)
+      *returned = outsize < node->reparse_size ? outsize : node->reparse_size;
+    if (outsize < node->reparse_size)
+      return fssim_fail (ERROR_MORE_DATA);
+    return TRUE;
+
+  case FSCTL_SET_REPARSE_POINT:
+  {
+    BYTE *copy;
+    if (in == NULL || insize < 8)
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memcpy (&tag, in, sizeof (tag));
+    if ((size_t) fssim_get_ushort ((BYTE *) in, 4) + 8 != insize)
+      return fssim_fail (ERROR_INVALID_REPARSE_DATA);
+    if ((tag == IO_REPARSE_TAG_SYMLINK || tag == IO_REPARSE_TAG_MOUNT_POINT) &&
+        fssim_reparse_names ((BYTE *) in, insize, NULL, NULL, NULL) != 0)
+      return fssim_fail (ERROR_INVALID_REPARSE_DATA);
+    if (tag == IO_REPARSE_TAG_SYMLINK && (sim->flags & NTLINK_FSSIM_FLAG_NO_SYMLINK_PRIVILEGE))
+      return fssim_fail (ERROR_PRIVILEGE_NOT_HELD);
+    if (tag == IO_REPARSE_TAG_MOUNT_POINT && !(node->attributes & FILE_ATTRIBUTE_DIRECTORY))
+      return fssim_fail (ERROR_DIRECTORY);
+    if (node->reparse != NULL && fssim_reparse_tag (node) != tag)
+      return fssim_fail (ERROR_REPARSE_TAG_MISMATCH);
+    if (node->nchildren > 0)
+      return fssim_fail (ERROR_DIR_NOT_EMPTY);
+    copy = malloc (insize);
+    if (copy == NULL)
+      return fssim_fail (ERROR_NOT_ENOUGH_MEMORY);
+    memcpy (copy, in, insize);
+    free (node->reparse);
+    node->reparse = copy;
+    node->reparse_size = insize;
+    node->attributes |= FILE_ATTRIBUTE_REPARSE_POINT;
+    sim->clock += FSSIM_TICK;
+    node->ctime = sim->clock;
+    return TRUE;
+  }
+
+  case FSCTL_DELETE_REPARSE_POINT:
+    if (in == NULL || insize < 8)
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memcpy (&tag, in, sizeof (tag));
+    if (fssim_get_ushort ((BYTE *) in, 4) != 0)
+      return fssim_fail (ERROR_INVALID_REPARSE_DATA);
+    if (node->reparse == NULL)
+      return fssim_fail (ERROR_NOT_A_REPARSE_POINT);
+    if (fssim_reparse_tag (node) != tag)
+      return fssim_fail (ERROR_REPARSE_TAG_MISMATCH);
+    free (node->reparse);
+    node->reparse = NULL;
+    node->reparse_size = 0;
+    node->attributes &= ~FILE_ATTRIBUTE_REPARSE_POINT;
+    sim->clock += FSSIM_TICK;
+    node->ctime = sim->clock;
+    return TRUE;
+
+  default:
+    return fssim_fail (ERROR_INVALID_FUNCTION);
+  }
+}
+
+static DWORD
+fssim_attributes (const fssim_node *node)
+{
+  return node->attributes != 0 ? node->attributes : FILE_ATTRIBUTE_NORMAL;
+}
+
+static BOOL
+sim_get_file_information_by_handle (ntlink_fssim *sim, HANDLE handle, LPBY_HANDLE_FILE_INFORMATION info)
+{
+  fssim_handle *h = fssim_handle_get (handle, FSSIM_HANDLE_FILE);
+  fssim_node *node;
+  if (h == NULL)
+    return fssim_fail (ERROR_INVALID_HANDLE);
+  node = h->node;
+  memset (info, 0, sizeof (BY_HANDLE_FILE_INFORMATION));
+  info->dwFileAttributes = fssim_attributes (node);
+  fssim_filetime (node->btime, &info->ftCreationTime);
+  fssim_filetime (node->atime, &info->ftLastAccessTime);
+  fssim_filetime (node->mtime, &info->ftLastWriteTime);
+  info->dwVolumeSerialNumber = node->volume->serial;
+  info->nFileSizeHigh = (DWORD) (node->size >> 32);
+  info->nFileSizeLow = (DWORD) (node->size & 0xFFFFFFFF);
+  info->nNumberOfLinks = node->nlink;
+  info->nFileIndexHigh = (DWORD) (node->id >> 32);
+  info->nFileIndexLow = (DWORD) (node->id & 0xFFFFFFFF);
+  return TRUE;
+}
+
+static BOOL
+sim_get_file_information_by_handle_ex (ntlink_fssim *sim, HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size)
+{
+  fssim_handle *h = fssim_handle_get (handle, FSSIM_HANDLE_FILE);
+  fssim_node *node;
+  if (h == NULL)
+    return fssim_fail (ERROR_INVALID_HANDLE);
+  node = h->node;
+
+  if (cls == FileBasicInfo)
+  {
+    FILE_BASIC_INFO bi;
+    if (size < sizeof (bi))
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memset (&bi, 0, sizeof (bi));
+    bi.CreationTime.QuadPart = node->btime;
+    bi.LastAccessTime.QuadPart = node->atime;
+    bi.LastWriteTime.QuadPart = node->mtime;
+    bi.ChangeTime.QuadPart = node->ctime;
+    bi.FileAttributes = fssim_attributes (node);
+    memcpy (info, &bi, sizeof (bi));
+    return TRUE;
+  }
+  if (cls == FileStandardInfo)
+  {
+    FILE_STANDARD_INFO stdi;
+    if (size < sizeof (stdi))
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memset (&stdi, 0, sizeof (stdi));
+    stdi.AllocationSize.QuadPart = (node->size + FSSIM_CLUSTER - 1) / FSSIM_CLUSTER * FSSIM_CLUSTER;
+    stdi.EndOfFile.QuadPart = node->size;
+    stdi.NumberOfLinks = node->nlink;
+    stdi.DeletePending = h->delete_on_close != 0;
+    stdi.Directory = (node->attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    memcpy (info, &stdi, sizeof (stdi));
+    return TRUE;
+  }
+  if (cls == FSSIM_FileAttributeTagInfo)
+  {
+    fssim_attribute_tag_info ti;
+    if (size < sizeof (ti))
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    ti.FileAttributes = fssim_attributes (node);
+    ti.ReparseTag = fssim_reparse_tag (node);
+    memcpy (info, &ti, sizeof (ti));
+    return TRUE;
+  }
+  if (cls == FSSIM_FileIdInfo)
+  {
+    fssim_file_id_info idi;
+    if (size < sizeof (idi))
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memset (&idi, 0, sizeof (idi));
+    idi.VolumeSerialNumber = node->volume->serial;
+    memcpy (idi.FileId, &node->id, sizeof (node->id));
+    memcpy (info, &idi, sizeof (idi));
+    return TRUE;
+  }
+  return fssim_fail (ERROR_INVALID_PARAMETER);
+}
+
+/* Checks whether the object @h is open on can be deleted */
+static DWORD
+fssim_can_delete (fssim_handle *h, int ignore_readonly)
+{
+  if (h->dir == NULL)
+    return ERROR_ACCESS_DENIED;
+  if ((h->node->attributes & FILE_ATTRIBUTE_READONLY) && !ignore_readonly)
+    return ERROR_ACCESS_DENIED;
+  if (h->node->nchildren > 0)
+    return ERROR_DIR_NOT_EMPTY;
+  return ERROR_SUCCESS;
+}
+
+static BOOL
+sim_set_file_information_by_handle (ntlink_fssim *sim, HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size)
+{
+  fssim_handle *h = fssim_handle_get (handle, FSSIM_HANDLE_FILE);
+  fssim_node *node;
+  DWORD err;
+  if (h == NULL)
+    return fssim_fail (ERROR_INVALID_HANDLE);
+  node = h->node;
+
+  if (cls == FileBasicInfo)
+  {
+    FILE_BASIC_INFO bi;
+    const DWORD settable = FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN |
+        FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE;
+    if (size < sizeof (bi))
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memcpy (&bi, info, sizeof (bi));
+    if (bi.CreationTime.QuadPart > 0)
+      node->btime = bi.CreationTime.QuadPart;
+    if (bi.LastAccessTime.QuadPart > 0)
+      node->atime = bi.LastAccessTime.QuadPart;
+    if (bi.LastWriteTime.QuadPart > 0)
+      node->mtime = bi.LastWriteTime.QuadPart;
+    if (bi.ChangeTime.QuadPart > 0)
+      node->ctime = bi.ChangeTime.QuadPart;
+    if (bi.FileAttributes != 0)
+      node->attributes = (node->attributes & ~settable) | (bi.FileAttributes & settable);
+    return TRUE;
+  }
+  if (cls == FileDispositionInfo)
+  {
+    FILE_DISPOSITION_INFO di;
+    if (size < sizeof (di))
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memcpy (&di, info, sizeof (di));
+    if (di.DeleteFile)
+    {
+      err = fssim_can_delete (h, FALSE);
+      if (err != ERROR_SUCCESS)
+        return fssim_fail (err);
+    }
+    h->delete_on_close = di.DeleteFile != 0;
+    return TRUE;
+  }
+  if (cls == FSSIM_FileDispositionInfoEx)
+  {
+    DWORD flags;
+    if (sim->flags & NTLINK_FSSIM_FLAG_NO_POSIX_DELETE)
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    if (size < sizeof (flags))
+      return fssim_fail (ERROR_INVALID_PARAMETER);
+    memcpy (&flags, info, sizeof (flags));
+    if (!(flags & FSSIM_DISPOSITION_DELETE))
+    {
+      h->delete_on_close = 0;
+      return TRUE;
+    }
+    err = fssim_can_delete (h, (flags & FSSIM_DISPOSITION_IGNORE_READONLY) != 0);
+    if (err != ERROR_SUCCESS)
+      return fssim_fail (err);
+    if (flags & FSSIM_DISPOSITION_POSIX_SEMANTICS)
+      fssim_handle_unlink (sim, h);
+    else
+      h->delete_on_close = 1;
+    return TRUE;
+  }
+  return fssim_fail (ERROR_INVALID_PARAMETER);
+}
+
+static DWORD
+fssim_copy_out (const wchar_t *s, LPWSTR buf, DWORD size)
+{
+  DWORD len = (DWORD) wcslen (s);
+  if (buf == NULL || size <= len)
+    return len + 1;
+  memcpy (buf, s, (len + 1) * sizeof (wchar_t));
+  return len;
+}
+
+static DWORD
+sim_get_final_path_name_by_handle (ntlink_fssim *sim, HANDLE handle, LPWSTR buf, DWORD size, DWORD flags)
+{
+  fssim_handle *h = fssim_handle_get (handle, FSSIM_HANDLE_FILE);
+  wchar_t *path;
+  DWORD r;
+  if (h == NULL)
+  {
+    SetLastError (ERROR_INVALID_HANDLE);
+    return 0;
+  }
+  /* Only VOLUME_NAME_DOS is supported, normalized or not makes no difference */
+  if ((flags & ~FILE_NAME_OPENED) != VOLUME_NAME_DOS)
+  {
+    SetLastError (ERROR_INVALID_PARAMETER);
+    return 0;
+  }
+  path = fssim_join (L"\\\\?", 3, h->path, NULL);
+  if (path == NULL)
+  {
+    SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    return 0;
+  }
+  r = fssim_copy_out (path, buf, size);
+  free (path);
+  return r;
+}
+
+/* Win32 wildcards: '*' and '?'. "*.*" matches everything */
+static int
+fssim_match (const wchar_t *pattern, const wchar_t *name)
+{
+  if (wcscmp (pattern, L"*.*") == 0)
+    pattern = L"*";
+  while (*pattern != L'\0')
+  {
+    if (*pattern == L'*')
+    {
+      while (*pattern == L'*')
+        pattern++;
+      if (*pattern == L'\0')
+        return 1;
+      for (; *name != L'\0'; name++)
+        if (fssim_match (pattern, name))
+          return 1;
+      return 0;
+    }
+    if (*name == L'\0')
+      return 0;
+    if (*pattern != L'?' && towupper (*pattern) != towupper (*name))
+      return 0;
+    pattern++;
+    name++;
+  }
+  return *name == L'\0';
+}
+
+static void
+fssim_fill_find_data (const fssim_node *node, const wchar_t *name, WIN32_FIND_DATAW *fd)
+{
+  memset (fd, 0, sizeof (WIN32_FIND_DATAW));
+  fd->dwFileAttributes = fssim_attributes (node);
+  fssim_filetime (node->btime, &fd->ftCreationTime);
+  fssim_filetime (node->atime, &fd->ftLastAccessTime);
+  fssim_filetime (node->mtime, &fd->ftLastWriteTime);
+  if (!(node->attributes & FILE_ATTRIBUTE_DIRECTORY))
+  {
+    fd->nFileSizeHigh = (DWORD) (node->size >> 32);
+    fd->nFileSizeLow = (DWORD) (node->size & 0xFFFFFFFF);
+  }
+  fd->dwReserved0 = fssim_reparse_tag (node);
+  wcsncpy (fd->cFileName, name, MAX_PATH - 1);
+}
+
+static HANDLE
+sim_find_first_file (ntlink_fssim *sim, LPCWSTR pattern, WIN32_FIND_DATAW *data)
+{
+  fssim_lookup_result r;
+  fssim_handle *h;
+  fssim_node *dir;
+  const wchar_t *mask;
+  wchar_t *parent = NULL;
+  DWORD err;
+  int trailing = 0;
+  size_t i, len;
+
+  if (pattern == NULL || pattern[0] == L'\0')
+  {
+    SetLastError (ERROR_PATH_NOT_FOUND);
+    return INVALID_HANDLE_VALUE;
+  }
+  len = wcslen (pattern);
+  for (i = len; i > 0 && !fssim_is_separator (pattern[i - 1]) && pattern[i - 1] != L':'; i--);
+  mask = &pattern[i];
+
+  if (mask[0] == L'\0' || wcspbrk (mask, L"*?") == NULL)
+  {
+    /* A single name. Roots and names with a trailing separator are not found */
+    err = fssim_full_path (sim, pattern, &parent, &trailing);
+    free (parent);
+    if (err == ERROR_SUCCESS && trailing)
+      err = ERROR_FILE_NOT_FOUND;
+    if (err == ERROR_SUCCESS)
+      err = fssim_lookup_existing (sim, pattern, FALSE, &r);
+    if (err == ERROR_SUCCESS && r.dir == NULL)
+    {
+      fssim_lookup_free (&r);
+      err = ERROR_FILE_NOT_FOUND;
+    }
+    if (err != ERROR_SUCCESS)
+    {
+      SetLastError (err);
+      return INVALID_HANDLE_VALUE;
+    }
+    h = fssim_handle_new (sim, FSSIM_HANDLE_FIND);
+    if (h != NULL)
+      h->items = malloc (sizeof (WIN32_FIND_DATAW));
+    if (h == NULL || h->items == NULL)
+    {
+      fssim_lookup_free (&r);
+      if (h != NULL)
+        sim_close_handle (sim, (HANDLE) h);
+      SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+      return INVALID_HANDLE_VALUE;
+    }
+    fssim_fill_find_data (r.node, r.name, &h->items[0]);
+    h->count = 1;
+    fssim_lookup_free (&r);
+  }
+  else
+  {
+    /* List the directory, following it if it is a link */
+    parent = malloc ((i + 2) * sizeof (wchar_t));
+    if (parent == NULL)
+    {
+      SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+      return INVALID_HANDLE_VALUE;
+    }
+    memcpy (parent, pattern, i * sizeof (wchar_t));
+    parent[i] = L'\0';
+    if (i == 0)
+      wcscpy (parent, L".");
+    err = fssim_lookup_existing (sim, parent, TRUE, &r);
+    free (parent);
+    if (err == ERROR_FILE_NOT_FOUND)
+      err = ERROR_PATH_NOT_FOUND;
+    if (err == ERROR_SUCCESS && !(r.node->attributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+      fssim_lookup_free (&r);
+      err = ERROR_DIRECTORY;
+    }
+    if (err != ERROR_SUCCESS)
+    {
+      SetLastError (err);
+      return INVALID_HANDLE_VALUE;
+    }
+    dir = r.node;
+    h = fssim_handle_new (sim, FSSIM_HANDLE_FIND);
+    if (h != NULL)
+      h->items = malloc ((dir->nchildren + 2) * sizeof (WIN32_FIND_DATAW));
+    if (h == NULL || h->items == NULL)
+    {
+      fssim_lookup_free (&r);
+      if (h != NULL)
+        sim_close_handle (sim, (HANDLE) h);
+      SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+      return INVALID_HANDLE_VALUE;
+    }
+    /* Only non-root directories have "." and ".." */
+    if (r.dir != NULL)
+    {
+      if (fssim_match (mask, L"."))
+        fssim_fill_find_data (dir, L".", &h->items[h->count++]);
+      if (fssim_match (mask, L".."))
+        fssim_fill_find_data (dir->parent != NULL ? dir->parent : dir, L"..", &h->items[h->count++]);
+    }
+    for (i = 0; i < dir->nchildren; i++)
+      if (fssim_match (mask, dir->children[i].name))
+        fssim_fill_find_data (dir->children[i].node, dir->children[i].name, &h->items[h->count++]);
+    fssim_lookup_free (&r);
+    if (h->count == 0)
+    {
+      sim_close_handle (sim, (HANDLE) h);
+      SetLastError (ERROR_FILE_NOT_FOUND);
+      return INVALID_HANDLE_VALUE;
+    }
+  }
+
+  memcpy (data, &h->items[0], sizeof (WIN32_FIND_DATAW));
+  h->next = 1;
+  SetLastError (ERROR_SUCCESS);
+  return (HANDLE) h;
+}
+
+static BOOL
+sim_find_next_file (ntlink_fssim *sim, HANDLE handle, LPWIN32_FIND_DATAW data)
+{
+  fssim_handle *h = fssim_handle_get (handle, FSSIM_HANDLE_FIND);
+  if (h == NULL)
+    return fssim_fail (ERROR_INVALID_HANDLE);
+  if (h->next >= h->count)
+    return fssim_fail (ERROR_NO_MORE_FILES);
+  memcpy (data, &h->items[h->next++], sizeof (WIN32_FIND_DATAW));
+  return TRUE;
+}
+
+static BOOL
+sim_get_file_attributes_ex (ntlink_fssim *sim, LPCWSTR path, WIN32_FILE_ATTRIBUTE_DATA *data)
+{
+  fssim_lookup_result r;
+  DWORD err = fssim_lookup_existing (sim, path, FALSE, &r);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  memset (data, 0, sizeof (WIN32_FILE_ATTRIBUTE_DATA));
+  data->dwFileAttributes = fssim_attributes (r.node);
+  fssim_filetime (r.node->btime, &data->ftCreationTime);
+  fssim_filetime (r.node->atime, &data->ftLastAccessTime);
+  fssim_filetime (r.node->mtime, &data->ftLastWriteTime);
+  if (!(r.node->attributes & FILE_ATTRIBUTE_DIRECTORY))
+  {
+    data->nFileSizeHigh = (DWORD) (r.node->size >> 32);
+    data->nFileSizeLow = (DWORD) (r.node->size & 0xFFFFFFFF);
+  }
+  fssim_lookup_free (&r);
+  return TRUE;
+}
+
+static BOOL
+sim_remove_directory (ntlink_fssim *sim, LPCWSTR path)
+{
+  fssim_lookup_result r;
+  DWORD err = fssim_lookup_existing (sim, path, FALSE, &r);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  if (!(r.node->attributes & FILE_ATTRIBUTE_DIRECTORY))
+    err = ERROR_DIRECTORY;
+  else if (r.dir == NULL)
+    err = ERROR_ACCESS_DENIED;
+  else if (r.node->nchildren > 0)
+    err = ERROR_DIR_NOT_EMPTY;
+  else
+    fssim_unlink_at (sim, r.dir, r.index);
+  fssim_lookup_free (&r);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  return TRUE;
+}
+
+static BOOL
+sim_delete_file (ntlink_fssim *sim, LPCWSTR path)
+{
+  fssim_lookup_result r;
+  DWORD err = fssim_lookup_existing (sim, path, FALSE, &r);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  if (r.node->attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_READONLY))
+    err = ERROR_ACCESS_DENIED;
+  else
+    fssim_unlink_at (sim, r.dir, r.index);
+  fssim_lookup_free (&r);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  return TRUE;
+}
+
+static BOOL
+sim_move_file_ex (ntlink_fssim *sim, LPCWSTR from, LPCWSTR to, DWORD flags)
+{
+  fssim_lookup_result src, dst;
+  fssim_node *node, *p;
+  DWORD err;
+  size_t index;
+
+  err = fssim_lookup_existing (sim, from, FALSE, &src);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  if (src.dir == NULL)
+  {
+    fssim_lookup_free (&src);
+    return fssim_fail (ERROR_ACCESS_DENIED);
+  }
+  err = fssim_lookup (sim, to, FALSE, &dst);
+  if (err != ERROR_SUCCESS)
+  {
+    fssim_lookup_free (&src);
+    return fssim_fail (err);
+  }
+  node = src.node;
+
+  if (dst.node == node && dst.dir == src.dir && dst.index == src.index)
+  {
+    /* Same name, maybe in another case */
+    wchar_t *name;
+    fssim_lookup_free (&dst);
+    err = fssim_lookup (sim, to, FALSE, &dst);
+    if (err == ERROR_SUCCESS)
+    {
+      const wchar_t *last = dst.full + wcslen (dst.full);
+      const wchar_t *given = to + wcslen (to);
+      while (given > to && !fssim_is_separator (given[-1]) && given[-1] != L':')
+        given--;
+      (void) last;
+      name = wcsdup (given);
+      if (name != NULL && fssim_valid_name (name))
+      {
+        free (src.dir->children[src.index].name);
+        src.dir->children[src.index].name = name;
+        fssim_touch (sim, src.dir);
+      }
+      else
+      {
+        free (name);
+        err = name == NULL ? ERROR_NOT_ENOUGH_MEMORY : ERROR_INVALID_NAME;
+      }
+      fssim_lookup_free (&dst);
+    }
+    fssim_lookup_free (&src);
+    if (err != ERROR_SUCCESS)
+      return fssim_fail (err);
+    return TRUE;
+  }
+
+  err = ERROR_SUCCESS;
+  if (dst.dir == NULL)
+    err = ERROR_ACCESS_DENIED;
+  else if (dst.node != NULL && !(flags & MOVEFILE_REPLACE_EXISTING))
+    err = ERROR_ALREADY_EXISTS;
+  else if (dst.node != NULL && ((dst.node->attributes | node->attributes) & FILE_ATTRIBUTE_DIRECTORY))
+    err = ERROR_ACCESS_DENIED;
+  else if (dst.node != NULL && (dst.node->attributes & FILE_ATTRIBUTE_READONLY))
+    err = ERROR_ACCESS_DENIED;
+  else if (dst.volume != src.volume && ((node->attributes & FILE_ATTRIBUTE_DIRECTORY) || !(flags & MOVEFILE_COPY_ALLOWED)))
+    err = ERROR_NOT_SAME_DEVICE;
+  else if (!fssim_valid_name (dst.name))
+    err = ERROR_INVALID_NAME;
+  /* A directory can't be moved into itself */
+  for (p = dst.dir; err == ERROR_SUCCESS && p != NULL; p = p->parent)
+    if (p == node)
+      err = ERROR_SHARING_VIOLATION;
+  if (err != ERROR_SUCCESS)
+  {
+    fssim_lookup_free (&src);
+    fssim_lookup_free (&dst);
+    return fssim_fail (err);
+  }
+
+  if (dst.volume != src.volume)
+  {
+    /* A copy, with a new file ID */
+    fssim_node *copy = fssim_node_new (sim, dst.volume, FALSE);
+    if (copy == NULL)
+      err = ERROR_NOT_ENOUGH_MEMORY;
+    else
+    {
+      copy->attributes = node->attributes;
+      copy->size = node->size;
+      copy->btime = node->btime;
+      copy->mtime = node->mtime;
+      if (node->reparse != NULL)
+      {
+        copy->reparse = malloc (node->reparse_size);
+        if (copy->reparse == NULL)
+          err = ERROR_NOT_ENOUGH_MEMORY;
+        else
+        {
+          memcpy (copy->reparse, node->reparse, node->reparse_size);
+          copy->reparse_size = node->reparse_size;
+        }
+      }
+    }
+    if (err != ERROR_SUCCESS)
+    {
+      if (copy != NULL)
+        fssim_node_release (copy);
+      fssim_lookup_free (&src);
+      fssim_lookup_free (&dst);
+      return fssim_fail (err);
+    }
+    node = copy;
+  }
+
+  /* Keep @node alive while it has no names */
+  node->opens += 1;
+  if (node == src.node)
+    fssim_unlink_at (sim, src.dir, src.index);
+  if (dst.node != NULL)
+  {
+    fssim_find (dst.dir, dst.name, &index);
+    fssim_unlink_at (sim, dst.dir, index);
+  }
+  fssim_find (dst.dir, dst.name, &index);
+  err = fssim_link_at (sim, dst.dir, index, dst.name, node);
+  node->opens -= 1;
+  if (err == ERROR_SUCCESS && node != src.node)
+  {
+    fssim_find (src.dir, src.name, &index);
+    fssim_unlink_at (sim, src.dir, index);
+  }
+  fssim_node_release (node);
+  fssim_lookup_free (&src);
+  fssim_lookup_free (&dst);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  return TRUE;
+}
+
+static BOOL
+sim_create_hard_link (ntlink_fssim *sim, LPCWSTR link, LPCWSTR existing)
+{
+  fssim_lookup_result src, dst;
+  DWORD err;
+
+  err = fssim_lookup_existing (sim, existing, FALSE, &src);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  err = fssim_lookup (sim, link, FALSE, &dst);
+  if (err != ERROR_SUCCESS)
+  {
+    fssim_lookup_free (&src);
+    return fssim_fail (err);
+  }
+  if (src.node->attributes & FILE_ATTRIBUTE_DIRECTORY)
+    err = ERROR_ACCESS_DENIED;
+  else if (dst.node != NULL)
+    err = ERROR_ALREADY_EXISTS;
+  else if (dst.volume != src.volume)
+    err = ERROR_NOT_SAME_DEVICE;
+  else
+    err = fssim_link_at (sim, dst.dir, dst.index, dst.name, src.node);
+  fssim_lookup_free (&src);
+  fssim_lookup_free (&dst);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  return TRUE;
+}
+
+static int
+fssim_is_absolute (const wchar_t *path)
+{
+  return (path[0] != L'\0' && path[1] == L':' && fssim_is_separator (path[2])) ||
+      (fssim_is_separator (path[0]) && fssim_is_separator (path[1]));
+}
+
+/*
+ * Creates a link object at @link with the reparse buffer for @target, the
+ * way CreateSymbolicLinkW() (@tag is IO_REPARSE_TAG_SYMLINK) and
+ * SetJuncPointW() (IO_REPARSE_TAG_MOUNT_POINT) do.
+ */
+static BOOL
+sim_make_link (ntlink_fssim *sim, LPCWSTR link, LPCWSTR target, DWORD tag, int directory)
+{
+  fssim_lookup_result r;
+  fssim_node *node;
+  wchar_t *substitute = NULL, *full = NULL;
+  int relative;
+  DWORD err;
+
+  if (target == NULL || target[0] == L'\0')
+    return fssim_fail (ERROR_INVALID_PARAMETER);
+  relative = !fssim_is_absolute (target);
+  if (relative && tag == IO_REPARSE_TAG_MOUNT_POINT)
+    return fssim_fail (ERROR_INVALID_PARAMETER);
+  err = fssim_lookup (sim, link, FALSE, &r);
+  if (err != ERROR_SUCCESS)
+    return fssim_fail (err);
+  if (r.node != NULL)
+  {
+    fssim_lookup_free (&r);
+    return fssim_fail (ERROR_ALREADY_EXISTS);
+  }
+
+  if (relative)
+    substitute = wcsdup (target);
+  else
+  {
+    err = fssim_full_path (sim, target, &full, NULL);
+    if (err == ERROR_SUCCESS)
+      substitute = fssim_join (L"\\??", 3, full, NULL);
+    else if (err == ERROR_BAD_NETPATH)
+      substitute = fssim_join (L"\\??\\UNC", 7, &target[2], NULL);
+    free (full);
+  }
+  node = substitute != NULL ? fssim_node_new (sim, r.volume, directory) : NULL;
+  if (node != NULL)
+  {
+    node->reparse = fssim_build_reparse (tag, substitute, target, relative, &node->reparse_size);
+    node->attributes |= FILE_ATTRIBUTE_REPARSE_POINT;
+  }
+  free (substitute);
+  if (node == NULL || node->reparse == NULL)
+  {
+    if (node != NULL)
+      fssim_node_release (node);
+    fssim_lookup_free (&r);
+    return fssim_fail (ERROR_NOT_ENOUGH_MEMORY);
+  }
+  err = fssim_link_at (sim, r.dir, r.index, r.name, node);
+  fssim_lookup_free (&r);
+  if (err != ERROR_SUCCESS)
+  {
+    fssim_node_release (node);
+    return fssim_fail (err);
+  }
+  return TRUE;
+}
+
+static BOOL
+sim_create_symbolic_link (ntlink_fssim *sim, LPCWSTR link, LPCWSTR target, DWORD flags)
+{
+  if (flags & ~(SYMBOLIC_LINK_FLAG_DIRECTORY | SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE))
+    return fssim_fail (ERROR_INVALID_PARAMETER);
+  if ((sim->flags & NTLINK_FSSIM_FLAG_NO_SYMLINK_PRIVILEGE) &&
+      !(flags & SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE))
+    return fssim_fail (ERROR_PRIVILEGE_NOT_HELD);
+  return sim_make_link (sim, link, target, IO_REPARSE_TAG_SYMLINK, (flags & SYMBOLIC_LINK_FLAG_DIRECTORY) != 0);
+}
+
+static DWORD
+sim_get_full_path_name (ntlink_fssim *sim, LPCWSTR path, DWORD size, LPWSTR buf, LPWSTR *filepart)
+{
+  wchar_t *full, *tmp;
+  int trailing;
+  DWORD r, err;
+
+  err = fssim_full_path (sim, path, &full, &trailing);
+  if (err != ERROR_SUCCESS)
+  {
+    SetLastError (err);
+    return 0;
+  }
+  if (trailing && full[3] != L'\0')
+  {
+    tmp = fssim_join (full, wcslen (full), NULL, NULL);
+    free (full);
+    full = tmp == NULL ? NULL : realloc (tmp, (wcslen (tmp) + 2) * sizeof (wchar_t));
+    if (full == NULL)
+    {
+      free (tmp);
+      SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+      return 0;
+    }
+    wcscat (full, L"\\");
+  }
+  r = fssim_copy_out (full, buf, size);
+  if (r < size && filepart != NULL)
+  {
+    wchar_t *sep = wcsrchr (buf, L'\\');
+    *filepart = sep != NULL && sep[1] != L'\0' ? sep + 1 : NULL;
+  }
+  free (full);
+  return r;
+}
+
+/*
+ * The backend. Each call is counted and delayed before the lock is taken,
+ * so that calls from several threads overlap like real I/O does.
+ */
+
+#define FSSIM_ENTER(op, fail) \
+  ntlink_fssim *sim = fssim_enter (op); \
+  if (sim == NULL) \
+    return fail
+
+static HANDLE WINAPI
+fssim_create_file (LPCWSTR path, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES sa, DWORD disposition, DWORD flags, HANDLE templ)
+{
+  HANDLE h;
+  FSSIM_ENTER (NTLINK_FS_CREATE_FILE, INVALID_HANDLE_VALUE);
+  AcquireSRWLockExclusive (&sim->lock);
+  h = sim_create_file (sim, path, access, disposition, flags);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return h;
+}
+
+static HANDLE WINAPI
+fssim_create_file_at (HANDLE dirhandle, LPCWSTR name, DWORD access, BOOL directory)
+{
+  HANDLE h;
+  FSSIM_ENTER (NTLINK_FS_CREATE_FILE_AT, INVALID_HANDLE_VALUE);
+  AcquireSRWLockExclusive (&sim->lock);
+  h = sim_create_file_at (sim, dirhandle, name, directory);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return h;
+}
+
+static BOOL WINAPI
+fssim_close_handle (HANDLE handle)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_CLOSE_HANDLE, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_close_handle (sim, handle);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_device_io_control (HANDLE handle, DWORD code, LPVOID in, DWORD insize, LPVOID out, DWORD outsize, LPDWORD returned, LPOVERLAPPED overlapped)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_DEVICE_IO_CONTROL, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_device_io_control (sim, handle, code, in, insize, out, outsize, returned);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_get_file_information_by_handle (HANDLE handle, LPBY_HANDLE_FILE_INFORMATION info)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_GET_FILE_INFORMATION_BY_HANDLE, FALSE);
+  AcquireSRWLockShared (&sim->lock);
+  r = sim_get_file_information_by_handle (sim, handle, info);
+  ReleaseSRWLockShared (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_get_file_information_by_handle_ex (HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_GET_FILE_INFORMATION_BY_HANDLE_EX, FALSE);
+  AcquireSRWLockShared (&sim->lock);
+  r = sim_get_file_information_by_handle_ex (sim, handle, cls, info, size);
+  ReleaseSRWLockShared (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_set_file_information_by_handle (HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_SET_FILE_INFORMATION_BY_HANDLE, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_set_file_information_by_handle (sim, handle, cls, info, size);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static DWORD WINAPI
+fssim_get_final_path_name_by_handle (HANDLE handle, LPWSTR buf, DWORD size, DWORD flags)
+{
+  DWORD r;
+  FSSIM_ENTER (NTLINK_FS_GET_FINAL_PATH_NAME_BY_HANDLE, 0);
+  AcquireSRWLockShared (&sim->lock);
+  r = sim_get_final_path_name_by_handle (sim, handle, buf, size, flags);
+  ReleaseSRWLockShared (&sim->lock);
+  return r;
+}
+
+static HANDLE WINAPI
+fssim_find_first_file (LPCWSTR pattern, LPWIN32_FIND_DATAW data)
+{
+  HANDLE h;
+  FSSIM_ENTER (NTLINK_FS_FIND_FIRST_FILE, INVALID_HANDLE_VALUE);
+  AcquireSRWLockShared (&sim->lock);
+  h = sim_find_first_file (sim, pattern, data);
+  ReleaseSRWLockShared (&sim->lock);
+  return h;
+}
+
+static HANDLE WINAPI
+fssim_find_first_file_ex (LPCWSTR pattern, FINDEX_INFO_LEVELS level, LPVOID data, FINDEX_SEARCH_OPS search, LPVOID filter, DWORD flags)
+{
+  HANDLE h;
+  FSSIM_ENTER (NTLINK_FS_FIND_FIRST_FILE_EX, INVALID_HANDLE_VALUE);
+  if ((level != FindExInfoStandard && level != FindExInfoBasic) ||
+      (search != FindExSearchNameMatch && search != FindExSearchLimitToDirectories) ||
+      filter != NULL || (flags & ~FIND_FIRST_EX_LARGE_FETCH) != 0 ||
+      ((sim->flags & NTLINK_FSSIM_FLAG_NO_BASIC_INFO) && (level == FindExInfoBasic || flags != 0)))
+  {
+    SetLastError (ERROR_INVALID_PARAMETER);
+    return INVALID_HANDLE_VALUE;
+  }
+  /* There are no short names, both levels return the same */
+  AcquireSRWLockShared (&sim->lock);
+  h = sim_find_first_file (sim, pattern, (WIN32_FIND_DATAW *) data);
+  ReleaseSRWLockShared (&sim->lock);
+  return h;
+}
+
+static BOOL WINAPI
+fssim_find_next_file (HANDLE handle, LPWIN32_FIND_DATAW data)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_FIND_NEXT_FILE, FALSE);
+  AcquireSRWLockShared (&sim->lock);
+  r = sim_find_next_file (sim, handle, data);
+  ReleaseSRWLockShared (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_find_close (HANDLE handle)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_FIND_CLOSE, FALSE);
+  if (fssim_handle_get (handle, FSSIM_HANDLE_FIND) == NULL)
+    return fssim_fail (ERROR_INVALID_HANDLE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_close_handle (sim, handle);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static DWORD WINAPI
+fssim_get_file_attributes (LPCWSTR path)
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_GET_FILE_ATTRIBUTES, INVALID_FILE_ATTRIBUTES);
+  AcquireSRWLockShared (&sim->lock);
+  r = sim_get_file_attributes_ex (sim, path, &data);
+  ReleaseSRWLockShared (&sim->lock);
+  return r ? data.dwFileAttributes : INVALID_FILE_ATTRIBUTES;
+}
+
+static BOOL WINAPI
+fssim_get_file_attributes_ex (LPCWSTR path, GET_FILEEX_INFO_LEVELS level, LPVOID data)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_GET_FILE_ATTRIBUTES_EX, FALSE);
+  if (level != GetFileExInfoStandard)
+    return fssim_fail (ERROR_INVALID_PARAMETER);
+  AcquireSRWLockShared (&sim->lock);
+  r = sim_get_file_attributes_ex (sim, path, (WIN32_FILE_ATTRIBUTE_DATA *) data);
+  ReleaseSRWLockShared (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_create_directory (LPCWSTR path, LPSECURITY_ATTRIBUTES sa)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_CREATE_DIRECTORY, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_create_directory (sim, path);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_remove_directory (LPCWSTR path)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_REMOVE_DIRECTORY, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_remove_directory (sim, path);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_delete_file (LPCWSTR path)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_DELETE_FILE, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_delete_file (sim, path);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_move_file_ex (LPCWSTR from, LPCWSTR to, DWORD flags)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_MOVE_FILE_EX, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_move_file_ex (sim, from, to, flags);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_create_hard_link (LPCWSTR link, LPCWSTR existing, LPSECURITY_ATTRIBUTES sa)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_CREATE_HARD_LINK, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_create_hard_link (sim, link, existing);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static BOOL WINAPI
+fssim_create_symbolic_link (LPCWSTR link, LPCWSTR target, DWORD flags)
+{
+  BOOL r;
+  FSSIM_ENTER (NTLINK_FS_CREATE_SYMBOLIC_LINK, FALSE);
+  AcquireSRWLockExclusive (&sim->lock);
+  r = sim_create_symbolic_link (sim, link, target, flags);
+  ReleaseSRWLockExclusive (&sim->lock);
+  return r;
+}
+
+static DWORD WINAPI
+fssim_get_full_path_name (LPCWSTR path, DWORD size, LPWSTR buf, LPWSTR *filepart)
+{
+  DWORD r;
+  FSSIM_ENTER (NTLINK_FS_GET_FULL_PATH_NAME, 0);
+  AcquireSRWLockShared (&sim->lock);
+  r = sim_get_full_path_name (sim, path, size, buf, filepart);
+  ReleaseSRWLockShared (&sim->lock);
+  return r;
+}
+
+static DWORD WINAPI
+fssim_get_current_directory (DWORD size, LPWSTR buf)
+{
+  DWORD r;
+  FSSIM_ENTER (NTLINK_FS_GET_CURRENT_DIRECTORY, 0);
+  AcquireSRWLockShared (&sim->lock);
+  r = fssim_copy_out (sim->cwd, buf, size);
+  ReleaseSRWLockShared (&sim->lock);
+  return r;
+}
+
+const ntlink_fs_backend ntlink_fssim_backend =
+{
+  "fssim",
+  fssim_create_file,
+  fssim_create_file_at,
+  fssim_close_handle,
+  fssim_device_io_control,
+  fssim_get_file_information_by_handle,
+  fssim_get_file_information_by_handle_ex,
+  fssim_set_file_information_by_handle,
+  fssim_get_final_path_name_by_handle,
+  fssim_find_first_file,
+  fssim_find_first_file_ex,
+  fssim_find_next_file,
+  fssim_find_close,
+  fssim_get_file_attributes,
+  fssim_get_file_attributes_ex,
+  fssim_create_directory,
+  fssim_remove_directory,
+  fssim_delete_file,
+  fssim_move_file_ex,
+  fssim_create_hard_link,
+  fssim_create_symbolic_link,
+  fssim_get_full_path_name,
+  fssim_get_current_directory,
+};
+
+/*
+ * Setting up
+ */
+
+/**
+ * ntlink_fssim_new:
+ * @flags: a combination of FssimFlags
+ *
+ * Creates an empty simulated filesystem with one volume, C:, which is
+ * also the current directory. Install it with ntlink_fssim_install().
+ * Free it with ntlink_fssim_free().
+ *
+ * Returns:
+ * NULL - out of memory
+ * non-NULL - the simulator
+ */
+ntlink_fssim *
+ntlink_fssim_new (FssimFlags flags)
+{
+  ntlink_fssim *sim = malloc (sizeof (ntlink_fssim));
+  if (sim == NULL)
+    return NULL;
+  memset (sim, 0, sizeof (ntlink_fssim));
+  InitializeSRWLock (&sim->lock);
+  sim->flags = flags;
+  sim->clock = FSSIM_EPOCH;
+  sim->cwd = wcsdup (L"C:\\");
+  if (sim->cwd == NULL || ntlink_fssim_add_volume (sim, L'C', 0x4E544C4B) != 0)
+  {
+    ntlink_fssim_free (sim);
+    return NULL;
+  }
+  return sim;
+}
+
+static void
+fssim_free_tree (fssim_node *node)
+{
+  size_t i;
+  for (i = 0; i < node->nchildren; i++)
+  {
+    fssim_node *child = node->children[i].node;
+    free (node->children[i].name);
+    if (child->attributes & FILE_ATTRIBUTE_DIRECTORY)
+      fssim_free_tree (child);
+    else if (--child->nlink == 0)
+    {
+      free (child->reparse);
+      free (child);
+    }
+  }
+  free (node->children);
+  free (node->reparse);
+  free (node);
+}
+
+/**
+ * ntlink_fssim_free:
+ * @sim: a simulator
+ *
+ * Frees @sim and everything in it. All handles must be closed, and @sim
+ * must not be installed.
+ */
+void
+ntlink_fssim_free (ntlink_fssim *sim)
+{
+  int i;
+  if (sim == NULL)
+    return;
+  if (fssim_active == sim)
+    ntlink_fssim_install (NULL);
+  for (i = 0; i < 26; i++)
+  {
+    if (sim->volumes[i] == NULL)
+      continue;
+    fssim_free_tree (sim->volumes[i]->root);
+    free (sim->volumes[i]);
+  }
+  free (sim->cwd);
+  free (sim);
+}
+
+/**
+ * ntlink_fssim_install:
+ * @sim: a simulator, or NULL
+ *
+ * Makes @sim the filesystem all calls go to (see ntlink_fs_set()).
+ * Only one simulator can be installed at a time.
+ * NULL switches back to the default backend.
+ */
+void
+ntlink_fssim_install (ntlink_fssim *sim)
+{
+  fssim_active = sim;
+  ntlink_fs_set (sim != NULL ? &ntlink_fssim_backend : NULL);
+}
+
+/**
+ * ntlink_fssim_add_volume:
+ * @sim: a simulator
+ * @letter: drive letter
+ * @serial: volume serial number
+ *
+ * Adds an empty volume to @sim. Hard links can't span volumes, and
+ * only files can be moved between them.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set)
+ */
+int
+ntlink_fssim_add_volume (ntlink_fssim *sim, wchar_t letter, DWORD serial)
+{
+  fssim_volume *volume;
+  letter = towupper (letter);
+  if (letter < L'A' || letter > L'Z')
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (sim->volumes[letter - L'A'] != NULL)
+  {
+    errno = EEXIST;
+    return -1;
+  }
+  volume = malloc (sizeof (fssim_volume));
+  if (volume == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  volume->letter = letter;
+  volume->serial = serial;
+  /* Low IDs are reserved for NTFS metadata files */
+  volume->next_id = 0x100;
+  volume->root = fssim_node_new (sim, volume, TRUE);
+  if (volume->root == NULL)
+  {
+    free (volume);
+    errno = ENOMEM;
+    return -1;
+  }
+  sim->volumes[letter - L'A'] = volume;
+  return 0;
+}
+
+/**
+ * ntlink_fssim_set_current_directory:
+ * @sim: a simulator
+ * @path: an existing directory
+ *
+ * Sets the directory relative paths are resolved against.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set)
+ */
+int
+ntlink_fssim_set_current_directory (ntlink_fssim *sim, const wchar_t *path)
+{
+  fssim_lookup_result r;
+  DWORD err;
+  AcquireSRWLockExclusive (&sim->lock);
+  err = fssim_lookup_existing (sim, path, TRUE, &r);
+  if (err == ERROR_SUCCESS && !(r.node->attributes & FILE_ATTRIBUTE_DIRECTORY))
+  {
+    fssim_lookup_free (&r);
+    err = ERROR_DIRECTORY;
+  }
+  if (err == ERROR_SUCCESS)
+  {
+    free (sim->cwd);
+    sim->cwd = r.full;
+    r.full = NULL;
+    fssim_lookup_free (&r);
+  }
+  ReleaseSRWLockExclusive (&sim->lock);
+  if (err != ERROR_SUCCESS)
+  {
+    errno = err == ERROR_DIRECTORY ? ENOTDIR : ENOENT;
+    return -1;
+  }
+  return 0;
+}
+
+/* Creates @path and its missing parents */
+static BOOL
+sim_create_directories (ntlink_fssim *sim, wchar_t *path)
+{
+  wchar_t *p;
+  DWORD attrs;
+  WIN32_FILE_ATTRIBUTE_DATA data;
+
+  if (sim_get_file_attributes_ex (sim, path, &data))
+  {
+    attrs = data.dwFileAttributes;
+    return (attrs & FILE_ATTRIBUTE_DIRECTORY) ? TRUE : fssim_fail (ERROR_ALREADY_EXISTS);
+  }
+  p = wcsrchr (path, L'\\');
+  if (p != NULL && p > path && p[-1] != L':')
+  {
+    BOOL r;
+    *p = L'\0';
+    r = sim_create_directories (sim, path);
+    *p = L'\\';
+    if (!r)
+      return FALSE;
+  }
+  return sim_create_directory (sim, path);
+}
+
+static wchar_t *
+fssim_utf8_to_wchar (const char *s)
+{
+  int len = MultiByteToWideChar (CP_UTF8, 0, s, -1, NULL, 0);
+  wchar_t *w;
+  if (len <= 0)
+    return NULL;
+  w = malloc (len * sizeof (wchar_t));
+  if (w != NULL && MultiByteToWideChar (CP_UTF8, 0, s, -1, w, len) != len)
+  {
+    free (w);
+    return NULL;
+  }
+  return w;
+}
+
+static int
+fssim_load_record (ntlink_fssim *sim, wchar_t *line)
+{
+  wchar_t type;
+  wchar_t *path, *arg = NULL, *tab, *full = NULL;
+  BOOL r = FALSE;
+  DWORD err;
+
+  type = line[0];
+  if (line[1] != L'\t')
+    return -1;
+  path = &line[2];
+  tab = wcschr (path, L'\t');
+  if (tab != NULL)
+  {
+    *tab = L'\0';
+    arg = tab + 1;
+  }
+  if (path[0] == L'\0')
+    return -1;
+
+  /* Times made after loading are later than the saved ones */
+  if (type == L'C')
+  {
+    LONGLONG clock = (LONGLONG) wcstoull (path, NULL, 10);
+    if (clock > sim->clock)
+      sim->clock = clock;
+    return 0;
+  }
+  /* Comes after the contents of the directory, which touched it */
+  if (type == L'T')
+  {
+    fssim_lookup_result lr;
+    if (arg == NULL || fssim_lookup_existing (sim, path, FALSE, &lr) != ERROR_SUCCESS)
+      return -1;
+    lr.node->mtime = (LONGLONG) wcstoull (arg, NULL, 10);
+    fssim_lookup_free (&lr);
+    return 0;
+  }
+
+  /* Volumes that are mentioned exist */
+  if (path[1] == L':' && fssim_volume_get (sim, path[0]) == NULL &&
+      ntlink_fssim_add_volume (sim, path[0], 0x4E544C4B + (DWORD) (towupper (path[0]) - L'C')) != 0)
+    return -1;
+  /* And so do the parents */
+  err = fssim_full_path (sim, path, &full, NULL);
+  if (err != ERROR_SUCCESS)
+    return -1;
+  if (wcsrchr (full, L'\\') != &full[2])
+  {
+    wchar_t *sep = wcsrchr (full, L'\\');
+    *sep = L'\0';
+    r = sim_create_directories (sim, full);
+    *sep = L'\\';
+    if (!r)
+    {
+      free (full);
+      return -1;
+    }
+  }
+
+  switch (type)
+  {
+  case L'D':
+    r = sim_create_directories (sim, full);
+    break;
+  case L'F':
+  {
+    HANDLE h = sim_create_file (sim, full, GENERIC_WRITE, CREATE_NEW, 0);
+    r = h != INVALID_HANDLE_VALUE;
+    if (r)
+    {
+      fssim_handle *fh = (fssim_handle *) h;
+      if (arg != NULL)
+        fh->node->size = wcstoull (arg, NULL, 10);
+      sim_close_handle (sim, h);
+    }
+    break;
+  }
+  case L'f':
+  case L'd':
+    r = arg != NULL && sim_make_link (sim, full, arg, IO_REPARSE_TAG_SYMLINK, type == L'd');
+    break;
+  case L'j':
+    r = arg != NULL && sim_make_link (sim, full, arg, IO_REPARSE_TAG_MOUNT_POINT, TRUE);
+    break;
+  case L'h':
+    r = arg != NULL && sim_create_hard_link (sim, full, arg);
+    break;
+  default:
+    break;
+  }
+  free (full);
+  return r ? 0 : -1;
+}
+
+/**
+ * ntlink_fssim_load:
+ * @sim: a simulator
+ * @f: a file to read from
+ *
+ * Creates objects described by @f in @sim. @f is UTF-8 text, one object
+ * per line, fields are separated by tabs:
+ *   D <path>                  a directory
+ *   F <path> [<size>]         a file
+ *   f <path> <target>         a file symlink
+ *   d <path> <target>         a directory symlink
+ *   j <path> <target>         a junction (@target must be absolute)
+ *   h <path> <existing>       a hard link to an existing file
+ *   T <path> <time>           last write time of an existing directory
+ *   C <time>                  the clock: later changes get later times
+ * Times are in 100ns units since 1601, like FILETIME.
+ * Missing parent directories and volumes are created. Empty lines and
+ * lines that start with '#' are skipped. Link targets are stored like
+ * CreateSymbolicLinkW() stores them, and are not checked.
+ * ntlink_fssim_save() writes files in this format.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to read @f or out of memory (errno is set)
+ *  n - line n (1-based) could not be applied (GetLastError() tells why)
+ */
+int
+ntlink_fssim_load (ntlink_fssim *sim, FILE *f)
+{
+  char buf[4096];
+  char *line = NULL;
+  size_t len = 0, lineno = 0;
+  int result = 0;
+
+  AcquireSRWLockExclusive (&sim->lock);
+  while (result == 0 && fgets (buf, sizeof (buf), f) != NULL)
+  {
+    size_t blen = strlen (buf);
+    char *tmp = realloc (line, len + blen + 1);
+    wchar_t *wline;
+    if (tmp == NULL)
+    {
+      errno = ENOMEM;
+      result = -1;
+      break;
+    }
+    line = tmp;
+    memcpy (&line[len], buf, blen + 1);
+    len += blen;
+    if (len == 0 || (line[len - 1] != '\n' && !feof (f)))
+      continue;
+    lineno += 1;
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    if (len > 0 && line[0] != '#')
+    {
+      wline = fssim_utf8_to_wchar (line);
+      if (wline == NULL || fssim_load_record (sim, wline) != 0)
+        result = (int) lineno;
+      free (wline);
+    }
+    len = 0;
+  }
+  if (result == 0 && ferror (f))
+  {
+    errno = EIO;
+    result = -1;
+  }
+  ReleaseSRWLockExclusive (&sim->lock);
+  free (line);
+  return result;
+}
+
+static int
+fssim_put (FILE *f, const wchar_t *s)
+{
+  int len = WideCharToMultiByte (CP_UTF8, 0, s, -1, NULL, 0, NULL, NULL);
+  char *buf;
+  int r;
+  if (len <= 0)
+    return -1;
+  buf = malloc (len);
+  if (buf == NULL)
+    return -1;
+  WideCharToMultiByte (CP_UTF8, 0, s, -1, buf, len, NULL, NULL);
+  r = fputs (buf, f) < 0 ? -1 : 0;
+  free (buf);
+  return r;
+}
+
+static int
+fssim_save_dir (FILE *f, fssim_node *dir, wchar_t *path, size_t pathlen, fssim_node ***saved, size_t *nsaved)
+{
+  size_t i;
+  for (i = 0; i < dir->nchildren; i++)
+  {
+    fssim_node *node = dir->children[i].node;
+    const wchar_t *name = dir->children[i].name;
+    size_t namelen = wcslen (name);
+    wchar_t *child = malloc ((pathlen + 1 + namelen + 1) * sizeof (wchar_t));
+    char type;
+    wchar_t *target = NULL, *substitute;
+    int r = 0;
+
+    if (child == NULL)
+      return -1;
+    memcpy (child, path, pathlen * sizeof (wchar_t));
+    child[pathlen] = L'\\';
+    memcpy (&child[pathlen + 1], name, (namelen + 1) * sizeof (wchar_t));
+
+    if (node->saved_as != NULL)
+    {
+      type = 'h';
+      target = wcsdup (node->saved_as);
+    }
+    else if (node->reparse != NULL && fssim_reparse_names (node->reparse, node->reparse_size, &substitute, &target, NULL) == 0)
+    {
+      /* Links made with an empty print name are saved by the substitute
+       * name, without the NT prefix
+       */
+      if (target[0] == L'\0')
+      {
+        free (target);
+        target = wcsdup (wcsncmp (substitute, L"\\??\\", 4) == 0 ? &substitute[4] : substitute);
+      }
+      free (substitute);
+      if (fssim_reparse_tag (node) == IO_REPARSE_TAG_MOUNT_POINT)
+        type = 'j';
+      else
+        type = (node->attributes & FILE_ATTRIBUTE_DIRECTORY) ? 'd' : 'f';
+    }
+    else
+      type = (node->attributes & FILE_ATTRIBUTE_DIRECTORY) ? 'D' : 'F';
+
+    fprintf (f, "%c\t", type);
+    r |= fssim_put (f, child);
+    if (target != NULL)
+    {
+      fputc ('\t', f);
+      r |= fssim_put (f, target);
+    }
+    else if (type == 'F' && node->size > 0)
+      fprintf (f, "\t%llu", (unsigned long long) node->size);
+    fputc ('\n', f);
+    free (target);
+
+    if (type == 'F' && node->nlink > 1)
+    {
+      fssim_node **tmp = realloc (*saved, (*nsaved + 1) * sizeof (fssim_node *));
+      if (tmp == NULL)
+        r = -1;
+      else
+      {
+        *saved = tmp;
+        (*saved)[(*nsaved)++] = node;
+        node->saved_as = child;
+        child = NULL;
+      }
+    }
+    if (r == 0 && type == 'D')
+    {
+      r = fssim_save_dir (f, node, child, pathlen + 1 + namelen, saved, nsaved);
+      fputs ("T\t", f);
+      r |= fssim_put (f, child);
+      fprintf (f, "\t%lld\n", (long long) node->mtime);
+    }
+    free (child);
+    if (r != 0)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * ntlink_fssim_save:
+ * @sim: a simulator
+ * @f: a file to write to
+ *
+ * Writes everything in @sim to @f, in the format ntlink_fssim_load()
+ * reads. Directories are listed before their contents, entries are in
+ * directory order, so the output only depends on the state of @sim.
+ * The clock and the last write times of directories are saved, so that
+ * incremental backups see the same directory times after loading; other
+ * times and file IDs are not.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure
+ */
+int
+ntlink_fssim_save (ntlink_fssim *sim, FILE *f)
+{
+  fssim_node **saved = NULL;
+  size_t nsaved = 0, i;
+  int r = 0, v;
+  wchar_t root[3];
+
+  AcquireSRWLockShared (&sim->lock);
+  fprintf (f, "C\t%lld\n", (long long) sim->clock);
+  for (v = 0; r == 0 && v < 26; v++)
+  {
+    if (sim->volumes[v] == NULL)
+      continue;
+    root[0] = sim->volumes[v]->letter;
+    root[1] = L':';
+    root[2] = L'\0';
+    r = fssim_save_dir (f, sim->volumes[v]->root, root, 2, &saved, &nsaved);
+  }
+  for (i = 0; i < nsaved; i++)
+  {
+    free (saved[i]->saved_as);
+    saved[i]->saved_as = NULL;
+  }
+  ReleaseSRWLockShared (&sim->lock);
+  free (saved);
+  if (r == 0 && ferror (f))
+    r = -1;
+  return r;
+}
+
+/**
+ * ntlink_fssim_set_latency:
+ * @sim: a simulator
+ * @op: the call to slow down, or NTLINK_FS_OP_COUNT for all of them
+ * @usec: time each call takes, in microseconds
+ *
+ * Makes calls of @op take @usec. The time is spent outside of the
+ * simulator lock, so calls from different threads overlap.
+ */
+void
+ntlink_fssim_set_latency (ntlink_fssim *sim, ntlink_fs_op op, unsigned int usec)
+{
+  int i;
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+    if (op == NTLINK_FS_OP_COUNT || (int) op == i)
+      sim->latency[i] = usec;
+}
+
+/**
+ * ntlink_fssim_get_counts:
+ * @sim: a simulator
+ * @counts: receives the number of calls made, indexed by ntlink_fs_op
+ *
+ * Calls that failed, including those with invalid arguments, are counted.
+ */
+void
+ntlink_fssim_get_counts (ntlink_fssim *sim, unsigned long counts[NTLINK_FS_OP_COUNT])
+{
+  int i;
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+    counts[i] = (unsigned long) InterlockedExchangeAdd (&sim->counts[i], 0);
+}
+
+/**
+ * ntlink_fssim_reset_counts:
+ * @sim: a simulator
+ *
+ * Sets all call counters to zero.
+ */
+void
+ntlink_fssim_reset_counts (ntlink_fssim *sim)
+{
+  int i;
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+    InterlockedExchange (&sim->counts[i], 0);
+}
+
+/**
+ * ntlink_fssim_print_counts:
+ * @sim: a simulator
+ * @f: a file to write to
+ *
+ * Writes the non-zero call counters and their total to @f, one per line.
+ */
+void
+ntlink_fssim_print_counts (ntlink_fssim *sim, FILE *f)
+{
+  unsigned long counts[NTLINK_FS_OP_COUNT], total = 0;
+  int i;
+  ntlink_fssim_get_counts (sim, counts);
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+  {
+    if (counts[i] == 0)
+      continue;
+    fprintf (f, "%-30s %lu\n", ntlink_fs_op_name ((ntlink_fs_op) i), counts[i]);
+    total += counts[i];
+  }
+  fprintf (f, "%-30s %lu\n", "total", total);
+}
+
+/**
+ * ntlink_fssim_open_handles:
+ * @sim: a simulator
+ *
+ * Returns:
+ * the number of file and find handles that are not closed yet
+ */
+long
+ntlink_fssim_open_handles (ntlink_fssim *sim)
+{
+  return InterlockedExchangeAdd (&sim->handles, 0);
+}
+
+/*
+ * The simulator that is used when none is installed (on platforms
+ * without Win32 that's always the case), configured from the environment:
+ *   NTLINK_FSSIM_TREE     a file to ntlink_fssim_load() from
+ *   NTLINK_FSSIM_CWD      the current directory
+ *   NTLINK_FSSIM_LATENCY  time each call takes, in microseconds
+ *   NTLINK_FSSIM_SAVE     a file to ntlink_fssim_save() to at exit
+ *   NTLINK_FSSIM_STATS    if set, call counters are printed to stderr at exit
+ */
+static ntlink_fssim *fssim_default = NULL;
+
+static void
+fssim_default_exit (void)
+{
+  ntlink_fssim *sim = fssim_default;
+  const char *save = getenv ("NTLINK_FSSIM_SAVE");
+  if (sim == NULL)
+    return;
+  if (save != NULL && save[0] != '\0')
+  {
+    FILE *f = fopen (save, "wb");
+    if (f == NULL || ntlink_fssim_save (sim, f) != 0)
+      fprintf (stderr, "fssim: failed to save the tree to `%s'\n", save);
+    if (f != NULL)
+      fclose (f);
+  }
+  if (getenv ("NTLINK_FSSIM_STATS") != NULL)
+    ntlink_fssim_print_counts (sim, stderr);
+}
+
+static ntlink_fssim *
+fssim_default_new (void)
+{
+  ntlink_fssim *sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+  const char *tree = getenv ("NTLINK_FSSIM_TREE");
+  const char *cwd = getenv ("NTLINK_FSSIM_CWD");
+  const char *latency = getenv ("NTLINK_FSSIM_LATENCY");
+
+  if (sim == NULL)
+    return NULL;
+  if (tree != NULL && tree[0] != '\0')
+  {
+    FILE *f = fopen (tree, "rb");
+    int r = f != NULL ? ntlink_fssim_load (sim, f) : -1;
+    if (r != 0)
+      fprintf (stderr, "fssim: failed to load `%s' (%d)\n", tree, r);
+    if (f != NULL)
+      fclose (f);
+  }
+  if (cwd != NULL && cwd[0] != '\0')
+  {
+    wchar_t *wcwd = fssim_utf8_to_wchar (cwd);
+    if (wcwd == NULL || ntlink_fssim_set_current_directory (sim, wcwd) != 0)
+      fprintf (stderr, "fssim: can't change into `%s'\n", cwd);
+    free (wcwd);
+  }
+  if (latency != NULL)
+    ntlink_fssim_set_latency (sim, NTLINK_FS_OP_COUNT, (unsigned int) strtoul (latency, NULL, 10));
+  return sim;
+}
+
+static ntlink_fssim *
+fssim_current (void)
+{
+  ntlink_fssim *sim = fssim_active;
+  if (sim != NULL)
+    return sim;
+  sim = fssim_default;
+  if (sim != NULL)
+    return sim;
+  sim = fssim_default_new ();
+  if (sim == NULL)
+    return NULL;
+  if (InterlockedCompareExchangePointer ((PVOID *) &fssim_default, sim, NULL) != NULL)
+  {
+    /* Another thread was first */
+    ntlink_fssim_free (sim);
+    return fssim_default;
+  }
+  atexit (fssim_default_exit);
+  return sim;
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_FSSIM_H__
+#define __NTLINK_FSSIM_H__
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "fsbackend.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * FssimFlags:
+ * @NTLINK_FSSIM_FLAG_NONE: behave like NTFS on Windows 10 with
+ *   SeCreateSymbolicLinkPrivilege held
+ * @NTLINK_FSSIM_FLAG_NO_SYMLINK_PRIVILEGE: creating symlinks fails with
+ *   ERROR_PRIVILEGE_NOT_HELD, unless CreateSymbolicLinkW() is given
+ *   SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE (developer mode)
+ * @NTLINK_FSSIM_FLAG_NO_POSIX_DELETE: FileDispositionInfoEx is rejected,
+ *   like before Windows 10 1607
+ * @NTLINK_FSSIM_FLAG_NO_BASIC_INFO: FindExInfoBasic and
+ *   FIND_FIRST_EX_LARGE_FETCH are rejected, like before Windows 7
+ */
+typedef enum
+{
+  NTLINK_FSSIM_FLAG_NONE                 = 0x00000000,
+  NTLINK_FSSIM_FLAG_NO_SYMLINK_PRIVILEGE = 0x00000001,
+  NTLINK_FSSIM_FLAG_NO_POSIX_DELETE      = 0x00000002,
+  NTLINK_FSSIM_FLAG_NO_BASIC_INFO        = 0x00000004,
+} FssimFlags;
+
+typedef struct _ntlink_fssim ntlink_fssim;
+
+/* Calls go to the simulator installed with ntlink_fssim_install() */
+extern const ntlink_fs_backend ntlink_fssim_backend;
+
+ntlink_fssim *ntlink_fssim_new (FssimFlags flags);
+void ntlink_fssim_free (ntlink_fssim *sim);
+void ntlink_fssim_install (ntlink_fssim *sim);
+
+int ntlink_fssim_add_volume (ntlink_fssim *sim, wchar_t letter, DWORD serial);
+int ntlink_fssim_set_current_directory (ntlink_fssim *sim, const wchar_t *path);
+int ntlink_fssim_load (ntlink_fssim *sim, FILE *f);
+int ntlink_fssim_save (ntlink_fssim *sim, FILE *f);
+
+void ntlink_fssim_set_latency (ntlink_fssim *sim, ntlink_fs_op op, unsigned int usec);
+void ntlink_fssim_get_counts (ntlink_fssim *sim, unsigned long counts[NTLINK_FS_OP_COUNT]);
+void ntlink_fssim_reset_counts (ntlink_fssim *sim);
+void ntlink_fssim_print_counts (ntlink_fssim *sim, FILE *f);
+long ntlink_fssim_open_handles (ntlink_fssim *sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_FSSIM_H__ */
@@ -0,0 +1,550 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <windows.h>
+
+#include "iosched.h"
+#include "fsbackend.h"
+#include "alloc.h"
+#include "stats.h"
+
+/* The limit shrinks to that much of itself when the volume slows down */
+#define IO_BACKOFF 0.75
+
+typedef struct _io_request io_request;
+
+struct _io_request
+{
+  io_request *next;
+  ntlink_io_queue *queue;
+  ntlink_task_group *group;
+  ntlink_task_func func;
+  void *arg;
+  unsigned int cost;
+  /* Performance counter ticks the task spent not waiting for the volume */
+  LONGLONG idle;
+};
+
+struct _ntlink_io_queue
+{
+  ntlink_io_queue *next;
+  wchar_t *root;
+  DWORD serial;
+  int unc;
+  CRITICAL_SECTION lock;
+  double limit;
+  int inflight;
+  int waiting;
+  io_request *head;
+  io_request *tail;
+  /* Microseconds per unit of cost */
+  double latency;
+  double baseline;
+  /* Completions since the limit was last looked at */
+  int window;
+  unsigned long long completed;
+  unsigned long long backoffs;
+};
+
+static ntlink_io_settings io_settings = { 1, 4, 64, 2.0 };
+
+/* Protects the list of queues and io_drives */
+static SRWLOCK io_lock;
+static ntlink_io_queue *io_queues = NULL;
+static ntlink_io_queue * volatile io_drives[26];
+static LONGLONG io_freq = 0;
+
+/* The io_request being run by the current thread */
+static DWORD io_request_index = FLS_OUT_OF_INDEXES;
+
+/**
+ * ntlink_io_configure:
+ * @settings: new settings
+ *
+ * Changes the settings of the I/O scheduler. New limits apply to queues
+ * that are created afterwards, and to the growth of the existing ones.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - invalid settings (errno is EINVAL)
+ */
+int
+ntlink_io_configure (const ntlink_io_settings *settings)
+{
+  if (settings == NULL || settings->initial_limit < 1 ||
+      settings->max_limit < settings->initial_limit ||
+      settings->latency_factor <= 1.0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  io_settings = *settings;
+  return 0;
+}
+
+/**
+ * ntlink_io_get_settings:
+ * @settings: receives the settings
+ */
+void
+ntlink_io_get_settings (ntlink_io_settings *settings)
+{
+  *settings = io_settings;
+}
+
+static ntlink_io_queue *
+io_queue_new (const wchar_t *root, size_t rootlen, DWORD serial, int unc)
+{
+  ntlink_io_queue *queue;
+  LARGE_INTEGER freq;
+
+  if (io_request_index == FLS_OUT_OF_INDEXES)
+  {
+    io_request_index = FlsAlloc (NULL);
+    if (io_request_index == FLS_OUT_OF_INDEXES)
+      return NULL;
+    QueryPerformanceFrequency (&freq);
+    io_freq = freq.QuadPart;
+  }
+
+  queue = (ntlink_io_queue *) ntlink_calloc (1, sizeof (ntlink_io_queue));
+  if (queue == NULL)
+    return NULL;
+  queue->root = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (rootlen + 1));
+  if (queue->root == NULL)
+  {
+    ntlink_free (queue);
+    return NULL;
+  }
+  memcpy (queue->root, root, sizeof (wchar_t) * rootlen);
+  queue->root[rootlen] = L'\0';
+  queue->serial = serial;
+  queue->unc = unc;
+  queue->limit = io_settings.initial_limit;
+  InitializeCriticalSection (&queue->lock);
+  queue->next = io_queues;
+  io_queues = queue;
+  return queue;
+}
+
+static ntlink_io_queue *
+io_drive_queue (wchar_t letter)
+{
+  ntlink_io_queue *queue;
+  int index = letter - L'A';
+  wchar_t root[4] = { letter, L':', L'\\', L'\0' };
+  BY_HANDLE_FILE_INFORMATION info;
+  HANDLE h;
+  DWORD serial = 0;
+
+  queue = io_drives[index];
+  if (queue != NULL)
+    return queue;
+
+  h = ntlink_fs->create_file (root, FILE_READ_ATTRIBUTES,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (h != INVALID_HANDLE_VALUE)
+  {
+    if (ntlink_fs->get_file_information_by_handle (h, &info))
+      serial = info.dwVolumeSerialNumber;
+    ntlink_fs->close_handle (h);
+  }
+
+  AcquireSRWLockExclusive (&io_lock);
+  queue = io_drives[index];
+  /* Letters of the same volume share its queue */
+  if (queue == NULL && serial != 0)
+    for (queue = io_queues; queue != NULL && (queue->unc || queue->serial != serial); queue = queue->next);
+  if (queue == NULL)
+    queue = io_queue_new (root, 2, serial, 0);
+  if (queue != NULL)
+    io_drives[index] = queue;
+  ReleaseSRWLockExclusive (&io_lock);
+  return queue;
+}
+
+static ntlink_io_queue *
+io_unc_queue (const wchar_t *root, size_t rootlen)
+{
+  ntlink_io_queue *queue;
+
+  AcquireSRWLockShared (&io_lock);
+  for (queue = io_queues; queue != NULL; queue = queue->next)
+    if (queue->unc && wcslen (queue->root) == rootlen && _wcsnicmp (queue->root, root, rootlen) == 0)
+      break;
+  ReleaseSRWLockShared (&io_lock);
+  if (queue != NULL)
+    return queue;
+
+  AcquireSRWLockExclusive (&io_lock);
+  for (queue = io_queues; queue != NULL; queue = queue->next)
+    if (queue->unc && wcslen (queue->root) == rootlen && _wcsnicmp (queue->root, root, rootlen) == 0)
+      break;
+  if (queue == NULL)
+    queue = io_queue_new (root, rootlen, 0, 1);
+  ReleaseSRWLockExclusive (&io_lock);
+  return queue;
+}
+
+/**
+ * ntlink_io_queue_get:
+ * @path: a name on the volume, absolute or relative to the current
+ *   directory; "\\?\" names are accepted
+ *
+ * Finds the queue of the volume (by its serial number) or of the network
+ * share @path is on, creating it if there's none. Only the root of @path
+ * is looked at: names that cross into another volume through a mount
+ * point are still counted against the first one.
+ *
+ * Returns:
+ * NULL - the scheduler is disabled, or the volume can't be told
+ * non-NULL - the queue
+ */
+ntlink_io_queue *
+ntlink_io_queue_get (const wchar_t *path)
+{
+  wchar_t cwd[MAX_PATH];
+  const wchar_t *p = path, *server = NULL, *share, *end;
+  wchar_t *root;
+  ntlink_io_queue *queue;
+  size_t len, i;
+
+  if (!io_settings.enabled || path == NULL)
+    return NULL;
+
+  if (wcsncmp (p, L"\\\\?\\", 4) == 0)
+  {
+    p += 4;
+    if (_wcsnicmp (p, L"UNC\\", 4) == 0)
+      server = p + 4;
+    else if (p[0] == L'\0' || p[1] != L':')
+      return NULL;
+  }
+  else if ((p[0] == L'\\' || p[0] == L'/') && (p[1] == L'\\' || p[1] == L'/'))
+    server = p + 2;
+  else if (p[0] == L'\0' || p[1] != L':')
+  {
+    /* Relative or root-relative, it is on the volume of the current directory */
+    DWORD cwdlen = ntlink_fs->get_current_directory (MAX_PATH, cwd);
+    if (cwdlen == 0 || cwdlen >= MAX_PATH ||
+        (cwd[1] != L':' && (cwd[0] != L'\\' || cwd[1] != L'\\')))
+      return NULL;
+    return ntlink_io_queue_get (cwd);
+  }
+
+  if (server == NULL)
+  {
+    wchar_t letter = towupper (p[0]);
+    if (p[1] != L':' || letter < L'A' || letter > L'Z')
+      return NULL;
+    return io_drive_queue (letter);
+  }
+
+  /* The key is "\\server\share", with backslashes */
+  for (end = server; *end != L'\0' && *end != L'\\' && *end != L'/'; end++);
+  if (end == server || *end == L'\0')
+    return NULL;
+  share = end + 1;
+  for (end = share; *end != L'\0' && *end != L'\\' && *end != L'/'; end++);
+  if (end == share)
+    return NULL;
+  len = 2 + (end - server);
+  root = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (len + 1));
+  if (root == NULL)
+    return NULL;
+  root[0] = root[1] = L'\\';
+  memcpy (&root[2], server, sizeof (wchar_t) * (end - server));
+  root[len] = L'\0';
+  for (i = 2; i < len; i++)
+    if (root[i] == L'/')
+      root[i] = L'\\';
+  queue = io_unc_queue (root, len);
+  ntlink_free (root);
+  return queue;
+}
+
+/* Called with the queue locked after each task; adjusts the limit once
+ * per round of tasks, by the latency observed during that round.
+ */
+static void
+io_adjust (ntlink_io_queue *queue, double sample)
+{
+  if (queue->completed == 0)
+  {
+    queue->latency = sample;
+    queue->baseline = sample;
+  }
+  else
+  {
+    queue->latency += (sample - queue->latency) / 8;
+    /* A minimum that is forgotten slowly, in case the volume gets slower for good */
+    if (sample < queue->baseline)
+      queue->baseline = sample;
+    else
+      queue->baseline += (sample - queue->baseline) / 1024;
+  }
+  queue->completed += 1;
+  queue->window += 1;
+  if (queue->window < (int) queue->limit)
+    return;
+  queue->window = 0;
+
+  if (queue->latency > queue->baseline * io_settings.latency_factor)
+  {
+    queue->limit *= IO_BACKOFF;
+    if (queue->limit < 1)
+      queue->limit = 1;
+    queue->backoffs += 1;
+  }
+  /* Only grow while the limit is what holds the tasks back */
+  else if (queue->head != NULL && queue->limit + 1 <= io_settings.max_limit)
+    queue->limit += 1;
+}
+
+static void io_run (void *arg);
+
+static void
+io_dispatch (io_request *req)
+{
+  ntlink_task_group *group = req->group;
+  if (ntlink_task_group_submit (group, io_run, req) != 0)
+    io_run (req);
+  ntlink_task_group_release (group);
+}
+
+static void
+io_run (void *arg)
+{
+  io_request *req = (io_request *) arg;
+  ntlink_io_queue *queue = req->queue;
+  io_request *ready = NULL, **last = &ready, *outer;
+  LARGE_INTEGER start, end;
+
+  outer = (io_request *) FlsGetValue (io_request_index);
+  FlsSetValue (io_request_index, req);
+  QueryPerformanceCounter (&start);
+  req->func (req->arg);
+  QueryPerformanceCounter (&end);
+  FlsSetValue (io_request_index, outer);
+  end.QuadPart -= req->idle;
+  if (end.QuadPart < start.QuadPart)
+    end.QuadPart = start.QuadPart;
+
+  EnterCriticalSection (&queue->lock);
+  queue->inflight -= 1;
+  io_adjust (queue, (double) (end.QuadPart - start.QuadPart) * 1000000.0 / io_freq / req->cost);
+  while (queue->head != NULL && queue->inflight < (int) queue->limit)
+  {
+    *last = queue->head;
+    last = &queue->head->next;
+    queue->head = queue->head->next;
+    queue->inflight += 1;
+    queue->waiting -= 1;
+  }
+  *last = NULL;
+  if (queue->head == NULL)
+    queue->tail = NULL;
+  LeaveCriticalSection (&queue->lock);
+  ntlink_free (req);
+
+  while (ready != NULL)
+  {
+    io_request *next = ready->next;
+    io_dispatch (ready);
+    ready = next;
+  }
+}
+
+/**
+ * ntlink_io_submit:
+ * @queue: a queue from ntlink_io_queue_get(), or NULL
+ * @group: the group to run the task in
+ * @cost: roughly how many filesystem calls the task makes (at least 1);
+ *   latencies are compared per unit of cost
+ * @func: function to run
+ * @arg: argument for @func
+ *
+ * Queues @func (@arg) on @queue. It is submitted to @group as soon as
+ * the limit of @queue allows, and ntlink_task_group_wait() on @group
+ * waits for it meanwhile. With a NULL @queue it is submitted to @group
+ * right away. Can be called from within a task.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+ntlink_io_submit (ntlink_io_queue *queue, ntlink_task_group *group, unsigned int cost, ntlink_task_func func, void *arg)
+{
+  io_request *req;
+
+  if (queue == NULL)
+    return ntlink_task_group_submit (group, func, arg);
+
+  req = (io_request *) ntlink_malloc (sizeof (io_request));
+  if (req == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  req->next = NULL;
+  req->queue = queue;
+  req->group = group;
+  req->func = func;
+  req->arg = arg;
+  req->cost = cost > 0 ? cost : 1;
+  req->idle = 0;
+
+  ntlink_task_group_hold (group);
+  EnterCriticalSection (&queue->lock);
+  if (queue->inflight < (int) queue->limit)
+  {
+    queue->inflight += 1;
+    LeaveCriticalSection (&queue->lock);
+    io_dispatch (req);
+    return 0;
+  }
+  if (queue->tail != NULL)
+    queue->tail->next = req;
+  else
+    queue->head = req;
+  queue->tail = req;
+  queue->waiting += 1;
+  LeaveCriticalSection (&queue->lock);
+
+  return 0;
+}
+
+/**
+ * ntlink_io_add_cost:
+ * @cost: additional cost
+ *
+ * Adds to the cost of the ntlink_io_submit() task that is running in this
+ * thread, for tasks that find out how much they have to do as they go.
+ * Does nothing elsewhere.
+ */
+void
+ntlink_io_add_cost (unsigned int cost)
+{
+  io_request *req;
+  if (io_request_index == FLS_OUT_OF_INDEXES)
+    return;
+  req = (io_request *) FlsGetValue (io_request_index);
+  if (req != NULL)
+    req->cost += cost;
+}
+
+/**
+ * ntlink_io_add_idle:
+ * @ticks: performance counter ticks (see QueryPerformanceCounter())
+ *
+ * Tells the scheduler that the ntlink_io_submit() task running in this
+ * thread spent @ticks waiting for something other than the volume (such
+ * as a rate limit, see ntlink_throttle_new()), so that the wait is not
+ * taken for a slow volume. Does nothing elsewhere.
+ */
+void
+ntlink_io_add_idle (LONGLONG ticks)
+{
+  io_request *req;
+  if (io_request_index == FLS_OUT_OF_INDEXES)
+    return;
+  req = (io_request *) FlsGetValue (io_request_index);
+  if (req != NULL)
+    req->idle += ticks;
+}
+
+/**
+ * ntlink_io_get_info:
+ * @info: an array to fill, can be NULL if @count is 0
+ * @count: number of elements in @info
+ *
+ * Describes the queues, the most recently created first.
+ *
+ * Returns:
+ * the number of queues (which can be larger than @count)
+ */
+int
+ntlink_io_get_info (ntlink_io_queue_info *info, int count)
+{
+  ntlink_io_queue *queue;
+  int n = 0;
+
+  AcquireSRWLockShared (&io_lock);
+  for (queue = io_queues; queue != NULL; queue = queue->next, n++)
+  {
+    if (n >= count)
+      continue;
+    EnterCriticalSection (&queue->lock);
+    info[n].root = queue->root;
+    info[n].serial = queue->serial;
+    info[n].limit = (int) queue->limit;
+    info[n].inflight = queue->inflight;
+    info[n].waiting = queue->waiting;
+    info[n].latency_us = queue->latency;
+    info[n].baseline_us = queue->baseline;
+    info[n].completed = queue->completed;
+    info[n].backoffs = queue->backoffs;
+    LeaveCriticalSection (&queue->lock);
+  }
+  ReleaseSRWLockShared (&io_lock);
+  return n;
+}
+
+/**
+ * ntlink_io_print_stats:
+ * @f: a file to write to
+ *
+ * Writes a table of the queues with their limits and latencies.
+ * Works with both narrow and wide streams. Prints nothing if there
+ * are no queues.
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int
+ntlink_io_print_stats (FILE *f)
+{
+  ntlink_io_queue_info *info;
+  int n, i, r = 0;
+
+  n = ntlink_io_get_info (NULL, 0);
+  if (n == 0)
+    return 0;
+  info = (ntlink_io_queue_info *) ntlink_malloc (sizeof (ntlink_io_queue_info) * n);
+  if (info == NULL)
+    return -1;
+  n = ntlink_io_get_info (info, n);
+  r |= ntlink_stats_print_line (f, "%-24s %9s %6s %9s %8s %12s %12s %10s %9s\n",
+      "volume", "serial", "limit", "inflight", "waiting", "latency_us", "baseline_us", "completed", "backoffs");
+  for (i = 0; i < n; i++)
+    r |= ntlink_stats_print_line (f, "%-24.24ls %04X-%04X %6d %9d %8d %12.1f %12.1f %10llu %9llu\n",
+        info[i].root, (unsigned) (info[i].serial >> 16), (unsigned) (info[i].serial & 0xFFFF),
+        info[i].limit, info[i].inflight, info[i].waiting, info[i].latency_us,
+        info[i].baseline_us, info[i].completed, info[i].backoffs);
+  ntlink_free (info);
+  return r;
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_IOSCHED_H__
+#define __NTLINK_IOSCHED_H__
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ntlink_io_queue:
+ *
+ * The queue of one volume (a drive letter, or several letters with the
+ * same volume serial number) or of one network share ("\\server\share").
+ * Tasks submitted to it with ntlink_io_submit() run in their task group,
+ * but only so many at once: each queue has a concurrency limit of its own,
+ * which grows while the tasks run at the volume's usual speed and shrinks
+ * as soon as they slow down (additive increase, multiplicative decrease).
+ * Queues live until the process exits.
+ */
+typedef struct _ntlink_io_queue ntlink_io_queue;
+
+/**
+ * ntlink_io_settings:
+ * @enabled: if 0, ntlink_io_queue_get() returns NULL and tasks are
+ *   submitted to their groups directly
+ * @initial_limit: concurrency limit of a new queue
+ * @max_limit: the limit never grows past this
+ * @latency_factor: the limit shrinks when the latency of the tasks
+ *   exceeds the lowest latency seen on the volume that many times
+ *
+ * Defaults: enabled, 4, 64, 2.0.
+ */
+typedef struct
+{
+  int enabled;
+  int initial_limit;
+  int max_limit;
+  double latency_factor;
+} ntlink_io_settings;
+
+/**
+ * ntlink_io_queue_info:
+ * @root: "X:" or "\\server\share"
+ * @serial: volume serial number, 0 for shares and unknown volumes
+ * @limit: current concurrency limit
+ * @inflight: tasks in the pool
+ * @waiting: tasks waiting for the limit
+ * @latency_us: recent latency per unit of cost, in microseconds
+ * @baseline_us: lowest latency per unit of cost seen lately
+ * @completed: tasks finished
+ * @backoffs: times the limit was decreased
+ */
+typedef struct
+{
+  const wchar_t *root;
+  DWORD serial;
+  int limit;
+  int inflight;
+  int waiting;
+  double latency_us;
+  double baseline_us;
+  unsigned long long completed;
+  unsigned long long backoffs;
+} ntlink_io_queue_info;
+
+int ntlink_io_configure (const ntlink_io_settings *settings);
+void ntlink_io_get_settings (ntlink_io_settings *settings);
+ntlink_io_queue *ntlink_io_queue_get (const wchar_t *path);
+int ntlink_io_submit (ntlink_io_queue *queue, ntlink_task_group *group, unsigned int cost, ntlink_task_func func, void *arg);
+void ntlink_io_add_cost (unsigned int cost);
+void ntlink_io_add_idle (LONGLONG ticks);
+int ntlink_io_get_info (ntlink_io_queue_info *info, int count);
+int ntlink_io_print_stats (FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_IOSCHED_H__ */
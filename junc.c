@@ -1,85 +1,462 @@
-/*
- * This file is part of libntlink.
- * Copyright (c) 2010, LRN
- *
- * libntlink is free software: you can redistribute it and/or modify
- * it under the terms of the GNU Lesser General Public License
- * as published by the Free Software Foundation, either version 3
- * of the License, or (at your option) any later version.
- *
- * libntlink is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU Lesser General Public License for more details.
- *
- * You should have received a copy of
- * the GNU Lesser General Public License and the GNU General Public License
- * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-
-#include "quasisymlink.h"
-
-void usage (char **argv)
-{
-    printf (
-"\
-Usage: %s <operation> [arguments ...]\n\
-Operations:\n\
-  l - link\n\
-    arguments - <link destination> <link name>\n\
-  u - unlink\n\
-    arguments - <link name>\n\
-  i - link information\n\
-    arguments - <link name>\n\
-", argv[0]);
-}
-
-int
-main (int argc, char **argv)
-{
-  if (argc < 2)
-  {
-    if (argc > 0)
-      usage (argv);
-    return 1;
-  }
-  if (strcmp (argv[1],"l") == 0)
-  {
-    if (argc < 4)
-    {
-      usage (argv);
-      return 1;
-    }
-    return ntlink_symlink (argv[2], argv[3]);
-  }
-  else if (strcmp (argv[1],"u") == 0)
-  {
-    if (argc < 3)
-    {
-      usage (argv);
-      return 1;
-    }
-    return ntlink_unlink (argv[2]);
-  }
-  else if (strcmp (argv[1],"i") == 0)
-  {
-    char buffer[1024];
-    int read_ret;
-    if (argc < 3)
-    {
-      usage (argv);
-      return 1;
-    }
-    read_ret = ntlink_readlink (argv[2], buffer, 1024);
-    if (read_ret > 0)
-      buffer[read_ret] = 0;
-    printf ("%s\n", buffer);
-    return 0;
-  }
-  usage (argv);
-  return 1;
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2010, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <io.h>
+#include <fcntl.h>
+
+#include "quasisymlink.h"
+#include "threadpool.h"
+#include "extra_string.h"
+#include "stats.h"
+#include "trace.h"
+#include "alloc.h"
+
+/* Batch mode reads and runs this many operations at a time */
+#define JUNC_BATCH_CHUNK 4096
+
+void usage (char **argv)
+{
+    printf (
+"\
+Usage: %s [S] [T <file>] <operation> [arguments ...]\n\
+  S - print call counts and latencies to stderr at exit\n\
+  T <file> - record the calls made into <file>, for replay\n\
+Operations:\n\
+  l - link\n\
+    arguments - <link destination> <link name>\n\
+  u - unlink\n\
+    arguments - <link name>\n\
+  i - link information\n\
+    arguments - <link name>\n\
+  b - batch: run many operations in one process\n\
+    arguments - [<file>] [0] [t <threads>]\n\
+    Reads operations from <file> (or from stdin if it's missing or `-'),\n\
+    one per line, or one per NUL-terminated record with `0'. The fields of\n\
+    an operation are separated by tabs: `l<TAB>destination<TAB>name',\n\
+    `u<TAB>name' or `i<TAB>name'. Empty lines and lines starting with `#'\n\
+    are skipped. With `t' operations run in <threads> threads (0 - one per\n\
+    CPU); operations on the same link name still run in their order.\n\
+    For each operation prints `<line> ok [<link destination>]' or\n\
+    `<line> failed <errno> <message>', in input order. Exits with 0 if all\n\
+    operations succeeded, 3 if some failed, 2 if <file> can't be read.\n\
+", argv[0]);
+}
+
+typedef struct
+{
+  char *record;
+  unsigned long line;
+  char op;
+  char *args[2];
+  int nargs;
+  /* 0 or an errno value */
+  int status;
+  /* link destination, for `i' */
+  char *info;
+} junc_op;
+
+typedef struct
+{
+  junc_op **ops;
+  size_t count;
+} junc_group;
+
+/*
+ * Reads one record terminated by @delim (or by the end of the file) into
+ * a newly allocated string. Returns 1 on success, 0 at the end of the file,
+ * -1 if out of memory.
+ */
+static int
+read_record (FILE *f, int delim, char **record)
+{
+  size_t len = 0, cap = 128;
+  char *buf = (char *) malloc (cap);
+  int c;
+  if (buf == NULL)
+    return -1;
+  while ((c = getc (f)) != EOF && c != delim)
+  {
+    if (len + 1 == cap)
+    {
+      char *tmp = (char *) realloc (buf, cap * 2);
+      if (tmp == NULL)
+      {
+        free (buf);
+        return -1;
+      }
+      buf = tmp;
+      cap *= 2;
+    }
+    buf[len++] = (char) c;
+  }
+  if (c == EOF && len == 0)
+  {
+    free (buf);
+    return 0;
+  }
+  if (delim == '\n' && len > 0 && buf[len - 1] == '\r')
+    len -= 1;
+  buf[len] = '\0';
+  *record = buf;
+  return 1;
+}
+
+/* Splits a record into fields. Returns 0 if it is a valid operation */
+static int
+parse_op (junc_op *op)
+{
+  char *fields[4];
+  int n = 0;
+  char *p = op->record;
+  while (n < 4)
+  {
+    fields[n++] = p;
+    p = strchr (p, '\t');
+    if (p == NULL)
+      break;
+    *p++ = '\0';
+  }
+  if (p != NULL || strlen (fields[0]) != 1)
+    return -1;
+  op->op = fields[0][0];
+  op->nargs = n - 1;
+  op->args[0] = n > 1 ? fields[1] : NULL;
+  op->args[1] = n > 2 ? fields[2] : NULL;
+  switch (op->op)
+  {
+  case 'l':
+    return n == 3 && fields[1][0] != '\0' && fields[2][0] != '\0' ? 0 : -1;
+  case 'u':
+  case 'i':
+    return n == 2 && fields[1][0] != '\0' ? 0 : -1;
+  default:
+    return -1;
+  }
+}
+
+/* The link name an operation works on */
+static const char *
+op_name (const junc_op *op)
+{
+  return op->args[op->nargs - 1];
+}
+
+static void
+run_op (junc_op *op)
+{
+  char buffer[1024];
+  int r;
+  if (op->status != 0)
+    return;
+  errno = 0;
+  switch (op->op)
+  {
+  case 'l':
+    r = ntlink_symlink (op->args[0], op->args[1]);
+    break;
+  case 'u':
+    r = ntlink_unlink (op->args[0]);
+    break;
+  default:
+    r = ntlink_readlink (op->args[0], buffer, sizeof (buffer) - 1);
+    if (r >= 0)
+    {
+      buffer[r] = '\0';
+      op->info = strdup (buffer);
+      r = 0;
+    }
+    break;
+  }
+  if (r != 0)
+    op->status = errno != 0 ? errno : EIO;
+}
+
+static void
+run_group (void *arg)
+{
+  junc_group *group = (junc_group *) arg;
+  size_t i;
+  for (i = 0; i < group->count; i++)
+    run_op (group->ops[i]);
+}
+
+static int
+op_name_cmp (const void *a, const void *b)
+{
+  const junc_op *oa = *(const junc_op **) a;
+  const junc_op *ob = *(const junc_op **) b;
+  int r;
+  if (oa->status != 0 || ob->status != 0)
+    r = (oa->status != 0) - (ob->status != 0);
+  else
+    r = _stricmp (op_name (oa), op_name (ob));
+  if (r != 0)
+    return r;
+  return oa->line < ob->line ? -1 : oa->line > ob->line ? 1 : 0;
+}
+
+/*
+ * Runs a chunk of operations. Operations on the same link name form
+ * a group that runs in order; groups run in parallel if there's a task group.
+ */
+static int
+run_chunk (junc_op *ops, size_t count, ntlink_task_group *group)
+{
+  junc_op **sorted;
+  junc_group *groups;
+  size_t ngroups = 0, i, j;
+
+  sorted = (junc_op **) malloc (sizeof (junc_op *) * count);
+  groups = (junc_group *) malloc (sizeof (junc_group) * count);
+  if (sorted == NULL || groups == NULL || group == NULL)
+  {
+    free (sorted);
+    free (groups);
+    for (i = 0; i < count; i++)
+      run_op (&ops[i]);
+    return 0;
+  }
+  for (i = 0; i < count; i++)
+    sorted[i] = &ops[i];
+  qsort (sorted, count, sizeof (junc_op *), op_name_cmp);
+  for (i = 0; i < count; i = j)
+  {
+    for (j = i + 1; j < count && sorted[i]->status == 0 && sorted[j]->status == 0 &&
+        _stricmp (op_name (sorted[i]), op_name (sorted[j])) == 0; j++);
+    groups[ngroups].ops = &sorted[i];
+    groups[ngroups].count = j - i;
+    if (ntlink_task_group_submit (group, run_group, &groups[ngroups]) != 0)
+      run_group (&groups[ngroups]);
+    ngroups += 1;
+  }
+  ntlink_task_group_wait (group);
+  free (sorted);
+  free (groups);
+  return 0;
+}
+
+/* Prints the status of each operation. Returns the number of failures */
+static size_t
+report_chunk (junc_op *ops, size_t count)
+{
+  size_t i, failed = 0;
+  for (i = 0; i < count; i++)
+  {
+    if (ops[i].status != 0)
+    {
+      printf ("%lu failed %d %s\n", ops[i].line, ops[i].status,
+          ops[i].status == EINVAL && ops[i].op == '\0' ? "Malformed operation" : strerror (ops[i].status));
+      failed += 1;
+    }
+    else if (ops[i].info != NULL)
+      printf ("%lu ok %s\n", ops[i].line, ops[i].info);
+    else
+      printf ("%lu ok\n", ops[i].line);
+    free (ops[i].info);
+    free (ops[i].record);
+  }
+  fflush (stdout);
+  return failed;
+}
+
+int
+batch (int argc, char **argv)
+{
+  FILE *f = stdin;
+  char *filename = NULL;
+  int delim = '\n';
+  int nthreads = 1;
+  ntlink_task_group *group = NULL;
+  junc_op *ops;
+  unsigned long line = 0;
+  size_t count, failed = 0;
+  int i, r = 1;
+
+  for (i = 2; i < argc; i++)
+  {
+    if (strcmp (argv[i], "0") == 0)
+      delim = '\0';
+    else if (strcmp (argv[i], "t") == 0 && i + 1 < argc)
+      nthreads = atoi (argv[++i]);
+    else if (filename == NULL)
+      filename = argv[i];
+    else
+    {
+      usage (argv);
+      return 1;
+    }
+  }
+  if (filename != NULL && strcmp (filename, "-") != 0)
+  {
+    f = fopen (filename, "rb");
+    if (f == NULL)
+    {
+      fprintf (stderr, "Failed to open `%s': %d - %s\n", filename, errno, strerror (errno));
+      return 2;
+    }
+  }
+  else
+    _setmode (_fileno (stdin), _O_BINARY);
+
+  ops = (junc_op *) malloc (sizeof (junc_op) * JUNC_BATCH_CHUNK);
+  if (ops == NULL)
+  {
+    if (f != stdin)
+      fclose (f);
+    return 2;
+  }
+  if (nthreads != 1)
+    group = ntlink_task_group_new (NULL, nthreads);
+
+  while (r > 0)
+  {
+    for (count = 0; count < JUNC_BATCH_CHUNK; )
+    {
+      junc_op *op = &ops[count];
+      char *record;
+      r = read_record (f, delim, &record);
+      if (r <= 0)
+        break;
+      line += 1;
+      if (record[0] == '\0' || record[0] == '#')
+      {
+        free (record);
+        continue;
+      }
+      memset (op, 0, sizeof (junc_op));
+      op->record = record;
+      op->line = line;
+      if (parse_op (op) != 0)
+      {
+        op->op = '\0';
+        op->status = EINVAL;
+      }
+      count += 1;
+    }
+    run_chunk (ops, count, group);
+    failed += report_chunk (ops, count);
+  }
+
+  ntlink_task_group_free (group);
+  free (ops);
+  if (f != stdin)
+    fclose (f);
+  if (r < 0)
+  {
+    fprintf (stderr, "Out of memory\n");
+    return 2;
+  }
+  return failed > 0 ? 3 : 0;
+}
+
+static void
+print_stats (void)
+{
+  ntlink_stats_print (stderr);
+}
+
+static void
+stop_trace (void)
+{
+  if (ntlink_trace_stop () != 0)
+    fprintf (stderr, "Failed to write the trace\n");
+}
+
+int
+main (int argc, char **argv)
+{
+  while (argc > 1 && (strcmp (argv[1], "S") == 0 || strcmp (argv[1], "T") == 0))
+  {
+    int used = 1;
+    if (argv[1][0] == 'S')
+    {
+      if (ntlink_stats_enable (1) == 0)
+        atexit (print_stats);
+    }
+    else if (argc < 3)
+    {
+      usage (argv);
+      return 1;
+    }
+    else
+    {
+      wchar_t *wfile = NULL;
+      if (strtowchar (argv[2], &wfile, CP_THREAD_ACP) < 0 ||
+          ntlink_trace_start (wfile, 0) != 0)
+      {
+        fprintf (stderr, "Failed to start tracing into `%s'\n", argv[2]);
+        return 1;
+      }
+      ntlink_free (wfile);
+      atexit (stop_trace);
+      used = 2;
+    }
+    argv[used] = argv[0];
+    argv += used;
+    argc -= used;
+  }
+  if (argc < 2)
+  {
+    if (argc > 0)
+      usage (argv);
+    return 1;
+  }
+  if (strcmp (argv[1],"l") == 0)
+  {
+    if (argc < 4)
+    {
+      usage (argv);
+      return 1;
+    }
+    return ntlink_symlink (argv[2], argv[3]);
+  }
+  else if (strcmp (argv[1],"u") == 0)
+  {
+    if (argc < 3)
+    {
+      usage (argv);
+      return 1;
+    }
+    return ntlink_unlink (argv[2]);
+  }
+  else if (strcmp (argv[1],"i") == 0)
+  {
+    char buffer[1024];
+    int read_ret;
+    if (argc < 3)
+    {
+      usage (argv);
+      return 1;
+    }
+    read_ret = ntlink_readlink (argv[2], buffer, sizeof (buffer) - 1);
+    if (read_ret < 0)
+      return read_ret;
+    buffer[read_ret] = 0;
+    printf ("%s\n", buffer);
+    return 0;
+  }
+  else if (strcmp (argv[1],"b") == 0)
+    return batch (argc, argv);
+  usage (argv);
+  return 1;
 }
\ No newline at end of file
@@ -1,442 +1,576 @@
-/*
- * This file is part of libntlink.
- * Copyright (c) 2010, LRN
- *
- * libntlink is free software: you can redistribute it and/or modify
- * it under the terms of the GNU Lesser General Public License
- * as published by the Free Software Foundation, either version 3
- * of the License, or (at your option) any later version.
- *
- * libntlink is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU Lesser General Public License for more details.
- *
- * You should have received a copy of
- * the GNU Lesser General Public License and the GNU General Public License
- * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <errno.h>
-
-#include <windows.h>
-#include <winioctl.h>
-#ifdef __MINGW64__
-typedef struct _REPARSE_DATA_BUFFER {
-  ULONG ReparseTag;
-  USHORT ReparseDataLength;
-  USHORT Reserved;
-  _ANONYMOUS_UNION union {
-    struct {
-      USHORT SubstituteNameOffset;
-      USHORT SubstituteNameLength;
-      USHORT PrintNameOffset;
-      USHORT PrintNameLength;
-      ULONG Flags;
-      WCHAR PathBuffer[1];
-    } SymbolicLinkReparseBuffer;
-    struct {
-      USHORT SubstituteNameOffset;
-      USHORT SubstituteNameLength;
-      USHORT PrintNameOffset;
-      USHORT PrintNameLength;
-      WCHAR PathBuffer[1];
-    } MountPointReparseBuffer;
-    struct {
-      UCHAR DataBuffer[1];
-    } GenericReparseBuffer;
-  } DUMMYUNIONNAME;
-} REPARSE_DATA_BUFFER, *PREPARSE_DATA_BUFFER;
-#define REPARSE_DATA_BUFFER_HEADER_SIZE   FIELD_OFFSET(REPARSE_DATA_BUFFER, GenericReparseBuffer)
-#endif
-
-#include "misc.h"
-#include "extra_string.h"
-
-/**
- * utf8towchar:
- * @str: a string (UTF-8-encoded) to convert
- * @wretstr: a pointer to variable (pointer to wchar_t) to receive the result
- *
- * Allocates new wchar_t string, fills it with converted @str and writes the
- * pointer to it into @wretstr. If the function fails, *@wretstr remains
- * unmodified.
- *
- * Returns:
- *  0 - conversion is successful
- * -1 - conversion failed at length-counting phase
- * -2 - conversion failed at memory allocation phase
- * -3 - conversion failed at string conversion phase
- *
- * 
- */
-int
-utf8towchar (char *str, wchar_t **wretstr)
-{
-  wchar_t *wstr;
-  size_t len, lenc;
-  len = mbstowcs (NULL, str, 0);
-  if (len < 0)
-  {
-    return -1;
-  }
-  
-  wstr = malloc (sizeof (wchar_t) * (len + 1));
-  if (wstr == NULL)
-  {
-    return -2;
-  }
-  
-  lenc = mbstowcs (wstr, str, len);
-  if (lenc != len)
-  {
-    free (wstr);
-    return -3;
-  }
-  wstr[lenc] = 0;
-  *wretstr = wstr;
-  return 0;
-}
-
-/**
- * IsJunctionPointA:
- * @path: full directory path (8-byte ASCII)
- *
- * Checks whether @path directory is a junction point or not
- *
- * Returns:
- *  0 - @path is not a junction point
- *  1 - @path is a junction point
- *  2 - @path is a directory AND a junction point
- * -1 - failed to get file attributes
- * 
- */
-int
-IsJunctionPointA (char *path)
-{
-  BOOL result;
-  WIN32_FILE_ATTRIBUTE_DATA attr_data;
-  
-  result = GetFileAttributesExA (path, GetFileExInfoStandard, &attr_data);
-  if (result == 0)
-    return -1;
-  if (attr_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT & FILE_ATTRIBUTE_DIRECTORY)
-    return 2;
-  if (attr_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-    return 1;
-  return 0;
-}
-
-/**
- * IsJunctionPointW:
- * @path: full directory path (UTF-16)
- *
- * Checks whether @path directory is a junction point or not
- *
- * Returns:
- *  0 - @path is not a junction point
- *  1 - @path is a junction point
- *  2 - @path is a directory AND a junction point
- * -1 - failed to get file attributes
- * 
- */
-int
-IsJunctionPointW (wchar_t *path)
-{
-  BOOL result;
-  WIN32_FILE_ATTRIBUTE_DATA attr_data;
-  
-  result = GetFileAttributesExW (path, GetFileExInfoStandard, &attr_data);
-  if (result == 0)
-    return -1;
-  if (attr_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT & FILE_ATTRIBUTE_DIRECTORY)
-    return 2;
-  if (attr_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-    return 1;
-  return 0;
-}
-
-/**
- * IsJunctionPointU:
- * @path: full directory path (UTF-8)
- *
- * Checks whether @path directory is a junction point or not
- *
- * Returns:
- *  0 - @path is not a junction point
- *  1 - @path is a junction point
- *  2 - @path is a directory AND a junction point
- * -1 - failed to get file attributes
- * -2 - failed to convert @path to UTF-16
- *
- */
-int
-IsJunctionPointU (char *path)
-{
-  int err;
-  wchar_t *wstr;
-  err = utf8towchar (path, &wstr);
-  if (err < 0)
-  {
-    return -2;
-  }
-  return IsJunctionPointW (wstr);
-}
-
-/**
- * SetJuncPointW:
- * @path1: full directory path (UTF-16), unparseable
- * @path2: full directory path (UTF-16)
- *
- * Makes @path2 directory into a junction point that points
- * to @path1 directory.
- * If @path2 does not exist, it will be created.
- * If @path2 exists, it must be empty.
- * If @path2 is a junction point, it will be re-targeted.
- * @path1 must be in unparseable form (e.g. \??\C:\Window)
- * Trailing slash does not matter (for both @path1 and @path2).
- *
- * Returns:
- *  0 - success
- * -1 - failed to create/open @path2
- * -2 - failed to allocate memory
- * -3 - failed to set junction
- *
- */
-int
-SetJuncPointW (wchar_t *path1, wchar_t *path2)
-{
-  HANDLE dir_handle;
-  BOOL ret;
-  REPARSE_DATA_BUFFER *rep_buf;
-  size_t len1, len2, reparse_size;
-  DWORD returned_bytes;
-
-  len1 = wcslen (path1);
-  len2 = 0;
-
-  if (PathExistsW (path2, NULL, PATH_EXISTS_FLAG_NOTHING) <= 0)
-  {
-    if (CreateDirectoryW (path2, NULL) == 0)
-    {
-      return -4;
-    }
-  }
-  /* FIXME: narrow access rights (just enough to link) */
-  dir_handle = CreateFileW (path2, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-      OPEN_ALWAYS, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
-      0);
-  if (dir_handle == INVALID_HANDLE_VALUE)
-  {
-    return -1;
-  }
-
-  reparse_size = (len1 + 1 + len2 + 1) * sizeof (wchar_t) +
-    sizeof (rep_buf->MountPointReparseBuffer) +
-    REPARSE_DATA_BUFFER_HEADER_SIZE -
-    sizeof (rep_buf->MountPointReparseBuffer.PathBuffer);
-
-  rep_buf = malloc (reparse_size);
-  if (rep_buf == NULL)
-  {
-    CloseHandle (dir_handle);
-    return -2;
-  }
-  memset (rep_buf, 0, reparse_size);
-
-  rep_buf->ReparseTag = IO_REPARSE_TAG_MOUNT_POINT;
-  rep_buf->ReparseDataLength = sizeof (rep_buf->MountPointReparseBuffer) -
-      sizeof (rep_buf->MountPointReparseBuffer.PathBuffer) +
-      (len1 + 1 + len2 + 1) * sizeof (wchar_t);
-  rep_buf->Reserved = 0;
-  rep_buf->MountPointReparseBuffer.SubstituteNameOffset = 0;
-  rep_buf->MountPointReparseBuffer.SubstituteNameLength = len1 *
-      sizeof (wchar_t);
-  rep_buf->MountPointReparseBuffer.PrintNameOffset = (len1 + 1) *
-      sizeof (wchar_t);
-  rep_buf->MountPointReparseBuffer.PrintNameLength = len2 * sizeof (wchar_t);
-
-  memcpy (&((BYTE *) rep_buf->MountPointReparseBuffer.PathBuffer)
-      [rep_buf->MountPointReparseBuffer.SubstituteNameOffset],
-      path1, rep_buf->MountPointReparseBuffer.SubstituteNameLength);
-  memcpy (&((BYTE *) rep_buf->MountPointReparseBuffer.PathBuffer)
-      [rep_buf->MountPointReparseBuffer.PrintNameOffset],
-      "", rep_buf->MountPointReparseBuffer.PrintNameLength);
-
-  ret = DeviceIoControl (dir_handle, FSCTL_SET_REPARSE_POINT, rep_buf, reparse_size, NULL, 0, &returned_bytes, NULL);
-  if (ret == 0)
-  {
-    return -3;
-  }
-
-  free (rep_buf);
-
-  CloseHandle (dir_handle);
-
-  return 0;
-}
-
-/**
- * UnJuncPointW:
- * @path: full directory path (UTF-16)
- *
- * Removes a junction point @path. Leaves empty directory @path afterwards.
- *
- * Returns:
- *  0 - success
- * -1 - failed to create/open @path
- * -2 - failed to allocate memory
- * -3 - failed to delete junction
- *
- */
-int
-UnJuncPointW (wchar_t *path)
-{
-  HANDLE dir_handle;
-  BOOL ret;
-  REPARSE_DATA_BUFFER *rep_buf;
-  size_t len1, len2, reparse_size;
-  DWORD returned_bytes2;
-
-  len1 = wcslen (path);
-  len2 = 0;
-
-  /* FIXME: narrow access rights (just enough to link) */
-  dir_handle = CreateFileW (path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-      OPEN_ALWAYS, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
-      0);
-  if (dir_handle == INVALID_HANDLE_VALUE)
-  {
-    return -1;
-  }
-
-  len1 = 0;
-
-  reparse_size = (len1 + 1 + len2 + 1) * sizeof (wchar_t) +
-    sizeof (rep_buf->MountPointReparseBuffer) +
-    REPARSE_DATA_BUFFER_HEADER_SIZE -
-    sizeof (rep_buf->MountPointReparseBuffer.PathBuffer);
-
-  rep_buf = malloc (reparse_size);
-  if (rep_buf == NULL)
-  {
-    CloseHandle (dir_handle);
-    return -2;
-  }
-  memset (rep_buf, 0, reparse_size);
-
-  rep_buf->ReparseTag = IO_REPARSE_TAG_MOUNT_POINT;
-  rep_buf->ReparseDataLength = 0;
-
-  ret = DeviceIoControl (dir_handle, FSCTL_DELETE_REPARSE_POINT, rep_buf, REPARSE_GUID_DATA_BUFFER_HEADER_SIZE, NULL, 0, &returned_bytes2, NULL);
-  if (ret == 0)
-  {
-    return -3;
-  }
-
-  if (rep_buf != NULL)
-    free (rep_buf);
-
-  CloseHandle (dir_handle);
-
-  return 0;
-}
-
-/**
- * GetJuncPointW:
- * @path1: a pointer to variable (pointer to wchar_t) to receive result
- * @path2: full directory path (UTF-16)
- * @relative: set to 1 if the path is relative. Always 0 for junction points.
- * @linktype: set to 1 if the link is a symlink. 0 if a junction
- *
- * Retrieves target directory for junction point @path2, allocates a buffer
- * for it and writes a pointer to that buffer into @path1
- *
- * @path2 must exist.
- * @path2 must be a junction point.
- * For junction points:
- *   String in @path1 will be in unparseable form - with \??\ prefix
- *   (i.e. \??\C:\Windows) - and without a trailing slash.
- * For symlinks:
- *   String in @path1 will be in normal form.
- * If the function fails, *@path1 remains unmodified.
- * Free @path1 with free() when it is no longer needed.
- *
- * Returns:
- * 0  - success
- * -1 - failed to open @path2
- * -2 - failed to get junction
- * -3 - failed to allocate memory
- *
- */
-int
-GetJuncPointW (wchar_t **path1, wchar_t *path2, int *relative, int *linktype)
-{
-  HANDLE dir_handle;
-  BOOL ret;
-  REPARSE_DATA_BUFFER *rep_buf;
-  size_t len1, len2;
-  DWORD returned_bytes;
-  BYTE returned_data[MAXIMUM_REPARSE_DATA_BUFFER_SIZE];
-
-  len2 = wcslen (path2);
-
-  /* FIXME: narrow access rights (just enough to link) */
-  dir_handle = CreateFileW (path2, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
-      0);
-  if (dir_handle == INVALID_HANDLE_VALUE)
-  {
-    return -1;
-  }
-
-  ret = DeviceIoControl (dir_handle, FSCTL_GET_REPARSE_POINT, NULL, 0, returned_data, 1024, &returned_bytes, NULL);
-  CloseHandle (dir_handle);
-  if (ret == 0)
-  {
-    return -2;
-  }
-
-  rep_buf = (REPARSE_DATA_BUFFER *) returned_data;
-
-  if (rep_buf->ReparseTag == IO_REPARSE_TAG_SYMLINK)
-  {
-    len1 = rep_buf->SymbolicLinkReparseBuffer.SubstituteNameLength;
-
-    *path1 = malloc (len1 + sizeof (wchar_t));
-    if (*path1 == NULL)
-    {
-      return -3;
-    }
-
-    if (relative)
-      *relative = (rep_buf->SymbolicLinkReparseBuffer.Flags & 0x0001) != 0;
-    if (linktype)
-      *linktype = 1;
-    memcpy (*path1, &((BYTE *) rep_buf->SymbolicLinkReparseBuffer.PathBuffer)
-        [rep_buf->SymbolicLinkReparseBuffer.SubstituteNameOffset], len1);
-  }
-  else if (rep_buf->ReparseTag == IO_REPARSE_TAG_MOUNT_POINT)
-  {
-    len1 = rep_buf->MountPointReparseBuffer.SubstituteNameLength;
-
-    *path1 = malloc (len1 + sizeof (wchar_t));
-    if (*path1 == NULL)
-    {
-      return -3;
-    }
-
-    if (relative)
-      *relative = 0;
-    if (linktype)
-      *linktype = 0;
-    memcpy (*path1, &((BYTE *) rep_buf->MountPointReparseBuffer.PathBuffer)
-        [rep_buf->MountPointReparseBuffer.SubstituteNameOffset], len1);
-  }
-
-  (*path1)[len1 / sizeof (wchar_t)] = 0;
-
-  return 0;
-}
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2010, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <windows.h>
+#include <winioctl.h>
+#ifdef __MINGW64__
+typedef struct _REPARSE_DATA_BUFFER {
+  ULONG ReparseTag;
+  USHORT ReparseDataLength;
+  USHORT Reserved;
+  _ANONYMOUS_UNION union {
+    struct {
+      USHORT SubstituteNameOffset;
+      USHORT SubstituteNameLength;
+      USHORT PrintNameOffset;
+      USHORT PrintNameLength;
+      ULONG Flags;
+      WCHAR PathBuffer[1];
+    } SymbolicLinkReparseBuffer;
+    struct {
+      USHORT SubstituteNameOffset;
+      USHORT SubstituteNameLength;
+      USHORT PrintNameOffset;
+      USHORT PrintNameLength;
+      WCHAR PathBuffer[1];
+    } MountPointReparseBuffer;
+    struct {
+      UCHAR DataBuffer[1];
+    } GenericReparseBuffer;
+  } DUMMYUNIONNAME;
+} REPARSE_DATA_BUFFER, *PREPARSE_DATA_BUFFER;
+#define REPARSE_DATA_BUFFER_HEADER_SIZE   FIELD_OFFSET(REPARSE_DATA_BUFFER, GenericReparseBuffer)
+#endif
+
+#include "juncpoint.h"
+#include "misc.h"
+#include "extra_string.h"
+#include "fsbackend.h"
+#include "stats.h"
+#include "trace.h"
+#include "ctx.h"
+#include "alloc.h"
+
+/**
+ * utf8towchar:
+ * @str: a string (UTF-8-encoded) to convert
+ * @wretstr: a pointer to variable (pointer to wchar_t) to receive the result
+ *
+ * Allocates new wchar_t string, fills it with converted @str and writes the
+ * pointer to it into @wretstr. If the function fails, *@wretstr remains
+ * unmodified.
+ *
+ * Returns:
+ *  0 - conversion is successful
+ * -1 - conversion failed at length-counting phase
+ * -2 - conversion failed at memory allocation phase
+ * -3 - conversion failed at string conversion phase
+ *
+ * 
+ */
+int
+utf8towchar (char *str, wchar_t **wretstr)
+{
+  wchar_t *wstr;
+  size_t len, lenc;
+  len = mbstowcs (NULL, str, 0);
+  if (len < 0)
+  {
+    return -1;
+  }
+  
+  wstr = ntlink_malloc (sizeof (wchar_t) * (len + 1));
+  if (wstr == NULL)
+  {
+    return -2;
+  }
+  
+  lenc = mbstowcs (wstr, str, len);
+  if (lenc != len)
+  {
+    ntlink_free (wstr);
+    return -3;
+  }
+  wstr[lenc] = 0;
+  *wretstr = wstr;
+  return 0;
+}
+
+/**
+ * IsJunctionPointA:
+ * @path: full directory path (8-byte ASCII)
+ *
+ * Checks whether @path directory is a junction point or not
+ *
+ * Returns:
+ *  0 - @path is not a junction point
+ *  1 - @path is a junction point
+ *  2 - @path is a directory AND a junction point
+ * -1 - failed to get file attributes
+ * 
+ */
+int
+IsJunctionPointA (char *path)
+{
+  int ret;
+  wchar_t *wpath = NULL;
+
+  if (strtowchar (path, &wpath, CP_THREAD_ACP) < 0)
+    return -1;
+  ret = IsJunctionPointW (wpath);
+  ntlink_free (wpath);
+  return ret;
+}
+
+/**
+ * IsJunctionPointW:
+ * @path: full directory path (UTF-16)
+ *
+ * Checks whether @path directory is a junction point or not
+ *
+ * Returns:
+ *  0 - @path is not a junction point
+ *  1 - @path is a junction point
+ *  2 - @path is a directory AND a junction point
+ * -1 - failed to get file attributes
+ * 
+ */
+int
+IsJunctionPointW (wchar_t *path)
+{
+  BOOL result;
+  WIN32_FILE_ATTRIBUTE_DATA attr_data;
+  
+  result = ntlink_fs->get_file_attributes_ex (path, GetFileExInfoStandard, &attr_data);
+  if (result == 0)
+    return -1;
+  if (attr_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT & FILE_ATTRIBUTE_DIRECTORY)
+    return 2;
+  if (attr_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+    return 1;
+  return 0;
+}
+
+/**
+ * IsJunctionPointU:
+ * @path: full directory path (UTF-8)
+ *
+ * Checks whether @path directory is a junction point or not
+ *
+ * Returns:
+ *  0 - @path is not a junction point
+ *  1 - @path is a junction point
+ *  2 - @path is a directory AND a junction point
+ * -1 - failed to get file attributes
+ * -2 - failed to convert @path to UTF-16
+ *
+ */
+int
+IsJunctionPointU (char *path)
+{
+  int err;
+  wchar_t *wstr;
+  err = utf8towchar (path, &wstr);
+  if (err < 0)
+  {
+    return -2;
+  }
+  return IsJunctionPointW (wstr);
+}
+
+/**
+ * SetJuncPointW:
+ * @path1: full directory path (UTF-16), unparseable
+ * @path2: full directory path (UTF-16)
+ *
+ * Makes @path2 directory into a junction point that points
+ * to @path1 directory.
+ * If @path2 does not exist, it will be created.
+ * If @path2 exists, it must be empty.
+ * If @path2 is a junction point, it will be re-targeted.
+ * @path1 must be in unparseable form (e.g. \??\C:\Window)
+ * Trailing slash does not matter (for both @path1 and @path2).
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to create/open @path2
+ * -2 - failed to allocate memory
+ * -3 - failed to set junction
+ *
+ */
+static int
+set_junc_point_impl (wchar_t *path1, const wchar_t *path2)
+{
+  HANDLE dir_handle;
+  int r;
+
+  if (PathExistsW (path2, NULL, PATH_EXISTS_FLAG_NOTHING) <= 0)
+  {
+    if (ntlink_fs->create_directory (path2, NULL) == 0)
+    {
+      return -4;
+    }
+  }
+  /* FIXME: narrow access rights (just enough to link) */
+  dir_handle = ntlink_fs->create_file (path2, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+      OPEN_ALWAYS, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+      0);
+  if (dir_handle == INVALID_HANDLE_VALUE)
+  {
+    return -1;
+  }
+
+  r = SetReparsePointHandleW (dir_handle, path1, NULL, 0, 0);
+  ntlink_fs->close_handle (dir_handle);
+  if (r == -2)
+    return -2;
+  else if (r != 0)
+    return -3;
+
+  return 0;
+}
+
+int
+SetJuncPointW (wchar_t *path1, const wchar_t *path2)
+{
+  int r;
+  LONGLONG start = ntlink_ctx_begin (NULL, NTLINK_API_SET_JUNC_POINT);
+  r = set_junc_point_impl (path1, path2);
+  ntlink_ctx_end (NULL, NTLINK_API_SET_JUNC_POINT, start, r != 0);
+  ntlink_trace_call (NTLINK_API_SET_JUNC_POINT, start, r, 0, 0, path1, path2, NULL);
+  return r;
+}
+
+/**
+ * SetReparsePointHandleW:
+ * @handle: a handle to an empty file or directory, opened with
+ *   FILE_FLAG_OPEN_REPARSE_POINT and write access
+ * @substitute: substitute name (UTF-16), e.g. \??\C:\Windows or ..\dir
+ * @printname: print name (UTF-16), e.g. C:\Windows or ..\dir. Can be NULL.
+ * @linktype: 1 to write a symlink, 0 to write a junction point
+ * @relative: 1 if @substitute is relative to the directory of the link.
+ *   Only symlinks can be relative.
+ *
+ * Writes a reparse buffer for @substitute into @handle.
+ * Unlike SetJuncPointW() this neither creates nor opens anything, so the
+ * caller can create the link relative to an already opened parent directory.
+ * Writing a symlink requires SeCreateSymbolicLinkPrivilege.
+ *
+ * Returns:
+ *  0 - success
+ * -2 - failed to allocate memory
+ * -3 - failed to set the reparse point (GetLastError() is preserved)
+ * -4 - @relative is set for a junction point
+ * -5 - the names are too long for a reparse point
+ *
+ */
+int
+SetReparsePointHandleW (HANDLE handle, wchar_t *substitute, wchar_t *printname, int linktype, int relative)
+{
+  BOOL ret;
+  BYTE *rep_buf;
+  DWORD reparse_size;
+  DWORD returned_bytes;
+  int r;
+
+  r = EncodeReparseBufferW (substitute, printname, linktype, relative, &rep_buf, &reparse_size);
+  if (r != 0)
+    return r;
+
+  ret = ntlink_fs->device_io_control (handle, FSCTL_SET_REPARSE_POINT, rep_buf, reparse_size, NULL, 0, &returned_bytes, NULL);
+  ntlink_free (rep_buf);
+  if (ret == 0)
+    return -3;
+
+  return 0;
+}
+
+/**
+ * EncodeReparseBufferW:
+ * @substitute: substitute name (UTF-16)
+ * @printname: print name (UTF-16). Can be NULL.
+ * @linktype: 1 to encode a symlink, 0 to encode a junction point
+ * @relative: 1 if @substitute is relative to the directory of the link
+ * @buffer: a pointer to variable to receive the reparse buffer
+ * @size: a pointer to variable to receive the size of *@buffer, in bytes
+ *
+ * Builds the reparse buffer that FSCTL_SET_REPARSE_POINT takes, the way
+ * CreateSymbolicLinkW() does: the substitute name, then the print name,
+ * each NUL-terminated. Free *@buffer with ntlink_free().
+ *
+ * Returns:
+ *  0 - success
+ * -2 - failed to allocate memory
+ * -4 - @relative is set for a junction point
+ * -5 - the names do not fit into a reparse buffer
+ *
+ */
+int
+EncodeReparseBufferW (wchar_t *substitute, wchar_t *printname, int linktype, int relative, BYTE **buffer, DWORD *size)
+{
+  REPARSE_DATA_BUFFER *rep_buf;
+  size_t len1, len2, reparse_size, header_size;
+  BYTE *pathbuffer;
+
+  if (relative && linktype == 0)
+    return -4;
+
+  len1 = wcslen (substitute);
+  len2 = printname != NULL ? wcslen (printname) : 0;
+
+  if (linktype == 1)
+    header_size = FIELD_OFFSET (REPARSE_DATA_BUFFER, SymbolicLinkReparseBuffer.PathBuffer);
+  else
+    header_size = FIELD_OFFSET (REPARSE_DATA_BUFFER, MountPointReparseBuffer.PathBuffer);
+  reparse_size = header_size + (len1 + 1 + len2 + 1) * sizeof (wchar_t);
+  if (reparse_size > MAXIMUM_REPARSE_DATA_BUFFER_SIZE)
+    return -5;
+
+  rep_buf = ntlink_malloc (reparse_size);
+  if (rep_buf == NULL)
+    return -2;
+  memset (rep_buf, 0, reparse_size);
+
+  rep_buf->ReparseDataLength = reparse_size - REPARSE_DATA_BUFFER_HEADER_SIZE;
+  rep_buf->Reserved = 0;
+  if (linktype == 1)
+  {
+    rep_buf->ReparseTag = IO_REPARSE_TAG_SYMLINK;
+    rep_buf->SymbolicLinkReparseBuffer.SubstituteNameOffset = 0;
+    rep_buf->SymbolicLinkReparseBuffer.SubstituteNameLength = len1 * sizeof (wchar_t);
+    rep_buf->SymbolicLinkReparseBuffer.PrintNameOffset = (len1 + 1) * sizeof (wchar_t);
+    rep_buf->SymbolicLinkReparseBuffer.PrintNameLength = len2 * sizeof (wchar_t);
+    /* SYMLINK_FLAG_RELATIVE */
+    rep_buf->SymbolicLinkReparseBuffer.Flags = relative ? 0x0001 : 0;
+    pathbuffer = (BYTE *) rep_buf->SymbolicLinkReparseBuffer.PathBuffer;
+  }
+  else
+  {
+    rep_buf->ReparseTag = IO_REPARSE_TAG_MOUNT_POINT;
+    rep_buf->MountPointReparseBuffer.SubstituteNameOffset = 0;
+    rep_buf->MountPointReparseBuffer.SubstituteNameLength = len1 * sizeof (wchar_t);
+    rep_buf->MountPointReparseBuffer.PrintNameOffset = (len1 + 1) * sizeof (wchar_t);
+    rep_buf->MountPointReparseBuffer.PrintNameLength = len2 * sizeof (wchar_t);
+    pathbuffer = (BYTE *) rep_buf->MountPointReparseBuffer.PathBuffer;
+  }
+
+  memcpy (pathbuffer, substitute, len1 * sizeof (wchar_t));
+  if (len2 > 0)
+    memcpy (&pathbuffer[(len1 + 1) * sizeof (wchar_t)], printname, len2 * sizeof (wchar_t));
+
+  *buffer = (BYTE *) rep_buf;
+  *size = reparse_size;
+  return 0;
+}
+
+/**
+ * DecodeReparseBufferW:
+ * @buffer: a reparse buffer, as returned by FSCTL_GET_REPARSE_POINT
+ * @size: size of @buffer, in bytes
+ * @substitute: a pointer to variable (pointer to wchar_t) to receive
+ *   the substitute name
+ * @relative: set to 1 if the name is relative. Always 0 for junction points.
+ *   Can be NULL.
+ * @linktype: set to 1 if the buffer is a symlink, 0 if a junction point.
+ *   Can be NULL.
+ *
+ * Extracts the substitute name of a symlink or junction point reparse buffer
+ * into a newly allocated string. If the function fails, *@substitute
+ * remains unmodified. Free *@substitute with ntlink_free().
+ *
+ * Returns:
+ *  0 - success
+ * -2 - @buffer is malformed or is not a symlink or a junction point
+ * -3 - failed to allocate memory
+ *
+ */
+int
+DecodeReparseBufferW (const BYTE *buffer, DWORD size, wchar_t **substitute, int *relative, int *linktype)
+{
+  const REPARSE_DATA_BUFFER *rep_buf = (const REPARSE_DATA_BUFFER *) buffer;
+  const BYTE *pathbuffer;
+  size_t header_size, offset, len;
+
+  if (size < REPARSE_DATA_BUFFER_HEADER_SIZE)
+    return -2;
+
+  if (rep_buf->ReparseTag == IO_REPARSE_TAG_SYMLINK)
+  {
+    header_size = FIELD_OFFSET (REPARSE_DATA_BUFFER, SymbolicLinkReparseBuffer.PathBuffer);
+    if (size < header_size)
+      return -2;
+    offset = rep_buf->SymbolicLinkReparseBuffer.SubstituteNameOffset;
+    len = rep_buf->SymbolicLinkReparseBuffer.SubstituteNameLength;
+    pathbuffer = (const BYTE *) rep_buf->SymbolicLinkReparseBuffer.PathBuffer;
+  }
+  else if (rep_buf->ReparseTag == IO_REPARSE_TAG_MOUNT_POINT)
+  {
+    header_size = FIELD_OFFSET (REPARSE_DATA_BUFFER, MountPointReparseBuffer.PathBuffer);
+    if (size < header_size)
+      return -2;
+    offset = rep_buf->MountPointReparseBuffer.SubstituteNameOffset;
+    len = rep_buf->MountPointReparseBuffer.SubstituteNameLength;
+    pathbuffer = (const BYTE *) rep_buf->MountPointReparseBuffer.PathBuffer;
+  }
+  else
+    return -2;
+
+  if (header_size + offset + len > size || len % sizeof (wchar_t) != 0)
+    return -2;
+
+  *substitute = ntlink_malloc (len + sizeof (wchar_t));
+  if (*substitute == NULL)
+    return -3;
+  memcpy (*substitute, &pathbuffer[offset], len);
+  (*substitute)[len / sizeof (wchar_t)] = 0;
+
+  if (relative)
+    *relative = rep_buf->ReparseTag == IO_REPARSE_TAG_SYMLINK &&
+        (rep_buf->SymbolicLinkReparseBuffer.Flags & 0x0001) != 0;
+  if (linktype)
+    *linktype = rep_buf->ReparseTag == IO_REPARSE_TAG_SYMLINK;
+
+  return 0;
+}
+
+/**
+ * UnJuncPointW:
+ * @path: full directory path (UTF-16)
+ *
+ * Removes a junction point @path. Leaves empty directory @path afterwards.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to create/open @path
+ * -2 - failed to allocate memory
+ * -3 - failed to delete junction
+ *
+ */
+int
+UnJuncPointW (wchar_t *path)
+{
+  HANDLE dir_handle;
+  BOOL ret;
+  REPARSE_DATA_BUFFER *rep_buf;
+  size_t len1, len2, reparse_size;
+  DWORD returned_bytes2;
+
+  len1 = wcslen (path);
+  len2 = 0;
+
+  /* FIXME: narrow access rights (just enough to link) */
+  dir_handle = ntlink_fs->create_file (path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+      OPEN_ALWAYS, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+      0);
+  if (dir_handle == INVALID_HANDLE_VALUE)
+  {
+    return -1;
+  }
+
+  len1 = 0;
+
+  reparse_size = (len1 + 1 + len2 + 1) * sizeof (wchar_t) +
+    sizeof (rep_buf->MountPointReparseBuffer) +
+    REPARSE_DATA_BUFFER_HEADER_SIZE -
+    sizeof (rep_buf->MountPointReparseBuffer.PathBuffer);
+
+  rep_buf = ntlink_malloc (reparse_size);
+  if (rep_buf == NULL)
+  {
+    ntlink_fs->close_handle (dir_handle);
+    return -2;
+  }
+  memset (rep_buf, 0, reparse_size);
+
+  rep_buf->ReparseTag = IO_REPARSE_TAG_MOUNT_POINT;
+  rep_buf->ReparseDataLength = 0;
+
+  ret = ntlink_fs->device_io_control (dir_handle, FSCTL_DELETE_REPARSE_POINT, rep_buf, REPARSE_GUID_DATA_BUFFER_HEADER_SIZE, NULL, 0, &returned_bytes2, NULL);
+  if (ret == 0)
+  {
+    return -3;
+  }
+
+  if (rep_buf != NULL)
+    ntlink_free (rep_buf);
+
+  ntlink_fs->close_handle (dir_handle);
+
+  return 0;
+}
+
+/**
+ * GetJuncPointW:
+ * @path1: a pointer to variable (pointer to wchar_t) to receive result
+ * @path2: full directory path (UTF-16)
+ * @relative: set to 1 if the path is relative. Always 0 for junction points.
+ * @linktype: set to 1 if the link is a symlink. 0 if a junction
+ *
+ * Retrieves target directory for junction point @path2, allocates a buffer
+ * for it and writes a pointer to that buffer into @path1
+ *
+ * @path2 must exist.
+ * @path2 must be a junction point.
+ * For junction points:
+ *   String in @path1 will be in unparseable form - with \??\ prefix
+ *   (i.e. \??\C:\Windows) - and without a trailing slash.
+ * For symlinks:
+ *   String in @path1 will be in normal form.
+ * If the function fails, *@path1 remains unmodified.
+ * Free @path1 with ntlink_free() when it is no longer needed.
+ *
+ * Returns:
+ * 0  - success
+ * -1 - failed to open @path2
+ * -2 - failed to get junction, or @path2 is neither a junction point
+ *      nor a symlink
+ * -3 - failed to allocate memory
+ *
+ */
+static int
+get_junc_point_impl (wchar_t **path1, wchar_t *path2, int *relative, int *linktype)
+{
+  HANDLE dir_handle;
+  BOOL ret;
+  DWORD returned_bytes;
+  BYTE returned_data[MAXIMUM_REPARSE_DATA_BUFFER_SIZE];
+
+  /* FIXME: narrow access rights (just enough to link) */
+  dir_handle = ntlink_fs->create_file (path2, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+      0);
+  if (dir_handle == INVALID_HANDLE_VALUE)
+  {
+    return -1;
+  }
+
+  ret = ntlink_fs->device_io_control (dir_handle, FSCTL_GET_REPARSE_POINT, NULL, 0, returned_data, sizeof (returned_data), &returned_bytes, NULL);
+  ntlink_fs->close_handle (dir_handle);
+  if (ret == 0)
+  {
+    return -2;
+  }
+
+  return DecodeReparseBufferW (returned_data, returned_bytes, path1, relative, linktype);
+}
+
+int
+GetJuncPointW (wchar_t **path1, wchar_t *path2, int *relative, int *linktype)
+{
+  int r;
+  LONGLONG start = ntlink_ctx_begin (NULL, NTLINK_API_GET_JUNC_POINT);
+  r = get_junc_point_impl (path1, path2, relative, linktype);
+  ntlink_ctx_end (NULL, NTLINK_API_GET_JUNC_POINT, start, r != 0);
+  ntlink_trace_call (NTLINK_API_GET_JUNC_POINT, start, r, 0, 0, path2, NULL, NULL);
+  return r;
+}
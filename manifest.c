@@ -0,0 +1,402 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <errno.h>
+
+#include "misc.h"
+#include "manifest.h"
+
+struct _manifest_map
+{
+  HANDLE fileh;
+  HANDLE mappingh;
+  const BYTE *base;
+  ULONGLONG size;
+  const manifest_header *header;
+  const manifest_record *records;
+  const wchar_t *strings;
+  const DWORD *index;
+};
+
+struct _manifest_pool_slot
+{
+  DWORD hash;
+  DWORD offset;
+  size_t length;
+  int used;
+};
+
+typedef struct _manifest_pool_slot manifest_pool_slot;
+
+/*
+ * Adds @s to the string pool unless an identical string is already there.
+ * Returns the offset of the string in the pool.
+ */
+static DWORD
+manifest_pool_add (wchar_t *pool, size_t *poollen, manifest_pool_slot *slots, size_t nslots,
+    const wchar_t *s, size_t len)
+{
+  DWORD hash = 2166136261U;
+  size_t i, slot;
+  for (i = 0; i < len; i++)
+  {
+    hash ^= (DWORD) s[i];
+    hash *= 16777619U;
+  }
+  for (slot = hash & (nslots - 1); slots[slot].used; slot = (slot + 1) & (nslots - 1))
+  {
+    if (slots[slot].hash == hash && slots[slot].length == len &&
+        memcmp (&pool[slots[slot].offset], s, sizeof (wchar_t) * len) == 0)
+      return slots[slot].offset;
+  }
+  slots[slot].used = 1;
+  slots[slot].hash = hash;
+  slots[slot].length = len;
+  slots[slot].offset = (DWORD) *poollen;
+  memcpy (&pool[*poollen], s, sizeof (wchar_t) * len);
+  *poollen += len;
+  return slots[slot].offset;
+}
+
+/**
+ * manifest_write_binary:
+ * @f: a file opened for writing in binary mode, positioned at its start
+ * @list: records to write. The list is sorted in place.
+ *
+ * Writes a binary manifest: a header, a sorted record table,
+ * a deduplicated string pool and a hash index of link names.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ * -2 - failed to write
+ * -3 - a name is too long or the string pool would be too big
+ */
+int
+manifest_write_binary (FILE *f, manifest_list *list)
+{
+  manifest_header header;
+  manifest_record *records = NULL;
+  wchar_t *pool = NULL;
+  manifest_pool_slot *slots = NULL;
+  DWORD *index = NULL;
+  size_t poollen = 0, poolcap = 0, nslots, nindex, i;
+  int ret = -1;
+
+  for (i = 0; i < list->count; i++)
+  {
+    if (list->items[i].linklen > 0xFFFF || list->items[i].targetlen > 0xFFFF)
+      return -3;
+    poolcap += list->items[i].linklen + list->items[i].targetlen;
+  }
+  if (poolcap > 0xFFFFFFFFU)
+    return -3;
+
+  manifest_list_sort (list);
+
+  for (nslots = 16; nslots < list->count * 4; nslots *= 2);
+  for (nindex = 16; nindex < list->count * 2; nindex *= 2);
+
+  records = (manifest_record *) malloc (sizeof (manifest_record) * (list->count > 0 ? list->count : 1));
+  pool = (wchar_t *) malloc (sizeof (wchar_t) * (poolcap > 0 ? poolcap : 1));
+  slots = (manifest_pool_slot *) calloc (nslots, sizeof (manifest_pool_slot));
+  index = (DWORD *) malloc (sizeof (DWORD) * nindex);
+  if (records == NULL || pool == NULL || slots == NULL || index == NULL)
+    goto end;
+  memset (index, 0xFF, sizeof (DWORD) * nindex);
+
+  for (i = 0; i < list->count; i++)
+  {
+    manifest_entry *e = &list->items[i];
+    size_t slot;
+    records[i].link_offset = manifest_pool_add (pool, &poollen, slots, nslots, e->link, e->linklen);
+    records[i].target_offset = manifest_pool_add (pool, &poollen, slots, nslots, e->target, e->targetlen);
+    records[i].link_length = (WORD) e->linklen;
+    records[i].target_length = (WORD) e->targetlen;
+    records[i].type = (WORD) e->type;
+    records[i].reserved = 0;
+    slot = manifest_name_hash (e->link, e->linklen) & (nindex - 1);
+    while (index[slot] != MANIFEST_INDEX_EMPTY)
+      slot = (slot + 1) & (nindex - 1);
+    index[slot] = (DWORD) i;
+  }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC));
+  header.version = MANIFEST_VERSION;
+  header.header_size = sizeof (header);
+  header.record_count = list->count;
+  header.records_offset = sizeof (header);
+  header.strings_offset = header.records_offset + sizeof (manifest_record) * list->count;
+  header.strings_length = poollen;
+  header.index_offset = header.strings_offset + sizeof (wchar_t) * poollen;
+  /* Keep the index aligned */
+  header.index_offset = (header.index_offset + 7) & ~7ULL;
+  header.index_slots = nindex;
+
+  ret = -2;
+  if (fwrite (&header, sizeof (header), 1, f) != 1)
+    goto end;
+  if (list->count > 0 && fwrite (records, sizeof (manifest_record), list->count, f) != list->count)
+    goto end;
+  if (poollen > 0 && fwrite (pool, sizeof (wchar_t), poollen, f) != poollen)
+    goto end;
+  for (i = header.strings_offset + sizeof (wchar_t) * poollen; i < header.index_offset; i++)
+    if (fputc (0, f) == EOF)
+      goto end;
+  if (fwrite (index, sizeof (DWORD), nindex, f) != nindex)
+    goto end;
+  ret = 0;
+
+end:
+  free (records);
+  free (pool);
+  free (slots);
+  free (index);
+  return ret;
+}
+
+/**
+ * manifest_map_open:
+ * @filename: name of a manifest file
+ * @map: receives the mapped manifest
+ *
+ * Maps a binary manifest into memory. Nothing is parsed; the records are
+ * read straight from the mapping by manifest_map_entry().
+ * Close the map with manifest_map_close().
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to open or map the file (errno is set)
+ * -2 - the file is not a binary manifest (it may be a text manifest)
+ * -3 - the manifest is corrupted or of an unsupported version
+ */
+int
+manifest_map_open (const wchar_t *filename, manifest_map **map)
+{
+  manifest_map *m;
+  LARGE_INTEGER size;
+  const manifest_header *h;
+  int ret = -1;
+
+  m = (manifest_map *) calloc (1, sizeof (manifest_map));
+  if (m == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  m->fileh = CreateFileW (filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (m->fileh == INVALID_HANDLE_VALUE)
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    m->fileh = NULL;
+    goto fail;
+  }
+  if (!GetFileSizeEx (m->fileh, &size))
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    goto fail;
+  }
+  m->size = size.QuadPart;
+  if (m->size < sizeof (manifest_header))
+  {
+    ret = -2;
+    goto fail;
+  }
+  m->mappingh = CreateFileMappingW (m->fileh, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (m->mappingh == NULL)
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    goto fail;
+  }
+  m->base = (const BYTE *) MapViewOfFile (m->mappingh, FILE_MAP_READ, 0, 0, 0);
+  if (m->base == NULL)
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    goto fail;
+  }
+
+  h = (const manifest_header *) m->base;
+  if (memcmp (h->magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC)) != 0)
+  {
+    ret = -2;
+    goto fail;
+  }
+  ret = -3;
+  if (h->version != MANIFEST_VERSION || h->header_size < sizeof (manifest_header))
+    goto fail;
+  if (h->records_offset > m->size ||
+      h->record_count > (m->size - h->records_offset) / sizeof (manifest_record) ||
+      h->strings_offset > m->size ||
+      h->strings_length > (m->size - h->strings_offset) / sizeof (wchar_t) ||
+      h->index_offset > m->size || (h->index_offset & 3) != 0 ||
+      h->index_slots > (m->size - h->index_offset) / sizeof (DWORD) ||
+      (h->index_slots & (h->index_slots - 1)) != 0 || h->index_slots <= h->record_count)
+    goto fail;
+
+  m->header = h;
+  m->records = (const manifest_record *) &m->base[h->records_offset];
+  m->strings = (const wchar_t *) &m->base[h->strings_offset];
+  m->index = (const DWORD *) &m->base[h->index_offset];
+  *map = m;
+  return 0;
+
+fail:
+  manifest_map_close (m);
+  return ret;
+}
+
+void
+manifest_map_close (manifest_map *map)
+{
+  if (map == NULL)
+    return;
+  if (map->base != NULL)
+    UnmapViewOfFile (map->base);
+  if (map->mappingh != NULL)
+    CloseHandle (map->mappingh);
+  if (map->fileh != NULL)
+    CloseHandle (map->fileh);
+  free (map);
+}
+
+size_t
+manifest_map_count (manifest_map *map)
+{
+  return (size_t) map->header->record_count;
+}
+
+/**
+ * manifest_map_entry:
+ * @map: a mapped manifest
+ * @i: record number (records are sorted by link name)
+ * @entry: receives pointers into the mapping (NOT NUL-terminated)
+ *
+ * Returns:
+ *  0 - success
+ * -1 - @i is out of range or the record points outside of the string pool
+ */
+int
+manifest_map_entry (manifest_map *map, size_t i, manifest_entry *entry)
+{
+  const manifest_record *r;
+  if (i >= map->header->record_count)
+    return -1;
+  r = &map->records[i];
+  if ((ULONGLONG) r->link_offset + r->link_length > map->header->strings_length ||
+      (ULONGLONG) r->target_offset + r->target_length > map->header->strings_length)
+    return -1;
+  entry->type = (wchar_t) r->type;
+  entry->link = &map->strings[r->link_offset];
+  entry->linklen = r->link_length;
+  entry->target = &map->strings[r->target_offset];
+  entry->targetlen = r->target_length;
+  return 0;
+}
+
+/**
+ * manifest_map_lookup:
+ * @map: a mapped manifest
+ * @link: a link name, as stored in the manifest (case does not matter)
+ *
+ * Finds a record through the hash index, without scanning the records.
+ *
+ * Returns:
+ * >= 0 - the record number
+ *   -1 - no such link
+ */
+long long
+manifest_map_lookup (manifest_map *map, const wchar_t *link)
+{
+  size_t len = wcslen (link);
+  ULONGLONG mask = map->header->index_slots - 1;
+  ULONGLONG slot, probes;
+  manifest_entry e;
+
+  slot = manifest_name_hash (link, len) & mask;
+  for (probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask)
+  {
+    DWORD rec = map->index[slot];
+    if (rec == MANIFEST_INDEX_EMPTY)
+      break;
+    if (manifest_map_entry (map, rec, &e) == 0 &&
+        manifest_name_cmp (e.link, e.linklen, link, len) == 0)
+      return rec;
+  }
+  return -1;
+}
+
+/**
+ * manifest_map_range:
+ * @map: a mapped manifest
+ * @prefix: a directory or link name
+ * @first: receives the number of the first matching record
+ * @last: receives the number of the record after the last matching one
+ *
+ * Finds the records for @prefix itself and for everything under it
+ * (binary search in the sorted record table).
+ * The range can also hold siblings of @prefix whose names continue with
+ * a character that sorts before the separator ("a-x", "a.txt" and "a1"
+ * for "a" come before "a\\b"), so callers must still check that each
+ * record is @prefix or continues it with a separator.
+ *
+ * Returns:
+ *  0 - success (*@first == *@last if nothing matches)
+ */
+int
+manifest_map_range (manifest_map *map, const wchar_t *prefix, size_t *first, size_t *last)
+{
+  size_t plen = wcslen (prefix);
+  size_t lo = 0, hi = manifest_map_count (map), i;
+  manifest_entry e;
+
+  while (plen > 0 && (prefix[plen - 1] == L'\\' || prefix[plen - 1] == L'/'))
+    plen -= 1;
+
+  /* Lower bound of @prefix */
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (manifest_map_entry (map, mid, &e) != 0 ||
+        manifest_name_cmp (e.link, e.linklen, prefix, plen) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *first = lo;
+
+  /* Everything that starts with @prefix is contiguous from here. Names
+   * under it ("prefix\\..." or "prefix/...") come before the siblings that
+   * continue with a character above the separator, stop at those.
+   */
+  for (i = lo; i < manifest_map_count (map); i++)
+  {
+    if (manifest_map_entry (map, i, &e) != 0 || e.linklen < plen ||
+        manifest_name_cmp (e.link, plen, prefix, plen) != 0)
+      break;
+    if (plen > 0 && e.linklen > plen && towlower (e.link[plen]) > L'\\')
+      break;
+  }
+  *last = i;
+  return 0;
+}
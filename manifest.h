@@ -0,0 +1,88 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_MANIFEST_H__
+#define __NTLINK_MANIFEST_H__
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "manifest_text.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary manifest layout (all integers are little-endian):
+ *
+ * manifest_header
+ * manifest_record[record_count]  - sorted by link name, case-insensitively
+ * UTF-16 string pool              - deduplicated, not NUL-terminated
+ * DWORD[index_slots]              - open-addressing hash index of link names,
+ *                                   record numbers, MANIFEST_INDEX_EMPTY if free
+ */
+
+#define MANIFEST_MAGIC "NTLNKMF"
+#define MANIFEST_VERSION 1
+#define MANIFEST_INDEX_EMPTY 0xFFFFFFFF
+
+typedef struct
+{
+  char magic[8];
+  DWORD version;
+  DWORD header_size;
+  ULONGLONG record_count;
+  ULONGLONG records_offset;
+  ULONGLONG strings_offset;
+  /* in characters */
+  ULONGLONG strings_length;
+  ULONGLONG index_offset;
+  /* a power of two */
+  ULONGLONG index_slots;
+} manifest_header;
+
+typedef struct
+{
+  /* Offsets are in characters from the beginning of the string pool */
+  DWORD link_offset;
+  DWORD target_offset;
+  WORD link_length;
+  WORD target_length;
+  /* 'f', 'd' or 'j', as in the text format */
+  WORD type;
+  WORD reserved;
+} manifest_record;
+
+typedef struct _manifest_map manifest_map;
+
+int manifest_write_binary (FILE *f, manifest_list *list);
+
+int manifest_map_open (const wchar_t *filename, manifest_map **map);
+void manifest_map_close (manifest_map *map);
+size_t manifest_map_count (manifest_map *map);
+int manifest_map_entry (manifest_map *map, size_t i, manifest_entry *entry);
+long long manifest_map_lookup (manifest_map *map, const wchar_t *link);
+int manifest_map_range (manifest_map *map, const wchar_t *prefix, size_t *first, size_t *last);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_MANIFEST_H__ */
@@ -0,0 +1,477 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "manifest_sort.h"
+
+/* Smallest accepted memory cap */
+#define MANIFEST_SORT_MIN_MEMORY (1024 * 1024)
+
+static FILE *
+default_spill (void *data)
+{
+  return tmpfile ();
+}
+
+/* Memory taken by a record in a run, approximately */
+static size_t
+record_size (const manifest_entry *e)
+{
+  return sizeof (manifest_entry) + sizeof (manifest_entry *) + sizeof (wchar_t) * (e->linklen + e->targetlen + 2);
+}
+
+/* Equal names are ordered by address, which is the order they were added in */
+static int
+run_cmp (const void *a, const void *b)
+{
+  const manifest_entry *ea = *(const manifest_entry **) a;
+  const manifest_entry *eb = *(const manifest_entry **) b;
+  int r = manifest_name_cmp (ea->link, ea->linklen, eb->link, eb->linklen);
+  if (r != 0)
+    return r;
+  return ea < eb ? -1 : ea > eb ? 1 : 0;
+}
+
+static int
+sort_run (manifest_sorter *sorter)
+{
+  size_t i;
+  free (sorter->sorted);
+  sorter->sorted = (const manifest_entry **) malloc (sizeof (manifest_entry *) * (sorter->run.count > 0 ? sorter->run.count : 1));
+  if (sorter->sorted == NULL)
+    return -9;
+  for (i = 0; i < sorter->run.count; i++)
+    sorter->sorted[i] = &sorter->run.items[i];
+  qsort (sorter->sorted, sorter->run.count, sizeof (manifest_entry *), run_cmp);
+  sorter->nsorted = sorter->run.count;
+  sorter->pos = 0;
+  return 0;
+}
+
+static int
+add_file (manifest_sorter *sorter, FILE *f)
+{
+  if (sorter->nfiles == sorter->capfiles)
+  {
+    size_t newcap = sorter->capfiles == 0 ? 16 : sorter->capfiles * 2;
+    FILE **files = (FILE **) realloc (sorter->files, sizeof (FILE *) * newcap);
+    if (files == NULL)
+      return -9;
+    sorter->files = files;
+    sorter->capfiles = newcap;
+  }
+  sorter->files[sorter->nfiles++] = f;
+  return 0;
+}
+
+/* Sorts the current run and writes it into a new file */
+static int
+spill_run (manifest_sorter *sorter)
+{
+  manifest_writer writer;
+  FILE *f;
+  size_t i;
+  int r;
+
+  r = sort_run (sorter);
+  if (r != 0)
+    return r;
+  f = sorter->spill (sorter->spill_data);
+  if (f == NULL)
+    return -2;
+  if (manifest_writer_init (&writer, f) != 0)
+  {
+    fclose (f);
+    return -9;
+  }
+  for (i = 0; r == 0 && i < sorter->nsorted; i++)
+    r = manifest_writer_add (&writer, sorter->sorted[i]);
+  if (r == 0)
+    r = manifest_writer_flush (&writer);
+  manifest_writer_free (&writer);
+  if (r == 0 && fseek (f, 0, SEEK_SET) != 0)
+    r = -2;
+  if (r == 0)
+    r = add_file (sorter, f);
+  if (r != 0)
+  {
+    fclose (f);
+    return r;
+  }
+  free (sorter->sorted);
+  sorter->sorted = NULL;
+  sorter->nsorted = 0;
+  manifest_list_clear (&sorter->run);
+  sorter->runbytes = 0;
+  return 0;
+}
+
+/* Orders the heap by the current record of each reader, then by reader number */
+static int
+heap_less (manifest_sorter *sorter, size_t a, size_t b)
+{
+  const manifest_entry *ea = &sorter->heads[sorter->heap[a]];
+  const manifest_entry *eb = &sorter->heads[sorter->heap[b]];
+  int r = manifest_name_cmp (ea->link, ea->linklen, eb->link, eb->linklen);
+  if (r != 0)
+    return r < 0;
+  return sorter->heap[a] < sorter->heap[b];
+}
+
+static void
+heap_down (manifest_sorter *sorter, size_t i)
+{
+  while (1)
+  {
+    size_t l = i * 2 + 1, r = l + 1, m = i, tmp;
+    if (l < sorter->nheap && heap_less (sorter, l, m))
+      m = l;
+    if (r < sorter->nheap && heap_less (sorter, r, m))
+      m = r;
+    if (m == i)
+      return;
+    tmp = sorter->heap[i];
+    sorter->heap[i] = sorter->heap[m];
+    sorter->heap[m] = tmp;
+    i = m;
+  }
+}
+
+static void
+merge_close (manifest_sorter *sorter, size_t n)
+{
+  size_t i;
+  for (i = 0; sorter->readers != NULL && i < n; i++)
+    manifest_reader_free (&sorter->readers[i]);
+  free (sorter->readers);
+  free (sorter->heads);
+  free (sorter->heap);
+  sorter->readers = NULL;
+  sorter->heads = NULL;
+  sorter->heap = NULL;
+  sorter->nheap = 0;
+}
+
+/* Starts a k-way merge of the runs files[0] ... files[n - 1] */
+static int
+merge_open (manifest_sorter *sorter, FILE **files, size_t n)
+{
+  size_t i;
+  int r;
+  sorter->readers = (manifest_reader *) calloc (n, sizeof (manifest_reader));
+  sorter->heads = (manifest_entry *) malloc (sizeof (manifest_entry) * n);
+  sorter->heap = (size_t *) malloc (sizeof (size_t) * n);
+  sorter->nheap = 0;
+  if (sorter->readers == NULL || sorter->heads == NULL || sorter->heap == NULL)
+  {
+    merge_close (sorter, 0);
+    return -9;
+  }
+  for (i = 0; i < n; i++)
+  {
+    if (manifest_reader_init (&sorter->readers[i], files[i]) != 0)
+    {
+      merge_close (sorter, i);
+      return -9;
+    }
+  }
+  for (i = 0; i < n; i++)
+  {
+    r = manifest_reader_next (&sorter->readers[i], &sorter->heads[i]);
+    if (r < 0)
+    {
+      merge_close (sorter, n);
+      return r;
+    }
+    if (r > 0)
+      sorter->heap[sorter->nheap++] = i;
+  }
+  for (i = sorter->nheap / 2; i-- > 0; )
+    heap_down (sorter, i);
+  return 0;
+}
+
+/* The next record in sorted order, without taking it */
+static int
+peek (manifest_sorter *sorter, const manifest_entry **entry)
+{
+  if (sorter->nfiles == 0)
+  {
+    if (sorter->pos == sorter->nsorted)
+      return 0;
+    *entry = sorter->sorted[sorter->pos];
+    return 1;
+  }
+  if (sorter->nheap == 0)
+    return 0;
+  *entry = &sorter->heads[sorter->heap[0]];
+  return 1;
+}
+
+/* Takes the record returned by peek(), which becomes invalid */
+static int
+advance (manifest_sorter *sorter)
+{
+  size_t top;
+  int r;
+  if (sorter->nfiles == 0)
+  {
+    sorter->pos += 1;
+    return 0;
+  }
+  top = sorter->heap[0];
+  r = manifest_reader_next (&sorter->readers[top], &sorter->heads[top]);
+  if (r < 0)
+    return r;
+  if (r == 0)
+    sorter->heap[0] = sorter->heap[--sorter->nheap];
+  heap_down (sorter, 0);
+  return 0;
+}
+
+/*
+ * Merges groups of runs until there are few enough of them to be merged
+ * in one go within the memory cap (each reader needs a block-sized buffer).
+ */
+static int
+merge_passes (manifest_sorter *sorter)
+{
+  size_t fanout = sorter->memory / (sizeof (wchar_t) * MANIFEST_TEXT_BLOCK * 2);
+  if (fanout < 2)
+    fanout = 2;
+  while (sorter->nfiles > fanout)
+  {
+    size_t first, nout = 0, i;
+    for (first = 0; first < sorter->nfiles; first += fanout)
+    {
+      size_t n = sorter->nfiles - first < fanout ? sorter->nfiles - first : fanout;
+      manifest_writer writer;
+      const manifest_entry *e;
+      FILE *out;
+      int r;
+      /* A single leftover run is carried over as is */
+      if (n == 1)
+      {
+        sorter->files[nout++] = sorter->files[first];
+        continue;
+      }
+      out = sorter->spill (sorter->spill_data);
+      if (out == NULL)
+        return -2;
+      if (manifest_writer_init (&writer, out) != 0)
+      {
+        fclose (out);
+        return -9;
+      }
+      r = merge_open (sorter, &sorter->files[first], n);
+      while (r == 0 && (r = peek (sorter, &e)) > 0)
+      {
+        r = manifest_writer_add (&writer, e);
+        if (r == 0)
+          r = advance (sorter);
+      }
+      if (r == 0)
+        r = manifest_writer_flush (&writer);
+      manifest_writer_free (&writer);
+      merge_close (sorter, n);
+      if (r == 0 && fseek (out, 0, SEEK_SET) != 0)
+        r = -2;
+      if (r != 0)
+      {
+        fclose (out);
+        return r;
+      }
+      for (i = first; i < first + n; i++)
+      {
+        fclose (sorter->files[i]);
+        sorter->files[i] = NULL;
+      }
+      /* Groups are merged in order, so equal names keep their order */
+      sorter->files[nout++] = out;
+    }
+    sorter->nfiles = nout;
+  }
+  return 0;
+}
+
+/**
+ * manifest_sorter_init:
+ * @sorter: a sorter
+ * @memory: memory cap in bytes, 0 for MANIFEST_SORT_DEFAULT_MEMORY
+ * @unique: if non-zero, only the last of the records with the same name
+ *   is returned (that's how records of appended backups override earlier ones)
+ * @spill: a function that creates temporary files, NULL for tmpfile()
+ * @spill_data: passed to @spill
+ *
+ * Returns:
+ *  0 - success
+ */
+int
+manifest_sorter_init (manifest_sorter *sorter, size_t memory, int unique, manifest_spill_func spill, void *spill_data)
+{
+  memset (sorter, 0, sizeof (manifest_sorter));
+  if (memory == 0)
+    memory = MANIFEST_SORT_DEFAULT_MEMORY;
+  sorter->memory = memory < MANIFEST_SORT_MIN_MEMORY ? MANIFEST_SORT_MIN_MEMORY : memory;
+  sorter->unique = unique;
+  sorter->spill = spill != NULL ? spill : default_spill;
+  sorter->spill_data = spill_data;
+  return 0;
+}
+
+/**
+ * manifest_sorter_add:
+ * @sorter: a sorter
+ * @entry: a record (its strings don't have to be NUL-terminated)
+ *
+ * Adds a record, spilling the records added so far into a temporary
+ * file if they take more memory than the cap allows.
+ *
+ * Returns:
+ *  0 - success
+ * -2 - failed to create or write a temporary file
+ * -9 - failed to allocate memory
+ */
+int
+manifest_sorter_add (manifest_sorter *sorter, const manifest_entry *entry)
+{
+  size_t size = record_size (entry);
+  if (sorter->run.count > 0 && sorter->runbytes + size > sorter->memory)
+  {
+    int r = spill_run (sorter);
+    if (r != 0)
+      return r;
+  }
+  if (manifest_list_add (&sorter->run, entry->type, entry->link, entry->linklen, entry->target, entry->targetlen) != 0)
+    return -9;
+  sorter->runbytes += size;
+  return 0;
+}
+
+/**
+ * manifest_sorter_finish:
+ * @sorter: a sorter
+ *
+ * Sorts the records. If nothing was spilled, this happens in memory.
+ * Otherwise the last run is spilled as well, and the runs are merged
+ * (in several passes, if there are too many of them) until they can
+ * be merged as they are read.
+ *
+ * Returns:
+ *  0 - success
+ * -2 - failed to create, write or read a temporary file
+ * -9 - failed to allocate memory
+ */
+int
+manifest_sorter_finish (manifest_sorter *sorter)
+{
+  int r;
+  if (sorter->nfiles == 0)
+    return sort_run (sorter);
+  if (sorter->run.count > 0)
+  {
+    r = spill_run (sorter);
+    if (r != 0)
+      return r;
+  }
+  r = merge_passes (sorter);
+  if (r != 0)
+    return r;
+  return merge_open (sorter, sorter->files, sorter->nfiles);
+}
+
+static int
+copy_entry (manifest_sorter *sorter, const manifest_entry *e, manifest_entry *entry)
+{
+  size_t size = e->linklen + e->targetlen + 2;
+  if (size > sorter->bufsize)
+  {
+    wchar_t *buf = (wchar_t *) realloc (sorter->buf, sizeof (wchar_t) * size * 2);
+    if (buf == NULL)
+      return -9;
+    sorter->buf = buf;
+    sorter->bufsize = size * 2;
+  }
+  memcpy (sorter->buf, e->link, sizeof (wchar_t) * e->linklen);
+  sorter->buf[e->linklen] = L'\0';
+  memcpy (&sorter->buf[e->linklen + 1], e->target, sizeof (wchar_t) * e->targetlen);
+  sorter->buf[e->linklen + 1 + e->targetlen] = L'\0';
+  entry->type = e->type;
+  entry->link = sorter->buf;
+  entry->linklen = e->linklen;
+  entry->target = &sorter->buf[e->linklen + 1];
+  entry->targetlen = e->targetlen;
+  return 0;
+}
+
+/**
+ * manifest_sorter_next:
+ * @sorter: a finished sorter
+ * @entry: receives the record. Its strings are NUL-terminated and are only
+ *   valid until the next call.
+ *
+ * Returns:
+ *  1 - a record was read
+ *  0 - no more records
+ * -2 - failed to read a temporary file
+ * -9 - failed to allocate memory
+ * other negative values - see manifest_reader_next()
+ */
+int
+manifest_sorter_next (manifest_sorter *sorter, manifest_entry *entry)
+{
+  const manifest_entry *e;
+  int r;
+  r = peek (sorter, &e);
+  if (r <= 0)
+    return r;
+  while (1)
+  {
+    r = copy_entry (sorter, e, entry);
+    if (r == 0)
+      r = advance (sorter);
+    if (r != 0)
+      return r;
+    if (!sorter->unique)
+      return 1;
+    r = peek (sorter, &e);
+    if (r < 0)
+      return r;
+    if (r == 0 || manifest_name_cmp (e->link, e->linklen, entry->link, entry->linklen) != 0)
+      return 1;
+  }
+}
+
+void
+manifest_sorter_free (manifest_sorter *sorter)
+{
+  size_t i;
+  merge_close (sorter, sorter->nfiles);
+  for (i = 0; i < sorter->nfiles; i++)
+    if (sorter->files[i] != NULL)
+      fclose (sorter->files[i]);
+  free (sorter->files);
+  free (sorter->sorted);
+  free (sorter->buf);
+  manifest_list_clear (&sorter->run);
+  memset (sorter, 0, sizeof (manifest_sorter));
+}
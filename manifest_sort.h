@@ -0,0 +1,90 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __NTLINK_MANIFEST_SORT_H__
+#define __NTLINK_MANIFEST_SORT_H__
+
+/* External merge sort of manifest records. Does not depend on windows.h */
+
+#include "manifest_text.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Used when the memory cap is 0 */
+#define MANIFEST_SORT_DEFAULT_MEMORY (64 * 1024 * 1024)
+
+/* Returns a new file opened for reading and writing in binary mode,
+ * which is deleted when it's closed, or NULL.
+ */
+typedef FILE *(*manifest_spill_func) (void *data);
+
+/**
+ * manifest_sorter:
+ *
+ * Sorts any number of records by link name using a bounded amount of
+ * memory: when the records added so far exceed the cap, they are sorted
+ * and spilled into a temporary file (a run), and the runs are merged
+ * when the records are read back. Records with equal names come out in
+ * the order they were added in.
+ *
+ * Initialize with manifest_sorter_init(), add records with
+ * manifest_sorter_add(), call manifest_sorter_finish() once, read the
+ * records with manifest_sorter_next(), release with manifest_sorter_free().
+ */
+typedef struct
+{
+  size_t memory;
+  int unique;
+  manifest_spill_func spill;
+  void *spill_data;
+  /* records that were not spilled yet */
+  manifest_list run;
+  size_t runbytes;
+  /* spilled runs, in the order they were written */
+  FILE **files;
+  size_t nfiles;
+  size_t capfiles;
+  /* records of the run, when nothing was spilled */
+  const manifest_entry **sorted;
+  size_t nsorted;
+  size_t pos;
+  /* k-way merge of the runs: a heap of reader numbers */
+  manifest_reader *readers;
+  manifest_entry *heads;
+  size_t *heap;
+  size_t nheap;
+  /* copy of the record returned last */
+  wchar_t *buf;
+  size_t bufsize;
+} manifest_sorter;
+
+int manifest_sorter_init (manifest_sorter *sorter, size_t memory, int unique, manifest_spill_func spill, void *spill_data);
+int manifest_sorter_add (manifest_sorter *sorter, const manifest_entry *entry);
+int manifest_sorter_finish (manifest_sorter *sorter);
+int manifest_sorter_next (manifest_sorter *sorter, manifest_entry *entry);
+void manifest_sorter_free (manifest_sorter *sorter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_MANIFEST_SORT_H__ */
@@ -0,0 +1,663 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+
+#include "manifest_text.h"
+
+/**
+ * manifest_name_cmp:
+ *
+ * Compares two link names case-insensitively. This is the order of the
+ * records in a binary manifest.
+ *
+ * Returns:
+ * <0, 0 or >0, like wcscmp()
+ */
+int
+manifest_name_cmp (const wchar_t *a, size_t alen, const wchar_t *b, size_t blen)
+{
+  size_t i;
+  for (i = 0; i < alen && i < blen; i++)
+  {
+    wint_t ca = towlower (a[i]);
+    wint_t cb = towlower (b[i]);
+    if (ca != cb)
+      return ca < cb ? -1 : 1;
+  }
+  if (alen == blen)
+    return 0;
+  return alen < blen ? -1 : 1;
+}
+
+/**
+ * manifest_name_hash:
+ *
+ * Hashes a link name case-insensitively (FNV-1a over lower-cased
+ * characters). Binary manifest indices are built with this function.
+ */
+unsigned int
+manifest_name_hash (const wchar_t *s, size_t len)
+{
+  unsigned int h = 2166136261U;
+  size_t i;
+  for (i = 0; i < len; i++)
+  {
+    h ^= (unsigned int) towlower (s[i]);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/**
+ * manifest_list_add:
+ * @list: a list (zero-initialize it before the first use)
+ * @type: link type
+ * @link: link name
+ * @linklen: length of @link in characters
+ * @target: link target
+ * @targetlen: length of @target in characters
+ *
+ * Appends a copy of the entry to @list.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+manifest_list_add (manifest_list *list, wchar_t type, const wchar_t *link, size_t linklen, const wchar_t *target, size_t targetlen)
+{
+  manifest_entry *e;
+  wchar_t *l, *t;
+
+  if (list->count == list->capacity)
+  {
+    size_t newcap = list->capacity == 0 ? 256 : list->capacity * 2;
+    manifest_entry *items = (manifest_entry *) realloc (list->items, sizeof (manifest_entry) * newcap);
+    if (items == NULL)
+      return -1;
+    list->items = items;
+    list->capacity = newcap;
+  }
+  l = (wchar_t *) malloc (sizeof (wchar_t) * (linklen + 1));
+  t = (wchar_t *) malloc (sizeof (wchar_t) * (targetlen + 1));
+  if (l == NULL || t == NULL)
+  {
+    free (l);
+    free (t);
+    return -1;
+  }
+  memcpy (l, link, sizeof (wchar_t) * linklen);
+  l[linklen] = L'\0';
+  memcpy (t, target, sizeof (wchar_t) * targetlen);
+  t[targetlen] = L'\0';
+
+  e = &list->items[list->count++];
+  e->type = type;
+  e->link = l;
+  e->linklen = linklen;
+  e->target = t;
+  e->targetlen = targetlen;
+  return 0;
+}
+
+static int
+manifest_list_cmp (const void *a, const void *b)
+{
+  const manifest_entry *ea = (const manifest_entry *) a;
+  const manifest_entry *eb = (const manifest_entry *) b;
+  int r = manifest_name_cmp (ea->link, ea->linklen, eb->link, eb->linklen);
+  if (r != 0)
+    return r;
+  /* Names that differ only in case: keep the order deterministic */
+  return wcscmp (ea->link, eb->link);
+}
+
+/**
+ * manifest_list_sort:
+ *
+ * Sorts a list by link name, case-insensitively (the order of
+ * a binary manifest).
+ */
+void
+manifest_list_sort (manifest_list *list)
+{
+  qsort (list->items, list->count, sizeof (manifest_entry), manifest_list_cmp);
+}
+
+void
+manifest_list_clear (manifest_list *list)
+{
+  size_t i;
+  for (i = 0; i < list->count; i++)
+  {
+    free ((wchar_t *) list->items[i].link);
+    free ((wchar_t *) list->items[i].target);
+  }
+  free (list->items);
+  list->items = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+/*
+ * Parses a decimal length followed by a space.
+ * Returns 1 on success, 0 if @buf ends before the space, -1 if malformed.
+ */
+static int
+parse_length (const wchar_t *buf, size_t len, size_t *pos, size_t *value)
+{
+  size_t p = *pos;
+  size_t v = 0;
+  int digits = 0;
+  for (; p < len && buf[p] >= L'0' && buf[p] <= L'9'; p++)
+  {
+    if (++digits > MANIFEST_TEXT_MAX_DIGITS)
+      return -1;
+    v = v * 10 + (buf[p] - L'0');
+  }
+  if (p == len)
+    return 0;
+  if (digits == 0 || v == 0 || buf[p] != L' ')
+    return -1;
+  *pos = p + 1;
+  *value = v;
+  return 1;
+}
+
+/**
+ * manifest_text_parse:
+ * @buf: text manifest data (a block read from a file, or a mapped file)
+ * @len: number of characters in @buf
+ * @used: receives the number of characters the record occupies
+ * @entry: receives the record. The strings point into @buf and are
+ *   NOT NUL-terminated.
+ *
+ * Parses one "link <type> <len> <name> <len> <target>\n" record.
+ * Names are skipped over using their length prefixes, so only the fixed
+ * parts of a record are examined character by character.
+ *
+ * Returns:
+ *  1 - a record was parsed
+ *  0 - @buf ends in the middle of a record (or is empty)
+ * -1 - no "link " keyword
+ * -2 - malformed link type
+ * -3 - malformed link name length
+ * -5 - no separator after the link name
+ * -6 - malformed target length
+ * -8 - no newline after the target
+ */
+int
+manifest_text_parse (const wchar_t *buf, size_t len, size_t *used, manifest_entry *entry)
+{
+  static const wchar_t keyword[] = L"link ";
+  size_t p, linklen, targetlen, link, target;
+  int r;
+
+  for (p = 0; p < 5; p++)
+  {
+    if (p == len)
+      return 0;
+    if (buf[p] != keyword[p])
+      return -1;
+  }
+  if (len < p + 2)
+    return 0;
+  if (buf[p + 1] != L' ')
+    return -2;
+  entry->type = buf[p];
+  p += 2;
+
+  r = parse_length (buf, len, &p, &linklen);
+  if (r <= 0)
+    return r < 0 ? -3 : 0;
+  if (len - p < linklen + 1)
+    return 0;
+  link = p;
+  p += linklen;
+  if (buf[p] != L' ')
+    return -5;
+  p += 1;
+
+  r = parse_length (buf, len, &p, &targetlen);
+  if (r <= 0)
+    return r < 0 ? -6 : 0;
+  if (len - p < targetlen + 1)
+    return 0;
+  target = p;
+  p += targetlen;
+  if (buf[p] != L'\n')
+    return -8;
+  p += 1;
+
+  entry->link = &buf[link];
+  entry->linklen = linklen;
+  entry->target = &buf[target];
+  entry->targetlen = targetlen;
+  *used = p;
+  return 1;
+}
+
+/**
+ * manifest_reader_init:
+ * @reader: a reader
+ * @f: a file opened in binary mode
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+manifest_reader_init (manifest_reader *reader, FILE *f)
+{
+  reader->f = f;
+  reader->capacity = MANIFEST_TEXT_BLOCK;
+  reader->start = 0;
+  reader->end = 0;
+  reader->eof = 0;
+  reader->buf = (wchar_t *) malloc (sizeof (wchar_t) * reader->capacity);
+  return reader->buf == NULL ? -1 : 0;
+}
+
+/**
+ * manifest_reader_next:
+ * @reader: a reader
+ * @entry: receives the record. The strings point into the reader's buffer,
+ *   are NOT NUL-terminated and are only valid until the next call.
+ *
+ * Returns:
+ *  1 - a record was read
+ *  0 - end of file
+ * -4 - the file ends in the middle of a record
+ * -9 - failed to allocate memory (a record is bigger than the buffer)
+ * other negative values - malformed record, see manifest_text_parse()
+ */
+int
+manifest_reader_next (manifest_reader *reader, manifest_entry *entry)
+{
+  while (1)
+  {
+    size_t used, got;
+    int r = manifest_text_parse (&reader->buf[reader->start], reader->end - reader->start, &used, entry);
+    if (r > 0)
+    {
+      reader->start += used;
+      return 1;
+    }
+    if (r < 0)
+      return r;
+    if (reader->eof)
+      return reader->start == reader->end ? 0 : -4;
+
+    /* Incomplete record: move it to the beginning of the buffer,
+     * grow the buffer if the record alone fills it, then read a block.
+     */
+    if (reader->start > 0)
+    {
+      memmove (reader->buf, &reader->buf[reader->start], sizeof (wchar_t) * (reader->end - reader->start));
+      reader->end -= reader->start;
+      reader->start = 0;
+    }
+    if (reader->end == reader->capacity)
+    {
+      wchar_t *buf = (wchar_t *) realloc (reader->buf, sizeof (wchar_t) * reader->capacity * 2);
+      if (buf == NULL)
+        return -9;
+      reader->buf = buf;
+      reader->capacity *= 2;
+    }
+    got = fread (&reader->buf[reader->end], sizeof (wchar_t), reader->capacity - reader->end, reader->f);
+    if (got == 0)
+      reader->eof = 1;
+    reader->end += got;
+  }
+}
+
+void
+manifest_reader_free (manifest_reader *reader)
+{
+  free (reader->buf);
+  reader->buf = NULL;
+}
+
+/**
+ * manifest_writer_init:
+ * @writer: a writer
+ * @f: a file opened in binary mode
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+manifest_writer_init (manifest_writer *writer, FILE *f)
+{
+  writer->f = f;
+  writer->capacity = MANIFEST_TEXT_BLOCK;
+  writer->len = 0;
+  writer->error = 0;
+  writer->buf = (wchar_t *) malloc (sizeof (wchar_t) * writer->capacity);
+  return writer->buf == NULL ? -1 : 0;
+}
+
+/**
+ * manifest_writer_flush:
+ * @writer: a writer
+ *
+ * Writes out the buffered records.
+ *
+ * Returns:
+ *  0 - success
+ * -2 - failed to write (now or at some point before)
+ */
+int
+manifest_writer_flush (manifest_writer *writer)
+{
+  if (writer->len > 0 && !writer->error)
+  {
+    if (fwrite (writer->buf, sizeof (wchar_t), writer->len, writer->f) != writer->len)
+      writer->error = 1;
+  }
+  writer->len = 0;
+  return writer->error ? -2 : 0;
+}
+
+static void
+writer_put (manifest_writer *writer, const wchar_t *s, size_t len)
+{
+  if (writer->capacity - writer->len < len)
+    manifest_writer_flush (writer);
+  if (len > writer->capacity)
+  {
+    if (!writer->error && fwrite (s, sizeof (wchar_t), len, writer->f) != len)
+      writer->error = 1;
+    return;
+  }
+  memcpy (&writer->buf[writer->len], s, sizeof (wchar_t) * len);
+  writer->len += len;
+}
+
+static size_t
+format_length (wchar_t *out, size_t value)
+{
+  wchar_t tmp[24];
+  size_t n = 0, i;
+  do
+  {
+    tmp[n++] = L'0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+  for (i = 0; i < n; i++)
+    out[i] = tmp[n - 1 - i];
+  return n;
+}
+
+/**
+ * manifest_writer_add:
+ * @writer: a writer
+ * @entry: a record (its strings don't have to be NUL-terminated)
+ *
+ * Appends one text record to the buffer, writing the buffer out when it
+ * is full.
+ *
+ * Returns:
+ *  0 - success
+ * -2 - failed to write
+ */
+int
+manifest_writer_add (manifest_writer *writer, const manifest_entry *entry)
+{
+  wchar_t head[64];
+  size_t n;
+
+  n = 0;
+  memcpy (head, L"link ", sizeof (wchar_t) * 5);
+  n += 5;
+  head[n++] = entry->type;
+  head[n++] = L' ';
+  n += format_length (&head[n], entry->linklen);
+  head[n++] = L' ';
+  writer_put (writer, head, n);
+  writer_put (writer, entry->link, entry->linklen);
+
+  n = 0;
+  head[n++] = L' ';
+  n += format_length (&head[n], entry->targetlen);
+  head[n++] = L' ';
+  writer_put (writer, head, n);
+  writer_put (writer, entry->target, entry->targetlen);
+  writer_put (writer, L"\n", 1);
+  return writer->error ? -2 : 0;
+}
+
+void
+manifest_writer_free (manifest_writer *writer)
+{
+  free (writer->buf);
+  writer->buf = NULL;
+}
+
+/**
+ * manifest_read_text:
+ * @f: a file opened in binary mode
+ * @list: a list to append the records to
+ *
+ * Reads a whole text manifest into @list.
+ *
+ * Returns:
+ *  0 - success
+ * <0 - see manifest_reader_next()
+ */
+int
+manifest_read_text (FILE *f, manifest_list *list)
+{
+  manifest_reader reader;
+  manifest_entry e;
+  int r;
+  if (manifest_reader_init (&reader, f) != 0)
+    return -9;
+  while ((r = manifest_reader_next (&reader, &e)) > 0)
+  {
+    if (manifest_list_add (list, e.type, e.link, e.linklen, e.target, e.targetlen) != 0)
+    {
+      r = -9;
+      break;
+    }
+  }
+  manifest_reader_free (&reader);
+  return r;
+}
+
+/* Length of the directory part of a link name, without the separator */
+static size_t
+parent_length (const manifest_entry *e)
+{
+  size_t len = e->linklen;
+  while (len > 0 && e->link[len - 1] != L'\\' && e->link[len - 1] != L'/')
+    len--;
+  return len > 0 ? len - 1 : 0;
+}
+
+static size_t
+index_key_length (const manifest_index *index, size_t i)
+{
+  return index->by_parent ? parent_length (&index->entries[i]) : index->entries[i].linklen;
+}
+
+typedef struct
+{
+  const wchar_t *key;
+  size_t keylen;
+  size_t i;
+} index_key;
+
+static int
+index_key_cmp (const void *a, const void *b)
+{
+  const index_key *ka = (const index_key *) a;
+  const index_key *kb = (const index_key *) b;
+  int r = manifest_name_cmp (ka->key, ka->keylen, kb->key, kb->keylen);
+  if (r != 0)
+    return r;
+  return ka->i < kb->i ? -1 : ka->i > kb->i ? 1 : 0;
+}
+
+/**
+ * manifest_index_build:
+ * @index: an index
+ * @entries: records to index. They must outlive the index.
+ * @count: number of records
+ * @by_parent: 0 to key the records by link name, 1 to key them by the
+ *   directory the link is in ("" for links directly in the base directory)
+ *
+ * Builds a hash index over @entries. Names are compared case-insensitively.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+manifest_index_build (manifest_index *index, const manifest_entry *entries, size_t count, int by_parent)
+{
+  index_key *keys;
+  size_t i;
+  index->entries = entries;
+  index->count = count;
+  index->by_parent = by_parent;
+  for (index->nslots = 16; index->nslots < count * 2; index->nslots *= 2);
+  index->order = (size_t *) malloc (sizeof (size_t) * (count > 0 ? count : 1));
+  index->slots = (size_t *) malloc (sizeof (size_t) * index->nslots);
+  keys = (index_key *) malloc (sizeof (index_key) * (count > 0 ? count : 1));
+  if (index->order == NULL || index->slots == NULL || keys == NULL)
+  {
+    free (keys);
+    manifest_index_free (index);
+    return -1;
+  }
+  for (i = 0; i < count; i++)
+  {
+    keys[i].key = entries[i].link;
+    keys[i].keylen = index_key_length (index, i);
+    keys[i].i = i;
+  }
+  qsort (keys, count, sizeof (index_key), index_key_cmp);
+
+  memset (index->slots, 0xFF, sizeof (size_t) * index->nslots);
+  for (i = 0; i < count; i++)
+  {
+    size_t slot;
+    index->order[i] = keys[i].i;
+    /* Only the first record of a group of equal keys goes into the table */
+    if (i > 0 && manifest_name_cmp (keys[i - 1].key, keys[i - 1].keylen, keys[i].key, keys[i].keylen) == 0)
+      continue;
+    slot = manifest_name_hash (keys[i].key, keys[i].keylen) & (index->nslots - 1);
+    while (index->slots[slot] != (size_t) -1)
+      slot = (slot + 1) & (index->nslots - 1);
+    index->slots[slot] = i;
+  }
+  free (keys);
+  return 0;
+}
+
+/**
+ * manifest_index_find:
+ * @index: an index
+ * @key: a link name (or a directory name, for an index built by parent)
+ * @keylen: length of @key in characters
+ * @n: receives the number of matching records
+ *
+ * Returns:
+ * position of the first matching record in @index->order (the records
+ * are @index->order[result] ... @index->order[result + *n - 1]),
+ * or (size_t) -1 (and *@n = 0) if nothing matches
+ */
+size_t
+manifest_index_find (const manifest_index *index, const wchar_t *key, size_t keylen, size_t *n)
+{
+  size_t slot = manifest_name_hash (key, keylen) & (index->nslots - 1);
+  size_t first, last;
+  *n = 0;
+  for (; index->slots[slot] != (size_t) -1; slot = (slot + 1) & (index->nslots - 1))
+  {
+    first = index->slots[slot];
+    if (manifest_name_cmp (index->entries[index->order[first]].link, index_key_length (index, index->order[first]), key, keylen) != 0)
+      continue;
+    for (last = first + 1; last < index->count &&
+        manifest_name_cmp (index->entries[index->order[last]].link, index_key_length (index, index->order[last]), key, keylen) == 0; last++);
+    *n = last - first;
+    return first;
+  }
+  return (size_t) -1;
+}
+
+void
+manifest_index_free (manifest_index *index)
+{
+  free (index->order);
+  free (index->slots);
+  index->order = NULL;
+  index->slots = NULL;
+}
+
+/**
+ * manifest_merge:
+ * @base: records of a full manifest
+ * @nbase: number of records in @base
+ * @delta: records of a delta manifest (see MANIFEST_TYPE_REMOVED)
+ * @ndelta: number of records in @delta
+ * @result: a list to put the merged records to, sorted by link name
+ *
+ * Applies a delta on top of a base: records of @delta replace the records
+ * of @base with the same name, removal records delete them.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+manifest_merge (const manifest_entry *base, size_t nbase, const manifest_entry *delta, size_t ndelta, manifest_list *result)
+{
+  manifest_index index;
+  size_t i, n;
+  int r = 0;
+
+  if (manifest_index_build (&index, delta, ndelta, 0) != 0)
+    return -1;
+  for (i = 0; i < nbase && r == 0; i++)
+  {
+    manifest_index_find (&index, base[i].link, base[i].linklen, &n);
+    if (n == 0)
+      r = manifest_list_add (result, base[i].type, base[i].link, base[i].linklen, base[i].target, base[i].targetlen);
+  }
+  /* For each name the last record of the delta wins */
+  for (i = 0; i < ndelta && r == 0; i++)
+  {
+    size_t first = manifest_index_find (&index, delta[i].link, delta[i].linklen, &n);
+    if (index.order[first + n - 1] != i || delta[i].type == MANIFEST_TYPE_REMOVED)
+      continue;
+    r = manifest_list_add (result, delta[i].type, delta[i].link, delta[i].linklen, delta[i].target, delta[i].targetlen);
+  }
+  manifest_index_free (&index);
+  if (r != 0)
+    return -1;
+  manifest_list_sort (result);
+  return 0;
+}
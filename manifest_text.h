@@ -0,0 +1,153 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_MANIFEST_TEXT_H__
+#define __NTLINK_MANIFEST_TEXT_H__
+
+/* Text manifest codec. Does not depend on windows.h */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Manifest files are read and written in blocks of this many characters */
+#define MANIFEST_TEXT_BLOCK 65536
+
+/* Longest accepted length prefix, in digits */
+#define MANIFEST_TEXT_MAX_DIGITS 9
+
+/* Record types besides L'f', L'd' and L'j' */
+/* A delta manifest record: the link was removed (target is the old one) */
+#define MANIFEST_TYPE_REMOVED L'x'
+/* A backup state record: a directory and its last write time (hex) */
+#define MANIFEST_TYPE_DIRECTORY L'D'
+/* A hard link: target is another name of the same file (relative to the base directory) */
+#define MANIFEST_TYPE_HARDLINK L'h'
+
+/**
+ * manifest_entry:
+ * @type: L'f' (file symlink), L'd' (directory symlink) or L'j' (junction)
+ * @link: link name, relative to the base directory
+ * @linklen: length of @link in characters
+ * @target: link target
+ * @targetlen: length of @target in characters
+ *
+ * Strings are NUL-terminated in a manifest_list, but NOT in entries
+ * obtained from a manifest_reader or a manifest_map.
+ */
+typedef struct
+{
+  wchar_t type;
+  const wchar_t *link;
+  size_t linklen;
+  const wchar_t *target;
+  size_t targetlen;
+} manifest_entry;
+
+typedef struct
+{
+  manifest_entry *items;
+  size_t count;
+  size_t capacity;
+} manifest_list;
+
+/**
+ * manifest_reader:
+ *
+ * Reads text records from a file in MANIFEST_TEXT_BLOCK-sized blocks.
+ * Initialize with manifest_reader_init(), release with manifest_reader_free().
+ */
+typedef struct
+{
+  FILE *f;
+  wchar_t *buf;
+  size_t capacity;
+  size_t start;
+  size_t end;
+  int eof;
+} manifest_reader;
+
+/**
+ * manifest_writer:
+ *
+ * Collects text records in a buffer and writes it out in large blocks.
+ * Initialize with manifest_writer_init(), call manifest_writer_flush()
+ * when done, release with manifest_writer_free().
+ */
+typedef struct
+{
+  FILE *f;
+  wchar_t *buf;
+  size_t capacity;
+  size_t len;
+  int error;
+} manifest_writer;
+
+/**
+ * manifest_index:
+ *
+ * A hash index over an array of records, see manifest_index_build().
+ */
+typedef struct
+{
+  const manifest_entry *entries;
+  size_t count;
+  int by_parent;
+  /* Record numbers, sorted by key */
+  size_t *order;
+  /* Open addressing table, positions in @order, (size_t) -1 if free */
+  size_t *slots;
+  size_t nslots;
+} manifest_index;
+
+int manifest_list_add (manifest_list *list, wchar_t type, const wchar_t *link, size_t linklen, const wchar_t *target, size_t targetlen);
+void manifest_list_sort (manifest_list *list);
+void manifest_list_clear (manifest_list *list);
+
+int manifest_index_build (manifest_index *index, const manifest_entry *entries, size_t count, int by_parent);
+size_t manifest_index_find (const manifest_index *index, const wchar_t *key, size_t keylen, size_t *n);
+void manifest_index_free (manifest_index *index);
+
+int manifest_merge (const manifest_entry *base, size_t nbase, const manifest_entry *delta, size_t ndelta, manifest_list *result);
+
+int manifest_text_parse (const wchar_t *buf, size_t len, size_t *used, manifest_entry *entry);
+
+int manifest_reader_init (manifest_reader *reader, FILE *f);
+int manifest_reader_next (manifest_reader *reader, manifest_entry *entry);
+void manifest_reader_free (manifest_reader *reader);
+
+int manifest_writer_init (manifest_writer *writer, FILE *f);
+int manifest_writer_add (manifest_writer *writer, const manifest_entry *entry);
+int manifest_writer_flush (manifest_writer *writer);
+void manifest_writer_free (manifest_writer *writer);
+
+int manifest_read_text (FILE *f, manifest_list *list);
+
+int manifest_name_cmp (const wchar_t *a, size_t alen, const wchar_t *b, size_t blen);
+unsigned int manifest_name_hash (const wchar_t *s, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_MANIFEST_TEXT_H__ */
@@ -1,1051 +1,1916 @@
-/*
- * This file is part of libntlink.
- * Copyright (c) 2010, LRN
- *
- * libntlink is free software: you can redistribute it and/or modify
- * it under the terms of the GNU Lesser General Public License
- * as published by the Free Software Foundation, either version 3
- * of the License, or (at your option) any later version.
- *
- * libntlink is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU Lesser General Public License for more details.
- *
- * You should have received a copy of
- * the GNU Lesser General Public License and the GNU General Public License
- * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#include <unistd.h>
-#include <windows.h>
-#include <direct.h>
-#include <stdio.h>
-
-#include "quasisymlink.h"
-#include "extra_string.h"
-#include "misc.h"
-#include "juncpoint.h"
-
-
-
-/* This is, basically, what mklink does */
-int
-ntlink_blind_symlinkw(const wchar_t *wpath1, const wchar_t *wpath2, SymlinkBlindType blindtype, wchar_t *basedir)
-{
-#if _WIN32_WINNT >= 0x0600
-  BOOL err;
-  DWORD lerr;
-#endif
-
-#if _WIN32_WINNT >= 0x0600
-  if (blindtype == BLIND_SYMLINK_FILE || blindtype == BLIND_SYMLINK_DIR)
-  {
-    SetLastError (0);
-    err = CreateSymbolicLinkW ((wchar_t *) wpath2, (wchar_t *) wpath1, blindtype != BLIND_SYMLINK_DIR ? 0 : SYMBOLIC_LINK_FLAG_DIRECTORY);
-    lerr = GetLastError ();
-    if (err == 0)
-    {
-      /* TODO: set errno properly from lerr */
-      errno = EIO;
-      goto fail;
-    }
-  } else
-#endif
-  if (blindtype == BLIND_SYMLINK_DIR || blindtype == BLIND_JUNCTION)
-  {
-    int err;
-    wchar_t *wpath1_unp = NULL;
-    /* Junctions are absolute-only, so first make sure the target is absolute. */
-    wchar_t *target = NULL;
-    if (blindtype == BLIND_SYMLINK_DIR)
-    {
-      /* Assume that target is relative to the link, not to the working directory! */
-      if (IsAbsName (wpath1))
-        target = wcsdup (wpath1);
-      else
-      {
-        target = malloc (sizeof (wchar_t) * (wcslen (wpath1) + 1 + 1 + wcslen (wpath2)));
-        swprintf (target, L"%s\\%s", wpath2, wpath1);
-      }
-    }
-    else
-    {
-      if (IsAbsName (wpath1))
-        target = wcsdup (wpath1);
-      else
-      {
-        target = NULL;
-        GetAbsNameW (wpath1, &target, basedir, 2);
-      }
-      /* Assume that target is relative to the base directory */
-    }
-    /* Create a junction point to target directory */
-    if (target != NULL)
-    {
-      wpath1_unp = malloc (sizeof (wchar_t) * (wcslen (target) + 1 + 4));
-      memcpy (wpath1_unp, L"\\??\\", sizeof (wchar_t) * 4);
-      memcpy (&wpath1_unp[4], target, (wcslen (target) + 1) * sizeof (wchar_t));
-      err = SetJuncPointW (wpath1_unp, wpath2);
-      free (wpath1_unp);
-      free (target);
-    }
-    else
-      err = -4;
-    switch (err)
-    {
-    case 0:
-      break;
-    case -1:
-      errno = EACCESS;
-      goto fail;
-      break;
-    case -2:
-      errno = ENOMEM;
-      goto fail;
-      break;
-    case -3:
-      errno = EIO;
-      goto fail;
-      break;
-    case -4:
-      errno = EINVAL;
-      goto fail;
-      break;
-    default:
-      break;
-    }
-  }
-  else if (blindtype == BLIND_SYMLINK_FILE || blindtype == BLIND_HARDLINK)
-  {
-    /* Create a hard link to target file */
-    /* FIXME: transform wpath1 from relative-to-wpath2 to absolute */
-    BOOL ret;
-    ret = CreateHardLinkW (wpath2, wpath1, NULL);
-    if (ret == 0)
-    {
-      errno = EIO;
-      goto fail;
-    }
-  }
-
-  return 0;
-fail:
-
-  return -1;
-}
-
-int  
-ntlink_symlinkw(const wchar_t *wpath1, const wchar_t *wpath2)
-{
-  int exists;
-  WIN32_FIND_DATAW finddata;
-#if _WIN32_WINNT >= 0x0600
-  BOOL err;
-  DWORD lerr;
-#endif
-
-  exists = PathExistsW ((wchar_t *) wpath2, &finddata, PATH_EXISTS_FLAG_NOTHING);
-  if (exists != 0)
-  {
-    if (exists > 0)
-      errno = EEXIST;
-    else
-      errno = EACCESS;
-    goto fail;
-  }
-
-  exists = PathExistsW ((wchar_t *) wpath1, &finddata, PATH_EXISTS_FLAG_NOTHING);
-  if (exists <= 0)
-  {
-    /* Since we don't know anything about the target,
-     * we can't link to it.
-     */
-    if (exists == 0)
-      errno = ENOENT;
-    else
-      errno = EACCESS;
-    goto fail;
-  }
-
-#if _WIN32_WINNT >= 0x0600
-  SetLastError (0);
-  err = CreateSymbolicLinkW ((wchar_t *) wpath2, (wchar_t *) wpath1, (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 ? 0 : SYMBOLIC_LINK_FLAG_DIRECTORY);
-  lerr = GetLastError ();
-  if (err == 0)
-  {
-    /* TODO: set errno properly from lerr */
-    errno = EIO;
-    goto fail;
-  }
-#else
-  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-  {
-    /* Create a junction point to target directory */
-    int err;
-    wchar_t *wpath1_unp = NULL;
-    wpath1_unp = malloc (sizeof (wchar_t) * (wcslen (wpath1) + 1 + 4));
-    memcpy (wpath1_unp, L"\\??\\", sizeof (wchar_t) * 4);
-    memcpy (&wpath1_unp[4], wpath1, (wcslen (wpath1) + 1) * sizeof (wchar_t));
-    err = SetJuncPointW (wpath1_unp, wpath2);
-    free (wpath1_unp);
-    switch (err)
-    {
-    case 0:
-      break;
-    case -1:
-      errno = EACCESS;
-      goto fail;
-      break;
-    case -2:
-      errno = ENOMEM;
-      goto fail;
-      break;
-    case -3:
-      errno = EIO;
-      goto fail;
-      break;
-    default:
-      break;
-    }
-  }
-  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_NORMAL)
-  {
-    /* Create a hard link to target file */
-    BOOL ret;
-    ret = CreateHardLinkW (wpath2, wpath1, NULL);
-    if (ret == 0)
-    {
-      errno = EIO;
-      goto fail;
-    }
-  }
-#endif
-
-  return 0;
-fail:
-
-  return -1;
-}
-
-int 
-ntlink_symlink(const char *path1, const char *path2)
-{
-  int ret;
-  wchar_t *wpath1 = NULL, *wpath2 = NULL;
-
-  if (strtowchar (path1, &wpath1, CP_THREAD_ACP) < 0)
-    goto fail;
-  if (strtowchar (path2, &wpath2, CP_THREAD_ACP) < 0)
-    goto fail;
-
-  ret = ntlink_symlinkw (wpath1, wpath2);
-
-  free (wpath1);
-  free (wpath2);
-
-  return ret;
-fail:
-  if (wpath1 != NULL)
-    free (wpath1);
-  if (wpath2 != NULL)
-    free (wpath2);
-
-  return -1;
-}
-
-int 
-ntlink_lchown(const char *path, uid_t owner, gid_t group)
-{
-  errno = EINVAL;
-  return -1;
-}
-
-int 
-ntlink_linkw(const wchar_t *wpath1, const wchar_t *wpath2)
-{
-  int exists;
-  WIN32_FIND_DATAW finddata;
-
-  exists = PathExistsW ((wchar_t *) wpath2, &finddata, PATH_EXISTS_FLAG_NOTHING);
-  if (exists != 0)
-  {
-    if (exists > 0)
-      errno = EEXIST;
-    else
-      errno = EACCESS;
-    goto fail;
-  }
-
-  exists = PathExistsW ((wchar_t *) wpath1, &finddata, PATH_EXISTS_FLAG_NOTHING);
-  if (exists <= 0)
-  {
-    /* path1 must exist */
-    if (exists == 0)
-      errno = ENOENT;
-    else
-      errno = EACCESS;
-    goto fail;
-  }
-
-  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-  {
-    /* This implementation does not support link() on directories */
-    errno = EPERM;
-    goto fail;
-  }
-  else
-  {
-    /* Create a hard link to target file */
-    BOOL ret;
-    ret = CreateHardLinkW ((wchar_t *) wpath2, (wchar_t *) wpath1, NULL);
-    if (ret == 0)
-    {
-      errno = EIO;
-      goto fail;
-    }
-  }
-
-  return 0;
-fail:
-  return -1;
-}
-
-int 
-ntlink_link(const char *path1, const char *path2)
-{
-  int ret;
-  wchar_t *wpath1 = NULL, *wpath2 = NULL/*, *wpath1_unp = NULL*/;
-
-  if (strtowchar (path1, &wpath1, CP_THREAD_ACP) < 0)
-    goto fail;
-  if (strtowchar (path2, &wpath2, CP_THREAD_ACP) < 0)
-    goto fail;
-
-  ret = ntlink_linkw (wpath1, wpath2);
-
-  free (wpath1);
-  free (wpath2);
-
-  return ret;
-fail:
-  if (wpath1 != NULL)
-    free (wpath1);
-  if (wpath2 != NULL)
-    free (wpath2);
-
-  return -1;
-}
-
-int 
-ntlink_lstatw(const wchar_t *wpath, struct stat *buf)
-{
-  int exists;
-  int result = 0;
-  WIN32_FIND_DATAW finddata;
-  wchar_t *abswpath = NULL;
-#if _WIN32_WINNT >= 0x0600
-  HANDLE fileh = NULL;
-  DWORD lerr;
-#endif
-
-  GetAbsNameW ((wchar_t *) wpath, &abswpath, NULL, 0);
-
-  exists = PathExistsW ((wchar_t *) wpath, &finddata, PATH_EXISTS_FLAG_NOTHING);
-  if (exists <= 0)
-  {
-    /* path1 must exist */
-    if (exists == 0)
-      errno = ENOENT;
-    else
-      errno = EACCESS;
-    goto fail;
-  }
-
-#if _WIN32_WINNT >= 0x0600
-  {
-    FILE_BASIC_INFO bi;
-    FILE_STANDARD_INFO stdi;
-    BY_HANDLE_FILE_INFORMATION info;
-    int linktype = -1;
-
-    SetLastError (0);
-    fileh = CreateFileW (wpath, 0, 0, NULL, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT | (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FILE_FLAG_BACKUP_SEMANTICS : 0,
-        NULL);
-    lerr = GetLastError ();
-    if (fileh == INVALID_HANDLE_VALUE)
-    {
-      /* TODO: set errno from GetLastError() */
-      errno = EIO;
-      goto fail;
-    }
-    SetLastError (0);
-    if (GetFileInformationByHandle(fileh, &info) == 0)
-    {
-      lerr = GetLastError ();
-      /* TODO: set errno from GetLastError () */
-      errno = EIO;
-      goto fail;
-    }
-    SetLastError (0);
-    if (GetFileInformationByHandleEx (fileh, FileBasicInfo, &bi, sizeof (bi)) == 0)
-    {
-      lerr = GetLastError ();
-      /* TODO: set errno from GetLastError () */
-      errno = EIO;
-      goto fail;
-    }
-    SetLastError (0);
-    if (GetFileInformationByHandleEx (fileh, FileStandardInfo, &stdi, sizeof (stdi)) == 0)
-    {
-      lerr = GetLastError ();
-      /* TODO: set errno from GetLastError () */
-      errno = EIO;
-      goto fail;
-    }
-    CloseHandle (fileh);
-    fileh = NULL;
-
-    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-    {
-      wchar_t *wjptarget = NULL;
-      int len = 0;
-      int relative = 0;
-      int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
-      if (jpresult >= 0)
-      {
-        free (wjptarget);
-      }
-    }
-
-    buf->st_gid = 0;
-    buf->st_uid = 0;
-    /* I've found that none of the following functions will return attributes
-     * with FILE_ATTRIBUTE_REPARSE_POINT set, but GetFileAttributesW that is called by PathExistsW will.
-     * Because of that i will set FILE_ATTRIBUTE_REPARSE_POINT here from finddata.
-     */
-    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-      bi.FileAttributes |= FILE_ATTRIBUTE_REPARSE_POINT;
-/*
-#st_mode
-#
-#    Bit mask for file-mode information. The _S_IFDIR bit is set if path specifies a directory;
-#    the _S_IFREG bit is set if path specifies an ordinary file or a device.
-#    User read/write bits are set according to the file's permission mode;
-#    user execute bits are set according to the filename extension.
-*/
-    buf->st_nlink = stdi.NumberOfLinks;
-    buf->st_mode = 0;
-    /* 1 means a symlink, -1 means unknown (and we assume a symlink). 0 is a junction point */
-    if (linktype == 1 || linktype == -1)
-    {
-      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? _S_IFLNK : 0;
-      /* Why was it like that? I must have had a good reason. Still, with it directory symlinks won't get a directory attribute set. On Windows there IS
-       * a difference between directory symlinks and file symlinks, so this attribute IS needed to distinguish between the two */
-      /* buf->st_mode |= ((bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) ? _S_IFDIR : _S_IFREG; */
-      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _S_IFDIR : _S_IFREG;
-    }
-    else
-    {
-      buf->st_mode |= _S_IFJUN;
-    }
-    buf->st_size = stdi.EndOfFile.QuadPart;
-    buf->st_dev = buf->st_rdev = info.dwVolumeSerialNumber;
-    buf->st_ino = ((info.nFileIndexHigh << sizeof(DWORD)) | info.nFileIndexLow);
-    /* buf->st_*time is either 32-bit or 64-bit integer */
-#ifdef _USE_32BIT_TIME_T
-    buf->st_atime = bi.LastAccessTime;
-    buf->st_ctime = bi.CreationTime;
-    buf->st_mtime = (bi.LastWriteTime > bi.ChangeTime) ? bi.LastWriteTime : bi.ChangeTime;
-#else
-    buf->st_atime = bi.LastAccessTime.LowPart;
-    buf->st_ctime = bi.CreationTime.LowPart;
-    buf->st_mtime = (bi.LastWriteTime.LowPart > bi.ChangeTime.LowPart) ? bi.LastWriteTime.LowPart : bi.ChangeTime.LowPart;
-#endif
-  }
-#else
-  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-  {
-/* I probably forgot to implement pre-0x0600 version, which is why
- * this code was here for some time.
- */
-/* 
-    int relative = 0;
-    wchar_t *jptarget = NULL;
-    int jpresult = GetJuncPointW (&jptarget, abswpath, &relative);
-    switch (jpresult)
-    {
-    case -1:
-      errno = EACCESS;
-      goto fail;
-    case -2:
-      errno = EIO;
-      goto fail;
-    case -3:
-      errno = ENOMEM;
-      goto fail;
-    default:
-      ;
-    }
-    free (jptarget);
-*/
-    BY_HANDLE_FILE_INFORMATION info;
-    int linktype = -1;
-
-    SetLastError (0);
-    fileh = CreateFileW (wpath, 0, 0, NULL, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT | (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FILE_FLAG_BACKUP_SEMANTICS : 0,
-        NULL);
-    lerr = GetLastError ();
-    if (fileh == INVALID_HANDLE_VALUE)
-    {
-      /* TODO: set errno from GetLastError() */
-      errno = EIO;
-      goto fail;
-    }
-    SetLastError (0);
-    if (GetFileInformationByHandle(fileh, &info) == 0)
-    {
-      lerr = GetLastError ();
-      /* TODO: set errno from GetLastError () */
-      errno = EIO;
-      goto fail;
-    }
-    CloseHandle (fileh);
-    fileh = NULL;
-
-    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-    {
-      wchar_t *wjptarget = NULL;
-      int len = 0;
-      int relative = 0;
-      int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
-      if (jpresult >= 0)
-      {
-        free (wjptarget);
-      }
-    }
-
-    buf->st_gid = 0;
-    buf->st_uid = 0;
-    /* I've found that none of the following functions will return attributes
-     * with FILE_ATTRIBUTE_REPARSE_POINT set, but GetFileAttributesW that is called by PathExistsW will.
-     * Because of that i will set FILE_ATTRIBUTE_REPARSE_POINT here from finddata.
-     */
-    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-      info.dwFileAttributes |= FILE_ATTRIBUTE_REPARSE_POINT;
-/*
-#st_mode
-#
-#    Bit mask for file-mode information. The _S_IFDIR bit is set if path specifies a directory;
-#    the _S_IFREG bit is set if path specifies an ordinary file or a device.
-#    User read/write bits are set according to the file's permission mode;
-#    user execute bits are set according to the filename extension.
-*/
-    buf->st_nlink = info.NumberOfLinks;
-    buf->st_mode = 0;
-    /* 1 means a symlink, -1 means unknown (and we assume a symlink). 0 is a junction point */
-    if (linktype == 1 || linktype == -1)
-    {
-      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? _S_IFLNK : 0;
-      /* Why was it like that? I must have had a good reason. Still, with it directory symlinks won't get a directory attribute set. On Windows there IS
-       * a difference between directory symlinks and file symlinks, so this attribute IS needed to distinguish between the two */
-      /* buf->st_mode |= ((bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) ? _S_IFDIR : _S_IFREG; */
-      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _S_IFDIR : _S_IFREG;
-    }
-    else
-    {
-      buf->st_mode |= _S_IFJUN;
-    }
-    buf->st_size = (info.nFileSizeHigh * (MAXDWORD + 1)) + info.nFileSizeLow;
-    buf->st_dev = buf->st_rdev = info.dwVolumeSerialNumber;
-    buf->st_ino = ((info.nFileIndexHigh << (sizeof(DWORD) * 8)) | info.nFileIndexLow);
-    /* buf->st_*time is either 32-bit or 64-bit integer */
-#ifdef _USE_32BIT_TIME_T
-    buf->st_atime = info.ftLastAccessTime.dwLowDateTime;
-    buf->st_ctime = info.ftCreationTime.dwLowDateTime;
-    buf->st_mtime = info.ftLastWriteTime.dwLowDateTime;
-#else
-    buf->st_atime = (info.ftLastAccessTime.dwHighDateTime << (sizeof(DWORD) * 8)) | info.ftLastAccessTime.dwLowDateTime;
-    buf->st_ctime = (info.ftCreationTime.dwHighDateTime << (sizeof(DWORD) * 8)) | info.ftCreationTime.dwLowDateTime;
-    buf->st_mtime = (info.ftLastWriteTime.dwHighDateTime << (sizeof(DWORD) * 8)) | info.ftLastWriteTime.dwLowDateTime;
-#endif
-  }
-  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_NORMAL)
-  {
-    /* This is a hard link, use normal stat() */
-    result = _wstat (wpath, buf);
-  }
-#endif
-
-  if (abswpath != NULL)
-    free (abswpath);
-
-  return result;
-fail:
-#if _WIN32_WINNT >= 0x0600
-  if (fileh != NULL)
-    CloseHandle (fileh);
-#endif
-  if (abswpath != NULL)
-    free (abswpath);
-  return -1;
-}
-
-
-int 
-ntlink_lstat(const char *path, struct stat *buf)
-{
-  int ret;
-  wchar_t *wpath = NULL;
-
-  if (strtowchar (path, &wpath, CP_THREAD_ACP) < 0)
-    goto fail;
-
-  ret = ntlink_lstatw (wpath, buf);
-
-  free (wpath);
-
-  return ret;
-fail:
-  if (wpath != NULL)
-    free (wpath);
-  return -1;
-}
-
-/*
-  bufsize and return value are in characters, not bytes
- */
-ssize_t 
-ntlink_readlinkw(const wchar_t *wpath, wchar_t *buf,
-    size_t bufsize)
-{
-  wchar_t *abswpath = NULL;
-  int exists;
-  int result = 0;
-  WIN32_FIND_DATAW finddata;
-#if _WIN32_WINNT >= 0x0600
-  HANDLE fileh = NULL;
-  wchar_t *wtarget = NULL;
-  DWORD lerr;
-#endif
-
-  GetAbsNameW ((wchar_t *) wpath, &abswpath, NULL, 0);
-
-  exists = PathExistsW ((wchar_t *) wpath, &finddata, PATH_EXISTS_FLAG_NOTHING);
-  if (exists <= 0)
-  {
-    /* path1 must exist */
-    if (exists == 0)
-      errno = ENOENT;
-    else
-      errno = EACCESS;
-    goto fail;
-  }
-
-#if _WIN32_WINNT >= 0x0600
-  if (!(finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
-  {
-    /* This is not a symlink */
-    errno = EINVAL;
-    goto fail;
-  }
-  else
-  {
-#if 0
-    DWORD required_size, required_size2;
-    char *target;
-    int len = 0;
-    int conv_result = 0;
-    SetLastError (0);
-    fileh = CreateFileW (wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FILE_FLAG_BACKUP_SEMANTICS : 0, NULL);
-    if (fileh == INVALID_HANDLE_VALUE)
-    {
-      lerr = GetLastError ();
-      /* TODO: set errno from GetLastError () */
-      errno = EIO;
-      goto fail;
-    }
-
-    SetLastError (0);
-    required_size = GetFinalPathNameByHandleW (fileh, (wchar_t *) &required_size, 0, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
-    if (required_size == 0)
-    {
-      lerr = GetLastError ();
-      /* TODO: set errno from GetLastError () */
-      errno = EIO;
-      goto fail;
-    }
-    wtarget = (wchar_t *) malloc ((required_size) * sizeof (wchar_t));
-    if (wtarget == NULL)
-    {
-      errno = ENOMEM;
-      goto fail;
-    }
-    SetLastError (0);
-    required_size2 = GetFinalPathNameByHandleW (fileh, wtarget, required_size, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
-    if (required_size2 == 0)
-    {
-      lerr = GetLastError ();
-      /* TODO: set errno from GetLastError () */
-      errno = EIO;
-      goto fail;
-    }
-    if (required_size2 != required_size - 1)
-    {
-      /* TODO: Figure out what would that mean... */
-      errno = EIO;
-      goto fail;
-    }
-    CloseHandle (fileh);
-    fileh = NULL;
-/*
-    conv_result = wchartostr (wtarget, &target, CP_THREAD_ACP);
-    free (wtarget);
-    wtarget = NULL;
-    if (conv_result < 0)
-      goto fail;
-*/
-    len = wcslen (wtarget);
-    if (len > bufsize)
-      len = bufsize;
-    memcpy (buf, wtarget, (len + 1) * sizeof (wchar_t));
-    free (wtarget);
-    result = len;
-#endif
-    wchar_t *wjptarget = NULL;
-    char *jptarget = NULL;
-    int len = 0;
-    int conv_result = 0;
-    int relative = 0;
-    int linktype = 0;
-    int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
-    switch (jpresult)
-    {
-    case -1:
-      errno = EACCESS;
-      goto fail;
-    case -2:
-      errno = EIO;
-      goto fail;
-    case -3:
-      errno = ENOMEM;
-      goto fail;
-    default:
-      ;
-    }
-    len = wcslen (wjptarget);
-    if (len > bufsize)
-      len = bufsize;
-    memcpy (buf, wjptarget, len * sizeof (wchar_t));
-    result = len;
-  }
-#else
-  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-  {
-    if (!(finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
-    {
-      /* This is not a junction point */
-      errno = EINVAL;
-      goto fail;
-    }
-    /* Obtain juncpoint information and fill the buf */
-
-    wchar_t *wjptarget = NULL;
-    char *jptarget = NULL;
-    int len = 0;
-    int conv_result = 0;
-    int relative = 0;
-    int linktype = 0;
-    int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
-    switch (jpresult)
-    {
-    case -1:
-      errno = EACCESS;
-      goto fail;
-    case -2:
-      errno = EIO;
-      goto fail;
-    case -3:
-      errno = ENOMEM;
-      goto fail;
-    default:
-      ;
-    }
-    len = wcslen (wjptarget);
-    if (len > bufsize)
-      len = bufsize;
-    memcpy (buf, wjptarget, len * sizeof (wchar_t));
-    result = len;
-  }
-  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_NORMAL)
-  {
-    /* This must be a hard link, return its own name */
-    int len = wcslen (wpath);
-    if (len > bufsize)
-      len = bufsize;
-    memcpy (buf, wpath, len * sizeof (wchar_t));
-    result = len;
-  }
-#endif
-
-  if (abswpath != NULL)
-    free (abswpath);
-
-  return result;
-fail:
-#if _WIN32_WINNT >= 0x0600
-  if (wtarget != NULL)
-    free (wtarget);
-  if (fileh != NULL)
-    CloseHandle (fileh);
-#endif
-  if (abswpath != NULL)
-    free (abswpath);
-
-  return -1;
-}
-
-
-ssize_t 
-ntlink_readlink(const char *path, char *buf, size_t bufsize)
-{
-  int ret;
-  wchar_t *wpath = NULL;
-  wchar_t *wbuf = NULL;
-
-  if (strtowchar (path, &wpath, CP_THREAD_ACP) < 0)
-    goto fail;
-
-  if (bufsize > 0)
-    wbuf = (wchar_t *) malloc (sizeof (wchar_t) * bufsize);
-
-  ret = ntlink_readlinkw (wpath, wbuf, bufsize);
-
-  free (wpath);
-
-  if (bufsize > 0)
-  {
-    if (ret == 0)
-    {
-      char *tmp;
-      if (wchartostr (wbuf, &tmp, CP_THREAD_ACP) < 0)
-        ret = -1;
-      else
-      {
-        strncpy (buf, tmp, bufsize);
-        free (tmp);
-      }
-    }
-    free (wbuf);
-  }
-
-  return ret;
-fail:
-  if (wpath != NULL)
-    free (wpath);
-
-  return -1;
-}
-
-int 
-ntlink_unlinkw(const wchar_t *wpath)
-{
-  int exists;
-  WIN32_FIND_DATAW finddata;
-  DWORD lerr;
-
-  exists = PathExistsW ((wchar_t *) wpath, &finddata, PATH_EXISTS_FLAG_NOTHING);
-  if (exists <= 0)
-  {
-    /* path must exist */
-    if (exists == 0)
-      errno = ENOENT;
-    else
-      errno = EACCESS;
-    return -1;
-  }
-  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-  {
-    BOOL bres;
-    SetLastError (0);
-    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-      bres = RemoveDirectoryW (wpath);
-    else
-      bres = DeleteFileW (wpath);
-    lerr = GetLastError ();
-    if (bres == 0)
-    {
-      /* TODO: Set errno from lerr */
-      errno = EIO;
-      return -1;
-    }
-    return 0;
-#if 0
-  } else if (finddata.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT))
-  {
-
-/* This code is disabled, because unlink() is not required to leave an empty
- * directory behind ('break link' behaviour), it is required to remove the link
- * completely ('remove link' behaviour), and simple RemoveDirectory() will suffice.
- */
-
-    /* Unjunc that junction */
-
-    int jpresult = UnJuncPointW (wpath);
-    switch (jpresult)
-    {
-    case -1:
-      errno = EACCESS;
-      goto fail;
-    case -2:
-      errno = EIO;
-      goto fail;
-    case -3:
-      errno = ENOMEM;
-      goto fail;
-    default:
-      ;
-    }
-#endif
-  }
-  else if (~finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-  {
-    return _wunlink (wpath);
-  }
-  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-  {
-    return _wrmdir (wpath);
-  }
-  return 0;
-}
-
-
-int 
-ntlink_unlink(const char *path)
-{
-  int ret;
-  wchar_t *wpath = NULL;
-
-  if (strtowchar (path, &wpath, CP_THREAD_ACP) < 0)
-    goto fail;
-
-  ret = ntlink_unlinkw (wpath);
-
-  free (wpath);
-
-  return ret;
-fail:
-  if (wpath != NULL)
-    free (wpath);
-
-  return -1;
-}
-
-int 
-ntlink_renamew(const wchar_t *wpath1, const wchar_t *wpath2)
-{
-  int exists;
-  struct stat stat1, stat2;
-  WIN32_FIND_DATAW finddata1, finddata2;
-
-  memset (&stat1, 0, sizeof (stat1));
-  memset (&stat2, 0, sizeof (stat2));
-
-  ntlink_lstatw (wpath1, &stat1);
-  ntlink_lstatw (wpath2, &stat2);
-
-  /* If the old argument and the new argument resolve to the same existing file, rename() shall return successfully and perform no other action. */
-  if (stat1.st_ino != 0 && stat1.st_ino == stat2.st_ino)
-    return 0;
-
-  exists = PathExistsW ((wchar_t *) wpath1, &finddata1, PATH_EXISTS_FLAG_NOTHING);
-  if (exists <= 0)
-  {
-    /* path1 must exist */
-    if (exists > 0)
-      errno = ENOENT;
-    else
-      errno = EACCESS;
-    goto fail;
-  }
-
-  exists = PathExistsW ((wchar_t *) wpath2, &finddata2, PATH_EXISTS_FLAG_NOTHING);
-  if (exists > 0)
-  {
-    /* If the old argument points to the pathname of a directory, the new argument shall not point to the pathname of a file that is not a directory. */
-    if ((finddata1.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY && !(finddata2.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)))
-    {
-      errno = ENOTDIR;
-      goto fail;
-    }
-    /* If the old argument points to the pathname of a file that is not a directory, the new argument shall not point to the pathname of a directory. */
-    if ((~finddata1.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY && !(~finddata2.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)))
-    {
-      errno = EISDIR;
-      goto fail;
-    }
-
-    /* If the directory named by the new argument exists, it shall be removed and old renamed to new. */
-    /* ntlink_unlink() removes a directory */
-
-    /* If the link named by the new argument exists, it shall be removed and old renamed to new. */
-    /* ntlink_unlink() removes a file*/
-
-    /* If new names an existing directory, it shall be required to be an empty directory.*/
-    /* ntlink_unlink() does not remove non-empty directories, fails with ENOTEMPTY */
-
-    /* If the new argument points to a pathname of a symbolic link, the symbolic link shall be removed. */
-    if (ntlink_unlinkw (wpath2) != 0)
-      goto fail;
-  }
-
-  /* If the old argument points to a pathname of a symbolic link, the symbolic link shall be renamed. */
-  /* TODO: make sure that this is what really happens */
-
-  /* The new pathname shall not contain a path prefix that names old. */
-  /* Hope that MoveFileEx will figure this out */
-
-  /* If the rename() function fails for any reason other than [EIO], any file named by new shall be unaffected. */
-  /* Can't see this happening. We can't tell MoveFileEx to remove the existing directory */
-
-  /* TODO: MoveFileEx can't move directories between drives, fix that */
-  if (MoveFileExW (wpath1, wpath2, MOVEFILE_COPY_ALLOWED | MOVEFILE_WRITE_THROUGH) == 0)
-  {
-    DWORD err = GetLastError ();
-    /*FIXME: set errno from GetLastError()*/
-    errno = EINVAL;
-    goto fail;
-  }
-
-  return 0;
-fail:
-  return -1;
-}
-
-int 
-ntlink_rename(const char *path1, const char *path2)
-{
-  int ret;
-  wchar_t *wpath1 = NULL, *wpath2 = NULL;
-
-  if (strtowchar (path1, &wpath1, CP_THREAD_ACP) < 0)
-    goto fail;
-  if (strtowchar (path2, &wpath2, CP_THREAD_ACP) < 0)
-    goto fail;
-
-  ret = ntlink_renamew (wpath1, wpath2);
-
-  free (wpath1);
-  free (wpath2);
-
-  return ret;
-
-fail:
-  if (wpath1 != NULL)
-    free (wpath1);
-  if (wpath2 != NULL)
-    free (wpath2);
-
-  return -1;
-
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2010, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <windows.h>
+#include <direct.h>
+#include <stdio.h>
+
+#include "quasisymlink.h"
+#include "extra_string.h"
+#include "misc.h"
+#include "juncpoint.h"
+#include "threadpool.h"
+#include "iosched.h"
+#include "fsbackend.h"
+#include "stats.h"
+#include "trace.h"
+#include "ctx.h"
+#include "alloc.h"
+
+
+
+/* This is, basically, what mklink does */
+static int
+blind_symlinkw_impl (const wchar_t *wpath1, const wchar_t *wpath2, SymlinkBlindType blindtype, wchar_t *basedir)
+{
+#if _WIN32_WINNT >= 0x0600
+  BOOL err;
+  DWORD lerr;
+#endif
+
+#if _WIN32_WINNT >= 0x0600
+  if (blindtype == BLIND_SYMLINK_FILE || blindtype == BLIND_SYMLINK_DIR)
+  {
+    SetLastError (0);
+    err = ntlink_fs->create_symbolic_link ((wchar_t *) wpath2, (wchar_t *) wpath1, blindtype != BLIND_SYMLINK_DIR ? 0 : SYMBOLIC_LINK_FLAG_DIRECTORY);
+    lerr = GetLastError ();
+    if (err == 0)
+    {
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+  } else
+#endif
+  if (blindtype == BLIND_SYMLINK_DIR || blindtype == BLIND_JUNCTION)
+  {
+    int err;
+    wchar_t *wpath1_unp = NULL;
+    /* Junctions are absolute-only, so first make sure the target is absolute. */
+    wchar_t *target = NULL;
+    if (blindtype == BLIND_SYMLINK_DIR)
+    {
+      /* Assume that target is relative to the link, not to the working directory! */
+      if (IsAbsName (wpath1))
+        target = ntlink_wcsdup (wpath1);
+      else
+      {
+        size_t len = wcslen (wpath1) + 1 + 1 + wcslen (wpath2);
+        target = ntlink_malloc (sizeof (wchar_t) * len);
+        _snwprintf (target, len, L"%ls\\%ls", wpath2, wpath1);
+      }
+    }
+    else
+    {
+      if (IsAbsName (wpath1))
+        target = ntlink_wcsdup (wpath1);
+      else
+      {
+        target = NULL;
+        GetAbsNameW (wpath1, &target, basedir, 2);
+      }
+      /* Assume that target is relative to the base directory */
+    }
+    /* Create a junction point to target directory */
+    if (target != NULL)
+    {
+      wpath1_unp = ntlink_malloc (sizeof (wchar_t) * (wcslen (target) + 1 + 4));
+      memcpy (wpath1_unp, L"\\??\\", sizeof (wchar_t) * 4);
+      memcpy (&wpath1_unp[4], target, (wcslen (target) + 1) * sizeof (wchar_t));
+      err = SetJuncPointW (wpath1_unp, wpath2);
+      ntlink_free (wpath1_unp);
+      ntlink_free (target);
+    }
+    else
+      err = -4;
+    switch (err)
+    {
+    case 0:
+      break;
+    case -1:
+      errno = EACCESS;
+      goto fail;
+      break;
+    case -2:
+      errno = ENOMEM;
+      goto fail;
+      break;
+    case -3:
+      errno = EIO;
+      goto fail;
+      break;
+    case -4:
+      errno = EINVAL;
+      goto fail;
+      break;
+    default:
+      break;
+    }
+  }
+  else if (blindtype == BLIND_SYMLINK_FILE || blindtype == BLIND_HARDLINK)
+  {
+    /* Create a hard link to target file */
+    /* FIXME: transform wpath1 from relative-to-wpath2 to absolute */
+    BOOL ret;
+    ret = ntlink_fs->create_hard_link (wpath2, wpath1, NULL);
+    if (ret == 0)
+    {
+      errno = Win32ErrorToErrno (GetLastError ());
+      goto fail;
+    }
+  }
+
+  return 0;
+fail:
+
+  return -1;
+}
+
+static int
+blind_symlinkw_call (ntlink_ctx *ctx, const wchar_t *wpath1, const wchar_t *wpath2, SymlinkBlindType blindtype, wchar_t *basedir)
+{
+  int r = -1;
+  wchar_t *abs1 = NULL, *abs2 = NULL;
+  const wchar_t *p1 = wpath1, *p2;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_BLIND_SYMLINK);
+  /* Symlink and junction targets are relative to the link or to @basedir */
+  if (blindtype == BLIND_HARDLINK)
+    p1 = ntlink_ctx_path (ctx, wpath1, &abs1);
+  p2 = ntlink_ctx_path (ctx, wpath2, &abs2);
+  if (p1 != NULL && p2 != NULL)
+    r = blind_symlinkw_impl (p1, p2, blindtype, basedir);
+  ntlink_ctx_end (ctx, NTLINK_API_BLIND_SYMLINK, start, r != 0);
+  ntlink_trace_call (NTLINK_API_BLIND_SYMLINK, start, r, blindtype, 0, p1 != NULL ? p1 : wpath1, p2 != NULL ? p2 : wpath2, basedir);
+  ntlink_free (abs1);
+  ntlink_free (abs2);
+  return r;
+}
+
+int
+ntlink_blind_symlinkw (const wchar_t *wpath1, const wchar_t *wpath2, SymlinkBlindType blindtype, wchar_t *basedir)
+{
+  return blind_symlinkw_call (NULL, wpath1, wpath2, blindtype, basedir);
+}
+
+/**
+ * ntlink_ctx_blind_symlinkw:
+ * @ctx: a context
+ *
+ * ntlink_blind_symlinkw() with the base directory of @ctx, which is also
+ * used for @wpath2 and the target of a hard link.
+ */
+int
+ntlink_ctx_blind_symlinkw (ntlink_ctx *ctx, const wchar_t *wpath1, const wchar_t *wpath2, SymlinkBlindType blindtype)
+{
+  return blind_symlinkw_call (ctx, wpath1, wpath2, blindtype, (wchar_t *) ntlink_ctx_get_basedir (ctx));
+}
+
+/**
+ * ntlink_opendirw:
+ * @path: a directory name
+ *
+ * Opens @path for use with ntlink_symlinkatw().
+ * Close the handle with ntlink_closedirw() when it is no longer needed.
+ *
+ * Returns:
+ * NULL - failed to open @path (errno is set)
+ * non-NULL - directory handle
+ */
+void *
+ntlink_opendirw(const wchar_t *wpath)
+{
+  HANDLE dirh;
+
+  dirh = ntlink_fs->create_file (wpath, FILE_LIST_DIRECTORY | FILE_ADD_FILE | FILE_ADD_SUBDIRECTORY | SYNCHRONIZE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+      FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (dirh == INVALID_HANDLE_VALUE)
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    return NULL;
+  }
+  return dirh;
+}
+
+void
+ntlink_closedirw(void *dirhandle)
+{
+  if (dirhandle != NULL)
+    ntlink_fs->close_handle ((HANDLE) dirhandle);
+}
+
+/**
+ * ntlink_symlinkatw:
+ * @dirhandle: a directory handle obtained from ntlink_opendirw()
+ * @name: name of the link to create in @dirhandle (a single path component)
+ * @target: link target. Absolute targets are stored as-is, relative targets
+ *   of symlinks are stored as relative to the directory of the link.
+ *   Junction targets must be absolute.
+ * @blindtype: BLIND_SYMLINK_FILE, BLIND_SYMLINK_DIR or BLIND_JUNCTION
+ *
+ * Creates a link without CreateSymbolicLinkW(): the file or directory is
+ * created relative to @dirhandle, and the reparse buffer
+ * (with proper print name and relative flag) is written directly.
+ * Nothing is resolved or probed, so the caller is responsible for
+ * validating @name and @target.
+ * Creating symlinks requires SeCreateSymbolicLinkPrivilege.
+ * If the reparse buffer can't be written, the created file or directory
+ * is removed.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set)
+ */
+static int
+symlinkatw_impl (void *dirhandle, const wchar_t *name, const wchar_t *target, SymlinkBlindType blindtype)
+{
+  HANDLE fileh = NULL;
+  int isdir, linktype, relative, r;
+  size_t namelen;
+  wchar_t *substitute = NULL, *printname = NULL;
+  size_t i;
+
+  if (dirhandle == NULL || name == NULL || target == NULL || target[0] == L'\0')
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (blindtype != BLIND_SYMLINK_FILE && blindtype != BLIND_SYMLINK_DIR && blindtype != BLIND_JUNCTION)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  namelen = wcslen (name);
+  if (namelen == 0 || namelen * sizeof (wchar_t) > 0xFFFF || wcspbrk (name, L"\\/") != NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  linktype = blindtype == BLIND_JUNCTION ? 0 : 1;
+  isdir = blindtype != BLIND_SYMLINK_FILE;
+  relative = !IsAbsName ((wchar_t *) target);
+  if (relative && linktype == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (relative)
+  {
+    substitute = ntlink_wcsdup (target);
+    printname = ntlink_wcsdup (target);
+  }
+  else if (wcsncmp (target, L"\\\\?\\", 4) == 0 || wcsncmp (target, L"\\??\\", 4) == 0)
+  {
+    substitute = ntlink_wcsdup (target);
+    printname = ntlink_wcsdup (&target[4]);
+    if (substitute != NULL)
+      substitute[1] = L'?';
+  }
+  else if (target[0] == L'\\' && target[1] == L'\\')
+  {
+    /* \\server\share -> \??\UNC\server\share */
+    substitute = dup_swprintf (NULL, L"\\??\\UNC%ls", &target[1]);
+    printname = ntlink_wcsdup (target);
+  }
+  else
+  {
+    substitute = dup_swprintf (NULL, L"\\??\\%ls", target);
+    printname = ntlink_wcsdup (target);
+  }
+  if (substitute == NULL || printname == NULL)
+  {
+    errno = ENOMEM;
+    goto fail;
+  }
+  /* The kernel does not accept forward slashes in reparse data */
+  for (i = 0; substitute[i] != L'\0'; i++)
+    if (substitute[i] == L'/')
+      substitute[i] = L'\\';
+
+  fileh = ntlink_fs->create_file_at ((HANDLE) dirhandle, name, FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES | DELETE, isdir);
+  if (fileh == INVALID_HANDLE_VALUE)
+  {
+    fileh = NULL;
+    errno = Win32ErrorToErrno (GetLastError ());
+    goto fail;
+  }
+
+  r = SetReparsePointHandleW (fileh, substitute, printname, linktype, relative);
+  if (r != 0)
+  {
+    FILE_DISPOSITION_INFO di;
+    errno = r == -2 ? ENOMEM : Win32ErrorToErrno (GetLastError ());
+    /* Don't leave an empty file or directory behind */
+    di.DeleteFile = TRUE;
+    ntlink_fs->set_file_information_by_handle (fileh, FileDispositionInfo, &di, sizeof (di));
+    goto fail;
+  }
+
+  ntlink_fs->close_handle (fileh);
+  ntlink_free (substitute);
+  ntlink_free (printname);
+
+  return 0;
+fail:
+  if (fileh != NULL)
+    ntlink_fs->close_handle (fileh);
+  ntlink_free (substitute);
+  ntlink_free (printname);
+
+  return -1;
+}
+
+int
+ntlink_symlinkatw (void *dirhandle, const wchar_t *name, const wchar_t *target, SymlinkBlindType blindtype)
+{
+  int r;
+  LONGLONG start = ntlink_ctx_begin (NULL, NTLINK_API_SYMLINKAT);
+  r = symlinkatw_impl (dirhandle, name, target, blindtype);
+  ntlink_ctx_end (NULL, NTLINK_API_SYMLINKAT, start, r != 0);
+  ntlink_trace_call (NTLINK_API_SYMLINKAT, start, r, blindtype, 0, name, target, NULL);
+  return r;
+}
+
+struct _symlink_batch_key
+{
+  size_t index;
+  wchar_t *parent;
+};
+
+typedef struct _symlink_batch_key symlink_batch_key;
+
+struct _symlink_batch_group
+{
+  SymlinkBatchItem *items;
+  symlink_batch_key *keys;
+  size_t count;
+  wchar_t *basedir;
+  SymlinkBatchFlags flags;
+};
+
+typedef struct _symlink_batch_group symlink_batch_group;
+
+static int
+symlink_batch_key_cmp (const void *a, const void *b)
+{
+  const symlink_batch_key *ka = (const symlink_batch_key *) a;
+  const symlink_batch_key *kb = (const symlink_batch_key *) b;
+  int r;
+  if (ka->parent == NULL || kb->parent == NULL)
+    r = (ka->parent == NULL) - (kb->parent == NULL);
+  else
+    r = _wcsicmp (ka->parent, kb->parent);
+  if (r != 0)
+    return r;
+  /* Keep the order of the items within a directory stable */
+  return (ka->index > kb->index) - (ka->index < kb->index);
+}
+
+static void
+symlink_batch_group_run (void *arg)
+{
+  symlink_batch_group *group = (symlink_batch_group *) arg;
+  size_t i;
+  int r;
+  int parent_errno = 0;
+  void *dirh = NULL;
+
+  if (group->flags & SYMLINK_BATCH_FLAG_CREATE_PARENTS)
+  {
+    if (CreateDirectoryRecursiveW (group->keys[0].parent) != 0)
+      parent_errno = errno;
+  }
+
+  if (parent_errno == 0 && (group->flags & SYMLINK_BATCH_FLAG_DIRECT))
+    dirh = ntlink_opendirw (group->keys[0].parent);
+
+  for (i = 0; i < group->count; i++)
+  {
+    SymlinkBatchItem *item = &group->items[group->keys[i].index];
+    const wchar_t *name;
+    if (parent_errno != 0)
+    {
+      item->status = parent_errno;
+      continue;
+    }
+    errno = 0;
+    name = wcsrchr (item->linkpath, L'\\');
+    if (name == NULL || wcsrchr (name, L'/') != NULL)
+      name = wcsrchr (item->linkpath, L'/');
+    name = name != NULL ? &name[1] : item->linkpath;
+    if (dirh != NULL && item->type == BLIND_JUNCTION && !IsAbsName ((wchar_t *) item->target))
+    {
+      /* Junction targets are relative to the base directory */
+      wchar_t *abstarget = NULL;
+      if (GetAbsNameW ((wchar_t *) item->target, &abstarget, group->basedir, 2) == 0)
+      {
+        r = ntlink_symlinkatw (dirh, name, abstarget, item->type);
+        ntlink_free (abstarget);
+      }
+      else
+      {
+        errno = EINVAL;
+        r = -1;
+      }
+    }
+    else if (dirh != NULL && item->type != BLIND_HARDLINK && name[0] != L'\0')
+      r = ntlink_symlinkatw (dirh, name, item->target, item->type);
+    else
+      r = ntlink_blind_symlinkw (item->target, item->linkpath, item->type, group->basedir);
+    if (r == 0)
+      item->status = 0;
+    else
+      item->status = errno != 0 ? errno : EIO;
+  }
+
+  ntlink_closedirw (dirh);
+}
+
+/**
+ * ntlink_symlink_batchw:
+ * @items: an array of links to create
+ * @nitems: number of elements in @items
+ * @basedir: base directory for junction targets, see ntlink_blind_symlinkw()
+ * @nthreads: at most that many groups are processed at once, on the shared
+ *   pool (see ntlink_pool_shared()). 0 or less means as many as the pool
+ *   has threads, 1 means that everything is done in the calling thread.
+ * @flags: a combination of one or more members of SymlinkBatchFlags
+ *
+ * Creates many links at once. Each link is created as ntlink_blind_symlinkw()
+ * would create it (no existence probes are made).
+ * The items are grouped by the parent directory of @linkpath. Each group is
+ * processed by one worker, in the original order of its items, and different
+ * groups are processed concurrently, as many at once as the volume of their
+ * directory allows (see ntlink_io_queue_get()). With SYMLINK_BATCH_FLAG_CREATE_PARENTS
+ * the parent directory of a group is created (once per group) if it does not
+ * exist.
+ * The result for each item is written into its @status field.
+ *
+ * Returns:
+ * >= 0 - the number of items that failed
+ *   -1 - failed to allocate memory or to start the threads
+ */
+static int
+symlink_batchw_impl (SymlinkBatchItem *items, size_t nitems, wchar_t *basedir, int nthreads, SymlinkBatchFlags flags)
+{
+  symlink_batch_key *keys = NULL;
+  symlink_batch_group *groups = NULL;
+  ntlink_task_group *group = NULL;
+  size_t i, j, ngroups = 0;
+  int failed = 0;
+
+  if (nitems == 0)
+    return 0;
+
+  keys = (symlink_batch_key *) ntlink_calloc (nitems, sizeof (symlink_batch_key));
+  groups = (symlink_batch_group *) ntlink_malloc (sizeof (symlink_batch_group) * nitems);
+  if (keys == NULL || groups == NULL)
+  {
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  for (i = 0; i < nitems; i++)
+  {
+    wchar_t *slash;
+    keys[i].index = i;
+    keys[i].parent = NULL;
+    items[i].status = EINVAL;
+    if (items[i].target == NULL || items[i].linkpath == NULL ||
+        GetAbsNameW ((wchar_t *) items[i].linkpath, &keys[i].parent, NULL, 2) != 0)
+      continue;
+    slash = wcsrchr (keys[i].parent, L'\\');
+    if (slash == NULL || slash == keys[i].parent)
+    {
+      ntlink_free (keys[i].parent);
+      keys[i].parent = NULL;
+      continue;
+    }
+    /* "X:\name" has "X:\" as its parent */
+    if (slash == &keys[i].parent[2] && keys[i].parent[1] == L':')
+      slash += 1;
+    *slash = L'\0';
+  }
+
+  qsort (keys, nitems, sizeof (symlink_batch_key), symlink_batch_key_cmp);
+
+  for (i = 0; i < nitems && keys[i].parent != NULL; i = j)
+  {
+    for (j = i + 1; j < nitems && keys[j].parent != NULL &&
+        _wcsicmp (keys[i].parent, keys[j].parent) == 0; j++);
+    groups[ngroups].items = items;
+    groups[ngroups].keys = &keys[i];
+    groups[ngroups].count = j - i;
+    groups[ngroups].basedir = basedir;
+    groups[ngroups].flags = flags;
+    ngroups += 1;
+  }
+
+  if (nthreads == 1 || ngroups <= 1)
+  {
+    for (i = 0; i < ngroups; i++)
+      symlink_batch_group_run (&groups[i]);
+  }
+  else
+  {
+    group = ntlink_task_group_new (NULL, nthreads);
+    if (group == NULL)
+      goto fail;
+    for (i = 0; i < ngroups; i++)
+      if (ntlink_io_submit (ntlink_io_queue_get (groups[i].keys[0].parent), group,
+          groups[i].count, symlink_batch_group_run, &groups[i]) != 0)
+        symlink_batch_group_run (&groups[i]);
+    ntlink_task_group_free (group);
+  }
+
+  for (i = 0; i < nitems; i++)
+  {
+    if (items[i].status != 0)
+      failed += 1;
+    ntlink_free (keys[i].parent);
+  }
+  ntlink_free (keys);
+  ntlink_free (groups);
+
+  return failed;
+fail:
+  if (keys != NULL)
+  {
+    for (i = 0; i < nitems; i++)
+      ntlink_free (keys[i].parent);
+    ntlink_free (keys);
+  }
+  ntlink_free (groups);
+
+  return -1;
+}
+
+static int
+symlink_batchw_call (ntlink_ctx *ctx, SymlinkBatchItem *items, size_t nitems, wchar_t *basedir, int nthreads, SymlinkBatchFlags flags)
+{
+  SymlinkBatchItem *resolved = items;
+  wchar_t **allocated = NULL;
+  size_t i;
+  int r = -1;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_SYMLINK_BATCH);
+
+  /* Work on a copy with the names made absolute */
+  if (ctx != NULL && nitems > 0)
+  {
+    resolved = (SymlinkBatchItem *) ntlink_malloc (sizeof (SymlinkBatchItem) * nitems);
+    allocated = (wchar_t **) ntlink_calloc (nitems * 2, sizeof (wchar_t *));
+    for (i = 0; resolved != NULL && allocated != NULL && i < nitems; i++)
+    {
+      resolved[i] = items[i];
+      resolved[i].linkpath = ntlink_ctx_path (ctx, items[i].linkpath, &allocated[i * 2]);
+      if (items[i].type == BLIND_HARDLINK)
+        resolved[i].target = ntlink_ctx_path (ctx, items[i].target, &allocated[i * 2 + 1]);
+      if ((items[i].linkpath != NULL && resolved[i].linkpath == NULL) ||
+          (items[i].target != NULL && resolved[i].target == NULL))
+        break;
+    }
+    if (resolved == NULL || allocated == NULL || i < nitems)
+    {
+      ntlink_free (resolved);
+      resolved = NULL;
+      errno = ENOMEM;
+    }
+  }
+
+  if (resolved != NULL)
+    r = symlink_batchw_impl (resolved, nitems, basedir, nthreads, flags);
+  if (resolved != items && resolved != NULL)
+    for (i = 0; i < nitems; i++)
+      items[i].status = resolved[i].status;
+
+  ntlink_ctx_end (ctx, NTLINK_API_SYMLINK_BATCH, start, r != 0);
+  ntlink_trace_call (NTLINK_API_SYMLINK_BATCH, start, r, (int) nitems, nthreads, basedir, NULL, NULL);
+  if (resolved != items)
+    ntlink_free (resolved);
+  if (allocated != NULL)
+  {
+    for (i = 0; i < nitems * 2; i++)
+      ntlink_free (allocated[i]);
+    ntlink_free (allocated);
+  }
+  return r;
+}
+
+int
+ntlink_symlink_batchw (SymlinkBatchItem *items, size_t nitems, wchar_t *basedir, int nthreads, SymlinkBatchFlags flags)
+{
+  return symlink_batchw_call (NULL, items, nitems, basedir, nthreads, flags);
+}
+
+/**
+ * ntlink_ctx_symlink_batchw:
+ * @ctx: a context
+ *
+ * ntlink_symlink_batchw() with the names and junction targets resolved
+ * against the base directory of @ctx.
+ */
+int
+ntlink_ctx_symlink_batchw (ntlink_ctx *ctx, SymlinkBatchItem *items, size_t nitems, int nthreads, SymlinkBatchFlags flags)
+{
+  return symlink_batchw_call (ctx, items, nitems, (wchar_t *) ntlink_ctx_get_basedir (ctx), nthreads, flags);
+}
+
+/* @wpath1 is stored in the link as it is, @wpath1_check is the same
+ * target resolved like the other names, to look at it before linking
+ */
+static int
+symlinkw_impl (const wchar_t *wpath1, const wchar_t *wpath1_check, const wchar_t *wpath2)
+{
+  int exists;
+  WIN32_FIND_DATAW finddata;
+#if _WIN32_WINNT >= 0x0600
+  BOOL err;
+  DWORD lerr;
+#endif
+
+  exists = PathExistsW ((wchar_t *) wpath2, &finddata, PATH_EXISTS_FLAG_NOTHING);
+  if (exists != 0)
+  {
+    if (exists > 0)
+      errno = EEXIST;
+    else
+      errno = EACCESS;
+    goto fail;
+  }
+
+  exists = PathExistsW ((wchar_t *) wpath1_check, &finddata, PATH_EXISTS_FLAG_NOTHING);
+  if (exists <= 0)
+  {
+    /* Since we don't know anything about the target,
+     * we can't link to it.
+     */
+    if (exists == 0)
+      errno = ENOENT;
+    else
+      errno = EACCESS;
+    goto fail;
+  }
+
+#if _WIN32_WINNT >= 0x0600
+  SetLastError (0);
+  err = ntlink_fs->create_symbolic_link ((wchar_t *) wpath2, (wchar_t *) wpath1, (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 ? 0 : SYMBOLIC_LINK_FLAG_DIRECTORY);
+  lerr = GetLastError ();
+  if (err == 0)
+  {
+    errno = Win32ErrorToErrno (lerr);
+    goto fail;
+  }
+#else
+  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+  {
+    /* Create a junction point to target directory */
+    int err;
+    wchar_t *wpath1_unp = NULL;
+    wpath1_unp = ntlink_malloc (sizeof (wchar_t) * (wcslen (wpath1_check) + 1 + 4));
+    memcpy (wpath1_unp, L"\\??\\", sizeof (wchar_t) * 4);
+    memcpy (&wpath1_unp[4], wpath1_check, (wcslen (wpath1_check) + 1) * sizeof (wchar_t));
+    err = SetJuncPointW (wpath1_unp, wpath2);
+    ntlink_free (wpath1_unp);
+    switch (err)
+    {
+    case 0:
+      break;
+    case -1:
+      errno = EACCESS;
+      goto fail;
+      break;
+    case -2:
+      errno = ENOMEM;
+      goto fail;
+      break;
+    case -3:
+      errno = EIO;
+      goto fail;
+      break;
+    default:
+      break;
+    }
+  }
+  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_NORMAL)
+  {
+    /* Create a hard link to target file */
+    BOOL ret;
+    ret = ntlink_fs->create_hard_link (wpath2, wpath1_check, NULL);
+    if (ret == 0)
+    {
+      errno = EIO;
+      goto fail;
+    }
+  }
+#endif
+
+  return 0;
+fail:
+
+  return -1;
+}
+
+int
+ntlink_ctx_symlinkw (ntlink_ctx *ctx, const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  int r = -1;
+  wchar_t *abs1 = NULL, *abs2 = NULL;
+  const wchar_t *p1, *p2;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_SYMLINK);
+  p1 = ntlink_ctx_path (ctx, wpath1, &abs1);
+  p2 = ntlink_ctx_path (ctx, wpath2, &abs2);
+  if (p1 != NULL && p2 != NULL)
+    r = symlinkw_impl (wpath1, p1, p2);
+  ntlink_ctx_end (ctx, NTLINK_API_SYMLINK, start, r != 0);
+  ntlink_trace_call (NTLINK_API_SYMLINK, start, r, 0, 0, wpath1, p2 != NULL ? p2 : wpath2, NULL);
+  ntlink_free (abs1);
+  ntlink_free (abs2);
+  return r;
+}
+
+int
+ntlink_symlinkw (const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  return ntlink_ctx_symlinkw (NULL, wpath1, wpath2);
+}
+
+int 
+ntlink_symlink(const char *path1, const char *path2)
+{
+  int ret;
+  wchar_t *wpath1 = NULL, *wpath2 = NULL;
+
+  if (strtowchar (path1, &wpath1, CP_THREAD_ACP) < 0)
+    goto fail;
+  if (strtowchar (path2, &wpath2, CP_THREAD_ACP) < 0)
+    goto fail;
+
+  ret = ntlink_symlinkw (wpath1, wpath2);
+
+  ntlink_free (wpath1);
+  ntlink_free (wpath2);
+
+  return ret;
+fail:
+  if (wpath1 != NULL)
+    ntlink_free (wpath1);
+  if (wpath2 != NULL)
+    ntlink_free (wpath2);
+
+  return -1;
+}
+
+int 
+ntlink_lchown(const char *path, uid_t owner, gid_t group)
+{
+  errno = EINVAL;
+  return -1;
+}
+
+static int
+linkw_impl (const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  int exists;
+  WIN32_FIND_DATAW finddata;
+
+  exists = PathExistsW ((wchar_t *) wpath2, &finddata, PATH_EXISTS_FLAG_NOTHING);
+  if (exists != 0)
+  {
+    if (exists > 0)
+      errno = EEXIST;
+    else
+      errno = EACCESS;
+    goto fail;
+  }
+
+  exists = PathExistsW ((wchar_t *) wpath1, &finddata, PATH_EXISTS_FLAG_NOTHING);
+  if (exists <= 0)
+  {
+    /* path1 must exist */
+    if (exists == 0)
+      errno = ENOENT;
+    else
+      errno = EACCESS;
+    goto fail;
+  }
+
+  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+  {
+    /* This implementation does not support link() on directories */
+    errno = EPERM;
+    goto fail;
+  }
+  else
+  {
+    /* Create a hard link to target file */
+    BOOL ret;
+    ret = ntlink_fs->create_hard_link ((wchar_t *) wpath2, (wchar_t *) wpath1, NULL);
+    if (ret == 0)
+    {
+      errno = EIO;
+      goto fail;
+    }
+  }
+
+  return 0;
+fail:
+  return -1;
+}
+
+int
+ntlink_ctx_linkw (ntlink_ctx *ctx, const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  int r = -1;
+  wchar_t *abs1 = NULL, *abs2 = NULL;
+  const wchar_t *p1, *p2;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_LINK);
+  p1 = ntlink_ctx_path (ctx, wpath1, &abs1);
+  p2 = ntlink_ctx_path (ctx, wpath2, &abs2);
+  if (p1 != NULL && p2 != NULL)
+    r = linkw_impl (p1, p2);
+  ntlink_ctx_end (ctx, NTLINK_API_LINK, start, r != 0);
+  ntlink_trace_call (NTLINK_API_LINK, start, r, 0, 0, p1 != NULL ? p1 : wpath1, p2 != NULL ? p2 : wpath2, NULL);
+  ntlink_free (abs1);
+  ntlink_free (abs2);
+  return r;
+}
+
+int
+ntlink_linkw (const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  return ntlink_ctx_linkw (NULL, wpath1, wpath2);
+}
+
+int 
+ntlink_link(const char *path1, const char *path2)
+{
+  int ret;
+  wchar_t *wpath1 = NULL, *wpath2 = NULL/*, *wpath1_unp = NULL*/;
+
+  if (strtowchar (path1, &wpath1, CP_THREAD_ACP) < 0)
+    goto fail;
+  if (strtowchar (path2, &wpath2, CP_THREAD_ACP) < 0)
+    goto fail;
+
+  ret = ntlink_linkw (wpath1, wpath2);
+
+  ntlink_free (wpath1);
+  ntlink_free (wpath2);
+
+  return ret;
+fail:
+  if (wpath1 != NULL)
+    ntlink_free (wpath1);
+  if (wpath2 != NULL)
+    ntlink_free (wpath2);
+
+  return -1;
+}
+
+static int
+lstatw_impl (const wchar_t *wpath, struct stat *buf)
+{
+  int exists;
+  int result = 0;
+  WIN32_FIND_DATAW finddata;
+  wchar_t *abswpath = NULL;
+#if _WIN32_WINNT >= 0x0600
+  HANDLE fileh = NULL;
+  DWORD lerr;
+#endif
+
+  GetAbsNameW ((wchar_t *) wpath, &abswpath, NULL, 0);
+
+  exists = PathExistsW ((wchar_t *) wpath, &finddata, PATH_EXISTS_FLAG_NOTHING);
+  if (exists <= 0)
+  {
+    /* path1 must exist */
+    if (exists == 0)
+      errno = ENOENT;
+    else
+      errno = EACCESS;
+    goto fail;
+  }
+
+#if _WIN32_WINNT >= 0x0600
+  {
+    FILE_BASIC_INFO bi;
+    FILE_STANDARD_INFO stdi;
+    BY_HANDLE_FILE_INFORMATION info;
+    int linktype = -1;
+
+    SetLastError (0);
+    fileh = ntlink_fs->create_file (wpath, 0, 0, NULL, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT | (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FILE_FLAG_BACKUP_SEMANTICS : 0,
+        NULL);
+    lerr = GetLastError ();
+    if (fileh == INVALID_HANDLE_VALUE)
+    {
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    SetLastError (0);
+    if (ntlink_fs->get_file_information_by_handle (fileh, &info) == 0)
+    {
+      lerr = GetLastError ();
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    SetLastError (0);
+    if (ntlink_fs->get_file_information_by_handle_ex (fileh, FileBasicInfo, &bi, sizeof (bi)) == 0)
+    {
+      lerr = GetLastError ();
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    SetLastError (0);
+    if (ntlink_fs->get_file_information_by_handle_ex (fileh, FileStandardInfo, &stdi, sizeof (stdi)) == 0)
+    {
+      lerr = GetLastError ();
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    ntlink_fs->close_handle (fileh);
+    fileh = NULL;
+
+    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+    {
+      wchar_t *wjptarget = NULL;
+      int relative = 0;
+      int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
+      if (jpresult >= 0)
+      {
+        ntlink_free (wjptarget);
+      }
+    }
+
+    buf->st_gid = 0;
+    buf->st_uid = 0;
+    /* I've found that none of the following functions will return attributes
+     * with FILE_ATTRIBUTE_REPARSE_POINT set, but GetFileAttributesW that is called by PathExistsW will.
+     * Because of that i will set FILE_ATTRIBUTE_REPARSE_POINT here from finddata.
+     */
+    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+      bi.FileAttributes |= FILE_ATTRIBUTE_REPARSE_POINT;
+/*
+#st_mode
+#
+#    Bit mask for file-mode information. The _S_IFDIR bit is set if path specifies a directory;
+#    the _S_IFREG bit is set if path specifies an ordinary file or a device.
+#    User read/write bits are set according to the file's permission mode;
+#    user execute bits are set according to the filename extension.
+*/
+    buf->st_nlink = stdi.NumberOfLinks;
+    buf->st_mode = 0;
+    /* 1 means a symlink, -1 means unknown (and we assume a symlink). 0 is a junction point */
+    if (linktype == 1 || linktype == -1)
+    {
+      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? _S_IFLNK : 0;
+      /* Why was it like that? I must have had a good reason. Still, with it directory symlinks won't get a directory attribute set. On Windows there IS
+       * a difference between directory symlinks and file symlinks, so this attribute IS needed to distinguish between the two */
+      /* buf->st_mode |= ((bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) ? _S_IFDIR : _S_IFREG; */
+      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _S_IFDIR : _S_IFREG;
+    }
+    else
+    {
+      buf->st_mode |= _S_IFJUN;
+    }
+    buf->st_size = stdi.EndOfFile.QuadPart;
+    buf->st_dev = buf->st_rdev = info.dwVolumeSerialNumber;
+    buf->st_ino = ((ULONGLONG) info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    /* buf->st_*time is either 32-bit or 64-bit integer */
+#ifdef _USE_32BIT_TIME_T
+    buf->st_atime = bi.LastAccessTime;
+    buf->st_ctime = bi.CreationTime;
+    buf->st_mtime = (bi.LastWriteTime > bi.ChangeTime) ? bi.LastWriteTime : bi.ChangeTime;
+#else
+    buf->st_atime = bi.LastAccessTime.LowPart;
+    buf->st_ctime = bi.CreationTime.LowPart;
+    buf->st_mtime = (bi.LastWriteTime.LowPart > bi.ChangeTime.LowPart) ? bi.LastWriteTime.LowPart : bi.ChangeTime.LowPart;
+#endif
+  }
+#else
+  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+  {
+/* I probably forgot to implement pre-0x0600 version, which is why
+ * this code was here for some time.
+ */
+/* 
+    int relative = 0;
+    wchar_t *jptarget = NULL;
+    int jpresult = GetJuncPointW (&jptarget, abswpath, &relative);
+    switch (jpresult)
+    {
+    case -1:
+      errno = EACCESS;
+      goto fail;
+    case -2:
+      errno = EIO;
+      goto fail;
+    case -3:
+      errno = ENOMEM;
+      goto fail;
+    default:
+      ;
+    }
+    ntlink_free (jptarget);
+*/
+    BY_HANDLE_FILE_INFORMATION info;
+    int linktype = -1;
+
+    SetLastError (0);
+    fileh = ntlink_fs->create_file (wpath, 0, 0, NULL, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT | (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FILE_FLAG_BACKUP_SEMANTICS : 0,
+        NULL);
+    lerr = GetLastError ();
+    if (fileh == INVALID_HANDLE_VALUE)
+    {
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    SetLastError (0);
+    if (ntlink_fs->get_file_information_by_handle (fileh, &info) == 0)
+    {
+      lerr = GetLastError ();
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    ntlink_fs->close_handle (fileh);
+    fileh = NULL;
+
+    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+    {
+      wchar_t *wjptarget = NULL;
+      int len = 0;
+      int relative = 0;
+      int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
+      if (jpresult >= 0)
+      {
+        ntlink_free (wjptarget);
+      }
+    }
+
+    buf->st_gid = 0;
+    buf->st_uid = 0;
+    /* I've found that none of the following functions will return attributes
+     * with FILE_ATTRIBUTE_REPARSE_POINT set, but GetFileAttributesW that is called by PathExistsW will.
+     * Because of that i will set FILE_ATTRIBUTE_REPARSE_POINT here from finddata.
+     */
+    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+      info.dwFileAttributes |= FILE_ATTRIBUTE_REPARSE_POINT;
+/*
+#st_mode
+#
+#    Bit mask for file-mode information. The _S_IFDIR bit is set if path specifies a directory;
+#    the _S_IFREG bit is set if path specifies an ordinary file or a device.
+#    User read/write bits are set according to the file's permission mode;
+#    user execute bits are set according to the filename extension.
+*/
+    buf->st_nlink = info.NumberOfLinks;
+    buf->st_mode = 0;
+    /* 1 means a symlink, -1 means unknown (and we assume a symlink). 0 is a junction point */
+    if (linktype == 1 || linktype == -1)
+    {
+      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? _S_IFLNK : 0;
+      /* Why was it like that? I must have had a good reason. Still, with it directory symlinks won't get a directory attribute set. On Windows there IS
+       * a difference between directory symlinks and file symlinks, so this attribute IS needed to distinguish between the two */
+      /* buf->st_mode |= ((bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(bi.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) ? _S_IFDIR : _S_IFREG; */
+      buf->st_mode |= (bi.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _S_IFDIR : _S_IFREG;
+    }
+    else
+    {
+      buf->st_mode |= _S_IFJUN;
+    }
+    buf->st_size = (info.nFileSizeHigh * (MAXDWORD + 1)) + info.nFileSizeLow;
+    buf->st_dev = buf->st_rdev = info.dwVolumeSerialNumber;
+    buf->st_ino = ((ULONGLONG) info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    /* buf->st_*time is either 32-bit or 64-bit integer */
+#ifdef _USE_32BIT_TIME_T
+    buf->st_atime = info.ftLastAccessTime.dwLowDateTime;
+    buf->st_ctime = info.ftCreationTime.dwLowDateTime;
+    buf->st_mtime = info.ftLastWriteTime.dwLowDateTime;
+#else
+    buf->st_atime = (info.ftLastAccessTime.dwHighDateTime << (sizeof(DWORD) * 8)) | info.ftLastAccessTime.dwLowDateTime;
+    buf->st_ctime = (info.ftCreationTime.dwHighDateTime << (sizeof(DWORD) * 8)) | info.ftCreationTime.dwLowDateTime;
+    buf->st_mtime = (info.ftLastWriteTime.dwHighDateTime << (sizeof(DWORD) * 8)) | info.ftLastWriteTime.dwLowDateTime;
+#endif
+  }
+  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_NORMAL)
+  {
+    /* This is a hard link, use normal stat() */
+    result = _wstat (wpath, buf);
+  }
+#endif
+
+  if (abswpath != NULL)
+    ntlink_free (abswpath);
+
+  return result;
+fail:
+#if _WIN32_WINNT >= 0x0600
+  if (fileh != NULL)
+    ntlink_fs->close_handle (fileh);
+#endif
+  if (abswpath != NULL)
+    ntlink_free (abswpath);
+  return -1;
+}
+
+int
+ntlink_ctx_lstatw (ntlink_ctx *ctx, const wchar_t *wpath, struct stat *buf)
+{
+  int r = -1;
+  wchar_t *abswpath = NULL;
+  const wchar_t *p;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_LSTAT);
+  p = ntlink_ctx_path (ctx, wpath, &abswpath);
+  if (p != NULL)
+    r = lstatw_impl (p, buf);
+  ntlink_ctx_end (ctx, NTLINK_API_LSTAT, start, r != 0);
+  ntlink_trace_call (NTLINK_API_LSTAT, start, r, 0, 0, p != NULL ? p : wpath, NULL, NULL);
+  ntlink_free (abswpath);
+  return r;
+}
+
+int
+ntlink_lstatw (const wchar_t *wpath, struct stat *buf)
+{
+  return ntlink_ctx_lstatw (NULL, wpath, buf);
+}
+
+
+int 
+ntlink_lstat(const char *path, struct stat *buf)
+{
+  int ret;
+  wchar_t *wpath = NULL;
+
+  if (strtowchar (path, &wpath, CP_THREAD_ACP) < 0)
+    goto fail;
+
+  ret = ntlink_lstatw (wpath, buf);
+
+  ntlink_free (wpath);
+
+  return ret;
+fail:
+  if (wpath != NULL)
+    ntlink_free (wpath);
+  return -1;
+}
+
+/* Windows 8+ and Vista+ bits that older headers don't have */
+typedef struct
+{
+  ULONGLONG VolumeSerialNumber;
+  BYTE FileId[16];
+} ntlink_file_id_info;
+
+typedef struct
+{
+  DWORD FileAttributes;
+  DWORD ReparseTag;
+} ntlink_file_attribute_tag_info;
+
+#define NTLINK_FileAttributeTagInfo ((FILE_INFO_BY_HANDLE_CLASS) 9)
+#define NTLINK_FileIdInfo ((FILE_INFO_BY_HANDLE_CLASS) 18)
+
+/* 100ns intervals between 1601-01-01 and 1970-01-01 */
+#define NTLINK_EPOCH_DIFFERENCE 116444736000000000LL
+
+static void
+filetime_to_statx_timestamp (LONGLONG ft, ntlink_statx_timestamp *ts)
+{
+  LONGLONG t = ft - NTLINK_EPOCH_DIFFERENCE;
+  LONGLONG sec = t / 10000000;
+  LONGLONG rem = t % 10000000;
+  if (rem < 0)
+  {
+    rem += 10000000;
+    sec -= 1;
+  }
+  ts->tv_sec = sec;
+  ts->tv_nsec = (unsigned int) (rem * 100);
+}
+
+static unsigned int
+statx_mode (DWORD attributes, DWORD tag)
+{
+  if (attributes & FILE_ATTRIBUTE_REPARSE_POINT)
+  {
+    if (tag == IO_REPARSE_TAG_MOUNT_POINT)
+      return _S_IFJUN;
+    if (tag == IO_REPARSE_TAG_SYMLINK)
+      return _S_IFLNK | ((attributes & FILE_ATTRIBUTE_DIRECTORY) ? _S_IFDIR : _S_IFREG);
+  }
+  return (attributes & FILE_ATTRIBUTE_DIRECTORY) ? _S_IFDIR : _S_IFREG;
+}
+
+/**
+ * ntlink_statxw:
+ * @wpath: a path (UTF-16)
+ * @flags: a combination of one or more members of StatxFlags
+ * @mask: a combination of StatxMask bits (the fields the caller needs)
+ * @buf: receives the result
+ *
+ * Extended version of ntlink_lstatw(). Only the information requested in
+ * @mask is queried:
+ *   type, attributes, reparse tag, size and a/m/b-times alone cost one
+ *     FindFirstFileW() and no handle is opened (unless
+ *     NTLINK_STATX_FLAG_FOLLOW_SYMLINK is set);
+ *   otherwise the file is opened once and only the needed information classes
+ *     (FileAttributeTagInfo, FileBasicInfo, FileStandardInfo, FileIdInfo)
+ *     are queried.
+ * Times are converted with full 100ns precision.
+ * @buf->stx_mask tells which fields were actually filled; it can have more
+ * bits than requested.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set)
+ */
+static int
+statxw_impl (const wchar_t *wpath, StatxFlags flags, unsigned int mask, ntlink_statx *buf)
+{
+  HANDLE fileh;
+  DWORD attributes = 0, tag = 0;
+  const unsigned int find_mask = NTLINK_STATX_TYPE | NTLINK_STATX_ATTRIBUTES | NTLINK_STATX_REPARSE_TAG |
+      NTLINK_STATX_SIZE | NTLINK_STATX_ATIME | NTLINK_STATX_MTIME | NTLINK_STATX_BTIME;
+
+  if (wpath == NULL || buf == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  memset (buf, 0, sizeof (ntlink_statx));
+
+  if ((mask & ~find_mask) == 0 && !(flags & NTLINK_STATX_FLAG_FOLLOW_SYMLINK) &&
+      wcspbrk (wpath, L"*?") == NULL)
+  {
+    WIN32_FIND_DATAW finddata;
+    HANDLE hFind = ntlink_fs->find_first_file (wpath, &finddata);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+      ULARGE_INTEGER li;
+      ntlink_fs->find_close (hFind);
+      attributes = finddata.dwFileAttributes;
+      tag = (attributes & FILE_ATTRIBUTE_REPARSE_POINT) ? finddata.dwReserved0 : 0;
+      buf->stx_attributes = attributes;
+      buf->stx_reparse_tag = tag;
+      buf->stx_mode = statx_mode (attributes, tag);
+      buf->stx_size = ((ULONGLONG) finddata.nFileSizeHigh << 32) | finddata.nFileSizeLow;
+      li.LowPart = finddata.ftLastAccessTime.dwLowDateTime;
+      li.HighPart = finddata.ftLastAccessTime.dwHighDateTime;
+      filetime_to_statx_timestamp (li.QuadPart, &buf->stx_atime);
+      li.LowPart = finddata.ftLastWriteTime.dwLowDateTime;
+      li.HighPart = finddata.ftLastWriteTime.dwHighDateTime;
+      filetime_to_statx_timestamp (li.QuadPart, &buf->stx_mtime);
+      li.LowPart = finddata.ftCreationTime.dwLowDateTime;
+      li.HighPart = finddata.ftCreationTime.dwHighDateTime;
+      filetime_to_statx_timestamp (li.QuadPart, &buf->stx_btime);
+      buf->stx_mask = find_mask;
+      return 0;
+    }
+    /* Fall through, let CreateFileW() report the error (or succeed on roots) */
+  }
+
+  fileh = ntlink_fs->create_file (wpath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_EXISTING,
+      FILE_FLAG_BACKUP_SEMANTICS | ((flags & NTLINK_STATX_FLAG_FOLLOW_SYMLINK) ? 0 : FILE_FLAG_OPEN_REPARSE_POINT),
+      NULL);
+  if (fileh == INVALID_HANDLE_VALUE)
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    return -1;
+  }
+
+  if (mask & (NTLINK_STATX_TYPE | NTLINK_STATX_ATTRIBUTES | NTLINK_STATX_REPARSE_TAG))
+  {
+    ntlink_file_attribute_tag_info ti;
+    if (ntlink_fs->get_file_information_by_handle_ex (fileh, NTLINK_FileAttributeTagInfo, &ti, sizeof (ti)))
+    {
+      attributes = ti.FileAttributes;
+      tag = (attributes & FILE_ATTRIBUTE_REPARSE_POINT) ? ti.ReparseTag : 0;
+      buf->stx_attributes = attributes;
+      buf->stx_reparse_tag = tag;
+      buf->stx_mode = statx_mode (attributes, tag);
+      buf->stx_mask |= NTLINK_STATX_TYPE | NTLINK_STATX_ATTRIBUTES | NTLINK_STATX_REPARSE_TAG;
+    }
+  }
+
+  if (mask & (NTLINK_STATX_ATIME | NTLINK_STATX_MTIME | NTLINK_STATX_CTIME | NTLINK_STATX_BTIME))
+  {
+    FILE_BASIC_INFO bi;
+    if (ntlink_fs->get_file_information_by_handle_ex (fileh, FileBasicInfo, &bi, sizeof (bi)))
+    {
+      filetime_to_statx_timestamp (bi.LastAccessTime.QuadPart, &buf->stx_atime);
+      filetime_to_statx_timestamp (bi.LastWriteTime.QuadPart, &buf->stx_mtime);
+      filetime_to_statx_timestamp (bi.ChangeTime.QuadPart, &buf->stx_ctime);
+      filetime_to_statx_timestamp (bi.CreationTime.QuadPart, &buf->stx_btime);
+      buf->stx_mask |= NTLINK_STATX_ATIME | NTLINK_STATX_MTIME | NTLINK_STATX_CTIME | NTLINK_STATX_BTIME;
+    }
+  }
+
+  if (mask & (NTLINK_STATX_NLINK | NTLINK_STATX_SIZE | NTLINK_STATX_ALLOC_SIZE))
+  {
+    FILE_STANDARD_INFO stdi;
+    if (ntlink_fs->get_file_information_by_handle_ex (fileh, FileStandardInfo, &stdi, sizeof (stdi)))
+    {
+      buf->stx_nlink = stdi.NumberOfLinks;
+      buf->stx_size = stdi.EndOfFile.QuadPart;
+      buf->stx_alloc_size = stdi.AllocationSize.QuadPart;
+      buf->stx_mask |= NTLINK_STATX_NLINK | NTLINK_STATX_SIZE | NTLINK_STATX_ALLOC_SIZE;
+    }
+  }
+
+  if (mask & NTLINK_STATX_INO)
+  {
+    ntlink_file_id_info idi;
+    BY_HANDLE_FILE_INFORMATION info;
+    if (ntlink_fs->get_file_information_by_handle_ex (fileh, NTLINK_FileIdInfo, &idi, sizeof (idi)))
+    {
+      buf->stx_volume_serial = idi.VolumeSerialNumber;
+      memcpy (buf->stx_file_id, idi.FileId, sizeof (buf->stx_file_id));
+      buf->stx_mask |= NTLINK_STATX_INO;
+    }
+    else if (ntlink_fs->get_file_information_by_handle (fileh, &info))
+    {
+      /* Pre-Windows 8: 64-bit file index, 32-bit serial */
+      ULONGLONG index = ((ULONGLONG) info.nFileIndexHigh << 32) | info.nFileIndexLow;
+      buf->stx_volume_serial = info.dwVolumeSerialNumber;
+      memcpy (buf->stx_file_id, &index, sizeof (index));
+      buf->stx_mask |= NTLINK_STATX_INO;
+    }
+  }
+
+  ntlink_fs->close_handle (fileh);
+
+  if ((buf->stx_mask & mask) != mask)
+  {
+    /* Something that was asked for could not be obtained */
+    errno = EIO;
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+ntlink_ctx_statxw (ntlink_ctx *ctx, const wchar_t *wpath, StatxFlags flags, unsigned int mask, ntlink_statx *buf)
+{
+  int r = -1;
+  wchar_t *abswpath = NULL;
+  const wchar_t *p;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_STATX);
+  p = ntlink_ctx_path (ctx, wpath, &abswpath);
+  if (p != NULL)
+    r = statxw_impl (p, flags, mask, buf);
+  ntlink_ctx_end (ctx, NTLINK_API_STATX, start, r != 0);
+  ntlink_trace_call (NTLINK_API_STATX, start, r, flags, (int) mask, p != NULL ? p : wpath, NULL, NULL);
+  ntlink_free (abswpath);
+  return r;
+}
+
+int
+ntlink_statxw (const wchar_t *wpath, StatxFlags flags, unsigned int mask, ntlink_statx *buf)
+{
+  return ntlink_ctx_statxw (NULL, wpath, flags, mask, buf);
+}
+
+/*
+  bufsize and return value are in characters, not bytes
+ */
+static ssize_t
+readlinkw_impl (const wchar_t *wpath, wchar_t *buf,
+    size_t bufsize)
+{
+  wchar_t *abswpath = NULL;
+  int exists;
+  int result = 0;
+  WIN32_FIND_DATAW finddata;
+#if _WIN32_WINNT >= 0x0600
+  HANDLE fileh = NULL;
+  wchar_t *wtarget = NULL;
+#endif
+
+  GetAbsNameW ((wchar_t *) wpath, &abswpath, NULL, 0);
+
+  exists = PathExistsW ((wchar_t *) wpath, &finddata, PATH_EXISTS_FLAG_NOTHING);
+  if (exists <= 0)
+  {
+    /* path1 must exist */
+    if (exists == 0)
+      errno = ENOENT;
+    else
+      errno = EACCESS;
+    goto fail;
+  }
+
+#if _WIN32_WINNT >= 0x0600
+  if (!(finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+  {
+    /* This is not a symlink */
+    errno = EINVAL;
+    goto fail;
+  }
+  else
+  {
+#if 0
+    DWORD lerr;
+    DWORD required_size, required_size2;
+    char *target;
+    int len = 0;
+    int conv_result = 0;
+    SetLastError (0);
+    fileh = ntlink_fs->create_file (wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FILE_FLAG_BACKUP_SEMANTICS : 0, NULL);
+    if (fileh == INVALID_HANDLE_VALUE)
+    {
+      lerr = GetLastError ();
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+
+    SetLastError (0);
+    required_size = ntlink_fs->get_final_path_name_by_handle (fileh, (wchar_t *) &required_size, 0, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    if (required_size == 0)
+    {
+      lerr = GetLastError ();
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    wtarget = (wchar_t *) ntlink_malloc ((required_size) * sizeof (wchar_t));
+    if (wtarget == NULL)
+    {
+      errno = ENOMEM;
+      goto fail;
+    }
+    SetLastError (0);
+    required_size2 = ntlink_fs->get_final_path_name_by_handle (fileh, wtarget, required_size, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    if (required_size2 == 0)
+    {
+      lerr = GetLastError ();
+      errno = Win32ErrorToErrno (lerr);
+      goto fail;
+    }
+    if (required_size2 != required_size - 1)
+    {
+      /* TODO: Figure out what would that mean... */
+      errno = EIO;
+      goto fail;
+    }
+    ntlink_fs->close_handle (fileh);
+    fileh = NULL;
+/*
+    conv_result = wchartostr (wtarget, &target, CP_THREAD_ACP);
+    ntlink_free (wtarget);
+    wtarget = NULL;
+    if (conv_result < 0)
+      goto fail;
+*/
+    len = wcslen (wtarget);
+    if (len > bufsize)
+      len = bufsize;
+    memcpy (buf, wtarget, (len + 1) * sizeof (wchar_t));
+    ntlink_free (wtarget);
+    result = len;
+#endif
+    wchar_t *wjptarget = NULL;
+    int len = 0;
+    int relative = 0;
+    int linktype = 0;
+    int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
+    switch (jpresult)
+    {
+    case -1:
+      errno = EACCESS;
+      goto fail;
+    case -2:
+      errno = EIO;
+      goto fail;
+    case -3:
+      errno = ENOMEM;
+      goto fail;
+    default:
+      ;
+    }
+    len = wcslen (wjptarget);
+    if (len > bufsize)
+      len = bufsize;
+    memcpy (buf, wjptarget, len * sizeof (wchar_t));
+    ntlink_free (wjptarget);
+    result = len;
+  }
+#else
+  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+  {
+    if (!(finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+    {
+      /* This is not a junction point */
+      errno = EINVAL;
+      goto fail;
+    }
+    /* Obtain juncpoint information and fill the buf */
+
+    wchar_t *wjptarget = NULL;
+    char *jptarget = NULL;
+    int len = 0;
+    int conv_result = 0;
+    int relative = 0;
+    int linktype = 0;
+    int jpresult = GetJuncPointW (&wjptarget, abswpath, &relative, &linktype);
+    switch (jpresult)
+    {
+    case -1:
+      errno = EACCESS;
+      goto fail;
+    case -2:
+      errno = EIO;
+      goto fail;
+    case -3:
+      errno = ENOMEM;
+      goto fail;
+    default:
+      ;
+    }
+    len = wcslen (wjptarget);
+    if (len > bufsize)
+      len = bufsize;
+    memcpy (buf, wjptarget, len * sizeof (wchar_t));
+    ntlink_free (wjptarget);
+    result = len;
+  }
+  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_NORMAL)
+  {
+    /* This must be a hard link, return its own name */
+    int len = wcslen (wpath);
+    if (len > bufsize)
+      len = bufsize;
+    memcpy (buf, wpath, len * sizeof (wchar_t));
+    result = len;
+  }
+#endif
+
+  if (abswpath != NULL)
+    ntlink_free (abswpath);
+
+  return result;
+fail:
+#if _WIN32_WINNT >= 0x0600
+  if (wtarget != NULL)
+    ntlink_free (wtarget);
+  if (fileh != NULL)
+    ntlink_fs->close_handle (fileh);
+#endif
+  if (abswpath != NULL)
+    ntlink_free (abswpath);
+
+  return -1;
+}
+
+ssize_t
+ntlink_ctx_readlinkw (ntlink_ctx *ctx, const wchar_t *wpath, wchar_t *buf, size_t bufsize)
+{
+  ssize_t r = -1;
+  wchar_t *abswpath = NULL;
+  const wchar_t *p;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_READLINK);
+  p = ntlink_ctx_path (ctx, wpath, &abswpath);
+  if (p != NULL)
+    r = readlinkw_impl (p, buf, bufsize);
+  ntlink_ctx_end (ctx, NTLINK_API_READLINK, start, r < 0);
+  ntlink_trace_call (NTLINK_API_READLINK, start, r, (int) bufsize, 0, p != NULL ? p : wpath, NULL, NULL);
+  ntlink_free (abswpath);
+  return r;
+}
+
+ssize_t
+ntlink_readlinkw (const wchar_t *wpath, wchar_t *buf, size_t bufsize)
+{
+  return ntlink_ctx_readlinkw (NULL, wpath, buf, bufsize);
+}
+
+
+ssize_t 
+ntlink_readlink(const char *path, char *buf, size_t bufsize)
+{
+  ssize_t ret;
+  wchar_t *wpath = NULL;
+  wchar_t *wbuf = NULL;
+
+  if (strtowchar (path, &wpath, CP_THREAD_ACP) < 0)
+    goto fail;
+
+  if (bufsize > 0)
+  {
+    /* One more for the terminator wchartostr() needs */
+    wbuf = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (bufsize + 1));
+    if (wbuf == NULL)
+    {
+      errno = ENOMEM;
+      goto fail;
+    }
+  }
+
+  ret = ntlink_readlinkw (wpath, wbuf, bufsize);
+
+  ntlink_free (wpath);
+
+  if (bufsize > 0)
+  {
+    if (ret >= 0)
+    {
+      char *tmp;
+      wbuf[ret] = L'\0';
+      if (wchartostr (wbuf, &tmp, CP_THREAD_ACP) < 0)
+        ret = -1;
+      else
+      {
+        /* Like readlink(), not terminated, truncated to bufsize bytes */
+        ret = strlen (tmp);
+        if ((size_t) ret > bufsize)
+          ret = bufsize;
+        memcpy (buf, tmp, ret);
+        ntlink_free (tmp);
+      }
+    }
+    ntlink_free (wbuf);
+  }
+
+  return ret;
+fail:
+  if (wpath != NULL)
+    ntlink_free (wpath);
+
+  return -1;
+}
+
+static int
+unlinkw_impl (const wchar_t *wpath)
+{
+  int exists;
+  WIN32_FIND_DATAW finddata;
+  DWORD lerr;
+
+  exists = PathExistsW ((wchar_t *) wpath, &finddata, PATH_EXISTS_FLAG_NOTHING);
+  if (exists <= 0)
+  {
+    /* path must exist */
+    if (exists == 0)
+      errno = ENOENT;
+    else
+      errno = EACCESS;
+    return -1;
+  }
+  if (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+  {
+    BOOL bres;
+    SetLastError (0);
+    if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      bres = ntlink_fs->remove_directory (wpath);
+    else
+      bres = ntlink_fs->delete_file (wpath);
+    lerr = GetLastError ();
+    if (bres == 0)
+    {
+      errno = Win32ErrorToErrno (lerr);
+      return -1;
+    }
+    return 0;
+#if 0
+  } else if (finddata.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT))
+  {
+
+/* This code is disabled, because unlink() is not required to leave an empty
+ * directory behind ('break link' behaviour), it is required to remove the link
+ * completely ('remove link' behaviour), and simple RemoveDirectory() will suffice.
+ */
+
+    /* Unjunc that junction */
+
+    int jpresult = UnJuncPointW (wpath);
+    switch (jpresult)
+    {
+    case -1:
+      errno = EACCESS;
+      goto fail;
+    case -2:
+      errno = EIO;
+      goto fail;
+    case -3:
+      errno = ENOMEM;
+      goto fail;
+    default:
+      ;
+    }
+#endif
+  }
+  else if (~finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+  {
+    if (!ntlink_fs->delete_file (wpath))
+    {
+      errno = Win32ErrorToErrno (GetLastError ());
+      return -1;
+    }
+    return 0;
+  }
+  else if (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+  {
+    if (!ntlink_fs->remove_directory (wpath))
+    {
+      errno = Win32ErrorToErrno (GetLastError ());
+      return -1;
+    }
+    return 0;
+  }
+  return 0;
+}
+
+int
+ntlink_ctx_unlinkw (ntlink_ctx *ctx, const wchar_t *wpath)
+{
+  int r = -1;
+  wchar_t *abswpath = NULL;
+  const wchar_t *p;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_UNLINK);
+  p = ntlink_ctx_path (ctx, wpath, &abswpath);
+  if (p != NULL)
+    r = unlinkw_impl (p);
+  ntlink_ctx_end (ctx, NTLINK_API_UNLINK, start, r != 0);
+  ntlink_trace_call (NTLINK_API_UNLINK, start, r, 0, 0, p != NULL ? p : wpath, NULL, NULL);
+  ntlink_free (abswpath);
+  return r;
+}
+
+int
+ntlink_unlinkw (const wchar_t *wpath)
+{
+  return ntlink_ctx_unlinkw (NULL, wpath);
+}
+
+
+int 
+ntlink_unlink(const char *path)
+{
+  int ret;
+  wchar_t *wpath = NULL;
+
+  if (strtowchar (path, &wpath, CP_THREAD_ACP) < 0)
+    goto fail;
+
+  ret = ntlink_unlinkw (wpath);
+
+  ntlink_free (wpath);
+
+  return ret;
+fail:
+  if (wpath != NULL)
+    ntlink_free (wpath);
+
+  return -1;
+}
+
+static int
+renamew_impl (const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  int exists;
+  struct stat stat1, stat2;
+  WIN32_FIND_DATAW finddata1, finddata2;
+
+  memset (&stat1, 0, sizeof (stat1));
+  memset (&stat2, 0, sizeof (stat2));
+
+  ntlink_lstatw (wpath1, &stat1);
+  ntlink_lstatw (wpath2, &stat2);
+
+  /* If the old argument and the new argument resolve to the same existing file, rename() shall return successfully and perform no other action. */
+  if (stat1.st_ino != 0 && stat1.st_ino == stat2.st_ino)
+    return 0;
+
+  exists = PathExistsW ((wchar_t *) wpath1, &finddata1, PATH_EXISTS_FLAG_NOTHING);
+  if (exists <= 0)
+  {
+    /* path1 must exist */
+    if (exists > 0)
+      errno = ENOENT;
+    else
+      errno = EACCESS;
+    goto fail;
+  }
+
+  exists = PathExistsW ((wchar_t *) wpath2, &finddata2, PATH_EXISTS_FLAG_NOTHING);
+  if (exists > 0)
+  {
+    /* If the old argument points to the pathname of a directory, the new argument shall not point to the pathname of a file that is not a directory. */
+    if ((finddata1.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY && !(finddata2.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)))
+    {
+      errno = ENOTDIR;
+      goto fail;
+    }
+    /* If the old argument points to the pathname of a file that is not a directory, the new argument shall not point to the pathname of a directory. */
+    if ((~finddata1.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY && !(~finddata2.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)))
+    {
+      errno = EISDIR;
+      goto fail;
+    }
+
+    /* If the directory named by the new argument exists, it shall be removed and old renamed to new. */
+    /* ntlink_unlink() removes a directory */
+
+    /* If the link named by the new argument exists, it shall be removed and old renamed to new. */
+    /* ntlink_unlink() removes a file*/
+
+    /* If new names an existing directory, it shall be required to be an empty directory.*/
+    /* ntlink_unlink() does not remove non-empty directories, fails with ENOTEMPTY */
+
+    /* If the new argument points to a pathname of a symbolic link, the symbolic link shall be removed. */
+    if (ntlink_unlinkw (wpath2) != 0)
+      goto fail;
+  }
+
+  /* If the old argument points to a pathname of a symbolic link, the symbolic link shall be renamed. */
+  /* TODO: make sure that this is what really happens */
+
+  /* The new pathname shall not contain a path prefix that names old. */
+  /* Hope that MoveFileEx will figure this out */
+
+  /* If the rename() function fails for any reason other than [EIO], any file named by new shall be unaffected. */
+  /* Can't see this happening. We can't tell MoveFileEx to remove the existing directory */
+
+  /* TODO: MoveFileEx can't move directories between drives, fix that */
+  if (ntlink_fs->move_file_ex (wpath1, wpath2, MOVEFILE_COPY_ALLOWED | MOVEFILE_WRITE_THROUGH) == 0)
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    goto fail;
+  }
+
+  return 0;
+fail:
+  return -1;
+}
+
+int
+ntlink_ctx_renamew (ntlink_ctx *ctx, const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  int r = -1;
+  wchar_t *abs1 = NULL, *abs2 = NULL;
+  const wchar_t *p1, *p2;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_RENAME);
+  p1 = ntlink_ctx_path (ctx, wpath1, &abs1);
+  p2 = ntlink_ctx_path (ctx, wpath2, &abs2);
+  if (p1 != NULL && p2 != NULL)
+    r = renamew_impl (p1, p2);
+  ntlink_ctx_end (ctx, NTLINK_API_RENAME, start, r != 0);
+  ntlink_trace_call (NTLINK_API_RENAME, start, r, 0, 0, p1 != NULL ? p1 : wpath1, p2 != NULL ? p2 : wpath2, NULL);
+  ntlink_free (abs1);
+  ntlink_free (abs2);
+  return r;
+}
+
+int
+ntlink_renamew (const wchar_t *wpath1, const wchar_t *wpath2)
+{
+  return ntlink_ctx_renamew (NULL, wpath1, wpath2);
+}
+
+int 
+ntlink_rename(const char *path1, const char *path2)
+{
+  int ret;
+  wchar_t *wpath1 = NULL, *wpath2 = NULL;
+
+  if (strtowchar (path1, &wpath1, CP_THREAD_ACP) < 0)
+    goto fail;
+  if (strtowchar (path2, &wpath2, CP_THREAD_ACP) < 0)
+    goto fail;
+
+  ret = ntlink_renamew (wpath1, wpath2);
+
+  ntlink_free (wpath1);
+  ntlink_free (wpath2);
+
+  return ret;
+
+fail:
+  if (wpath1 != NULL)
+    ntlink_free (wpath1);
+  if (wpath2 != NULL)
+    ntlink_free (wpath2);
+
+  return -1;
+
 }
\ No newline at end of file
@@ -1,130 +1,250 @@
-/*
- * This file is part of libntlink.
- * Copyright (c) 2010, LRN
- *
- * libntlink is free software: you can redistribute it and/or modify
- * it under the terms of the GNU Lesser General Public License
- * as published by the Free Software Foundation, either version 3
- * of the License, or (at your option) any later version.
- *
- * libntlink is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU Lesser General Public License for more details.
- *
- * You should have received a copy of
- * the GNU Lesser General Public License and the GNU General Public License
- * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#ifndef __NTLINK_SYMLINK_H__
-#define __NTLINK_SYMLINK_H__
-
-#include <unistd.h>
-#include <sys/stat.h>
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-#ifndef uid_t
-  #define uid_t int
-#endif
-
-#ifndef gid_t
-  #define gid_t uid_t
-#endif
-
-#ifndef _S_IFLNK
-#define _S_IFLNK (_S_IFREG | _S_IFCHR)
-#endif
-#ifndef S_IFLNK
-#define S_IFLNK _S_IFLNK
-#endif
-#ifndef _S_IFJUN
-#define _S_IFJUN (_S_IFDIR | _S_IFCHR)
-#endif
-#ifndef S_IFJUN
-#define S_IFJUN _S_IFJUN
-#endif
-#ifndef _S_ISLNK
-#define _S_ISLNK(a) (((a & _S_IFLNK) == _S_IFLNK) && !((a & _S_IFDIR) == _S_IFDIR))
-#endif
-#ifndef S_ISLNK
-#define S_ISLNK _S_ISLNK
-#endif
-#ifndef _S_ISDIRLNK
-#define _S_ISDIRLNK(a) (((a & _S_IFLNK) == _S_IFLNK) && ((a & _S_IFDIR) == _S_IFDIR))
-#endif
-#ifndef S_ISDIRLNK
-#define S_ISDIRLNK _S_ISDIRLNK
-#endif
-#ifndef _S_ISJUN
-#define _S_ISJUN(a) ((a & _S_IFJUN) == _S_IFJUN && !((a & _S_IFLNK) == _S_IFLNK))
-#endif
-#ifndef S_ISJUN
-#define S_ISJUN _S_ISJUN
-#endif
-
-#ifndef lstat
-#define lstat ntlink_lstat
-#endif
-#ifndef symlink
-#define symlink ntlink_symlink
-#endif
-#ifndef lchown
-#define lchown ntlink_lchown
-#endif
-#ifndef link
-#define link ntlink_link
-#endif
-#ifndef readlink
-#define readlink ntlink_readlink
-#endif
-#ifndef unlink
-#define unlink ntlink_unlink
-#endif
-#define rename ntlink_rename
-
-int ntlink_symlink(const char *path1, const char *path2);
-int ntlink_lchown(const char *path, uid_t owner, gid_t group);
-int ntlink_link(const char *path1, const char *path2);
-int ntlink_lstat(const char *path, struct stat *buf);
-ssize_t ntlink_readlink(const char *path, char *buf,
-    size_t bufsize);
-int ntlink_unlink(const char *path);
-int ntlink_rename(const char *path1, const char *path2);
-
-int ntlink_symlinkw(const wchar_t *path1, const wchar_t *path2);
-int ntlink_lchownw(const wchar_t *path, uid_t owner, gid_t group);
-int ntlink_linkw(const wchar_t *path1, const wchar_t *path2);
-int ntlink_lstatw(const wchar_t *path, struct stat *buf);
-ssize_t ntlink_readlinkw(const wchar_t *path, wchar_t *buf,
-    size_t bufsize);
-int ntlink_unlinkw(const wchar_t *path);
-int ntlink_renamew(const wchar_t *path1, const wchar_t *path2);
-
-/**
- * SymlinkBlindType:
- * @BLIND_SYMLINK_FILE: file symlink
- * @BLIND_SYMLINK_DIR: directory symlink
- * @BLIND_JUNCTION: directory junction
- * @BLIND_HARDLINK: hardlink
- *
- * See ntlink_blind_symlinkw() for details.
- */
-typedef enum
-{
-  BLIND_SYMLINK_FILE = 0x00000000,
-  BLIND_SYMLINK_DIR = 0x00000001,
-  BLIND_JUNCTION = 0x00000002,
-  BLIND_HARDLINK = 0x00000003
-} SymlinkBlindType;
-
-int ntlink_blind_symlinkw(const wchar_t *path1, const wchar_t *path2, SymlinkBlindType blindtype, wchar_t *basedir);
-
-#ifdef __cplusplus
-}
-#endif
-
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2010, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_SYMLINK_H__
+#define __NTLINK_SYMLINK_H__
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef uid_t
+  #define uid_t int
+#endif
+
+#ifndef gid_t
+  #define gid_t uid_t
+#endif
+
+#ifndef _S_IFLNK
+#define _S_IFLNK (_S_IFREG | _S_IFCHR)
+#endif
+#ifndef S_IFLNK
+#define S_IFLNK _S_IFLNK
+#endif
+#ifndef _S_IFJUN
+#define _S_IFJUN (_S_IFDIR | _S_IFCHR)
+#endif
+#ifndef S_IFJUN
+#define S_IFJUN _S_IFJUN
+#endif
+#ifndef _S_ISLNK
+#define _S_ISLNK(a) (((a & _S_IFLNK) == _S_IFLNK) && !((a & _S_IFDIR) == _S_IFDIR))
+#endif
+#ifndef S_ISLNK
+#define S_ISLNK _S_ISLNK
+#endif
+#ifndef _S_ISDIRLNK
+#define _S_ISDIRLNK(a) (((a & _S_IFLNK) == _S_IFLNK) && ((a & _S_IFDIR) == _S_IFDIR))
+#endif
+#ifndef S_ISDIRLNK
+#define S_ISDIRLNK _S_ISDIRLNK
+#endif
+#ifndef _S_ISJUN
+#define _S_ISJUN(a) ((a & _S_IFJUN) == _S_IFJUN && !((a & _S_IFLNK) == _S_IFLNK))
+#endif
+#ifndef S_ISJUN
+#define S_ISJUN _S_ISJUN
+#endif
+
+#ifndef lstat
+#define lstat ntlink_lstat
+#endif
+#ifndef symlink
+#define symlink ntlink_symlink
+#endif
+#ifndef lchown
+#define lchown ntlink_lchown
+#endif
+#ifndef link
+#define link ntlink_link
+#endif
+#ifndef readlink
+#define readlink ntlink_readlink
+#endif
+#ifndef unlink
+#define unlink ntlink_unlink
+#endif
+#define rename ntlink_rename
+
+int ntlink_symlink(const char *path1, const char *path2);
+int ntlink_lchown(const char *path, uid_t owner, gid_t group);
+int ntlink_link(const char *path1, const char *path2);
+int ntlink_lstat(const char *path, struct stat *buf);
+ssize_t ntlink_readlink(const char *path, char *buf,
+    size_t bufsize);
+int ntlink_unlink(const char *path);
+int ntlink_rename(const char *path1, const char *path2);
+
+int ntlink_symlinkw(const wchar_t *path1, const wchar_t *path2);
+int ntlink_lchownw(const wchar_t *path, uid_t owner, gid_t group);
+int ntlink_linkw(const wchar_t *path1, const wchar_t *path2);
+int ntlink_lstatw(const wchar_t *path, struct stat *buf);
+ssize_t ntlink_readlinkw(const wchar_t *path, wchar_t *buf,
+    size_t bufsize);
+int ntlink_unlinkw(const wchar_t *path);
+int ntlink_renamew(const wchar_t *path1, const wchar_t *path2);
+
+/**
+ * SymlinkBlindType:
+ * @BLIND_SYMLINK_FILE: file symlink
+ * @BLIND_SYMLINK_DIR: directory symlink
+ * @BLIND_JUNCTION: directory junction
+ * @BLIND_HARDLINK: hardlink
+ *
+ * See ntlink_blind_symlinkw() for details.
+ */
+typedef enum
+{
+  BLIND_SYMLINK_FILE = 0x00000000,
+  BLIND_SYMLINK_DIR = 0x00000001,
+  BLIND_JUNCTION = 0x00000002,
+  BLIND_HARDLINK = 0x00000003
+} SymlinkBlindType;
+
+int ntlink_blind_symlinkw(const wchar_t *path1, const wchar_t *path2, SymlinkBlindType blindtype, wchar_t *basedir);
+
+void *ntlink_opendirw(const wchar_t *path);
+void ntlink_closedirw(void *dirhandle);
+int ntlink_symlinkatw(void *dirhandle, const wchar_t *name, const wchar_t *target, SymlinkBlindType blindtype);
+
+/**
+ * StatxMask:
+ * @NTLINK_STATX_TYPE: stx_mode
+ * @NTLINK_STATX_ATTRIBUTES: stx_attributes (FILE_ATTRIBUTE_*)
+ * @NTLINK_STATX_REPARSE_TAG: stx_reparse_tag
+ * @NTLINK_STATX_NLINK: stx_nlink
+ * @NTLINK_STATX_SIZE: stx_size
+ * @NTLINK_STATX_ALLOC_SIZE: stx_alloc_size
+ * @NTLINK_STATX_INO: stx_file_id and stx_volume_serial
+ * @NTLINK_STATX_ATIME: stx_atime
+ * @NTLINK_STATX_MTIME: stx_mtime
+ * @NTLINK_STATX_CTIME: stx_ctime (time of the last metadata change)
+ * @NTLINK_STATX_BTIME: stx_btime (creation time)
+ * @NTLINK_STATX_ALL: everything
+ *
+ * See ntlink_statxw() for details.
+ */
+typedef enum
+{
+  NTLINK_STATX_TYPE        = 0x00000001,
+  NTLINK_STATX_ATTRIBUTES  = 0x00000002,
+  NTLINK_STATX_REPARSE_TAG = 0x00000004,
+  NTLINK_STATX_NLINK       = 0x00000008,
+  NTLINK_STATX_SIZE        = 0x00000010,
+  NTLINK_STATX_ALLOC_SIZE  = 0x00000020,
+  NTLINK_STATX_INO         = 0x00000040,
+  NTLINK_STATX_ATIME       = 0x00000080,
+  NTLINK_STATX_MTIME       = 0x00000100,
+  NTLINK_STATX_CTIME       = 0x00000200,
+  NTLINK_STATX_BTIME       = 0x00000400,
+  NTLINK_STATX_ALL         = 0x000007FF
+} StatxMask;
+
+/**
+ * StatxFlags:
+ * @NTLINK_STATX_FLAG_NOTHING: do not follow the last link (like lstat())
+ * @NTLINK_STATX_FLAG_FOLLOW_SYMLINK: report the target of the last link
+ *   (like stat())
+ */
+typedef enum
+{
+  NTLINK_STATX_FLAG_NOTHING        = 0x00000000,
+  NTLINK_STATX_FLAG_FOLLOW_SYMLINK = 0x00000001
+} StatxFlags;
+
+/**
+ * ntlink_statx_timestamp:
+ * @tv_sec: seconds since 1970-01-01 00:00:00 UTC (can be negative)
+ * @tv_nsec: nanoseconds, 0-999999999, in 100ns steps
+ */
+typedef struct
+{
+  long long tv_sec;
+  unsigned int tv_nsec;
+} ntlink_statx_timestamp;
+
+/**
+ * ntlink_statx:
+ * @stx_mask: StatxMask bits of the fields that were filled
+ *
+ * @stx_file_id is the 128-bit NTFS/ReFS file ID (FILE_ID_INFO); on systems
+ * without FILE_ID_INFO the 64-bit file index is stored in its first 8 bytes.
+ */
+typedef struct
+{
+  unsigned int stx_mask;
+  unsigned int stx_mode;
+  unsigned int stx_attributes;
+  unsigned int stx_reparse_tag;
+  unsigned int stx_nlink;
+  unsigned long long stx_size;
+  unsigned long long stx_alloc_size;
+  unsigned long long stx_volume_serial;
+  unsigned char stx_file_id[16];
+  ntlink_statx_timestamp stx_atime;
+  ntlink_statx_timestamp stx_mtime;
+  ntlink_statx_timestamp stx_ctime;
+  ntlink_statx_timestamp stx_btime;
+} ntlink_statx;
+
+int ntlink_statxw(const wchar_t *path, StatxFlags flags, unsigned int mask, ntlink_statx *buf);
+
+/**
+ * SymlinkBatchFlags:
+ * @SYMLINK_BATCH_FLAG_NOTHING: default behaviour
+ * @SYMLINK_BATCH_FLAG_CREATE_PARENTS: create missing parent directories
+ *   of the links
+ * @SYMLINK_BATCH_FLAG_DIRECT: create symlinks and junctions with
+ *   ntlink_symlinkatw() relative to the parent directory of each group
+ *
+ * See ntlink_symlink_batchw() for details.
+ */
+typedef enum
+{
+  SYMLINK_BATCH_FLAG_NOTHING        = 0x00000000,
+  SYMLINK_BATCH_FLAG_CREATE_PARENTS = 0x00000001,
+  SYMLINK_BATCH_FLAG_DIRECT         = 0x00000002
+} SymlinkBatchFlags;
+
+/**
+ * SymlinkBatchItem:
+ * @target: link target, interpreted as by ntlink_blind_symlinkw()
+ * @linkpath: name of the link to create
+ * @type: kind of the link
+ * @status: receives 0 on success or an errno value on failure
+ */
+typedef struct
+{
+  const wchar_t *target;
+  const wchar_t *linkpath;
+  SymlinkBlindType type;
+  int status;
+} SymlinkBatchItem;
+
+int ntlink_symlink_batchw(SymlinkBatchItem *items, size_t nitems, wchar_t *basedir, int nthreads, SymlinkBatchFlags flags);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* __NTLINK_SYMLINK_H__ */
\ No newline at end of file
@@ -0,0 +1,620 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <errno.h>
+
+#include "misc.h"
+#include "extra_string.h"
+#include "juncpoint.h"
+#include "realpath.h"
+#include "fsbackend.h"
+#include "stats.h"
+#include "trace.h"
+#include "ctx.h"
+#include "alloc.h"
+
+/* The cache is dropped completely when it grows beyond this */
+#define REALPATH_CACHE_MAX_ENTRIES 65536
+
+struct _realpath_entry
+{
+  struct _realpath_entry *next;
+  ULONG hash;
+  /* Resolved parent + "\" + unresolved name */
+  wchar_t *key;
+  /* Fully resolved path */
+  wchar_t *value;
+};
+
+typedef struct _realpath_entry realpath_entry;
+
+struct _ntlink_realpath_cache
+{
+  SRWLOCK lock;
+  size_t nbuckets;
+  size_t nentries;
+  realpath_entry **buckets;
+};
+
+struct _realpath_ctx
+{
+  ntlink_realpath_cache *cache;
+  int hops;
+};
+
+typedef struct _realpath_ctx realpath_ctx;
+
+static ntlink_realpath_cache *global_cache = NULL;
+
+static ULONG
+realpath_hash (const wchar_t *s)
+{
+  /* FNV-1a over upper-cased characters, names are case-insensitive */
+  ULONG h = 2166136261U;
+  for (; *s != L'\0'; s++)
+  {
+    h ^= (ULONG) towupper (*s);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/**
+ * ntlink_realpath_cache_new:
+ *
+ * Creates a cache of resolved path prefixes for ntlink_realpathw().
+ * The cache is thread-safe. It is never invalidated automatically,
+ * call ntlink_realpath_cache_clear() after changing links.
+ * Free the cache with ntlink_realpath_cache_free().
+ *
+ * Returns:
+ * NULL - failed to allocate memory
+ * non-NULL - the cache
+ */
+ntlink_realpath_cache *
+ntlink_realpath_cache_new (void)
+{
+  ntlink_realpath_cache *cache;
+  cache = (ntlink_realpath_cache *) ntlink_malloc (sizeof (ntlink_realpath_cache));
+  if (cache == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  InitializeSRWLock (&cache->lock);
+  cache->nentries = 0;
+  cache->nbuckets = 256;
+  cache->buckets = (realpath_entry **) ntlink_calloc (cache->nbuckets, sizeof (realpath_entry *));
+  if (cache->buckets == NULL)
+  {
+    ntlink_free (cache);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return cache;
+}
+
+static void
+realpath_cache_clear_locked (ntlink_realpath_cache *cache)
+{
+  size_t i;
+  realpath_entry *e, *next;
+  for (i = 0; i < cache->nbuckets; i++)
+  {
+    for (e = cache->buckets[i]; e != NULL; e = next)
+    {
+      next = e->next;
+      ntlink_free (e->key);
+      ntlink_free (e->value);
+      ntlink_free (e);
+    }
+    cache->buckets[i] = NULL;
+  }
+  cache->nentries = 0;
+}
+
+/**
+ * ntlink_realpath_cache_clear:
+ * @cache: a cache, or NULL for the process-wide cache
+ *
+ * Forgets everything @cache knows.
+ */
+void
+ntlink_realpath_cache_clear (ntlink_realpath_cache *cache)
+{
+  if (cache == NULL)
+    cache = global_cache;
+  if (cache == NULL)
+    return;
+  AcquireSRWLockExclusive (&cache->lock);
+  realpath_cache_clear_locked (cache);
+  ReleaseSRWLockExclusive (&cache->lock);
+}
+
+void
+ntlink_realpath_cache_free (ntlink_realpath_cache *cache)
+{
+  if (cache == NULL)
+    return;
+  realpath_cache_clear_locked (cache);
+  ntlink_free (cache->buckets);
+  ntlink_free (cache);
+}
+
+static ntlink_realpath_cache *
+realpath_global_cache (void)
+{
+  ntlink_realpath_cache *cache;
+  if (global_cache != NULL)
+    return global_cache;
+  cache = ntlink_realpath_cache_new ();
+  if (cache == NULL)
+    return NULL;
+  if (InterlockedCompareExchangePointer ((PVOID *) &global_cache, cache, NULL) != NULL)
+    ntlink_realpath_cache_free (cache);
+  return global_cache;
+}
+
+/* Returns a copy of the cached value or NULL */
+static wchar_t *
+realpath_cache_lookup (ntlink_realpath_cache *cache, const wchar_t *key)
+{
+  ULONG hash = realpath_hash (key);
+  realpath_entry *e;
+  wchar_t *result = NULL;
+
+  AcquireSRWLockShared (&cache->lock);
+  for (e = cache->buckets[hash % cache->nbuckets]; e != NULL; e = e->next)
+  {
+    if (e->hash == hash && _wcsicmp (e->key, key) == 0)
+    {
+      result = ntlink_wcsdup (e->value);
+      break;
+    }
+  }
+  ReleaseSRWLockShared (&cache->lock);
+  return result;
+}
+
+static void
+realpath_cache_insert (ntlink_realpath_cache *cache, const wchar_t *key, const wchar_t *value)
+{
+  ULONG hash = realpath_hash (key);
+  realpath_entry *e;
+  size_t i;
+
+  e = (realpath_entry *) ntlink_malloc (sizeof (realpath_entry));
+  if (e == NULL)
+    return;
+  e->hash = hash;
+  e->key = ntlink_wcsdup (key);
+  e->value = ntlink_wcsdup (value);
+  if (e->key == NULL || e->value == NULL)
+  {
+    ntlink_free (e->key);
+    ntlink_free (e->value);
+    ntlink_free (e);
+    return;
+  }
+
+  AcquireSRWLockExclusive (&cache->lock);
+  if (cache->nentries >= REALPATH_CACHE_MAX_ENTRIES)
+    realpath_cache_clear_locked (cache);
+  else if (cache->nentries >= cache->nbuckets)
+  {
+    /* Grow to keep the chains short */
+    size_t newsize = cache->nbuckets * 4;
+    realpath_entry **newbuckets = (realpath_entry **) ntlink_calloc (newsize, sizeof (realpath_entry *));
+    if (newbuckets != NULL)
+    {
+      for (i = 0; i < cache->nbuckets; i++)
+      {
+        realpath_entry *next, *old;
+        for (old = cache->buckets[i]; old != NULL; old = next)
+        {
+          next = old->next;
+          old->next = newbuckets[old->hash % newsize];
+          newbuckets[old->hash % newsize] = old;
+        }
+      }
+      ntlink_free (cache->buckets);
+      cache->buckets = newbuckets;
+      cache->nbuckets = newsize;
+    }
+  }
+  e->next = cache->buckets[hash % cache->nbuckets];
+  cache->buckets[hash % cache->nbuckets] = e;
+  cache->nentries += 1;
+  ReleaseSRWLockExclusive (&cache->lock);
+}
+
+/* Length of "X:" or "\\server\share", 0 if @path has neither */
+static size_t
+realpath_root_length (const wchar_t *path)
+{
+  size_t i;
+  int slashes = 0;
+  if (path[0] != L'\0' && path[1] == L':')
+    return 2;
+  if (path[0] == L'\\' && path[1] == L'\\')
+  {
+    for (i = 2; path[i] != L'\0'; i++)
+      if (path[i] == L'\\' && ++slashes == 2)
+        return i;
+    return slashes == 1 ? i : 0;
+  }
+  return 0;
+}
+
+/* Turns a reparse point substitute name into a Win32 name, in place */
+static wchar_t *
+realpath_unparse (wchar_t *target)
+{
+  size_t len = wcslen (target);
+  if (wcsncmp (target, L"\\??\\UNC\\", 8) == 0)
+  {
+    memmove (&target[1], &target[7], (len - 7 + 1) * sizeof (wchar_t));
+    target[0] = L'\\';
+  }
+  else if (wcsncmp (target, L"\\??\\", 4) == 0 || wcsncmp (target, L"\\\\?\\", 4) == 0)
+    memmove (target, &target[4], (len - 4 + 1) * sizeof (wchar_t));
+  return target;
+}
+
+/* Asks Windows for the final name of an existing path */
+static wchar_t *
+realpath_final_path (const wchar_t *path)
+{
+  HANDLE fileh;
+  DWORD size, size2;
+  wchar_t *result;
+
+  fileh = ntlink_fs->create_file (path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (fileh == INVALID_HANDLE_VALUE)
+    return NULL;
+  size = ntlink_fs->get_final_path_name_by_handle (fileh, NULL, 0, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+  if (size == 0)
+  {
+    ntlink_fs->close_handle (fileh);
+    return NULL;
+  }
+  result = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (size + 1));
+  if (result == NULL)
+  {
+    ntlink_fs->close_handle (fileh);
+    return NULL;
+  }
+  size2 = ntlink_fs->get_final_path_name_by_handle (fileh, result, size + 1, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+  ntlink_fs->close_handle (fileh);
+  if (size2 == 0 || size2 > size)
+  {
+    ntlink_free (result);
+    return NULL;
+  }
+  if (wcsncmp (result, L"\\\\?\\UNC\\", 8) == 0)
+  {
+    memmove (&result[1], &result[7], (size2 - 7 + 1) * sizeof (wchar_t));
+    result[0] = L'\\';
+  }
+  else if (wcsncmp (result, L"\\\\?\\", 4) == 0)
+    memmove (result, &result[4], (size2 - 4 + 1) * sizeof (wchar_t));
+  return result;
+}
+
+static int realpath_resolve (realpath_ctx *ctx, const wchar_t *abspath, wchar_t **result);
+
+/*
+ * Resolves one component @name in the already resolved directory @parent.
+ * Returns 0 and the resolved path in *@result, or -1 with errno set.
+ */
+static int
+realpath_component (realpath_ctx *ctx, const wchar_t *parent, const wchar_t *name, wchar_t **result)
+{
+  wchar_t *candidate;
+  wchar_t *cached;
+  wchar_t *real = NULL;
+  WIN32_FIND_DATAW finddata;
+  HANDLE hFind;
+  DWORD attrs;
+  int r = -1;
+
+  candidate = dup_swprintf (NULL, L"%ls\\%ls", parent, name);
+  if (candidate == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  cached = realpath_cache_lookup (ctx->cache, candidate);
+  if (cached != NULL)
+  {
+    ntlink_free (candidate);
+    *result = cached;
+    return 0;
+  }
+
+  /* FindFirstFileW() gives both the reparse tag and the on-disk case of the
+   * name, but can't be used with wildcards.
+   */
+  if (wcspbrk (name, L"*?") == NULL)
+  {
+    hFind = ntlink_fs->find_first_file (candidate, &finddata);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+      errno = Win32ErrorToErrno (GetLastError ());
+      goto end;
+    }
+    ntlink_fs->find_close (hFind);
+    attrs = finddata.dwFileAttributes;
+    real = dup_swprintf (NULL, L"%ls\\%ls", parent, finddata.cFileName);
+  }
+  else
+  {
+    attrs = ntlink_fs->get_file_attributes (candidate);
+    if (attrs == INVALID_FILE_ATTRIBUTES)
+    {
+      errno = Win32ErrorToErrno (GetLastError ());
+      goto end;
+    }
+    finddata.dwReserved0 = (attrs & FILE_ATTRIBUTE_REPARSE_POINT) ? IO_REPARSE_TAG_SYMLINK : 0;
+    real = ntlink_wcsdup (candidate);
+  }
+  if (real == NULL)
+  {
+    errno = ENOMEM;
+    goto end;
+  }
+
+  if ((attrs & FILE_ATTRIBUTE_REPARSE_POINT) &&
+      (finddata.dwReserved0 == IO_REPARSE_TAG_SYMLINK || finddata.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT))
+  {
+    wchar_t *target = NULL;
+    wchar_t *joined;
+    int relative = 0;
+    int linktype = 0;
+
+    if (++ctx->hops > NTLINK_MAXSYMLINKS)
+    {
+      errno = ELOOP;
+      goto end;
+    }
+    if (GetJuncPointW (&target, real, &relative, &linktype) != 0)
+    {
+      errno = EIO;
+      goto end;
+    }
+    realpath_unparse (target);
+    if (relative || !IsAbsName (target))
+    {
+      /* Relative to the directory that contains the link; "\foo" is
+       * relative to its root, "X:" or "\\server\share"
+       */
+      if (target[0] == L'\\')
+        joined = dup_swprintf (NULL, L"%.*ls%ls", (int) realpath_root_length (parent), parent, target);
+      else
+        joined = dup_swprintf (NULL, L"%ls\\%ls", parent, target);
+    }
+    else
+      joined = ntlink_wcsdup (target);
+    ntlink_free (target);
+    if (joined == NULL)
+    {
+      errno = ENOMEM;
+      goto end;
+    }
+    r = realpath_resolve (ctx, joined, result);
+    ntlink_free (joined);
+    if (r != 0)
+      goto end;
+  }
+  else
+  {
+    *result = real;
+    real = NULL;
+    r = 0;
+  }
+
+  realpath_cache_insert (ctx->cache, candidate, *result);
+
+end:
+  ntlink_free (real);
+  ntlink_free (candidate);
+  return r;
+}
+
+static int
+realpath_resolve (realpath_ctx *ctx, const wchar_t *abspath, wchar_t **result)
+{
+  wchar_t *simple;
+  wchar_t *resolved;
+  wchar_t *token, *lasts = NULL;
+  size_t rootlen;
+
+  simple = SimplifyAbsNameW ((wchar_t *) abspath, 1);
+  if (simple == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  realpath_unparse (simple);
+
+  rootlen = realpath_root_length (simple);
+  if (rootlen == 0)
+  {
+    /* Something like Volume{GUID}\, can't be taken apart */
+    *result = simple;
+    return 0;
+  }
+
+  resolved = (wchar_t *) ntlink_malloc (sizeof (wchar_t) * (rootlen + 1));
+  if (resolved == NULL)
+  {
+    ntlink_free (simple);
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy (resolved, simple, sizeof (wchar_t) * rootlen);
+  resolved[rootlen] = L'\0';
+  if (resolved[1] == L':')
+    resolved[0] = towupper (resolved[0]);
+
+  for (token = wcstok_r (&simple[rootlen], L"\\", &lasts); token != NULL; token = wcstok_r (NULL, L"\\", &lasts))
+  {
+    wchar_t *next = NULL;
+    if (realpath_component (ctx, resolved, token, &next) != 0)
+    {
+      ntlink_free (resolved);
+      ntlink_free (simple);
+      return -1;
+    }
+    ntlink_free (resolved);
+    resolved = next;
+  }
+  ntlink_free (simple);
+
+  if (wcslen (resolved) == 2 && resolved[1] == L':')
+  {
+    wchar_t *root = dup_swprintf (NULL, L"%ls\\", resolved);
+    ntlink_free (resolved);
+    if (root == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+    resolved = root;
+  }
+
+  *result = resolved;
+  return 0;
+}
+
+/**
+ * ntlink_realpathw:
+ * @path: a path (UTF-16), absolute or relative to the current directory
+ * @resolved: a pointer to a wchar_t * that receives the result
+ * @cache: a cache created with ntlink_realpath_cache_new(), or NULL
+ * @flags: a combination of one or more members of RealpathFlags
+ *
+ * Resolves every symlink and junction in @path, including intermediate
+ * ones, and returns an absolute path without links, "." or "..", with
+ * the names in their on-disk case.
+ * Every resolved prefix is remembered in @cache, so resolving many paths
+ * under the same (linked) directory costs about as much as resolving one.
+ * If @cache is NULL, the process-wide cache is used with
+ * REALPATH_FLAG_GLOBAL_CACHE and a private per-call cache otherwise.
+ * At most NTLINK_MAXSYMLINKS links are followed.
+ * *@resolved is allocated internally and must be freed with ntlink_free()
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failure (errno is set: ENOENT if a component or a link target does
+ *      not exist, ELOOP if there are too many links, ENOMEM, EACCESS...)
+ */
+static int
+realpathw_impl (const wchar_t *path, wchar_t **resolved, ntlink_realpath_cache *cache, RealpathFlags flags)
+{
+  realpath_ctx ctx;
+  wchar_t *abspath = NULL;
+  int r;
+
+  if (path == NULL || resolved == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (GetAbsNameW ((wchar_t *) path, &abspath, NULL, 2) != 0)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (flags & REALPATH_FLAG_FINAL_PATH)
+  {
+    wchar_t *final = realpath_final_path (abspath);
+    if (final != NULL)
+    {
+      ntlink_free (abspath);
+      *resolved = final;
+      return 0;
+    }
+  }
+
+  ctx.hops = 0;
+  ctx.cache = cache;
+  if (ctx.cache == NULL && (flags & REALPATH_FLAG_GLOBAL_CACHE))
+    ctx.cache = realpath_global_cache ();
+  if (ctx.cache == NULL)
+    ctx.cache = ntlink_realpath_cache_new ();
+  if (ctx.cache == NULL)
+  {
+    ntlink_free (abspath);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  r = realpath_resolve (&ctx, abspath, resolved);
+
+  if (ctx.cache != cache && ctx.cache != global_cache)
+    ntlink_realpath_cache_free (ctx.cache);
+  ntlink_free (abspath);
+
+  return r;
+}
+
+static int
+realpathw_call (ntlink_ctx *ctx, const wchar_t *path, wchar_t **resolved, ntlink_realpath_cache *cache, RealpathFlags flags)
+{
+  int r = -1;
+  wchar_t *abspath = NULL;
+  const wchar_t *p;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_REALPATH);
+  p = ntlink_ctx_path (ctx, path, &abspath);
+  if (path == NULL)
+    errno = EINVAL;
+  else if (p != NULL)
+    r = realpathw_impl (p, resolved, cache, flags);
+  ntlink_ctx_end (ctx, NTLINK_API_REALPATH, start, r != 0);
+  ntlink_trace_call (NTLINK_API_REALPATH, start, r, flags, cache != NULL, p != NULL ? p : path, NULL, NULL);
+  ntlink_free (abspath);
+  return r;
+}
+
+int
+ntlink_realpathw (const wchar_t *path, wchar_t **resolved, ntlink_realpath_cache *cache, RealpathFlags flags)
+{
+  return realpathw_call (NULL, path, resolved, cache, flags);
+}
+
+/**
+ * ntlink_ctx_realpathw:
+ * @ctx: a context
+ *
+ * ntlink_realpathw() relative to the base directory of @ctx, with the
+ * cache set by ntlink_ctx_set_realpath_cache().
+ */
+int
+ntlink_ctx_realpathw (ntlink_ctx *ctx, const wchar_t *path, wchar_t **resolved, RealpathFlags flags)
+{
+  return realpathw_call (ctx, path, resolved, ntlink_ctx_get_realpath_cache (ctx), flags);
+}
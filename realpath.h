@@ -0,0 +1,62 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_REALPATH_H__
+#define __NTLINK_REALPATH_H__
+
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of links followed while resolving one path (same as NT) */
+#define NTLINK_MAXSYMLINKS 63
+
+/**
+ * RealpathFlags:
+ * @REALPATH_FLAG_NOTHING: default behaviour
+ * @REALPATH_FLAG_GLOBAL_CACHE: use (and fill) the process-wide cache
+ *   when no cache is given explicitly
+ * @REALPATH_FLAG_FINAL_PATH: first try to open the path and ask Windows for
+ *   the final name (GetFinalPathNameByHandleW()); fall back to resolving the
+ *   components one by one if that fails (e.g. because of a dangling link)
+ *
+ * See ntlink_realpathw() for details.
+ */
+typedef enum
+{
+  REALPATH_FLAG_NOTHING      = 0x00000000,
+  REALPATH_FLAG_GLOBAL_CACHE = 0x00000001,
+  REALPATH_FLAG_FINAL_PATH   = 0x00000002
+} RealpathFlags;
+
+typedef struct _ntlink_realpath_cache ntlink_realpath_cache;
+
+ntlink_realpath_cache *ntlink_realpath_cache_new (void);
+void ntlink_realpath_cache_clear (ntlink_realpath_cache *cache);
+void ntlink_realpath_cache_free (ntlink_realpath_cache *cache);
+
+int ntlink_realpathw (const wchar_t *path, wchar_t **resolved, ntlink_realpath_cache *cache, RealpathFlags flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_REALPATH_H__ */
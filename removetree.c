@@ -0,0 +1,499 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "misc.h"
+#include "extra_string.h"
+#include "threadpool.h"
+#include "iosched.h"
+#include "removetree.h"
+#include "fsbackend.h"
+#include "stats.h"
+#include "trace.h"
+#include "ctx.h"
+#include "alloc.h"
+
+/* Windows 10 1607+ bits that older headers don't have */
+#ifndef FILE_DISPOSITION_FLAG_DELETE
+#define FILE_DISPOSITION_FLAG_DELETE                   0x00000001
+#define FILE_DISPOSITION_FLAG_POSIX_SEMANTICS          0x00000002
+#define FILE_DISPOSITION_FLAG_IGNORE_READONLY_ATTRIBUTE 0x00000010
+typedef struct
+{
+  DWORD Flags;
+} FILE_DISPOSITION_INFO_EX;
+#endif
+#define NTLINK_FileDispositionInfoEx ((FILE_INFO_BY_HANDLE_CLASS) 21)
+
+/* Number of files removed by one task */
+#define REMOVE_TREE_FILES_PER_TASK 64
+
+struct _remove_tree_state
+{
+  ntlink_task_group *group;
+  ntlink_io_queue *queue;
+  ntlink_throttle *throttle;
+  RemoveTreeOptions *options;
+  LONG aborted;
+  LONG nerrors;
+  LONG first_errno;
+  /* Set once FileDispositionInfoEx turns out to be unsupported */
+  LONG no_posix_delete;
+};
+
+typedef struct _remove_tree_state remove_tree_state;
+
+struct _remove_dir_node
+{
+  struct _remove_dir_node *parent;
+  remove_tree_state *state;
+  wchar_t *path;
+  /* Children that are not removed yet, plus one while the directory is being scanned */
+  LONG pending;
+  LONG failed;
+};
+
+typedef struct _remove_dir_node remove_dir_node;
+
+struct _remove_files_task
+{
+  remove_dir_node *dir;
+  int nfiles;
+  wchar_t *paths[REMOVE_TREE_FILES_PER_TASK];
+};
+
+typedef struct _remove_files_task remove_files_task;
+
+static void
+remove_report_error (remove_tree_state *state, const wchar_t *path, int err)
+{
+  InterlockedIncrement (&state->nerrors);
+  InterlockedCompareExchange (&state->first_errno, err, 0);
+  if (state->options != NULL && state->options->error != NULL &&
+      state->options->error (path, err, state->options->userdata) != 0)
+    InterlockedExchange (&state->aborted, 1);
+}
+
+static void
+remove_report_progress (remove_tree_state *state, const wchar_t *path, int isdir)
+{
+  if (state->options != NULL && state->options->progress != NULL &&
+      state->options->progress (path, isdir, state->options->userdata) != 0)
+    InterlockedExchange (&state->aborted, 1);
+}
+
+/*
+ * Removes a single file, link or empty directory without following it.
+ * Returns 0 on success, an errno value otherwise.
+ */
+static int
+remove_entry (remove_tree_state *state, const wchar_t *path, int isdir)
+{
+  HANDLE h;
+  DWORD err;
+  FILE_DISPOSITION_INFO_EX diex;
+  FILE_DISPOSITION_INFO di;
+
+  h = ntlink_fs->create_file (path, DELETE | FILE_READ_ATTRIBUTES | FILE_WRITE_ATTRIBUTES,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+      FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (h == INVALID_HANDLE_VALUE)
+    return Win32ErrorToErrno (GetLastError ());
+
+  if (!state->no_posix_delete)
+  {
+    /* POSIX semantics unlink the name immediately, even if somebody else
+     * still has the file open, so the parent can be removed right after.
+     */
+    diex.Flags = FILE_DISPOSITION_FLAG_DELETE | FILE_DISPOSITION_FLAG_POSIX_SEMANTICS |
+        FILE_DISPOSITION_FLAG_IGNORE_READONLY_ATTRIBUTE;
+    if (ntlink_fs->set_file_information_by_handle (h, NTLINK_FileDispositionInfoEx, &diex, sizeof (diex)))
+    {
+      ntlink_fs->close_handle (h);
+      return 0;
+    }
+    err = GetLastError ();
+    if (err != ERROR_INVALID_PARAMETER && err != ERROR_NOT_SUPPORTED && err != ERROR_INVALID_FUNCTION)
+    {
+      ntlink_fs->close_handle (h);
+      return Win32ErrorToErrno (err);
+    }
+    /* Older Windows or a filesystem without POSIX delete support */
+    InterlockedExchange (&state->no_posix_delete, 1);
+  }
+
+  if (!isdir)
+  {
+    FILE_BASIC_INFO bi;
+    if (ntlink_fs->get_file_information_by_handle_ex (h, FileBasicInfo, &bi, sizeof (bi)) &&
+        (bi.FileAttributes & FILE_ATTRIBUTE_READONLY))
+    {
+      bi.FileAttributes &= ~FILE_ATTRIBUTE_READONLY;
+      if (bi.FileAttributes == 0)
+        bi.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+      ntlink_fs->set_file_information_by_handle (h, FileBasicInfo, &bi, sizeof (bi));
+    }
+  }
+  di.DeleteFile = TRUE;
+  if (!ntlink_fs->set_file_information_by_handle (h, FileDispositionInfo, &di, sizeof (di)))
+  {
+    err = GetLastError ();
+    ntlink_fs->close_handle (h);
+    return Win32ErrorToErrno (err);
+  }
+  ntlink_fs->close_handle (h);
+  return 0;
+}
+
+/*
+ * Drops one reference of @node. The last reference removes the (now empty)
+ * directory and drops a reference of its parent, bottom-up.
+ */
+static void
+remove_dir_release (remove_dir_node *node)
+{
+  remove_dir_node *parent;
+  remove_tree_state *state;
+  int err;
+
+  while (node != NULL && InterlockedDecrement (&node->pending) == 0)
+  {
+    state = node->state;
+    parent = node->parent;
+    if (node->failed || state->aborted)
+    {
+      if (parent != NULL)
+        InterlockedExchange (&parent->failed, 1);
+    }
+    else
+    {
+      err = remove_entry (state, node->path, 1);
+      ntlink_throttle_charge (state->throttle, 1, 0);
+      if (err != 0)
+      {
+        remove_report_error (state, node->path, err);
+        if (parent != NULL)
+          InterlockedExchange (&parent->failed, 1);
+      }
+      else
+        remove_report_progress (state, node->path, 1);
+    }
+    ntlink_free (node->path);
+    ntlink_free (node);
+    node = parent;
+  }
+}
+
+static void
+remove_files_run (void *arg)
+{
+  remove_files_task *task = (remove_files_task *) arg;
+  remove_tree_state *state = task->dir->state;
+  int i, err;
+
+  ntlink_throttle_begin (state->throttle);
+  for (i = 0; i < task->nfiles; i++)
+  {
+    if (!state->aborted)
+    {
+      err = remove_entry (state, task->paths[i], 0);
+      ntlink_throttle_charge (state->throttle, 1, 0);
+      if (err != 0)
+      {
+        remove_report_error (state, task->paths[i], err);
+        InterlockedExchange (&task->dir->failed, 1);
+      }
+      else
+        remove_report_progress (state, task->paths[i], 0);
+    }
+    ntlink_free (task->paths[i]);
+  }
+  for (i = 0; i < task->nfiles; i++)
+    remove_dir_release (task->dir);
+  ntlink_throttle_end (state->throttle);
+  ntlink_free (task);
+}
+
+static void remove_dir_scan (void *arg);
+
+static void
+remove_submit (remove_tree_state *state, unsigned int cost, ntlink_task_func func, void *arg)
+{
+  if (ntlink_io_submit (state->queue, state->group, cost, func, arg) != 0)
+    func (arg);
+}
+
+static remove_dir_node *
+remove_dir_node_new (remove_tree_state *state, remove_dir_node *parent, wchar_t *path)
+{
+  remove_dir_node *node;
+  node = (remove_dir_node *) ntlink_malloc (sizeof (remove_dir_node));
+  if (node == NULL)
+    return NULL;
+  node->parent = parent;
+  node->state = state;
+  node->path = path;
+  node->pending = 1;
+  node->failed = 0;
+  return node;
+}
+
+static void
+remove_dir_list (remove_dir_node *node)
+{
+  remove_tree_state *state = node->state;
+  remove_files_task *files = NULL;
+  WIN32_FIND_DATAW finddata;
+  HANDLE hFind;
+  wchar_t *pattern;
+  DWORD err;
+
+  if (state->aborted)
+  {
+    node->failed = 1;
+    remove_dir_release (node);
+    return;
+  }
+
+  pattern = dup_swprintf (NULL, L"%ls\\*", node->path);
+  if (pattern == NULL)
+  {
+    remove_report_error (state, node->path, ENOMEM);
+    node->failed = 1;
+    remove_dir_release (node);
+    return;
+  }
+
+  hFind = ntlink_fs->find_first_file (pattern, &finddata);
+  ntlink_free (pattern);
+  if (hFind == INVALID_HANDLE_VALUE)
+  {
+    err = GetLastError ();
+    if (err != ERROR_FILE_NOT_FOUND)
+    {
+      remove_report_error (state, node->path, Win32ErrorToErrno (err));
+      node->failed = 1;
+    }
+    remove_dir_release (node);
+    return;
+  }
+
+  do
+  {
+    wchar_t *path;
+    if (wcscmp (finddata.cFileName, L".") == 0 || wcscmp (finddata.cFileName, L"..") == 0)
+      continue;
+    ntlink_throttle_charge (state->throttle, 1, sizeof (wchar_t) * wcslen (finddata.cFileName));
+    path = dup_swprintf (NULL, L"%ls\\%ls", node->path, finddata.cFileName);
+    if (path == NULL)
+    {
+      remove_report_error (state, node->path, ENOMEM);
+      node->failed = 1;
+      continue;
+    }
+    /* Never descend into symlinks or junctions, remove the link itself */
+    if ((finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+        !(finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+    {
+      remove_dir_node *child = remove_dir_node_new (state, node, path);
+      if (child == NULL)
+      {
+        ntlink_free (path);
+        remove_report_error (state, node->path, ENOMEM);
+        node->failed = 1;
+        continue;
+      }
+      InterlockedIncrement (&node->pending);
+      remove_submit (state, 1, remove_dir_scan, child);
+      continue;
+    }
+    if (files == NULL)
+    {
+      files = (remove_files_task *) ntlink_malloc (sizeof (remove_files_task));
+      if (files == NULL)
+      {
+        ntlink_free (path);
+        remove_report_error (state, node->path, ENOMEM);
+        node->failed = 1;
+        continue;
+      }
+      files->dir = node;
+      files->nfiles = 0;
+    }
+    files->paths[files->nfiles++] = path;
+    if (files->nfiles == REMOVE_TREE_FILES_PER_TASK)
+    {
+      InterlockedExchangeAdd (&node->pending, files->nfiles);
+      remove_submit (state, files->nfiles, remove_files_run, files);
+      files = NULL;
+    }
+  } while (!state->aborted && ntlink_fs->find_next_file (hFind, &finddata) != 0);
+
+  ntlink_fs->find_close (hFind);
+
+  if (files != NULL)
+  {
+    InterlockedExchangeAdd (&node->pending, files->nfiles);
+    /* Run the tail in this thread, it is already warm */
+    ntlink_io_add_cost (files->nfiles);
+    remove_files_run (files);
+  }
+
+  remove_dir_release (node);
+}
+
+static void
+remove_dir_scan (void *arg)
+{
+  remove_dir_node *node = (remove_dir_node *) arg;
+  /* The node can be gone by the time the listing returns */
+  ntlink_throttle *throttle = node->state->throttle;
+  ntlink_throttle_begin (throttle);
+  remove_dir_list (node);
+  ntlink_throttle_end (throttle);
+}
+
+/**
+ * ntlink_remove_treew:
+ * @path: a file, link or directory to remove
+ * @options: options, can be NULL
+ *
+ * Removes @path and, if it is a real directory, everything in it.
+ * Symlinks and junctions are never followed: the link itself is removed,
+ * its target is left alone.
+ * Directories are scanned and files are removed concurrently on the shared
+ * pool (see ntlink_pool_shared()), as fast as the volume allows (see
+ * ntlink_io_queue_get()); each directory is removed as soon as it is drained.
+ * Files are removed with POSIX semantics and read-only attributes are
+ * ignored (where supported, Windows 10 1607 and later; otherwise the
+ * read-only attribute is cleared and a normal delete is used).
+ * A directory that could not be emptied is not removed, and neither are
+ * its parents. The error callback is called for every failure.
+ *
+ * Returns:
+ *  0 - everything was removed
+ * -1 - something was not removed or the operation was cancelled;
+ *      errno is set to the first error (ECANCELED if cancelled without errors,
+ *      EINVAL if @path is NULL)
+ */
+static int
+remove_treew_impl (const wchar_t *path, RemoveTreeOptions *options)
+{
+  remove_tree_state state;
+  remove_dir_node *root;
+  wchar_t *rootpath;
+  DWORD attrs;
+  size_t len;
+  int err;
+
+  memset (&state, 0, sizeof (state));
+  state.options = options;
+  state.throttle = options != NULL ? options->throttle : NULL;
+
+  attrs = ntlink_fs->get_file_attributes (path);
+  if (attrs == INVALID_FILE_ATTRIBUTES)
+  {
+    errno = Win32ErrorToErrno (GetLastError ());
+    return -1;
+  }
+
+  if (!(attrs & FILE_ATTRIBUTE_DIRECTORY) || (attrs & FILE_ATTRIBUTE_REPARSE_POINT))
+  {
+    err = remove_entry (&state, path, (attrs & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    if (err != 0)
+    {
+      remove_report_error (&state, path, err);
+      errno = err;
+      return -1;
+    }
+    remove_report_progress (&state, path, 0);
+    return 0;
+  }
+
+  rootpath = ntlink_wcsdup (path);
+  if (rootpath == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  /* "C:\dir\" and "C:\dir" are the same thing */
+  len = wcslen (rootpath);
+  while (len > 3 && (rootpath[len - 1] == L'\\' || rootpath[len - 1] == L'/'))
+    rootpath[--len] = L'\0';
+
+  root = remove_dir_node_new (&state, NULL, rootpath);
+  if (root == NULL)
+  {
+    ntlink_free (rootpath);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  state.group = ntlink_task_group_new (NULL, options != NULL ? options->nthreads : 0);
+  if (state.group == NULL)
+  {
+    ntlink_free (root);
+    ntlink_free (rootpath);
+    return -1;
+  }
+
+  /* Mount points are not followed, the tree is on one volume */
+  state.queue = ntlink_io_queue_get (rootpath);
+  remove_submit (&state, 1, remove_dir_scan, root);
+  ntlink_task_group_free (state.group);
+
+  if (state.nerrors > 0)
+  {
+    errno = state.first_errno;
+    return -1;
+  }
+  if (state.aborted)
+  {
+    errno = ECANCELED;
+    return -1;
+  }
+  return 0;
+}
+
+int
+ntlink_ctx_remove_treew (ntlink_ctx *ctx, const wchar_t *path, RemoveTreeOptions *options)
+{
+  int r = -1;
+  wchar_t *abspath = NULL;
+  const wchar_t *p;
+  LONGLONG start = ntlink_ctx_begin (ctx, NTLINK_API_REMOVE_TREE);
+  p = ntlink_ctx_path (ctx, path, &abspath);
+  if (path == NULL)
+    errno = EINVAL;
+  else if (p != NULL)
+    r = remove_treew_impl (p, options);
+  ntlink_ctx_end (ctx, NTLINK_API_REMOVE_TREE, start, r != 0);
+  ntlink_trace_call (NTLINK_API_REMOVE_TREE, start, r, options != NULL ? options->nthreads : 0, options != NULL, p != NULL ? p : path, NULL, NULL);
+  ntlink_free (abspath);
+  return r;
+}
+
+int
+ntlink_remove_treew (const wchar_t *path, RemoveTreeOptions *options)
+{
+  return ntlink_ctx_remove_treew (NULL, path, options);
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_REMOVETREE_H__
+#define __NTLINK_REMOVETREE_H__
+
+#include <windows.h>
+
+#include "throttle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * RemoveTreeProgressFunc:
+ * @path: name of the file, link or directory that was removed
+ * @isdir: 1 if @path was a real directory (not a link to one)
+ * @userdata: RemoveTreeOptions.userdata
+ *
+ * Called from worker threads, must be thread-safe.
+ *
+ * Returns:
+ * 0 to continue, non-zero to cancel the removal
+ */
+typedef int (*RemoveTreeProgressFunc) (const wchar_t *path, int isdir, void *userdata);
+
+/**
+ * RemoveTreeErrorFunc:
+ * @path: name of the file, link or directory that could not be removed
+ * @err: errno value
+ * @userdata: RemoveTreeOptions.userdata
+ *
+ * Called from worker threads, must be thread-safe.
+ *
+ * Returns:
+ * 0 to continue with the rest of the tree, non-zero to abort
+ */
+typedef int (*RemoveTreeErrorFunc) (const wchar_t *path, int err, void *userdata);
+
+/**
+ * RemoveTreeOptions:
+ * @nthreads: at most that many tasks run at once, 0 or less means as many
+ *   as the shared pool has threads
+ * @progress: progress callback, can be NULL
+ * @error: error callback, can be NULL (errors are then ignored until the end)
+ * @userdata: passed to the callbacks
+ * @throttle: if not NULL, the removal works in the background and at the
+ *   rates of @throttle (see ntlink_throttle_new()); every entry listed and
+ *   every file, link or directory removed is an operation, the bytes are
+ *   those of the names listed
+ */
+typedef struct
+{
+  int nthreads;
+  RemoveTreeProgressFunc progress;
+  RemoveTreeErrorFunc error;
+  void *userdata;
+  ntlink_throttle *throttle;
+} RemoveTreeOptions;
+
+int ntlink_remove_treew (const wchar_t *path, RemoveTreeOptions *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_REMOVETREE_H__ */
@@ -0,0 +1,472 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <windows.h>
+
+#include "quasisymlink.h"
+#include "juncpoint.h"
+#include "realpath.h"
+#include "removetree.h"
+#include "extra_string.h"
+#include "fsbackend.h"
+#include "fssim.h"
+#include "stats.h"
+#include "trace.h"
+#include "alloc.h"
+
+void usage (char **argv)
+{
+  fprintf (stderr,
+"\
+Usage: %s <trace file> [option [option argument] ...]\n\
+Runs the calls recorded in <trace file> (see ntlink_trace_start()) again,\n\
+and prints how long they took then and now.\n\
+Options:\n\
+  c - run the calls of each traced thread in a thread of its own, as they\n\
+  were run (otherwise all calls run one after another, in the order they\n\
+  were made)\n\
+  p - do not start a call earlier (since the replay started) than it was\n\
+  started (since the trace started)\n\
+  l <filename> - run against a simulated filesystem loaded from <filename>\n\
+  (see ntlink_fssim_load()) instead of the default one\n\
+  d <directory> - current directory of the simulated filesystem\n\
+  L <microseconds> - time each simulated filesystem call takes\n\
+  S - also print call counts and latencies of the filesystem calls\n\
+Calls that can't be repeated from the trace (ntlink_symlinkatw(),\n\
+ntlink_symlink_batchw(), walk_nextw()) and calls made by other traced\n\
+functions are skipped. Exits with 0 if every call that was run succeeded\n\
+or failed as it did when traced, 3 otherwise, 2 if the trace can't be read.\n\
+", argv[0]);
+}
+
+typedef struct
+{
+  ntlink_trace_entry *entries;
+  size_t count;
+  /* Calls to run, in the order they were made */
+  size_t *order;
+  size_t nordered;
+  int pace;
+  LONGLONG origin;
+  LONGLONG freq;
+  ntlink_realpath_cache *cache;
+  /* Per ntlink_stats_api */
+  ntlink_stats_counter traced[NTLINK_API_COUNT];
+  ntlink_stats_counter replayed[NTLINK_API_COUNT];
+  unsigned long skipped[NTLINK_API_COUNT];
+  unsigned long differ[NTLINK_API_COUNT];
+} replay_job;
+
+static int
+entry_failed (ntlink_stats_api api, long long result)
+{
+  if (api == NTLINK_API_READLINK)
+    return result < 0;
+  return result != 0;
+}
+
+/* Returns 1 if the call was run, with its result in @result */
+static int
+replay_entry (replay_job *job, const ntlink_trace_entry *e, long long *result)
+{
+  wchar_t **s = (wchar_t **) e->strings;
+  struct stat st;
+  ntlink_statx stx;
+  wchar_t *out = NULL;
+  int relative, linktype;
+
+  switch (e->api)
+  {
+  case NTLINK_API_SYMLINK:
+    *result = ntlink_symlinkw (s[0], s[1]);
+    break;
+  case NTLINK_API_BLIND_SYMLINK:
+    *result = ntlink_blind_symlinkw (s[0], s[1], (SymlinkBlindType) e->arg1, s[2]);
+    break;
+  case NTLINK_API_LINK:
+    *result = ntlink_linkw (s[0], s[1]);
+    break;
+  case NTLINK_API_LSTAT:
+    *result = ntlink_lstatw (s[0], &st);
+    break;
+  case NTLINK_API_STATX:
+    *result = ntlink_statxw (s[0], (StatxFlags) e->arg1, (unsigned int) e->arg2, &stx);
+    break;
+  case NTLINK_API_READLINK:
+    out = (wchar_t *) malloc ((e->arg1 > 0 && e->arg1 < 32768 ? e->arg1 : 32768) * sizeof (wchar_t));
+    if (out == NULL)
+      return 0;
+    *result = ntlink_readlinkw (s[0], out, e->arg1 > 0 && e->arg1 < 32768 ? e->arg1 : 32768);
+    break;
+  case NTLINK_API_UNLINK:
+    *result = ntlink_unlinkw (s[0]);
+    break;
+  case NTLINK_API_RENAME:
+    *result = ntlink_renamew (s[0], s[1]);
+    break;
+  case NTLINK_API_REALPATH:
+    *result = ntlink_realpathw (s[0], &out, e->arg2 ? job->cache : NULL, (RealpathFlags) e->arg1);
+    break;
+  case NTLINK_API_REMOVE_TREE:
+    if (e->arg2)
+    {
+      RemoveTreeOptions options;
+      memset (&options, 0, sizeof (options));
+      options.nthreads = e->arg1;
+      *result = ntlink_remove_treew (s[0], &options);
+    }
+    else
+      *result = ntlink_remove_treew (s[0], NULL);
+    break;
+  case NTLINK_API_SET_JUNC_POINT:
+    *result = SetJuncPointW (s[0], s[1]);
+    break;
+  case NTLINK_API_GET_JUNC_POINT:
+    *result = GetJuncPointW (&out, s[0], &relative, &linktype);
+    break;
+  default:
+    return 0;
+  }
+  free (out);
+  return 1;
+}
+
+static int
+can_replay (const ntlink_trace_entry *e)
+{
+  if (e->nested)
+    return 0;
+  switch (e->api)
+  {
+  case NTLINK_API_SYMLINKAT:
+  case NTLINK_API_SYMLINK_BATCH:
+  case NTLINK_API_WALK_NEXT:
+    return 0;
+  case NTLINK_API_SYMLINK:
+  case NTLINK_API_LINK:
+  case NTLINK_API_RENAME:
+  case NTLINK_API_SET_JUNC_POINT:
+    return e->strings[0] != NULL && e->strings[1] != NULL;
+  default:
+    return e->strings[0] != NULL;
+  }
+}
+
+typedef struct
+{
+  replay_job *job;
+  unsigned long thread;
+  ntlink_stats_counter replayed[NTLINK_API_COUNT];
+  unsigned long differ[NTLINK_API_COUNT];
+} replay_worker;
+
+static void
+replay_wait (replay_job *job, unsigned long long start_ns)
+{
+  LARGE_INTEGER now;
+  unsigned long long elapsed;
+  QueryPerformanceCounter (&now);
+  elapsed = (unsigned long long) (now.QuadPart - job->origin) * 1000000000ULL / job->freq;
+  if (elapsed < start_ns)
+    Sleep ((DWORD) ((start_ns - elapsed) / 1000000));
+}
+
+/* Runs the calls made by w->thread, or all of them if it's 0 */
+static DWORD WINAPI
+replay_run (LPVOID arg)
+{
+  replay_worker *w = (replay_worker *) arg;
+  replay_job *job = w->job;
+  size_t i;
+
+  for (i = 0; i < job->nordered; i++)
+  {
+    const ntlink_trace_entry *e = &job->entries[job->order[i]];
+    LARGE_INTEGER before, after;
+    long long result;
+    int failed;
+
+    if (w->thread != 0 && e->thread != w->thread)
+      continue;
+    if (job->pace)
+      replay_wait (job, e->start_ns);
+    QueryPerformanceCounter (&before);
+    if (!replay_entry (job, e, &result))
+      continue;
+    QueryPerformanceCounter (&after);
+    failed = entry_failed (e->api, result);
+    ntlink_stats_counter_add (&w->replayed[e->api],
+        (unsigned long long) (after.QuadPart - before.QuadPart) * 1000000000ULL / job->freq, failed, 0);
+    if (failed != entry_failed (e->api, e->result))
+      w->differ[e->api] += 1;
+  }
+  return 0;
+}
+
+static replay_job *sort_job;
+
+static int
+compare_start (const void *a, const void *b)
+{
+  const ntlink_trace_entry *ea = &sort_job->entries[*(const size_t *) a];
+  const ntlink_trace_entry *eb = &sort_job->entries[*(const size_t *) b];
+  if (ea->start_ns != eb->start_ns)
+    return ea->start_ns < eb->start_ns ? -1 : 1;
+  /* Keep the order of the trace otherwise */
+  return *(const size_t *) a < *(const size_t *) b ? -1 : 1;
+}
+
+static void
+print_row (const char *name, const ntlink_stats_counter *traced, const ntlink_stats_counter *replayed,
+    unsigned long skipped, unsigned long differ)
+{
+  printf ("%-24s %8llu %8lu %8lu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+      replayed->calls, skipped, differ,
+      ntlink_stats_percentile (traced, 50) / 1000.0,
+      ntlink_stats_percentile (traced, 99) / 1000.0,
+      ntlink_stats_percentile (replayed, 50) / 1000.0,
+      ntlink_stats_percentile (replayed, 90) / 1000.0,
+      ntlink_stats_percentile (replayed, 99) / 1000.0,
+      replayed->max_ns / 1000.0);
+}
+
+int
+main (int argc, char **argv)
+{
+  replay_job *job;
+  replay_worker *workers = NULL;
+  size_t nworkers = 0, i, j;
+  ntlink_fssim *sim = NULL;
+  const char *tree = NULL, *cwd = NULL;
+  int concurrent = 0, pace = 0, stats = 0, latency = -1;
+  unsigned long long total_differ = 0, total_replayed = 0, total_skipped = 0;
+  LARGE_INTEGER freq, end;
+  FILE *f;
+  int r;
+
+  if (argc < 2)
+  {
+    if (argc > 0)
+      usage (argv);
+    return 1;
+  }
+  for (i = 2; i < (size_t) argc; i++)
+  {
+    if (strcmp (argv[i], "c") == 0)
+      concurrent = 1;
+    else if (strcmp (argv[i], "p") == 0)
+      pace = 1;
+    else if (strcmp (argv[i], "S") == 0)
+      stats = 1;
+    else if ((strcmp (argv[i], "l") == 0 || strcmp (argv[i], "d") == 0 ||
+        strcmp (argv[i], "L") == 0) && i + 1 < (size_t) argc)
+    {
+      if (argv[i][0] == 'l')
+        tree = argv[i + 1];
+      else if (argv[i][0] == 'd')
+        cwd = argv[i + 1];
+      else
+        latency = atoi (argv[i + 1]);
+      i++;
+    }
+    else
+    {
+      fprintf (stderr, "Unknown option `%s'\n", argv[i]);
+      usage (argv);
+      return 1;
+    }
+  }
+
+  job = (replay_job *) calloc (1, sizeof (replay_job));
+  if (job == NULL)
+  {
+    fprintf (stderr, "Out of memory\n");
+    return 2;
+  }
+  job->pace = pace;
+
+  f = fopen (argv[1], "rb");
+  if (f == NULL)
+  {
+    fprintf (stderr, "Failed to open `%s': %s\n", argv[1], strerror (errno));
+    return 2;
+  }
+  r = ntlink_trace_load (f, &job->entries, &job->count);
+  fclose (f);
+  if (r != 0)
+  {
+    fprintf (stderr, r == -2 ? "Out of memory\n" : "`%s' is not a trace\n", argv[1]);
+    return 2;
+  }
+
+  if (tree != NULL || cwd != NULL || latency >= 0)
+  {
+    sim = ntlink_fssim_new (NTLINK_FSSIM_FLAG_NONE);
+    f = tree != NULL ? fopen (tree, "rb") : NULL;
+    if (sim == NULL || (tree != NULL && (f == NULL || ntlink_fssim_load (sim, f) != 0)))
+    {
+      fprintf (stderr, "Failed to load `%s'\n", tree != NULL ? tree : "");
+      return 2;
+    }
+    if (f != NULL)
+      fclose (f);
+    if (cwd != NULL)
+    {
+      wchar_t *wcwd = NULL;
+      if (strtowchar (cwd, &wcwd, CP_THREAD_ACP) < 0 ||
+          ntlink_fssim_set_current_directory (sim, wcwd) != 0)
+      {
+        fprintf (stderr, "Invalid directory `%s'\n", cwd);
+        return 2;
+      }
+      ntlink_free (wcwd);
+    }
+    if (latency >= 0)
+      ntlink_fssim_set_latency (sim, NTLINK_FS_OP_COUNT, (unsigned int) latency);
+    ntlink_fssim_install (sim);
+  }
+  if (stats)
+    ntlink_stats_enable (1);
+
+  job->order = (size_t *) malloc ((job->count + 1) * sizeof (size_t));
+  job->cache = ntlink_realpath_cache_new ();
+  if (job->order == NULL || job->cache == NULL)
+  {
+    fprintf (stderr, "Out of memory\n");
+    return 2;
+  }
+  j = 0;
+  for (i = 0; i < job->count; i++)
+  {
+    const ntlink_trace_entry *e = &job->entries[i];
+    if (!e->nested)
+      ntlink_stats_counter_add (&job->traced[e->api], e->duration_ns, entry_failed (e->api, e->result), 0);
+    if (can_replay (e))
+      job->order[j++] = i;
+    else if (!e->nested)
+      job->skipped[e->api] += 1;
+  }
+  job->nordered = j;
+  sort_job = job;
+  qsort (job->order, j, sizeof (size_t), compare_start);
+
+  /* One worker per traced thread, or one for everything */
+  workers = (replay_worker *) calloc (j + 1, sizeof (replay_worker));
+  if (workers == NULL)
+  {
+    fprintf (stderr, "Out of memory\n");
+    return 2;
+  }
+  if (!concurrent)
+    nworkers = 1;
+  else
+  {
+    for (i = 0; i < j; i++)
+    {
+      unsigned long thread = job->entries[job->order[i]].thread;
+      size_t k;
+      for (k = 0; k < nworkers && workers[k].thread != thread; k++);
+      if (k == nworkers)
+        workers[nworkers++].thread = thread;
+    }
+    if (nworkers == 0)
+      nworkers = 1;
+  }
+  for (i = 0; i < nworkers; i++)
+    workers[i].job = job;
+
+  QueryPerformanceFrequency (&freq);
+  job->freq = freq.QuadPart;
+  QueryPerformanceCounter (&end);
+  job->origin = end.QuadPart;
+  if (nworkers == 1)
+    replay_run (&workers[0]);
+  else
+  {
+    HANDLE *threads = (HANDLE *) calloc (nworkers, sizeof (HANDLE));
+    if (threads == NULL)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return 2;
+    }
+    for (i = 0; i < nworkers; i++)
+    {
+      threads[i] = CreateThread (NULL, 0, replay_run, &workers[i], 0, NULL);
+      /* Run it here, after the others are started */
+      if (threads[i] == NULL)
+        replay_run (&workers[i]);
+    }
+    for (i = 0; i < nworkers; i++)
+      if (threads[i] != NULL)
+      {
+        WaitForSingleObject (threads[i], INFINITE);
+        CloseHandle (threads[i]);
+      }
+    free (threads);
+  }
+  QueryPerformanceCounter (&end);
+
+  for (i = 0; i < nworkers; i++)
+    for (r = 0; r < NTLINK_API_COUNT; r++)
+    {
+      ntlink_stats_counter *to = &job->replayed[r], *from = &workers[i].replayed[r];
+      to->calls += from->calls;
+      to->errors += from->errors;
+      to->total_ns += from->total_ns;
+      if (from->max_ns > to->max_ns)
+        to->max_ns = from->max_ns;
+      for (j = 0; j < NTLINK_STATS_BUCKETS; j++)
+        to->latency[j] += from->latency[j];
+      job->differ[r] += workers[i].differ[r];
+    }
+
+  printf ("%-24s %8s %8s %8s %9s %9s %9s %9s %9s %9s\n", "call", "replayed", "skipped", "differ",
+      "was p50", "was p99", "p50 us", "p90 us", "p99 us", "max us");
+  for (r = 0; r < NTLINK_API_COUNT; r++)
+  {
+    if (job->traced[r].calls == 0)
+      continue;
+    print_row (ntlink_stats_api_name ((ntlink_stats_api) r), &job->traced[r], &job->replayed[r],
+        job->skipped[r], job->differ[r]);
+    total_replayed += job->replayed[r].calls;
+    total_skipped += job->skipped[r];
+    total_differ += job->differ[r];
+  }
+  printf ("%llu calls replayed in %.1f ms by %lu threads, %llu skipped, %llu with a different outcome\n",
+      total_replayed, (end.QuadPart - job->origin) * 1000.0 / job->freq, (unsigned long) nworkers,
+      total_skipped, total_differ);
+  if (stats)
+    ntlink_stats_print (stdout);
+
+  if (sim != NULL)
+  {
+    ntlink_fssim_install (NULL);
+    ntlink_fssim_free (sim);
+  }
+  ntlink_realpath_cache_free (job->cache);
+  ntlink_trace_free (job->entries, job->count);
+  free (job->order);
+  free (workers);
+  free (job);
+  return total_differ > 0 ? 3 : 0;
+}
@@ -0,0 +1,766 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h>
+#include <windows.h>
+#include <winioctl.h>
+
+#include "stats.h"
+#include "fsbackend.h"
+#include "trace.h"
+#include "alloc.h"
+
+static const char *ntlink_stats_api_names[NTLINK_API_COUNT] =
+{
+  "ntlink_symlinkw",
+  "ntlink_blind_symlinkw",
+  "ntlink_symlinkatw",
+  "ntlink_symlink_batchw",
+  "ntlink_linkw",
+  "ntlink_lstatw",
+  "ntlink_statxw",
+  "ntlink_readlinkw",
+  "ntlink_unlinkw",
+  "ntlink_renamew",
+  "ntlink_realpathw",
+  "ntlink_remove_treew",
+  "walk_nextw",
+  "SetJuncPointW",
+  "GetJuncPointW",
+};
+
+/*
+ * Every thread counts into a block of its own, without locks or atomic
+ * operations; readers add the blocks up. stats_lock protects the list of
+ * blocks, the totals of the threads that exited and the epoch.
+ * ntlink_stats_reset() does not touch the blocks (their threads may be
+ * writing to them), it starts a new epoch instead: a block from an older
+ * epoch is ignored by readers, and is cleared by its thread the next
+ * time it counts something.
+ */
+typedef struct _stats_block stats_block;
+
+struct _stats_block
+{
+  stats_block *next;
+  stats_block *prev;
+  LONG epoch;
+  ntlink_stats data;
+};
+
+static volatile int stats_enabled = 0;
+static volatile LONG stats_epoch = 0;
+static DWORD stats_index = FLS_OUT_OF_INDEXES;
+static LONGLONG stats_freq = 0;
+static SRWLOCK stats_lock;
+static stats_block *stats_live = NULL;
+static stats_block *stats_spare = NULL;
+static ntlink_stats stats_exited;
+
+static void
+stats_add_counter (ntlink_stats_counter *to, const ntlink_stats_counter *from)
+{
+  int i;
+  to->calls += from->calls;
+  to->errors += from->errors;
+  to->bytes += from->bytes;
+  to->total_ns += from->total_ns;
+  if (from->max_ns > to->max_ns)
+    to->max_ns = from->max_ns;
+  for (i = 0; i < NTLINK_STATS_BUCKETS; i++)
+    to->latency[i] += from->latency[i];
+}
+
+static void
+stats_add (ntlink_stats *to, const ntlink_stats *from)
+{
+  int i;
+  for (i = 0; i < NTLINK_API_COUNT; i++)
+    stats_add_counter (&to->api[i], &from->api[i]);
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+    stats_add_counter (&to->os[i], &from->os[i]);
+}
+
+/* Runs when a thread exits: keep its counts, reuse its block */
+static void WINAPI
+stats_thread_exit (PVOID data)
+{
+  stats_block *block = (stats_block *) data;
+
+  AcquireSRWLockExclusive (&stats_lock);
+  if (block->epoch == stats_epoch)
+    stats_add (&stats_exited, &block->data);
+  if (block->prev != NULL)
+    block->prev->next = block->next;
+  else
+    stats_live = block->next;
+  if (block->next != NULL)
+    block->next->prev = block->prev;
+  block->prev = NULL;
+  block->next = stats_spare;
+  stats_spare = block;
+  ReleaseSRWLockExclusive (&stats_lock);
+}
+
+/* The calling thread's counters, NULL if there is no memory for them */
+static ntlink_stats *
+stats_thread (void)
+{
+  stats_block *block = (stats_block *) FlsGetValue (stats_index);
+
+  if (block == NULL)
+  {
+    AcquireSRWLockExclusive (&stats_lock);
+    block = stats_spare;
+    if (block != NULL)
+      stats_spare = block->next;
+    else
+      block = (stats_block *) ntlink_malloc (sizeof (stats_block));
+    if (block != NULL)
+    {
+      memset (&block->data, 0, sizeof (block->data));
+      block->epoch = stats_epoch;
+      block->prev = NULL;
+      block->next = stats_live;
+      if (stats_live != NULL)
+        stats_live->prev = block;
+      stats_live = block;
+    }
+    ReleaseSRWLockExclusive (&stats_lock);
+    if (block == NULL)
+      return NULL;
+    FlsSetValue (stats_index, block);
+  }
+  if (block->epoch != stats_epoch)
+  {
+    memset (&block->data, 0, sizeof (block->data));
+    block->epoch = stats_epoch;
+  }
+  return &block->data;
+}
+
+static int
+stats_bucket (unsigned long long ns)
+{
+  int bits = 0;
+  unsigned long long v = ns;
+
+  if (ns < (1 << NTLINK_STATS_SUB_BITS))
+    return (int) ns;
+  while (v >> 1 != 0 && bits < NTLINK_STATS_MAX_BITS)
+  {
+    v >>= 1;
+    bits++;
+  }
+  if (bits >= NTLINK_STATS_MAX_BITS)
+    return NTLINK_STATS_BUCKETS - 1;
+  return ((bits - NTLINK_STATS_SUB_BITS + 1) << NTLINK_STATS_SUB_BITS) |
+      (int) ((ns >> (bits - NTLINK_STATS_SUB_BITS)) & ((1 << NTLINK_STATS_SUB_BITS) - 1));
+}
+
+/**
+ * ntlink_stats_counter_add:
+ * @counter: counters to add a call to
+ * @ns: how long the call took
+ * @failed: non-zero if it failed
+ * @bytes: bytes it transferred
+ *
+ * Counts a call in @counter, for callers that keep counters of their own
+ * (and add them up themselves).
+ */
+void
+ntlink_stats_counter_add (ntlink_stats_counter *counter, unsigned long long ns, int failed, unsigned long long bytes)
+{
+  counter->calls += 1;
+  if (failed)
+    counter->errors += 1;
+  counter->bytes += bytes;
+  counter->total_ns += ns;
+  if (ns > counter->max_ns)
+    counter->max_ns = ns;
+  counter->latency[stats_bucket (ns)] += 1;
+}
+
+static void
+stats_record (ntlink_stats_counter *counter, LONGLONG start, int failed, unsigned long long bytes)
+{
+  LARGE_INTEGER now;
+
+  QueryPerformanceCounter (&now);
+  ntlink_stats_counter_add (counter, now.QuadPart > start ?
+      (unsigned long long) (now.QuadPart - start) * 1000000000ULL / stats_freq : 0, failed, bytes);
+}
+
+/**
+ * ntlink_stats_begin:
+ *
+ * Starts timing a public function. Cheap when neither statistics nor
+ * tracing (see ntlink_trace_start()) are enabled.
+ *
+ * Returns:
+ * a value for ntlink_stats_end() and ntlink_trace_call(), 0 if neither
+ * is enabled
+ */
+LONGLONG
+ntlink_stats_begin (void)
+{
+  LARGE_INTEGER now;
+  if (!stats_enabled && !ntlink_trace_active)
+    return 0;
+  QueryPerformanceCounter (&now);
+  if (ntlink_trace_active)
+    ntlink_trace_enter ();
+  return now.QuadPart;
+}
+
+/**
+ * ntlink_stats_end:
+ * @api: the function that was called
+ * @start: what ntlink_stats_begin() returned when it was called
+ * @failed: non-zero if it failed
+ *
+ * Counts a call. Preserves errno and the last Win32 error.
+ */
+void
+ntlink_stats_end (ntlink_stats_api api, LONGLONG start, int failed)
+{
+  ntlink_stats *stats;
+  DWORD lerr;
+  int err;
+
+  if (start == 0 || !stats_enabled)
+    return;
+  lerr = GetLastError ();
+  err = errno;
+  stats = stats_thread ();
+  if (stats != NULL)
+    stats_record (&stats->api[api], start, failed, 0);
+  errno = err;
+  SetLastError (lerr);
+}
+
+/*
+ * The counting backend: forwards every call to the selected backend
+ */
+static const ntlink_fs_backend *stats_inner = NULL;
+
+static LONGLONG
+stats_os_begin (void)
+{
+  LARGE_INTEGER now;
+  QueryPerformanceCounter (&now);
+  return now.QuadPart;
+}
+
+static void
+stats_os_end (ntlink_fs_op op, LONGLONG start, int failed, unsigned long long bytes)
+{
+  ntlink_stats *stats;
+  DWORD lerr = GetLastError ();
+  stats = stats_thread ();
+  if (stats != NULL)
+    stats_record (&stats->os[op], start, failed, bytes);
+  SetLastError (lerr);
+}
+
+static HANDLE WINAPI
+stats_create_file (LPCWSTR path, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES sa, DWORD disposition, DWORD flags, HANDLE templ)
+{
+  LONGLONG start = stats_os_begin ();
+  HANDLE r = stats_inner->create_file (path, access, share, sa, disposition, flags, templ);
+  stats_os_end (NTLINK_FS_CREATE_FILE, start, r == INVALID_HANDLE_VALUE, 0);
+  return r;
+}
+
+static HANDLE WINAPI
+stats_create_file_at (HANDLE dirhandle, LPCWSTR name, DWORD access, BOOL directory)
+{
+  LONGLONG start = stats_os_begin ();
+  HANDLE r = stats_inner->create_file_at (dirhandle, name, access, directory);
+  stats_os_end (NTLINK_FS_CREATE_FILE_AT, start, r == INVALID_HANDLE_VALUE, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_close_handle (HANDLE handle)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->close_handle (handle);
+  stats_os_end (NTLINK_FS_CLOSE_HANDLE, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_device_io_control (HANDLE handle, DWORD code, LPVOID in, DWORD insize, LPVOID out, DWORD outsize, LPDWORD returned, LPOVERLAPPED overlapped)
+{
+  unsigned long long bytes = 0;
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->device_io_control (handle, code, in, insize, out, outsize, returned, overlapped);
+  if (r && code == FSCTL_GET_REPARSE_POINT && returned != NULL)
+    bytes = *returned;
+  else if (r && code == FSCTL_SET_REPARSE_POINT)
+    bytes = insize;
+  stats_os_end (NTLINK_FS_DEVICE_IO_CONTROL, start, !r, bytes);
+  return r;
+}
+
+static BOOL WINAPI
+stats_get_file_information_by_handle (HANDLE handle, LPBY_HANDLE_FILE_INFORMATION info)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->get_file_information_by_handle (handle, info);
+  stats_os_end (NTLINK_FS_GET_FILE_INFORMATION_BY_HANDLE, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_get_file_information_by_handle_ex (HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->get_file_information_by_handle_ex (handle, cls, info, size);
+  stats_os_end (NTLINK_FS_GET_FILE_INFORMATION_BY_HANDLE_EX, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_set_file_information_by_handle (HANDLE handle, FILE_INFO_BY_HANDLE_CLASS cls, LPVOID info, DWORD size)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->set_file_information_by_handle (handle, cls, info, size);
+  stats_os_end (NTLINK_FS_SET_FILE_INFORMATION_BY_HANDLE, start, !r, 0);
+  return r;
+}
+
+static DWORD WINAPI
+stats_get_final_path_name_by_handle (HANDLE handle, LPWSTR buf, DWORD size, DWORD flags)
+{
+  LONGLONG start = stats_os_begin ();
+  DWORD r = stats_inner->get_final_path_name_by_handle (handle, buf, size, flags);
+  stats_os_end (NTLINK_FS_GET_FINAL_PATH_NAME_BY_HANDLE, start, r == 0, 0);
+  return r;
+}
+
+static HANDLE WINAPI
+stats_find_first_file (LPCWSTR pattern, LPWIN32_FIND_DATAW data)
+{
+  LONGLONG start = stats_os_begin ();
+  HANDLE r = stats_inner->find_first_file (pattern, data);
+  stats_os_end (NTLINK_FS_FIND_FIRST_FILE, start, r == INVALID_HANDLE_VALUE, 0);
+  return r;
+}
+
+static HANDLE WINAPI
+stats_find_first_file_ex (LPCWSTR pattern, FINDEX_INFO_LEVELS level, LPVOID data, FINDEX_SEARCH_OPS search, LPVOID filter, DWORD flags)
+{
+  LONGLONG start = stats_os_begin ();
+  HANDLE r = stats_inner->find_first_file_ex (pattern, level, data, search, filter, flags);
+  stats_os_end (NTLINK_FS_FIND_FIRST_FILE_EX, start, r == INVALID_HANDLE_VALUE, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_find_next_file (HANDLE handle, LPWIN32_FIND_DATAW data)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->find_next_file (handle, data);
+  /* Running out of entries is not an error */
+  stats_os_end (NTLINK_FS_FIND_NEXT_FILE, start, !r && GetLastError () != ERROR_NO_MORE_FILES, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_find_close (HANDLE handle)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->find_close (handle);
+  stats_os_end (NTLINK_FS_FIND_CLOSE, start, !r, 0);
+  return r;
+}
+
+static DWORD WINAPI
+stats_get_file_attributes (LPCWSTR path)
+{
+  LONGLONG start = stats_os_begin ();
+  DWORD r = stats_inner->get_file_attributes (path);
+  stats_os_end (NTLINK_FS_GET_FILE_ATTRIBUTES, start, r == INVALID_FILE_ATTRIBUTES, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_get_file_attributes_ex (LPCWSTR path, GET_FILEEX_INFO_LEVELS level, LPVOID data)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->get_file_attributes_ex (path, level, data);
+  stats_os_end (NTLINK_FS_GET_FILE_ATTRIBUTES_EX, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_create_directory (LPCWSTR path, LPSECURITY_ATTRIBUTES sa)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->create_directory (path, sa);
+  stats_os_end (NTLINK_FS_CREATE_DIRECTORY, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_remove_directory (LPCWSTR path)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->remove_directory (path);
+  stats_os_end (NTLINK_FS_REMOVE_DIRECTORY, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_delete_file (LPCWSTR path)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->delete_file (path);
+  stats_os_end (NTLINK_FS_DELETE_FILE, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_move_file_ex (LPCWSTR from, LPCWSTR to, DWORD flags)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->move_file_ex (from, to, flags);
+  stats_os_end (NTLINK_FS_MOVE_FILE_EX, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_create_hard_link (LPCWSTR link, LPCWSTR existing, LPSECURITY_ATTRIBUTES sa)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->create_hard_link (link, existing, sa);
+  stats_os_end (NTLINK_FS_CREATE_HARD_LINK, start, !r, 0);
+  return r;
+}
+
+static BOOL WINAPI
+stats_create_symbolic_link (LPCWSTR link, LPCWSTR target, DWORD flags)
+{
+  LONGLONG start = stats_os_begin ();
+  BOOL r = stats_inner->create_symbolic_link (link, target, flags);
+  stats_os_end (NTLINK_FS_CREATE_SYMBOLIC_LINK, start, !r, 0);
+  return r;
+}
+
+static DWORD WINAPI
+stats_get_full_path_name (LPCWSTR path, DWORD size, LPWSTR buf, LPWSTR *filepart)
+{
+  LONGLONG start = stats_os_begin ();
+  DWORD r = stats_inner->get_full_path_name (path, size, buf, filepart);
+  stats_os_end (NTLINK_FS_GET_FULL_PATH_NAME, start, r == 0, 0);
+  return r;
+}
+
+static DWORD WINAPI
+stats_get_current_directory (DWORD size, LPWSTR buf)
+{
+  LONGLONG start = stats_os_begin ();
+  DWORD r = stats_inner->get_current_directory (size, buf);
+  stats_os_end (NTLINK_FS_GET_CURRENT_DIRECTORY, start, r == 0, 0);
+  return r;
+}
+
+/* Not const: the name is that of the backend underneath */
+static ntlink_fs_backend stats_backend =
+{
+  "stats",
+  stats_create_file,
+  stats_create_file_at,
+  stats_close_handle,
+  stats_device_io_control,
+  stats_get_file_information_by_handle,
+  stats_get_file_information_by_handle_ex,
+  stats_set_file_information_by_handle,
+  stats_get_final_path_name_by_handle,
+  stats_find_first_file,
+  stats_find_first_file_ex,
+  stats_find_next_file,
+  stats_find_close,
+  stats_get_file_attributes,
+  stats_get_file_attributes_ex,
+  stats_create_directory,
+  stats_remove_directory,
+  stats_delete_file,
+  stats_move_file_ex,
+  stats_create_hard_link,
+  stats_create_symbolic_link,
+  stats_get_full_path_name,
+  stats_get_current_directory,
+};
+
+/**
+ * ntlink_stats_wrap_backend:
+ * @backend: the backend being selected
+ *
+ * Returns:
+ * the counting backend on top of @backend if statistics are enabled,
+ * @backend otherwise
+ */
+const ntlink_fs_backend *
+ntlink_stats_wrap_backend (const ntlink_fs_backend *backend)
+{
+  if (!stats_enabled)
+    return backend;
+  stats_inner = backend;
+  stats_backend.name = backend->name;
+  return &stats_backend;
+}
+
+/**
+ * ntlink_stats_unwrap_backend:
+ * @backend: a backend ntlink_stats_wrap_backend() returned
+ *
+ * Returns:
+ * the backend underneath @backend
+ */
+const ntlink_fs_backend *
+ntlink_stats_unwrap_backend (const ntlink_fs_backend *backend)
+{
+  if (backend == &stats_backend)
+    return stats_inner;
+  return backend;
+}
+
+/**
+ * ntlink_stats_enable:
+ * @enable: non-zero to start counting, 0 to stop
+ *
+ * Statistics are disabled by default, and then cost the public functions
+ * one check each. When enabled, every call to a public function and
+ * to the filesystem backend is timed. Counts are kept while disabled,
+ * use ntlink_stats_reset() to clear them. Like ntlink_fs_set(), don't
+ * call this while other threads use the library.
+ *
+ * Returns:
+ * 1 if statistics were enabled before, 0 if not, -1 if they can't be
+ * enabled (out of FLS slots)
+ */
+int
+ntlink_stats_enable (int enable)
+{
+  int was = stats_enabled;
+  LARGE_INTEGER freq;
+
+  if (enable && stats_index == FLS_OUT_OF_INDEXES)
+  {
+    stats_index = FlsAlloc (stats_thread_exit);
+    if (stats_index == FLS_OUT_OF_INDEXES)
+      return -1;
+    QueryPerformanceFrequency (&freq);
+    stats_freq = freq.QuadPart;
+  }
+  stats_enabled = enable != 0;
+  ntlink_fs_set (ntlink_stats_unwrap_backend (ntlink_fs));
+  return was;
+}
+
+/**
+ * ntlink_stats_get:
+ * @stats: receives the counters
+ *
+ * Adds up the counters of all threads, including those that exited,
+ * since the last ntlink_stats_reset(). Calls in progress in other
+ * threads may or may not be counted.
+ *
+ * Returns:
+ * 0 on success, -1 if statistics were never enabled (@stats is zeroed)
+ */
+int
+ntlink_stats_get (ntlink_stats *stats)
+{
+  stats_block *block;
+
+  memset (stats, 0, sizeof (*stats));
+  if (stats_index == FLS_OUT_OF_INDEXES)
+    return -1;
+  AcquireSRWLockExclusive (&stats_lock);
+  stats_add (stats, &stats_exited);
+  for (block = stats_live; block != NULL; block = block->next)
+    if (block->epoch == stats_epoch)
+      stats_add (stats, &block->data);
+  ReleaseSRWLockExclusive (&stats_lock);
+  return 0;
+}
+
+/**
+ * ntlink_stats_reset:
+ *
+ * Sets all counters to zero.
+ */
+void
+ntlink_stats_reset (void)
+{
+  AcquireSRWLockExclusive (&stats_lock);
+  InterlockedIncrement (&stats_epoch);
+  memset (&stats_exited, 0, sizeof (stats_exited));
+  ReleaseSRWLockExclusive (&stats_lock);
+}
+
+/**
+ * ntlink_stats_api_name:
+ * @api: a member of ntlink_stats_api
+ *
+ * Returns:
+ * the name of the function @api stands for, or NULL if @api is invalid
+ */
+const char *
+ntlink_stats_api_name (ntlink_stats_api api)
+{
+  if ((int) api < 0 || api >= NTLINK_API_COUNT)
+    return NULL;
+  return ntlink_stats_api_names[api];
+}
+
+/**
+ * ntlink_stats_bucket_bound:
+ * @bucket: index into ntlink_stats_counter.latency
+ *
+ * Returns:
+ * the shortest latency, in nanoseconds, that falls into @bucket
+ */
+unsigned long long
+ntlink_stats_bucket_bound (int bucket)
+{
+  int bits;
+  if (bucket < (1 << NTLINK_STATS_SUB_BITS))
+    return (unsigned long long) bucket;
+  bits = (bucket >> NTLINK_STATS_SUB_BITS) + NTLINK_STATS_SUB_BITS - 1;
+  return ((1ULL << NTLINK_STATS_SUB_BITS) | (bucket & ((1 << NTLINK_STATS_SUB_BITS) - 1))) <<
+      (bits - NTLINK_STATS_SUB_BITS);
+}
+
+/**
+ * ntlink_stats_percentile:
+ * @counter: counters of a call
+ * @percent: 0 to 100
+ *
+ * Returns:
+ * the latency, in nanoseconds, @percent percent of the calls did not
+ * exceed (the upper bound of the bucket it falls into, but no more
+ * than the longest call), 0 if there were no calls
+ */
+unsigned long long
+ntlink_stats_percentile (const ntlink_stats_counter *counter, double percent)
+{
+  unsigned long long seen = 0, want, bound;
+  int i;
+
+  if (counter->calls == 0)
+    return 0;
+  want = (unsigned long long) (counter->calls * percent / 100.0 + 0.5);
+  if (want == 0)
+    want = 1;
+  for (i = 0; i < NTLINK_STATS_BUCKETS - 1; i++)
+  {
+    seen += counter->latency[i];
+    if (seen >= want)
+    {
+      bound = ntlink_stats_bucket_bound (i + 1) - 1;
+      return bound < counter->max_ns ? bound : counter->max_ns;
+    }
+  }
+  return counter->max_ns;
+}
+
+/**
+ * ntlink_stats_print_line:
+ * @f: a file to write to
+ * @format: printf() format of the line, at most 255 characters long
+ *   once formatted (the rest is cut off)
+ *
+ * Prints a line of a statistics table to @f, whether @f is narrow or
+ * wide oriented. Also used by ntlink_alloc_print_stats() and
+ * ntlink_io_print_stats().
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to write
+ */
+int
+ntlink_stats_print_line (FILE *f, const char *format, ...)
+{
+  char line[256];
+  va_list argptr;
+
+  va_start (argptr, format);
+  vsnprintf (line, sizeof (line), format, argptr);
+  va_end (argptr);
+  line[sizeof (line) - 1] = '\0';
+  if (fwide (f, 0) > 0)
+    return fwprintf (f, L"%hs", line) < 0 ? -1 : 0;
+  return fputs (line, f) < 0 ? -1 : 0;
+}
+
+static int
+stats_print_counter (FILE *f, const char *name, const ntlink_stats_counter *c)
+{
+  if (c->calls == 0)
+    return 0;
+  return ntlink_stats_print_line (f, "%-40s %10llu %8llu %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+      name, c->calls, c->errors, c->bytes,
+      c->total_ns / 1000.0 / c->calls,
+      ntlink_stats_percentile (c, 50) / 1000.0,
+      ntlink_stats_percentile (c, 90) / 1000.0,
+      ntlink_stats_percentile (c, 99) / 1000.0,
+      c->max_ns / 1000.0);
+}
+
+/**
+ * ntlink_stats_print:
+ * @f: a file to write to
+ *
+ * Writes a table of the functions and filesystem calls that were
+ * called: number of calls, errors, bytes and latencies (average,
+ * percentiles and maximum, in microseconds). Works with both narrow and
+ * wide streams.
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int
+ntlink_stats_print (FILE *f)
+{
+  ntlink_stats *stats;
+  int i, r = 0;
+
+  stats = (ntlink_stats *) ntlink_malloc (sizeof (ntlink_stats));
+  if (stats == NULL)
+    return -1;
+  ntlink_stats_get (stats);
+  r |= ntlink_stats_print_line (f, "%-40s %10s %8s %10s %10s %10s %10s %10s %10s\n",
+      "call", "calls", "errors", "bytes", "avg us", "p50 us", "p90 us", "p99 us", "max us");
+  for (i = 0; i < NTLINK_API_COUNT; i++)
+    r |= stats_print_counter (f, ntlink_stats_api_name ((ntlink_stats_api) i), &stats->api[i]);
+  for (i = 0; i < NTLINK_FS_OP_COUNT; i++)
+    r |= stats_print_counter (f, ntlink_fs_op_name ((ntlink_fs_op) i), &stats->os[i]);
+  ntlink_free (stats);
+  return r;
+}
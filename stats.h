@@ -0,0 +1,123 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_STATS_H__
+#define __NTLINK_STATS_H__
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "fsbackend.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ntlink_stats_api:
+ *
+ * Public functions that are counted, the wide versions only (the narrow
+ * ones call them). Calls the library makes to itself are counted too.
+ */
+typedef enum
+{
+  NTLINK_API_SYMLINK = 0,
+  NTLINK_API_BLIND_SYMLINK,
+  NTLINK_API_SYMLINKAT,
+  NTLINK_API_SYMLINK_BATCH,
+  NTLINK_API_LINK,
+  NTLINK_API_LSTAT,
+  NTLINK_API_STATX,
+  NTLINK_API_READLINK,
+  NTLINK_API_UNLINK,
+  NTLINK_API_RENAME,
+  NTLINK_API_REALPATH,
+  NTLINK_API_REMOVE_TREE,
+  NTLINK_API_WALK_NEXT,
+  NTLINK_API_SET_JUNC_POINT,
+  NTLINK_API_GET_JUNC_POINT,
+  NTLINK_API_COUNT
+} ntlink_stats_api;
+
+/*
+ * Latencies are kept in nanoseconds, in a log-linear histogram: values
+ * below 2^NTLINK_STATS_SUB_BITS have a bucket each, every power of two
+ * above that is split into 2^NTLINK_STATS_SUB_BITS buckets (so a bucket
+ * is at most 25% wide), up to 2^NTLINK_STATS_MAX_BITS ns (about 18
+ * minutes); longer calls go into the last bucket.
+ */
+#define NTLINK_STATS_SUB_BITS 2
+#define NTLINK_STATS_MAX_BITS 40
+#define NTLINK_STATS_BUCKETS ((NTLINK_STATS_MAX_BITS - NTLINK_STATS_SUB_BITS + 1) << NTLINK_STATS_SUB_BITS)
+
+/**
+ * ntlink_stats_counter:
+ * @calls: number of calls
+ * @errors: number of calls that failed
+ * @bytes: bytes of reparse data read (FSCTL_GET_REPARSE_POINT) and
+ *   written (FSCTL_SET_REPARSE_POINT), DeviceIoControl only
+ * @total_ns: time spent in all calls
+ * @max_ns: the longest call
+ * @latency: number of calls per latency bucket, see
+ *   ntlink_stats_bucket_bound()
+ */
+typedef struct
+{
+  unsigned long long calls;
+  unsigned long long errors;
+  unsigned long long bytes;
+  unsigned long long total_ns;
+  unsigned long long max_ns;
+  unsigned long long latency[NTLINK_STATS_BUCKETS];
+} ntlink_stats_counter;
+
+/**
+ * ntlink_stats:
+ * @api: counters of the public functions, indexed by ntlink_stats_api
+ * @os: counters of the filesystem calls, indexed by ntlink_fs_op
+ */
+typedef struct
+{
+  ntlink_stats_counter api[NTLINK_API_COUNT];
+  ntlink_stats_counter os[NTLINK_FS_OP_COUNT];
+} ntlink_stats;
+
+int ntlink_stats_enable (int enable);
+int ntlink_stats_get (ntlink_stats *stats);
+void ntlink_stats_reset (void);
+int ntlink_stats_print (FILE *f);
+int ntlink_stats_print_line (FILE *f, const char *format, ...);
+const char *ntlink_stats_api_name (ntlink_stats_api api);
+unsigned long long ntlink_stats_bucket_bound (int bucket);
+unsigned long long ntlink_stats_percentile (const ntlink_stats_counter *counter, double percent);
+void ntlink_stats_counter_add (ntlink_stats_counter *counter, unsigned long long ns, int failed, unsigned long long bytes);
+
+/* Used by the library to time its public functions */
+LONGLONG ntlink_stats_begin (void);
+void ntlink_stats_end (ntlink_stats_api api, LONGLONG start, int failed);
+
+/* Used by fsbackend.c to keep the counting backend on top of the selected one */
+const ntlink_fs_backend *ntlink_stats_wrap_backend (const ntlink_fs_backend *backend);
+const ntlink_fs_backend *ntlink_stats_unwrap_backend (const ntlink_fs_backend *backend);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_STATS_H__ */
@@ -0,0 +1,900 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "threadpool.h"
+#include "alloc.h"
+
+/* Initial capacity of a worker deque, it doubles when it fills up */
+#define POOL_DEQUE_SIZE 256
+
+typedef struct _ntlink_task ntlink_task;
+
+struct _ntlink_task
+{
+  /* Link in the injection queue or in the queue of a limited group */
+  ntlink_task *next;
+  ntlink_task_func func;
+  void *arg;
+  ntlink_task_group *group;
+  /* Allocations are counted for the function that submitted the task */
+  int api;
+};
+
+typedef struct _pool_array pool_array;
+
+struct _pool_array
+{
+  /* Smaller arrays this one replaced. Thieves may still be reading
+   * them, so they are freed with the deque.
+   */
+  pool_array *retired;
+  ULONG mask;
+  ntlink_task *tasks[1];
+};
+
+/* Chase-Lev deque. The owner pushes and pops at the bottom, other
+ * threads steal from the top. Indices only grow and wrap around.
+ */
+typedef struct
+{
+  volatile LONG top;
+  volatile LONG bottom;
+  pool_array * volatile array;
+} pool_deque;
+
+typedef struct
+{
+  ntlink_pool *pool;
+  pool_deque deque;
+  HANDLE thread;
+  /* The worker that was robbed last, stealing starts there */
+  int victim;
+} pool_worker;
+
+struct _ntlink_task_group
+{
+  ntlink_pool *pool;
+  /* Submitted tasks that have not finished yet */
+  volatile LONG pending;
+  /* At most that many tasks are in the pool at once, 0 - no limit */
+  int limit;
+  /* The rest waits here; only used with a limit */
+  CRITICAL_SECTION lock;
+  int active;
+  ntlink_task *head;
+  ntlink_task *tail;
+};
+
+struct _ntlink_pool
+{
+  int nworkers;
+  pool_worker *workers;
+  int have_executor;
+  ntlink_executor executor;
+  /* Executor calls that have not returned yet */
+  int tokens;
+  /* Tasks from threads that are not workers of this pool */
+  CRITICAL_SECTION inject_lock;
+  ntlink_task *inject_head;
+  ntlink_task *inject_tail;
+  /* Tasks in the deques and in the injection queue */
+  volatile LONG queued;
+  /* Idle workers and threads waiting for a group */
+  volatile LONG sleeping;
+  /* Protects nothing but the sleeping, signalled when a task is queued,
+   * a group finishes or the pool is shutting down.
+   */
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE wake;
+  int shutdown;
+  int shared;
+  /* ntlink_pool_submit() tasks */
+  ntlink_task_group group;
+};
+
+/* The pool_worker of the current thread */
+static DWORD pool_worker_index = FLS_OUT_OF_INDEXES;
+
+static ntlink_pool * volatile pool_shared = NULL;
+static int pool_shared_size = 0;
+static int pool_shared_have_executor = 0;
+static ntlink_executor pool_shared_executor;
+
+/**
+ * ntlink_pool_default_size:
+ *
+ * Returns:
+ * the number of logical processors (at least 1)
+ */
+int
+ntlink_pool_default_size (void)
+{
+  SYSTEM_INFO si;
+  GetSystemInfo (&si);
+  if (si.dwNumberOfProcessors < 1)
+    return 1;
+  return si.dwNumberOfProcessors;
+}
+
+static pool_array *
+pool_array_new (ULONG size)
+{
+  pool_array *a;
+  a = (pool_array *) ntlink_malloc (sizeof (pool_array) + sizeof (ntlink_task *) * (size - 1));
+  if (a == NULL)
+    return NULL;
+  a->retired = NULL;
+  a->mask = size - 1;
+  return a;
+}
+
+static void
+pool_array_free (pool_array *a)
+{
+  while (a != NULL)
+  {
+    pool_array *retired = a->retired;
+    ntlink_free (a);
+    a = retired;
+  }
+}
+
+/* Owner only. Returns -1 if the deque is full and can't grow */
+static int
+deque_push (pool_deque *d, ntlink_task *task)
+{
+  LONG b = d->bottom;
+  LONG t = d->top;
+  pool_array *a = d->array;
+
+  if ((ULONG) b - (ULONG) t > a->mask)
+  {
+    pool_array *grown = pool_array_new ((a->mask + 1) * 2);
+    LONG i;
+    if (grown == NULL)
+      return -1;
+    for (i = t; i != b; i++)
+      grown->tasks[(ULONG) i & grown->mask] = a->tasks[(ULONG) i & a->mask];
+    grown->retired = a;
+    MemoryBarrier ();
+    d->array = grown;
+    a = grown;
+  }
+  a->tasks[(ULONG) b & a->mask] = task;
+  MemoryBarrier ();
+  d->bottom = b + 1;
+  return 0;
+}
+
+/* Owner only */
+static ntlink_task *
+deque_pop (pool_deque *d)
+{
+  LONG b = d->bottom - 1;
+  LONG t, size;
+  pool_array *a = d->array;
+  ntlink_task *task;
+
+  InterlockedExchange (&d->bottom, b);
+  t = d->top;
+  size = (LONG) ((ULONG) b - (ULONG) t);
+  if (size < 0)
+  {
+    d->bottom = b + 1;
+    return NULL;
+  }
+  task = a->tasks[(ULONG) b & a->mask];
+  if (size > 0)
+    return task;
+  /* The last one, thieves may be after it too */
+  if (InterlockedCompareExchange (&d->top, t + 1, t) != t)
+    task = NULL;
+  d->bottom = b + 1;
+  return task;
+}
+
+/* Any thread. Returns NULL if the deque is empty or another thread won */
+static ntlink_task *
+deque_steal (pool_deque *d)
+{
+  LONG t = d->top;
+  LONG b;
+  pool_array *a;
+  ntlink_task *task;
+
+  MemoryBarrier ();
+  b = d->bottom;
+  if ((LONG) ((ULONG) b - (ULONG) t) <= 0)
+    return NULL;
+  MemoryBarrier ();
+  a = d->array;
+  task = a->tasks[(ULONG) t & a->mask];
+  if (InterlockedCompareExchange (&d->top, t + 1, t) != t)
+    return NULL;
+  return task;
+}
+
+static pool_worker *
+pool_current_worker (ntlink_pool *pool)
+{
+  pool_worker *self;
+  if (pool->nworkers == 0)
+    return NULL;
+  self = (pool_worker *) FlsGetValue (pool_worker_index);
+  if (self == NULL || self->pool != pool)
+    return NULL;
+  return self;
+}
+
+static void
+pool_wake_one (ntlink_pool *pool)
+{
+  if (pool->sleeping == 0)
+    return;
+  EnterCriticalSection (&pool->lock);
+  WakeConditionVariable (&pool->wake);
+  LeaveCriticalSection (&pool->lock);
+}
+
+static void pool_run_one (void *arg);
+
+/* Puts a task into the deque of the current worker, or into the
+ * injection queue if it is not a worker of @pool.
+ */
+static void
+pool_push (ntlink_pool *pool, ntlink_task *task)
+{
+  pool_worker *self = pool_current_worker (pool);
+
+  InterlockedIncrement (&pool->queued);
+  if (self == NULL || deque_push (&self->deque, task) != 0)
+  {
+    task->next = NULL;
+    EnterCriticalSection (&pool->inject_lock);
+    if (pool->inject_tail != NULL)
+      pool->inject_tail->next = task;
+    else
+      pool->inject_head = task;
+    pool->inject_tail = task;
+    LeaveCriticalSection (&pool->inject_lock);
+  }
+
+  if (pool->have_executor)
+  {
+    EnterCriticalSection (&pool->lock);
+    pool->tokens += 1;
+    LeaveCriticalSection (&pool->lock);
+    if (pool->executor.submit (pool_run_one, pool, pool->executor.userdata) == 0)
+      return;
+    /* The task stays queued for the threads that wait for its group */
+    EnterCriticalSection (&pool->lock);
+    pool->tokens -= 1;
+    LeaveCriticalSection (&pool->lock);
+  }
+  pool_wake_one (pool);
+}
+
+/* Takes a task: from the own deque first (the most recent one), then from
+ * the injection queue, then from the other workers (their oldest ones).
+ */
+static ntlink_task *
+pool_find (ntlink_pool *pool, pool_worker *self)
+{
+  ntlink_task *task = NULL;
+  int i, n = pool->nworkers;
+
+  if (pool->queued == 0)
+    return NULL;
+
+  if (self != NULL)
+    task = deque_pop (&self->deque);
+
+  if (task == NULL && pool->inject_head != NULL)
+  {
+    EnterCriticalSection (&pool->inject_lock);
+    task = pool->inject_head;
+    if (task != NULL)
+    {
+      pool->inject_head = task->next;
+      if (pool->inject_head == NULL)
+        pool->inject_tail = NULL;
+    }
+    LeaveCriticalSection (&pool->inject_lock);
+  }
+
+  for (i = 0; task == NULL && i < n; i++)
+  {
+    int v = ((self != NULL ? self->victim : (int) (GetCurrentThreadId () % n)) + i) % n;
+    if (&pool->workers[v] == self)
+      continue;
+    task = deque_steal (&pool->workers[v].deque);
+    if (task != NULL && self != NULL)
+      self->victim = v;
+  }
+
+  if (task != NULL)
+    InterlockedDecrement (&pool->queued);
+  return task;
+}
+
+/* Runs @task and, for a limited group, the tasks of the group that
+ * queued up behind it.
+ */
+static void
+pool_run (ntlink_pool *pool, ntlink_task *task)
+{
+  ntlink_task_group *group = task->group;
+
+  while (task != NULL)
+  {
+    ntlink_task *next = NULL;
+
+    ntlink_alloc_enter (task->api);
+    task->func (task->arg);
+    ntlink_alloc_leave ();
+    ntlink_free (task);
+
+    if (group->limit > 0)
+    {
+      EnterCriticalSection (&group->lock);
+      next = group->head;
+      if (next != NULL)
+      {
+        group->head = next->next;
+        if (group->head == NULL)
+          group->tail = NULL;
+      }
+      else
+        group->active -= 1;
+      LeaveCriticalSection (&group->lock);
+    }
+
+    ntlink_task_group_release (group);
+    task = next;
+  }
+}
+
+static void
+pool_run_one (void *arg)
+{
+  ntlink_pool *pool = (ntlink_pool *) arg;
+  ntlink_task *task;
+
+  /* Whoever waits for the group may have taken it already */
+  task = pool_find (pool, NULL);
+  if (task != NULL)
+    pool_run (pool, task);
+
+  EnterCriticalSection (&pool->lock);
+  pool->tokens -= 1;
+  if (pool->tokens == 0)
+    WakeAllConditionVariable (&pool->wake);
+  LeaveCriticalSection (&pool->lock);
+}
+
+static DWORD WINAPI
+pool_worker_main (LPVOID data)
+{
+  pool_worker *self = (pool_worker *) data;
+  ntlink_pool *pool = self->pool;
+  ntlink_task *task;
+
+  FlsSetValue (pool_worker_index, self);
+  while (1)
+  {
+    task = pool_find (pool, self);
+    if (task != NULL)
+    {
+      pool_run (pool, task);
+      continue;
+    }
+    /* Paired with the increment of queued in pool_push() */
+    InterlockedIncrement (&pool->sleeping);
+    EnterCriticalSection (&pool->lock);
+    while (pool->queued == 0 && !pool->shutdown)
+      SleepConditionVariableCS (&pool->wake, &pool->lock, INFINITE);
+    LeaveCriticalSection (&pool->lock);
+    InterlockedDecrement (&pool->sleeping);
+    if (pool->shutdown && pool->queued == 0)
+      break;
+  }
+  FlsSetValue (pool_worker_index, NULL);
+  return 0;
+}
+
+static void
+pool_group_init (ntlink_task_group *group, ntlink_pool *pool, int limit)
+{
+  memset (group, 0, sizeof (ntlink_task_group));
+  group->pool = pool;
+  group->limit = limit > 0 ? limit : 0;
+  InitializeCriticalSection (&group->lock);
+}
+
+static ntlink_pool *
+pool_alloc (void)
+{
+  ntlink_pool *pool;
+
+  if (pool_worker_index == FLS_OUT_OF_INDEXES)
+  {
+    DWORD index = FlsAlloc (NULL);
+    if (index == FLS_OUT_OF_INDEXES)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+    if (InterlockedCompareExchange ((LONG volatile *) &pool_worker_index, (LONG) index, (LONG) FLS_OUT_OF_INDEXES) != (LONG) FLS_OUT_OF_INDEXES)
+      FlsFree (index);
+  }
+
+  pool = (ntlink_pool *) ntlink_malloc (sizeof (ntlink_pool));
+  if (pool == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset (pool, 0, sizeof (ntlink_pool));
+  InitializeCriticalSection (&pool->inject_lock);
+  InitializeCriticalSection (&pool->lock);
+  InitializeConditionVariable (&pool->wake);
+  pool_group_init (&pool->group, pool, 0);
+  return pool;
+}
+
+static void
+pool_release (ntlink_pool *pool)
+{
+  int i;
+  for (i = 0; i < pool->nworkers; i++)
+    pool_array_free (pool->workers[i].deque.array);
+  DeleteCriticalSection (&pool->group.lock);
+  DeleteCriticalSection (&pool->inject_lock);
+  DeleteCriticalSection (&pool->lock);
+  ntlink_free (pool->workers);
+  ntlink_free (pool);
+}
+
+/**
+ * ntlink_pool_new:
+ * @nthreads: number of worker threads. 0 or less means
+ *   ntlink_pool_default_size().
+ *
+ * Creates a pool of worker threads. Each worker has a deque of its own:
+ * tasks submitted from within a task go there and are taken back most
+ * recent first, idle workers steal the oldest tasks from the others.
+ * Tasks submitted from other threads go into a common queue.
+ * Free the pool with ntlink_pool_free() when it is no longer needed.
+ *
+ * The library runs its own parallel work on ntlink_pool_shared().
+ *
+ * Returns:
+ * NULL - failed to allocate memory or to start the threads (errno is set)
+ * non-NULL - the pool
+ */
+ntlink_pool *
+ntlink_pool_new (int nthreads)
+{
+  ntlink_pool *pool;
+  int i;
+
+  if (nthreads <= 0)
+    nthreads = ntlink_pool_default_size ();
+
+  pool = pool_alloc ();
+  if (pool == NULL)
+    return NULL;
+  pool->workers = (pool_worker *) ntlink_calloc (nthreads, sizeof (pool_worker));
+  if (pool->workers == NULL)
+  {
+    pool_release (pool);
+    errno = ENOMEM;
+    return NULL;
+  }
+  for (i = 0; i < nthreads; i++)
+  {
+    pool->workers[i].pool = pool;
+    pool->workers[i].victim = (i + 1) % nthreads;
+    pool->workers[i].deque.array = pool_array_new (POOL_DEQUE_SIZE);
+    if (pool->workers[i].deque.array == NULL)
+      break;
+  }
+  if (i < nthreads)
+  {
+    pool->nworkers = nthreads;
+    pool_release (pool);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  pool->nworkers = nthreads;
+  for (i = 0; i < nthreads; i++)
+  {
+    pool->workers[i].thread = CreateThread (NULL, 0, pool_worker_main, &pool->workers[i], 0, NULL);
+    if (pool->workers[i].thread == NULL)
+      break;
+  }
+  /* Nothing is pushed into the deques of workers that did not start,
+   * the pool can do with the ones that did.
+   */
+  if (i == 0)
+  {
+    pool_release (pool);
+    errno = EAGAIN;
+    return NULL;
+  }
+
+  return pool;
+}
+
+/**
+ * ntlink_pool_new_executor:
+ * @executor: the executor to run the tasks on
+ *
+ * Creates a pool that starts no threads: each task submitted to it is
+ * handed to @executor. Tasks that @executor refuses are run by the
+ * threads that wait for them (ntlink_pool_wait() and
+ * ntlink_task_group_wait() help with queued tasks in any pool).
+ * Free the pool with ntlink_pool_free() when it is no longer needed.
+ *
+ * Returns:
+ * NULL - failed to allocate memory (errno is set)
+ * non-NULL - the pool
+ */
+ntlink_pool *
+ntlink_pool_new_executor (const ntlink_executor *executor)
+{
+  ntlink_pool *pool;
+
+  if (executor == NULL || executor->submit == NULL)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  pool = pool_alloc ();
+  if (pool == NULL)
+    return NULL;
+  pool->have_executor = 1;
+  pool->executor = *executor;
+  return pool;
+}
+
+/**
+ * ntlink_pool_size:
+ * @pool: a pool
+ *
+ * Returns:
+ * the number of worker threads of @pool, 0 if it runs on an executor
+ */
+int
+ntlink_pool_size (const ntlink_pool *pool)
+{
+  return pool->nworkers;
+}
+
+/**
+ * ntlink_pool_submit:
+ * @pool: a pool
+ * @func: function to run
+ * @arg: argument for @func
+ *
+ * Queues @func (@arg) for execution. Can be called from within a task.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+ntlink_pool_submit (ntlink_pool *pool, ntlink_task_func func, void *arg)
+{
+  return ntlink_task_group_submit (&pool->group, func, arg);
+}
+
+/**
+ * ntlink_pool_wait:
+ * @pool: a pool
+ *
+ * Blocks until every task submitted with ntlink_pool_submit(), including
+ * the tasks submitted by other tasks while waiting, has finished.
+ * Must not be called from within such a task.
+ */
+void
+ntlink_pool_wait (ntlink_pool *pool)
+{
+  ntlink_task_group_wait (&pool->group);
+}
+
+/**
+ * ntlink_pool_free:
+ * @pool: a pool
+ *
+ * Waits for all ntlink_pool_submit() tasks to finish, stops the worker
+ * threads and frees @pool. Task groups of @pool must be freed before.
+ * Does nothing for ntlink_pool_shared().
+ */
+void
+ntlink_pool_free (ntlink_pool *pool)
+{
+  int i;
+
+  if (pool == NULL || pool->shared)
+    return;
+
+  ntlink_pool_wait (pool);
+
+  EnterCriticalSection (&pool->lock);
+  pool->shutdown = 1;
+  WakeAllConditionVariable (&pool->wake);
+  /* The executor may still be about to look for a task */
+  while (pool->tokens > 0)
+    SleepConditionVariableCS (&pool->wake, &pool->lock, INFINITE);
+  LeaveCriticalSection (&pool->lock);
+
+  for (i = 0; i < pool->nworkers; i++)
+  {
+    if (pool->workers[i].thread == NULL)
+      continue;
+    WaitForSingleObject (pool->workers[i].thread, INFINITE);
+    CloseHandle (pool->workers[i].thread);
+  }
+
+  pool_release (pool);
+}
+
+/**
+ * ntlink_pool_configure_shared:
+ * @nthreads: number of worker threads of the shared pool. 0 or less
+ *   means ntlink_pool_default_size().
+ * @executor: if not NULL, the shared pool runs its tasks on @executor
+ *   instead, see ntlink_pool_new_executor()
+ *
+ * Sets up ntlink_pool_shared(). Must be called before the pool is first
+ * used, that is, before any function that runs things in parallel.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - the shared pool already exists (errno is EBUSY)
+ */
+int
+ntlink_pool_configure_shared (int nthreads, const ntlink_executor *executor)
+{
+  if (pool_shared != NULL)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  if (executor != NULL && executor->submit == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  pool_shared_size = nthreads;
+  pool_shared_have_executor = executor != NULL;
+  if (executor != NULL)
+    pool_shared_executor = *executor;
+  return 0;
+}
+
+/**
+ * ntlink_pool_shared:
+ *
+ * Returns the pool that the library runs its parallel work on
+ * (ntlink_symlink_batchw(), ntlink_remove_treew()...), creating it on
+ * the first call. Every operation gets a task group of its own, so they
+ * share the threads without waiting for each other's tasks.
+ * The shared pool lives until the process exits.
+ *
+ * Returns:
+ * NULL - failed to create the pool (errno is set)
+ * non-NULL - the pool
+ */
+ntlink_pool *
+ntlink_pool_shared (void)
+{
+  ntlink_pool *pool = pool_shared;
+
+  if (pool != NULL)
+    return pool;
+  if (pool_shared_have_executor)
+    pool = ntlink_pool_new_executor (&pool_shared_executor);
+  else
+    pool = ntlink_pool_new (pool_shared_size);
+  if (pool == NULL)
+    return NULL;
+  if (InterlockedCompareExchangePointer ((PVOID volatile *) &pool_shared, pool, NULL) != NULL)
+    ntlink_pool_free (pool);
+  else
+    pool->shared = 1;
+  return pool_shared;
+}
+
+/**
+ * ntlink_task_group_new:
+ * @pool: a pool, or NULL for ntlink_pool_shared()
+ * @limit: at most that many tasks of the group run at once, the rest
+ *   waits in the group. 0 or less means no limit.
+ *
+ * Creates a task group: tasks submitted to it run in @pool and
+ * ntlink_task_group_wait() waits for them only.
+ * Free the group with ntlink_task_group_free().
+ *
+ * Returns:
+ * NULL - failed to allocate memory or to create the pool (errno is set)
+ * non-NULL - the group
+ */
+ntlink_task_group *
+ntlink_task_group_new (ntlink_pool *pool, int limit)
+{
+  ntlink_task_group *group;
+
+  if (pool == NULL)
+    pool = ntlink_pool_shared ();
+  if (pool == NULL)
+    return NULL;
+  group = (ntlink_task_group *) ntlink_malloc (sizeof (ntlink_task_group));
+  if (group == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  pool_group_init (group, pool, limit);
+  return group;
+}
+
+/**
+ * ntlink_task_group_submit:
+ * @group: a group
+ * @func: function to run
+ * @arg: argument for @func
+ *
+ * Queues @func (@arg) for execution in the pool of @group.
+ * Can be called from within a task.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - failed to allocate memory
+ */
+int
+ntlink_task_group_submit (ntlink_task_group *group, ntlink_task_func func, void *arg)
+{
+  ntlink_task *task;
+
+  task = (ntlink_task *) ntlink_malloc (sizeof (ntlink_task));
+  if (task == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  task->next = NULL;
+  task->func = func;
+  task->arg = arg;
+  task->group = group;
+  task->api = ntlink_alloc_current ();
+
+  InterlockedIncrement (&group->pending);
+  if (group->limit > 0)
+  {
+    EnterCriticalSection (&group->lock);
+    if (group->active >= group->limit)
+    {
+      /* Runs after one of the active tasks, in the same thread */
+      if (group->tail != NULL)
+        group->tail->next = task;
+      else
+        group->head = task;
+      group->tail = task;
+      LeaveCriticalSection (&group->lock);
+      return 0;
+    }
+    group->active += 1;
+    LeaveCriticalSection (&group->lock);
+  }
+  pool_push (group->pool, task);
+
+  return 0;
+}
+
+/**
+ * ntlink_task_group_wait:
+ * @group: a group
+ *
+ * Blocks until every task of @group, including the tasks submitted to it
+ * by other tasks while waiting, has finished. Meanwhile the calling thread
+ * runs queued tasks of the pool (of any group).
+ * Can be called from within a task, but not from a task of @group.
+ */
+void
+ntlink_task_group_wait (ntlink_task_group *group)
+{
+  ntlink_pool *pool = group->pool;
+  pool_worker *self = pool_current_worker (pool);
+  ntlink_task *task;
+
+  while (group->pending > 0)
+  {
+    task = pool_find (pool, self);
+    if (task != NULL)
+    {
+      pool_run (pool, task);
+      continue;
+    }
+    InterlockedIncrement (&pool->sleeping);
+    EnterCriticalSection (&pool->lock);
+    while (group->pending > 0 && pool->queued == 0)
+      SleepConditionVariableCS (&pool->wake, &pool->lock, INFINITE);
+    LeaveCriticalSection (&pool->lock);
+    InterlockedDecrement (&pool->sleeping);
+  }
+
+  /* The wakeup for a queued task could have come here; pass it on */
+  if (pool->queued > 0)
+    pool_wake_one (pool);
+}
+
+/**
+ * ntlink_task_group_hold:
+ * @group: a group
+ *
+ * Makes ntlink_task_group_wait() wait as if a task was submitted to
+ * @group, until ntlink_task_group_release() is called.
+ */
+void
+ntlink_task_group_hold (ntlink_task_group *group)
+{
+  InterlockedIncrement (&group->pending);
+}
+
+/**
+ * ntlink_task_group_release:
+ * @group: a group
+ *
+ * Undoes ntlink_task_group_hold(); also called when a task finishes.
+ * @group may be freed as soon as this returns.
+ */
+void
+ntlink_task_group_release (ntlink_task_group *group)
+{
+  ntlink_pool *pool = group->pool;
+  if (InterlockedDecrement (&group->pending) == 0)
+  {
+    EnterCriticalSection (&pool->lock);
+    WakeAllConditionVariable (&pool->wake);
+    LeaveCriticalSection (&pool->lock);
+  }
+}
+
+/**
+ * ntlink_task_group_free:
+ * @group: a group
+ *
+ * Waits for the tasks of @group to finish and frees @group.
+ */
+void
+ntlink_task_group_free (ntlink_task_group *group)
+{
+  if (group == NULL)
+    return;
+  ntlink_task_group_wait (group);
+  DeleteCriticalSection (&group->lock);
+  ntlink_free (group);
+}
@@ -0,0 +1,73 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_THREADPOOL_H__
+#define __NTLINK_THREADPOOL_H__
+
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*ntlink_task_func) (void *arg);
+
+typedef struct _ntlink_pool ntlink_pool;
+typedef struct _ntlink_task_group ntlink_task_group;
+
+/**
+ * ntlink_executor:
+ * @submit: queues @func (@arg) for execution in a thread of the executor,
+ *   returns 0 on success and non-zero if it can't
+ * @userdata: passed to @submit
+ *
+ * A thread pool of the application that a pool can run its tasks on
+ * instead of starting threads of its own, see ntlink_pool_new_executor().
+ */
+typedef struct
+{
+  int (*submit) (ntlink_task_func func, void *arg, void *userdata);
+  void *userdata;
+} ntlink_executor;
+
+ntlink_pool *ntlink_pool_new (int nthreads);
+ntlink_pool *ntlink_pool_new_executor (const ntlink_executor *executor);
+int ntlink_pool_submit (ntlink_pool *pool, ntlink_task_func func, void *arg);
+void ntlink_pool_wait (ntlink_pool *pool);
+void ntlink_pool_free (ntlink_pool *pool);
+int ntlink_pool_size (const ntlink_pool *pool);
+int ntlink_pool_default_size (void);
+
+int ntlink_pool_configure_shared (int nthreads, const ntlink_executor *executor);
+ntlink_pool *ntlink_pool_shared (void);
+
+ntlink_task_group *ntlink_task_group_new (ntlink_pool *pool, int limit);
+int ntlink_task_group_submit (ntlink_task_group *group, ntlink_task_func func, void *arg);
+void ntlink_task_group_wait (ntlink_task_group *group);
+void ntlink_task_group_free (ntlink_task_group *group);
+
+/* Used by the library to keep a group waiting for tasks it submits later */
+void ntlink_task_group_hold (ntlink_task_group *group);
+void ntlink_task_group_release (ntlink_task_group *group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_THREADPOOL_H__ */
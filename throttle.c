@@ -0,0 +1,273 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <windows.h>
+
+#include "throttle.h"
+#include "iosched.h"
+#include "alloc.h"
+
+/* Older headers don't have the background mode (Vista and later) */
+#ifndef THREAD_MODE_BACKGROUND_BEGIN
+#define THREAD_MODE_BACKGROUND_BEGIN 0x00010000
+#define THREAD_MODE_BACKGROUND_END   0x00020000
+#endif
+
+/* Seconds of full speed after a pause, by default */
+#define THROTTLE_DEFAULT_BURST 0.1
+
+typedef struct
+{
+  /* Tokens per second, 0 if there is no limit */
+  double rate;
+  double capacity;
+  /* Negative while the threads owe time */
+  double tokens;
+  LONGLONG last;
+} throttle_bucket;
+
+struct _ntlink_throttle
+{
+  int background;
+  CRITICAL_SECTION lock;
+  LONGLONG freq;
+  throttle_bucket ops;
+  throttle_bucket bytes;
+  ntlink_throttle_info info;
+};
+
+/*
+ * Nesting depth of ntlink_throttle_begin() in the current thread, times
+ * two, plus one if the outermost call put the thread in the background
+ * (it is not taken out of it by us if it was there already)
+ */
+static DWORD throttle_depth_index = FLS_OUT_OF_INDEXES;
+
+static void
+throttle_bucket_init (throttle_bucket *b, double rate, double burst, LONGLONG now)
+{
+  if (rate <= 0)
+  {
+    memset (b, 0, sizeof (throttle_bucket));
+    return;
+  }
+  b->rate = rate;
+  b->capacity = rate * burst;
+  /* The smallest charge must fit, or every charge would wait */
+  if (b->capacity < 1.0)
+    b->capacity = 1.0;
+  b->tokens = b->capacity;
+  b->last = now;
+}
+
+/* Returns the seconds to wait until the bucket is out of debt */
+static double
+throttle_bucket_take (throttle_bucket *b, LONGLONG now, LONGLONG freq, double amount)
+{
+  if (b->rate <= 0)
+    return 0;
+  /* Other threads may have read the clock later, but taken the lock first */
+  if (now > b->last)
+  {
+    b->tokens += (double) (now - b->last) / freq * b->rate;
+    if (b->tokens > b->capacity)
+      b->tokens = b->capacity;
+    b->last = now;
+  }
+  b->tokens -= amount;
+  return b->tokens < 0 ? -b->tokens / b->rate : 0;
+}
+
+/**
+ * ntlink_throttle_new:
+ * @settings: what to do, see ntlink_throttle_settings
+ *
+ * Creates a throttle, to be given to walk_set_throttle(),
+ * RemoveTreeOptions.throttle and the like. The operations charge it as
+ * they work and wait whenever they are ahead of the rates; the first
+ * ntlink_throttle_settings.burst seconds worth of work never waits.
+ *
+ * Returns:
+ * a new throttle, or NULL (errno is EINVAL or ENOMEM)
+ */
+ntlink_throttle *
+ntlink_throttle_new (const ntlink_throttle_settings *settings)
+{
+  ntlink_throttle *throttle;
+  LARGE_INTEGER freq, now;
+  double burst;
+
+  if (settings == NULL)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (throttle_depth_index == FLS_OUT_OF_INDEXES)
+  {
+    DWORD index = FlsAlloc (NULL);
+    if (index == FLS_OUT_OF_INDEXES)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+    if (InterlockedCompareExchange ((LONG volatile *) &throttle_depth_index, (LONG) index, (LONG) FLS_OUT_OF_INDEXES) != (LONG) FLS_OUT_OF_INDEXES)
+      FlsFree (index);
+  }
+
+  throttle = (ntlink_throttle *) ntlink_calloc (1, sizeof (ntlink_throttle));
+  if (throttle == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&now);
+  burst = settings->burst > 0 ? settings->burst : THROTTLE_DEFAULT_BURST;
+  throttle->background = settings->background != 0;
+  throttle->freq = freq.QuadPart;
+  throttle_bucket_init (&throttle->ops, settings->ops_per_sec, burst, now.QuadPart);
+  throttle_bucket_init (&throttle->bytes, settings->bytes_per_sec, burst, now.QuadPart);
+  InitializeCriticalSection (&throttle->lock);
+  return throttle;
+}
+
+/**
+ * ntlink_throttle_free:
+ * @throttle: a throttle, can be NULL
+ *
+ * Frees @throttle. The operations that use it must be finished.
+ */
+void
+ntlink_throttle_free (ntlink_throttle *throttle)
+{
+  if (throttle == NULL)
+    return;
+  DeleteCriticalSection (&throttle->lock);
+  ntlink_free (throttle);
+}
+
+/**
+ * ntlink_throttle_get_info:
+ * @throttle: a throttle
+ * @info: filled with what @throttle has seen so far
+ */
+void
+ntlink_throttle_get_info (ntlink_throttle *throttle, ntlink_throttle_info *info)
+{
+  EnterCriticalSection (&throttle->lock);
+  *info = throttle->info;
+  LeaveCriticalSection (&throttle->lock);
+}
+
+/**
+ * ntlink_throttle_begin:
+ * @throttle: a throttle, can be NULL
+ *
+ * Puts the current thread in the background mode if @throttle asks for
+ * it, until the matching ntlink_throttle_end(). Calls can be nested.
+ * Handles opened meanwhile keep the low I/O priority until they are
+ * closed, so the work has to be done between the two calls.
+ */
+void
+ntlink_throttle_begin (ntlink_throttle *throttle)
+{
+  LONG_PTR depth;
+
+  if (throttle == NULL || !throttle->background)
+    return;
+  depth = (LONG_PTR) FlsGetValue (throttle_depth_index);
+  if (depth == 0 && SetThreadPriority (GetCurrentThread (), THREAD_MODE_BACKGROUND_BEGIN))
+    depth = 1;
+  FlsSetValue (throttle_depth_index, (PVOID) (depth + 2));
+}
+
+/**
+ * ntlink_throttle_end:
+ * @throttle: the throttle given to ntlink_throttle_begin()
+ *
+ * Undoes ntlink_throttle_begin().
+ */
+void
+ntlink_throttle_end (ntlink_throttle *throttle)
+{
+  LONG_PTR depth;
+
+  if (throttle == NULL || !throttle->background)
+    return;
+  depth = (LONG_PTR) FlsGetValue (throttle_depth_index);
+  if (depth < 2)
+    return;
+  depth -= 2;
+  if (depth == 1)
+  {
+    SetThreadPriority (GetCurrentThread (), THREAD_MODE_BACKGROUND_END);
+    depth = 0;
+  }
+  FlsSetValue (throttle_depth_index, (PVOID) depth);
+}
+
+/**
+ * ntlink_throttle_charge:
+ * @throttle: a throttle, can be NULL
+ * @ops: operations done
+ * @bytes: bytes read
+ *
+ * Accounts for work that was just done, and waits if it went over the
+ * rates of @throttle. Work is charged after the fact so that a single
+ * big charge (a long link target) waits for as long as it deserves
+ * instead of never fitting. The wait is not counted as I/O latency
+ * (see ntlink_io_add_idle()).
+ */
+void
+ntlink_throttle_charge (ntlink_throttle *throttle, unsigned int ops, unsigned long long bytes)
+{
+  LARGE_INTEGER now, after;
+  double wait, bytes_wait;
+
+  if (throttle == NULL)
+    return;
+
+  QueryPerformanceCounter (&now);
+  EnterCriticalSection (&throttle->lock);
+  throttle->info.ops += ops;
+  throttle->info.bytes += bytes;
+  wait = throttle_bucket_take (&throttle->ops, now.QuadPart, throttle->freq, (double) ops);
+  bytes_wait = throttle_bucket_take (&throttle->bytes, now.QuadPart, throttle->freq, (double) bytes);
+  if (bytes_wait > wait)
+    wait = bytes_wait;
+  LeaveCriticalSection (&throttle->lock);
+
+  /* Smaller debts are paid by the next charge */
+  if (wait < 0.001)
+    return;
+
+  Sleep ((DWORD) (wait * 1000));
+  QueryPerformanceCounter (&after);
+  ntlink_io_add_idle (after.QuadPart - now.QuadPart);
+
+  EnterCriticalSection (&throttle->lock);
+  throttle->info.waits += 1;
+  throttle->info.wait_msec += (unsigned long long) ((after.QuadPart - now.QuadPart) * 1000 / throttle->freq);
+  LeaveCriticalSection (&throttle->lock);
+}
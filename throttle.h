@@ -0,0 +1,93 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __NTLINK_THROTTLE_H__
+#define __NTLINK_THROTTLE_H__
+
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ntlink_throttle:
+ *
+ * Keeps a long-running operation (a tree walk, a backup, a verification,
+ * a tree removal) in the background, so that it does not slow down the
+ * foreground work on the same volumes: its threads run in the background
+ * processing mode while they do its work (low I/O and memory priority,
+ * see SetThreadPriority()), and its filesystem work is held to a number
+ * of operations and bytes per second (token buckets).
+ * One throttle can be shared by several operations, they then share the
+ * rates; it can be used from any thread.
+ */
+typedef struct _ntlink_throttle ntlink_throttle;
+
+/**
+ * ntlink_throttle_settings:
+ * @background: if non-zero, the threads run in the background mode
+ *   while they work for the operation
+ * @ops_per_sec: operations per second, 0 or less means no limit;
+ *   an operation is one item handled: a directory entry listed, a file,
+ *   link or directory removed, a link read
+ * @bytes_per_sec: bytes per second, 0 or less means no limit; the bytes
+ *   are those of the names listed and of the link targets read (the
+ *   library reads no file contents)
+ * @burst: how long the operation may run at full speed after being
+ *   idle, in seconds; 0 or less means 0.1
+ */
+typedef struct
+{
+  int background;
+  double ops_per_sec;
+  double bytes_per_sec;
+  double burst;
+} ntlink_throttle_settings;
+
+/**
+ * ntlink_throttle_info:
+ * @ops: operations charged
+ * @bytes: bytes charged
+ * @waits: times a thread had to wait
+ * @wait_msec: milliseconds spent waiting, summed over the threads
+ */
+typedef struct
+{
+  unsigned long long ops;
+  unsigned long long bytes;
+  unsigned long long waits;
+  unsigned long long wait_msec;
+} ntlink_throttle_info;
+
+ntlink_throttle *ntlink_throttle_new (const ntlink_throttle_settings *settings);
+void ntlink_throttle_free (ntlink_throttle *throttle);
+void ntlink_throttle_get_info (ntlink_throttle *throttle, ntlink_throttle_info *info);
+
+/* Used by the library to do the work of the operations in the background */
+void ntlink_throttle_begin (ntlink_throttle *throttle);
+void ntlink_throttle_end (ntlink_throttle *throttle);
+void ntlink_throttle_charge (ntlink_throttle *throttle, unsigned int ops, unsigned long long bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_THROTTLE_H__ */
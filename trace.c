@@ -0,0 +1,587 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h>
+#include <windows.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "alloc.h"
+
+/*
+ * Trace format, all numbers little-endian:
+ *   header: "NTLTRACE", u32 version (1), u32 reserved (0)
+ *   records, each:
+ *     u32 size of the record, in bytes, including this field
+ *     u8 api (ntlink_stats_api)
+ *     u8 flags (TRACE_FLAG_*)
+ *     u8 strings present (bit N - string N)
+ *     u8 reserved (0)
+ *     u32 thread id
+ *     u64 start, ns since the trace was started
+ *     u64 duration, ns
+ *     i64 result
+ *     i32 errno
+ *     i32 arg1
+ *     i32 arg2
+ *     the strings present, each: u32 length in UTF-16 units, UTF-16 units
+ */
+#define TRACE_MAGIC "NTLTRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+#define TRACE_RECORD_SIZE 48
+#define TRACE_FLAG_NESTED 0x01
+
+/* Big enough for any record (three strings of 32767 characters) */
+#define TRACE_MIN_BUFFER (256 * 1024)
+
+volatile int ntlink_trace_active = 0;
+
+/*
+ * trace_lock protects everything below. In file mode trace_buf collects
+ * records until it is full, then is written out; in ring mode it keeps
+ * the newest records that fit, trace_head being the oldest one.
+ */
+static SRWLOCK trace_lock;
+static DWORD trace_depth_index = FLS_OUT_OF_INDEXES;
+static FILE *trace_file = NULL;
+static unsigned char *trace_buf = NULL;
+static size_t trace_size = 0;
+static size_t trace_head = 0;
+static size_t trace_used = 0;
+static int trace_failed = 0;
+static LONGLONG trace_origin = 0;
+static LONGLONG trace_freq = 1;
+
+static void
+trace_put (const unsigned char *data, size_t len)
+{
+  size_t tail = (trace_head + trace_used) % trace_size;
+  size_t first = trace_size - tail < len ? trace_size - tail : len;
+  memcpy (&trace_buf[tail], data, first);
+  memcpy (trace_buf, &data[first], len - first);
+  trace_used += len;
+}
+
+static void
+trace_u32 (unsigned char *p, unsigned long v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = (v >> 24) & 0xFF;
+}
+
+static void
+trace_u64 (unsigned char *p, unsigned long long v)
+{
+  trace_u32 (p, (unsigned long) (v & 0xFFFFFFFF));
+  trace_u32 (&p[4], (unsigned long) (v >> 32));
+}
+
+static unsigned long
+trace_get_u32 (const unsigned char *p)
+{
+  return (unsigned long) p[0] | (unsigned long) p[1] << 8 |
+      (unsigned long) p[2] << 16 | (unsigned long) p[3] << 24;
+}
+
+static unsigned long long
+trace_get_u64 (const unsigned char *p)
+{
+  return (unsigned long long) trace_get_u32 (p) | (unsigned long long) trace_get_u32 (&p[4]) << 32;
+}
+
+/* Length of @s in UTF-16 units */
+static size_t
+trace_units (const wchar_t *s)
+{
+  size_t n = 0;
+  for (; *s != L'\0'; s++)
+    n += (unsigned long) *s > 0xFFFF ? 2 : 1;
+  return n;
+}
+
+static void
+trace_put_string (const wchar_t *s, size_t units)
+{
+  unsigned char chunk[256];
+  size_t n = 0;
+  unsigned long c;
+
+  trace_u32 (chunk, (unsigned long) units);
+  trace_put (chunk, 4);
+  for (; *s != L'\0'; s++)
+  {
+    c = (unsigned long) *s;
+    if (c > 0xFFFF)
+    {
+      c -= 0x10000;
+      chunk[n++] = (0xD800 | (c >> 10)) & 0xFF;
+      chunk[n++] = (0xD800 | (c >> 10)) >> 8;
+      c = 0xDC00 | (c & 0x3FF);
+    }
+    chunk[n++] = c & 0xFF;
+    chunk[n++] = (c >> 8) & 0xFF;
+    if (n + 4 > sizeof (chunk))
+    {
+      trace_put (chunk, n);
+      n = 0;
+    }
+  }
+  trace_put (chunk, n);
+}
+
+static int
+trace_flush (void)
+{
+  if (trace_used > 0 && fwrite (trace_buf, 1, trace_used, trace_file) != trace_used)
+    trace_failed = 1;
+  trace_used = 0;
+  return trace_failed ? -1 : 0;
+}
+
+static int
+trace_write_header (FILE *f)
+{
+  unsigned char header[TRACE_HEADER_SIZE];
+  memcpy (header, TRACE_MAGIC, 8);
+  trace_u32 (&header[8], TRACE_VERSION);
+  trace_u32 (&header[12], 0);
+  return fwrite (header, 1, sizeof (header), f) == sizeof (header) ? 0 : -1;
+}
+
+/**
+ * ntlink_trace_start:
+ * @filename: file to write the trace to, or NULL to keep it in memory
+ * @bufsize: size of the buffer, in bytes (at least 256 KiB is used).
+ *   Without @filename that is how much of the trace is kept: when it is
+ *   full the oldest records are dropped to make room (see
+ *   ntlink_trace_save())
+ *
+ * Starts recording every call to a public function (see ntlink_stats_api):
+ * its arguments, result and timing. Records are only added to the buffer
+ * under a lock, they are written out when it is full, so tracing is
+ * meant for diagnostics rather than for running all the time. Read the
+ * trace with ntlink_trace_load(), replay it with the replay tool.
+ *
+ * Returns:
+ *  0 - success
+ * -1 - @filename can't be created (errno is set)
+ * -2 - out of memory or FLS slots
+ * -3 - a trace is already being recorded
+ */
+int
+ntlink_trace_start (const wchar_t *filename, size_t bufsize)
+{
+  LARGE_INTEGER now;
+  int r = 0;
+
+  if (bufsize < TRACE_MIN_BUFFER)
+    bufsize = TRACE_MIN_BUFFER;
+  AcquireSRWLockExclusive (&trace_lock);
+  if (trace_buf != NULL)
+    r = -3;
+  if (r == 0 && trace_depth_index == FLS_OUT_OF_INDEXES)
+  {
+    trace_depth_index = FlsAlloc (NULL);
+    if (trace_depth_index == FLS_OUT_OF_INDEXES)
+      r = -2;
+  }
+  if (r == 0)
+  {
+    trace_buf = (unsigned char *) ntlink_malloc (bufsize);
+    if (trace_buf == NULL)
+      r = -2;
+  }
+  if (r == 0 && filename != NULL)
+  {
+    trace_file = _wfopen (filename, L"wb");
+    if (trace_file == NULL || trace_write_header (trace_file) != 0)
+    {
+      if (trace_file != NULL)
+        fclose (trace_file);
+      trace_file = NULL;
+      ntlink_free (trace_buf);
+      trace_buf = NULL;
+      r = -1;
+    }
+  }
+  if (r == 0)
+  {
+    trace_size = bufsize;
+    trace_head = 0;
+    trace_used = 0;
+    trace_failed = 0;
+    QueryPerformanceFrequency (&now);
+    trace_freq = now.QuadPart;
+    QueryPerformanceCounter (&now);
+    trace_origin = now.QuadPart;
+    ntlink_trace_active = 1;
+  }
+  ReleaseSRWLockExclusive (&trace_lock);
+  return r;
+}
+
+/**
+ * ntlink_trace_save:
+ * @f: a file to write to
+ *
+ * Writes the records kept in memory to @f, in the format
+ * ntlink_trace_load() reads. Tracing goes on.
+ *
+ * Returns:
+ * 0 on success, -1 on write error or if the trace is not kept in
+ * memory (started with a file name, or not started)
+ */
+int
+ntlink_trace_save (FILE *f)
+{
+  size_t first;
+  int r = 0;
+
+  AcquireSRWLockExclusive (&trace_lock);
+  if (trace_buf == NULL || trace_file != NULL)
+    r = -1;
+  else
+  {
+    first = trace_size - trace_head < trace_used ? trace_size - trace_head : trace_used;
+    if (trace_write_header (f) != 0 ||
+        fwrite (&trace_buf[trace_head], 1, first, f) != first ||
+        fwrite (trace_buf, 1, trace_used - first, f) != trace_used - first)
+      r = -1;
+  }
+  ReleaseSRWLockExclusive (&trace_lock);
+  return r;
+}
+
+/**
+ * ntlink_trace_stop:
+ *
+ * Stops tracing, writes the rest of the trace out and closes its file.
+ * Records kept in memory are discarded, save them first.
+ *
+ * Returns:
+ * 0 on success, -1 if some records could not be written
+ */
+int
+ntlink_trace_stop (void)
+{
+  int r = 0;
+
+  AcquireSRWLockExclusive (&trace_lock);
+  ntlink_trace_active = 0;
+  if (trace_file != NULL)
+  {
+    r = trace_flush ();
+    if (fclose (trace_file) != 0)
+      r = -1;
+    trace_file = NULL;
+  }
+  ntlink_free (trace_buf);
+  trace_buf = NULL;
+  ReleaseSRWLockExclusive (&trace_lock);
+  return r;
+}
+
+/**
+ * ntlink_trace_enter:
+ *
+ * Called by ntlink_stats_begin() while tracing, to tell the calls made by
+ * other public functions from those made by the application.
+ */
+void
+ntlink_trace_enter (void)
+{
+  DWORD lerr = GetLastError ();
+  INT_PTR depth = (INT_PTR) FlsGetValue (trace_depth_index);
+  FlsSetValue (trace_depth_index, (PVOID) (depth + 1));
+  SetLastError (lerr);
+}
+
+/**
+ * ntlink_trace_call:
+ * @api: the function that was called
+ * @start: what ntlink_stats_begin() returned when it was called
+ * @result: what it returned
+ * @arg1: an integer argument
+ * @arg2: another integer argument
+ * @s1: a string argument or NULL
+ * @s2: a string argument or NULL
+ * @s3: a string argument or NULL
+ *
+ * Records a call, see ntlink_trace_entry. Which arguments are recorded
+ * for which function is up to the function and the replay tool.
+ * Preserves errno and the last Win32 error.
+ */
+void
+ntlink_trace_call (ntlink_stats_api api, LONGLONG start, long long result, int arg1, int arg2,
+    const wchar_t *s1, const wchar_t *s2, const wchar_t *s3)
+{
+  const wchar_t *strings[NTLINK_TRACE_MAX_STRINGS];
+  size_t units[NTLINK_TRACE_MAX_STRINGS];
+  unsigned char record[TRACE_RECORD_SIZE];
+  LARGE_INTEGER now;
+  INT_PTR depth;
+  size_t size = TRACE_RECORD_SIZE;
+  unsigned int present = 0;
+  DWORD lerr;
+  int err, i;
+
+  if (start == 0 || !ntlink_trace_active)
+    return;
+  QueryPerformanceCounter (&now);
+  lerr = GetLastError ();
+  err = errno;
+
+  depth = (INT_PTR) FlsGetValue (trace_depth_index);
+  if (depth > 0)
+    depth -= 1;
+  FlsSetValue (trace_depth_index, (PVOID) depth);
+
+  strings[0] = s1;
+  strings[1] = s2;
+  strings[2] = s3;
+  for (i = 0; i < NTLINK_TRACE_MAX_STRINGS; i++)
+  {
+    if (strings[i] == NULL)
+      continue;
+    present |= 1 << i;
+    units[i] = trace_units (strings[i]);
+    /* Longer than any path can be */
+    if (units[i] > 32767)
+    {
+      present &= ~(1 << i);
+      continue;
+    }
+    size += 4 + units[i] * 2;
+  }
+
+  AcquireSRWLockExclusive (&trace_lock);
+  if (trace_buf != NULL && start >= trace_origin)
+  {
+    if (trace_file != NULL)
+    {
+      if (trace_size - trace_used < size)
+        trace_flush ();
+    }
+    else
+    {
+      while (trace_size - trace_used < size)
+      {
+        unsigned char head[4];
+        size_t k, dropped;
+        for (k = 0; k < 4; k++)
+          head[k] = trace_buf[(trace_head + k) % trace_size];
+        dropped = trace_get_u32 (head);
+        trace_head = (trace_head + dropped) % trace_size;
+        trace_used -= dropped;
+      }
+    }
+    trace_u32 (record, (unsigned long) size);
+    record[4] = (unsigned char) api;
+    record[5] = depth > 0 ? TRACE_FLAG_NESTED : 0;
+    record[6] = (unsigned char) present;
+    record[7] = 0;
+    trace_u32 (&record[8], (unsigned long) GetCurrentThreadId ());
+    trace_u64 (&record[12], (unsigned long long) (start - trace_origin) * 1000000000ULL / trace_freq);
+    trace_u64 (&record[20], (unsigned long long) (now.QuadPart - start) * 1000000000ULL / trace_freq);
+    trace_u64 (&record[28], (unsigned long long) result);
+    trace_u32 (&record[36], (unsigned long) err);
+    trace_u32 (&record[40], (unsigned long) arg1);
+    trace_u32 (&record[44], (unsigned long) arg2);
+    trace_put (record, TRACE_RECORD_SIZE);
+    for (i = 0; i < NTLINK_TRACE_MAX_STRINGS; i++)
+      if (present & (1 << i))
+        trace_put_string (strings[i], units[i]);
+  }
+  ReleaseSRWLockExclusive (&trace_lock);
+
+  errno = err;
+  SetLastError (lerr);
+}
+
+/* Decodes @units UTF-16 units at @p */
+static wchar_t *
+trace_get_string (const unsigned char *p, size_t units)
+{
+  wchar_t *s = (wchar_t *) ntlink_malloc ((units + 1) * sizeof (wchar_t));
+  size_t i, n = 0;
+  unsigned long c, c2;
+
+  if (s == NULL)
+    return NULL;
+  for (i = 0; i < units; i++)
+  {
+    c = p[i * 2] | p[i * 2 + 1] << 8;
+    if (sizeof (wchar_t) > 2 && c >= 0xD800 && c < 0xDC00 && i + 1 < units)
+    {
+      c2 = p[i * 2 + 2] | p[i * 2 + 3] << 8;
+      if (c2 >= 0xDC00 && c2 < 0xE000)
+      {
+        c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+        i++;
+      }
+    }
+    s[n++] = (wchar_t) c;
+  }
+  s[n] = L'\0';
+  return s;
+}
+
+/**
+ * ntlink_trace_free:
+ * @entries: what ntlink_trace_load() returned
+ * @count: number of @entries
+ *
+ * Frees @entries and their strings.
+ */
+void
+ntlink_trace_free (ntlink_trace_entry *entries, size_t count)
+{
+  size_t i;
+  int j;
+  if (entries == NULL)
+    return;
+  for (i = 0; i < count; i++)
+    for (j = 0; j < NTLINK_TRACE_MAX_STRINGS; j++)
+      ntlink_free (entries[i].strings[j]);
+  ntlink_free (entries);
+}
+
+/**
+ * ntlink_trace_load:
+ * @f: a trace, as written by ntlink_trace_start() or ntlink_trace_save()
+ * @entries: receives the records, in the order they were recorded (the
+ *   order in which the calls returned); free them with ntlink_trace_free()
+ * @count: receives the number of records
+ *
+ * Returns:
+ *  0 - success
+ * -1 - read error, or @f is not a trace
+ * -2 - out of memory
+ */
+int
+ntlink_trace_load (FILE *f, ntlink_trace_entry **entries, size_t *count)
+{
+  unsigned char header[TRACE_HEADER_SIZE];
+  unsigned char *record = NULL;
+  size_t capacity = 0, n = 0, allocated = 0;
+  ntlink_trace_entry *list = NULL;
+  int r = 0;
+
+  *entries = NULL;
+  *count = 0;
+  if (fread (header, 1, sizeof (header), f) != sizeof (header) ||
+      memcmp (header, TRACE_MAGIC, 8) != 0 || trace_get_u32 (&header[8]) != TRACE_VERSION)
+    return -1;
+
+  while (r == 0)
+  {
+    unsigned char sizebuf[4];
+    size_t size, got, pos;
+    ntlink_trace_entry *e;
+    int i;
+
+    got = fread (sizebuf, 1, 4, f);
+    if (got == 0 && feof (f))
+      break;
+    size = got == 4 ? trace_get_u32 (sizebuf) : 0;
+    if (size < TRACE_RECORD_SIZE || size > TRACE_MIN_BUFFER)
+    {
+      r = -1;
+      break;
+    }
+    if (size > capacity)
+    {
+      unsigned char *bigger = (unsigned char *) ntlink_realloc (record, size);
+      if (bigger == NULL)
+      {
+        r = -2;
+        break;
+      }
+      record = bigger;
+      capacity = size;
+    }
+    memcpy (record, sizebuf, 4);
+    if (fread (&record[4], 1, size - 4, f) != size - 4)
+    {
+      r = -1;
+      break;
+    }
+    if (n == allocated)
+    {
+      size_t more = allocated == 0 ? 1024 : allocated * 2;
+      ntlink_trace_entry *bigger = (ntlink_trace_entry *) ntlink_realloc (list, more * sizeof (ntlink_trace_entry));
+      if (bigger == NULL)
+      {
+        r = -2;
+        break;
+      }
+      list = bigger;
+      allocated = more;
+    }
+    e = &list[n];
+    memset (e, 0, sizeof (*e));
+    n++;
+    e->api = (ntlink_stats_api) record[4];
+    e->nested = (record[5] & TRACE_FLAG_NESTED) != 0;
+    e->thread = trace_get_u32 (&record[8]);
+    e->start_ns = trace_get_u64 (&record[12]);
+    e->duration_ns = trace_get_u64 (&record[20]);
+    e->result = (long long) trace_get_u64 (&record[28]);
+    e->err = (int) trace_get_u32 (&record[36]);
+    e->arg1 = (int) trace_get_u32 (&record[40]);
+    e->arg2 = (int) trace_get_u32 (&record[44]);
+    if (e->api >= NTLINK_API_COUNT)
+      r = -1;
+    pos = TRACE_RECORD_SIZE;
+    for (i = 0; i < NTLINK_TRACE_MAX_STRINGS && r == 0; i++)
+    {
+      size_t units;
+      if (!(record[6] & (1 << i)))
+        continue;
+      units = pos + 4 <= size ? trace_get_u32 (&record[pos]) : (size_t) -1;
+      if (units > (size - pos - 4) / 2)
+      {
+        r = -1;
+        break;
+      }
+      e->strings[i] = trace_get_string (&record[pos + 4], units);
+      if (e->strings[i] == NULL)
+        r = -2;
+      pos += 4 + units * 2;
+    }
+  }
+  if (r == 0 && ferror (f))
+    r = -1;
+  ntlink_free (record);
+  if (r != 0)
+  {
+    ntlink_trace_free (list, n);
+    return r;
+  }
+  *entries = list;
+  *count = n;
+  return 0;
+}
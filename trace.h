@@ -0,0 +1,81 @@
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTLINK_TRACE_H__
+#define __NTLINK_TRACE_H__
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NTLINK_TRACE_MAX_STRINGS 3
+
+/**
+ * ntlink_trace_entry:
+ * @api: the function that was called
+ * @nested: non-zero if it was called by another traced function (replaying
+ *   the outer call repeats it)
+ * @thread: Win32 id of the calling thread
+ * @start_ns: when it was called, since the trace was started
+ * @duration_ns: how long it took
+ * @result: what it returned (pointers: 0 for NULL, 1 otherwise)
+ * @err: errno after the call, if it failed
+ * @arg1: an integer argument (see ntlink_trace_call())
+ * @arg2: another integer argument
+ * @strings: string arguments, NULL if absent
+ */
+typedef struct
+{
+  ntlink_stats_api api;
+  int nested;
+  unsigned long thread;
+  unsigned long long start_ns;
+  unsigned long long duration_ns;
+  long long result;
+  int err;
+  int arg1;
+  int arg2;
+  wchar_t *strings[NTLINK_TRACE_MAX_STRINGS];
+} ntlink_trace_entry;
+
+/* Non-zero while tracing, for ntlink_stats_begin() */
+extern volatile int ntlink_trace_active;
+
+int ntlink_trace_start (const wchar_t *filename, size_t bufsize);
+int ntlink_trace_save (FILE *f);
+int ntlink_trace_stop (void);
+
+int ntlink_trace_load (FILE *f, ntlink_trace_entry **entries, size_t *count);
+void ntlink_trace_free (ntlink_trace_entry *entries, size_t count);
+
+/* Used by the library to record its public functions */
+void ntlink_trace_enter (void);
+void ntlink_trace_call (ntlink_stats_api api, LONGLONG start, long long result, int arg1, int arg2,
+    const wchar_t *s1, const wchar_t *s2, const wchar_t *s3);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NTLINK_TRACE_H__ */
@@ -1,339 +1,2834 @@
-/*
- * This file is part of libntlink.
- * Copyright (c) 2011, LRN
- *
- * libntlink is free software: you can redistribute it and/or modify
- * it under the terms of the GNU Lesser General Public License
- * as published by the Free Software Foundation, either version 3
- * of the License, or (at your option) any later version.
- *
- * libntlink is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU Lesser General Public License for more details.
- *
- * You should have received a copy of
- * the GNU Lesser General Public License and the GNU General Public License
- * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-
-#include "misc.h"
-#include "walk.h"
-#include "quasisymlink.h"
-
-/*
-  basedir - root of the tree
-  name - absolute or relative to basedir
- */
-int backup_links (wchar_t *basedir, wchar_t *name, FILE *f, int dry, int recursive, int reljunc)
-{
-  wchar_t *absname;
-  int r = 0;
-  int islink, isdir, isdirlnk, isjunc;
-  struct stat s;
-  if (f == NULL)
-    f = stdout;
-  r = GetAbsNameW (name, &absname, basedir, 2);
-  if (r != 0)
-    return r;
-  r = ntlink_lstatw (absname, &s);
-  if (r < 0)
-  {
-    free (absname);
-    return 0;
-  }
-  islink = S_ISLNK (s.st_mode);
-  isdirlnk = S_ISDIRLNK (s.st_mode);
-  isdir = S_ISDIR (s.st_mode);
-  isjunc = S_ISJUN (s.st_mode);
-  if (islink || isdirlnk || isjunc)
-  {
-    wchar_t *rel;
-    if (GetRelNameW (name, &rel, basedir) >= 0)
-    {
-      wchar_t tmp[MAX_PATH + 1];
-      wchar_t *tmpptr = NULL;
-      ssize_t linklen = ntlink_readlinkw (absname, tmp, MAX_PATH);
-      if (tmp[linklen] != L'\0') 
-        tmp[linklen] = L'\0';
-      if (isjunc && reljunc)
-      {
-        if ((linklen < 4) || tmp[0] != L'\\' || tmp[3] != L'\\' || tmp[1] != L'?' || tmp[2] != L'?')
-          r = GetRelNameW (tmp, &tmpptr, basedir);
-        else
-          r = GetRelNameW (&tmp[4], &tmpptr, basedir);
-        if (r >= 0)
-        {
-          linklen = wcslen (tmpptr);
-        }
-        else
-        {
-          tmpptr = NULL;
-        }
-      }
-      else
-      {
-        if (linklen != wcslen (tmp))
-        {
-          fprintf (stderr, "warning: link length mismatch\n");
-        }
-        if ((linklen < 4) || tmp[0] != L'\\' || tmp[3] != L'\\' || tmp[1] != L'?' || tmp[2] != L'?')
-          tmpptr = wcsdup(tmp);
-        else
-        {
-          tmpptr = wcsdup(&tmp[4]);
-          linklen -= 4;
-        }
-      }
-      /* now linklen is the same as the result of wcslen */
-      if (tmpptr != NULL)
-      {
-        if (dry || ntlink_unlinkw(absname) == 0)
-          fwprintf (f, L"link %c %d %s %d %s\n", isdirlnk ? L'd' : isjunc ? L'j' : L'f', wcslen (rel), rel, linklen, tmpptr);
-        free (tmpptr);
-      }
-      free (rel);
-    }
-  }
-  else if (isdir && recursive)
-  {
-    int i;
-    wchar_t tmp[MAX_PATH];
-    walk_iteratorw *walker;
-    int wlen = wcslen (absname);
-    walker = walk_allocw (NULL, absname, WALK_FLAG_DONT_FOLLOW_SYMLINKS);
-    walker = walk_nextw (walker);
-    for (i = 0; walker != NULL && i < walker->nitems; i++)
-    {
-      if (walker->items[i].cFileName[0] == L'\0')
-        continue;
-      if (MAX_PATH - wlen - 1 - wcslen (walker->items[i].cFileName) - 1 < 0)
-        continue;
-      wcsncpy (tmp, absname, MAX_PATH);
-      wcsncat (tmp, L"\\", MAX_PATH - wlen);
-      wcsncat (tmp, walker->items[i].cFileName, MAX_PATH - wlen - 1);
-      tmp[MAX_PATH - 1] = 0;
-      r = backup_links (basedir, tmp, f, dry, recursive, reljunc);
-      if (r < 0)
-        break;
-    }
-    freeiterw (walker);
-  }
-  free (absname);
-  return r;
-}
-
-int restore_links (wchar_t *basedir, wchar_t *name, FILE *f, int dry)
-{
-  if (f == NULL)
-    f = stdin;
-  int b;
-  wchar_t magic[6];
-  magic[5] = L'\0';
-  while (1)
-  {
-    /* Some of the return statements will leak memory, but we don't care, since the process is going to die anyway */
-    size_t linklen = 0, targetlen = 0;
-    wchar_t *link, *target;
-    wchar_t linktype;
-    int i;
-    b = fread (magic, 1, sizeof (wchar_t) * 5, f);
-    if (b == 0)
-      return 0;
-    if ((b < sizeof (wchar_t) * 5) || (wcscmp (magic, L"link ") != 0))
-      return -1;
-
-    b = fread (magic, 1, sizeof (wchar_t) * 2, f);
-    if (b != sizeof (wchar_t) * 2 || magic[1] != L' ')
-      return -2;
-    linktype = magic[0];
-
-    b = fread (magic, 1, sizeof (wchar_t), f);
-    for (i = 0; b == sizeof (wchar_t) && magic[0] != L' ' && magic[0] != L'\n' && magic[0] >= L'0' && magic[0] <= L'9'; i++)
-    {
-      linklen = linklen * (10 * i) + (magic[0] - L'0');
-      b = fread (magic, 1, sizeof (wchar_t), f);
-    }
-    if (linklen == 0 || magic[0] != L' ')
-      return -3;
-    link = malloc (sizeof (wchar_t) * (linklen + 1));
-    b = fread (link, 1, sizeof (wchar_t) * (linklen), f);
-    if (b != sizeof (wchar_t) * (linklen))
-      return -4;
-    link[linklen] = L'\0';
-    b = fread (magic, 1, sizeof (wchar_t), f);
-    if (b != sizeof (wchar_t) || magic[0] != L' ')
-      return -5;
-
-    b = fread (magic, 1, sizeof (wchar_t), f);
-    for (i = 0; b == sizeof (wchar_t) && magic[0] != L' ' && magic[0] != L'\n' && magic[0] >= L'0' && magic[0] <= L'9'; i++)
-    {
-      targetlen = targetlen * (10 * i) + (magic[0] - L'0');
-      b = fread (magic, 1, sizeof (wchar_t), f);
-    }
-    if (targetlen == 0 || magic[0] != L' ')
-      return -6;
-    target = malloc (sizeof (wchar_t) * (targetlen + 1));
-    b = fread (target, 1, sizeof (wchar_t) * (targetlen), f);
-    if (b != sizeof (wchar_t) * (targetlen))
-      return -7;
-    target[targetlen] = L'\0';
-    b = fread (magic, 1, sizeof (wchar_t), f);
-    if (b != sizeof (wchar_t) || magic[0] != L'\n')
-      return -8;
-
-    {
-      WIN32_FIND_DATAW finddata;
-      int r;
-      /* the link name must exist in the link-less tree */
-      r = PathExistsW (link, &finddata, PATH_EXISTS_FLAG_DONT_FOLLOW_SYMLINKS);
-      /* zero means that the link name does not exist yet, and that we haven't had
-       * any problems checking that (access restriction), and that the path to it
-       * does not contain links; note that the absolute path MIGHT contain links, but
-       * we only test relative path here.
-       */
-      if (r == 0)
-      {
-        switch (linktype)
-        {
-          /* Use blind linking to be able to create relative links (otherwise a call
-           * to PathExistsW() will break on paths relative to the link instead of %CD% */
-        case L'd':
-          r = ntlink_blind_symlinkw (target, link, BLIND_SYMLINK_DIR, basedir);
-          break;
-        case L'f':
-          r = ntlink_blind_symlinkw (target, link, BLIND_SYMLINK_FILE, basedir);
-          break;
-        case L'j':
-          r = ntlink_blind_symlinkw (target, link, BLIND_JUNCTION, basedir);
-          break;
-        default:
-          break;
-        }
-      }
-    }
-
-    free (link);
-    free (target);
-  }
-  return 0;
-}
-
-void usage (wchar_t **argv)
-{
-  fwprintf (stderr,
-L"\
-Usage: %s <operation> <base directory> <file or directory name> [option [option argument] ...]\n\
-Operations:\n\
-  b - backup\n\
-  r - restore\n\
-Options:\n\
-  j - make junction point paths relative when packing them up (they are always absolute)\n\
-  r - when backing up a directory examine its contents as well\n\
-  d - dry run: do not remove/restore links, print only\n\
-  f <filename> - read/append backup information from/to <filename>\n\
-  (otherwise - read/write backup information from/to stdin/stdout)\n\
-", argv[0]);
-}
-
-int wmain (int argc, wchar_t **argv);
-
-#if defined(__MINGW32__) && !defined(__MINGW64__)
-int
-main (int argc, char **argv)
-{
-   LPWSTR *szArglist;
-   int nArgs;
-   int r;
-
-   szArglist = CommandLineToArgvW(GetCommandLineW(), &nArgs);
-   if( NULL == szArglist )
-   {
-      fwprintf(stderr, L"CommandLineToArgvW failed\n");
-      return -1;
-   }
-   else
-     r = wmain (nArgs, szArglist);
-
-   LocalFree(szArglist);
-
-   return r;
-}
-#endif
-
-int
-wmain (int argc, wchar_t **argv)
-{
-  FILE *f = NULL;
-  int dry = 0;
-  int recursive = 0;
-  int reljunc = 0;
-  if (argc < 4)
-  {
-    fwprintf (stderr, L"Must have at least 3 arguments\n");
-    if (argc > 0)
-      usage (argv);
-    return 1;
-  }
-  if (argc > 4)
-  {
-    int i;
-    for (i = 4; i < argc; i++)
-    {
-      if (wcscmp (argv[i], L"r") == 0)
-        recursive = 1;
-      else if (wcscmp (argv[i], L"d") == 0)
-        dry = 1;
-      else if (wcscmp (argv[i], L"j") == 0)
-        reljunc = 1;
-      else if (wcscmp (argv[i], L"f") == 0)
-      {
-        const wchar_t *mode = NULL;
-        if (i + 1 >= argc)
-        {
-          fwprintf (stderr, L"Option 'f' requires extra argument\n");
-          usage (argv);
-          return 1;
-        }
-        if (wcscmp (argv[1],L"b") == 0)
-          mode = L"ab";
-        else if (wcscmp (argv[1],L"r") == 0)
-          mode = L"rb";
-        else
-        {
-          fwprintf (stderr, L"Unknown operation `%s'\n", argv[1]);
-          usage (argv);
-          return 1;
-        }
-        f = _wfopen (argv[i + 1], mode);
-        if (f == NULL)
-        {
-          fwprintf (stderr, L"Failed to open file `%s' with mode `%s': %d - %S\n", argv[i + 1], mode, errno, strerror (errno));
-          return 2;
-        }
-        i += 1;
-      }
-    }
-  }
-  if (wcscmp (argv[1],L"b") == 0)
-  {
-    int r = backup_links (argv[2], argv[3], f, dry, recursive, reljunc);
-    if (f != NULL)
-      fclose (f);
-    return r;
-  }
-  else if (wcscmp (argv[1],L"r") == 0)
-  {
-    int r = restore_links (argv[2], argv[3], f, dry);
-    if (f != NULL)
-      fclose (f);
-    return r;
-  }
-  fwprintf (stderr, L"Unknown operation `%s'\n", argv[1]);
-  usage (argv);
-  return 1;
-}
\ No newline at end of file
+/*
+ * This file is part of libntlink.
+ * Copyright (c) 2011, LRN
+ *
+ * libntlink is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libntlink is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of
+ * the GNU Lesser General Public License and the GNU General Public License
+ * along with libntlink.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <io.h>
+#include <fcntl.h>
+
+#include "misc.h"
+#include "quasisymlink.h"
+#include "manifest.h"
+#include "manifest_sort.h"
+#include "threadpool.h"
+#include "iosched.h"
+#include "throttle.h"
+#include "dircache.h"
+#include "fsbackend.h"
+#include "stats.h"
+#include "trace.h"
+#include "alloc.h"
+
+#ifndef FIND_FIRST_EX_LARGE_FETCH
+#define FIND_FIRST_EX_LARGE_FETCH 2
+#endif
+
+/* Links are read and unlinked in batches of this size by the backup pipeline */
+#define BACKUP_LINK_BATCH 256
+
+/*
+  Reads the target of the link absname and converts it into the form stored
+  in a manifest. Returns NULL if the link can't be read.
+ */
+wchar_t *link_target (wchar_t *basedir, wchar_t *absname, int isjunc, int reljunc, size_t *targetlen)
+{
+  wchar_t tmp[MAX_PATH + 1];
+  wchar_t *tmpptr = NULL, *rel;
+  ssize_t linklen = ntlink_readlinkw (absname, tmp, MAX_PATH);
+  int r;
+  if (linklen < 0)
+    return NULL;
+  if (tmp[linklen] != L'\0')
+    tmp[linklen] = L'\0';
+  if (isjunc && reljunc)
+  {
+    if ((linklen < 4) || tmp[0] != L'\\' || tmp[3] != L'\\' || tmp[1] != L'?' || tmp[2] != L'?')
+      r = GetRelNameW (tmp, &rel, basedir);
+    else
+      r = GetRelNameW (&tmp[4], &rel, basedir);
+    if (r < 0)
+      return NULL;
+    /* The library allocated it, the callers free() it */
+    tmpptr = wcsdup (rel);
+    ntlink_free (rel);
+    if (tmpptr == NULL)
+      return NULL;
+    linklen = wcslen (tmpptr);
+  }
+  else
+  {
+    if (linklen != wcslen (tmp))
+    {
+      fprintf (stderr, "warning: link length mismatch\n");
+      linklen = wcslen (tmp);
+    }
+    if ((linklen < 4) || tmp[0] != L'\\' || tmp[3] != L'\\' || tmp[1] != L'?' || tmp[2] != L'?')
+      tmpptr = wcsdup (tmp);
+    else
+    {
+      tmpptr = wcsdup (&tmp[4]);
+      linklen -= 4;
+    }
+  }
+  /* now linklen is the same as the result of wcslen */
+  *targetlen = linklen;
+  return tmpptr;
+}
+
+int add_record (manifest_writer *out, manifest_list *collect, wchar_t type, const wchar_t *link, size_t linklen, const wchar_t *target, size_t targetlen)
+{
+  manifest_entry e;
+  if (collect != NULL)
+    return manifest_list_add (collect, type, link, linklen, target, targetlen) != 0 ? -5 : 0;
+  e.type = type;
+  e.link = link;
+  e.linklen = linklen;
+  e.target = target;
+  e.targetlen = targetlen;
+  return manifest_writer_add (out, &e) != 0 ? -6 : 0;
+}
+
+int matches_prefix (const manifest_entry *e, const wchar_t *prefix, size_t prefixlen)
+{
+  if (prefixlen == 0)
+    return 1;
+  if (e->linklen < prefixlen || manifest_name_cmp (e->link, prefixlen, prefix, prefixlen) != 0)
+    return 0;
+  return e->linklen == prefixlen || e->link[prefixlen] == L'\\' || e->link[prefixlen] == L'/';
+}
+
+/*
+  Loads a manifest of either format: binary ones are mapped, text ones are
+  read into list. *entries receives the records either way; release them
+  with free (*entries), manifest_map_close (*map) and manifest_list_clear (list),
+  even if loading fails.
+  Returns 0 on success, 2 if the file can't be opened (errno is set),
+  other non-zero values if it is malformed or out of memory.
+ */
+int load_manifest (wchar_t *filename, manifest_map **map, manifest_list *list, manifest_entry **entries, size_t *count)
+{
+  FILE *f;
+  size_t i;
+  int r;
+  *entries = NULL;
+  *count = 0;
+  r = manifest_map_open (filename, map);
+  if (r == 0)
+  {
+    *entries = (manifest_entry *) malloc (sizeof (manifest_entry) * (manifest_map_count (*map) + 1));
+    if (*entries == NULL)
+      return -9;
+    for (i = 0; i < manifest_map_count (*map); i++)
+      if (manifest_map_entry (*map, i, &(*entries)[i]) != 0)
+        return -9;
+    *count = i;
+    return 0;
+  }
+  *map = NULL;
+  if (r != -2)
+    return r == -1 ? 2 : r;
+  f = _wfopen (filename, L"rb");
+  if (f == NULL)
+    return 2;
+  r = manifest_read_text (f, list);
+  fclose (f);
+  if (r != 0)
+    return r;
+  *entries = (manifest_entry *) malloc (sizeof (manifest_entry) * (list->count + 1));
+  if (*entries == NULL)
+    return -9;
+  memcpy (*entries, list->items, sizeof (manifest_entry) * list->count);
+  *count = list->count;
+  return 0;
+}
+
+/*
+  Backup pipeline for a whole tree:
+  1) directories are scanned in parallel; links are recognized by the
+     reparse tags that FindFirstFileEx() returns, nothing is stat'ed
+     (except for files, when hard link groups are backed up)
+  2) link targets are read (and the links removed) in parallel batches
+  3) the records are sorted by name and written out by one thread
+  The output does not depend on the number of threads.
+
+  An incremental backup compares the tree with a previous manifest and
+  writes only the links that were added, retargeted (both as normal
+  records) or removed (MANIFEST_TYPE_REMOVED records). Directories whose
+  last write time matches the previous state are not listed at all: NTFS
+  updates it whenever an entry is added, removed or renamed, so their links
+  are known to be the same as in the previous manifest. Their subdirectories
+  are taken from the previous state and checked one by one.
+ */
+typedef struct
+{
+  manifest_map *base_map;
+  manifest_list base_list;
+  manifest_map *state_map;
+  manifest_list state_list;
+  /* previous manifest */
+  manifest_entry *base;
+  size_t nbase;
+  manifest_index base_names;
+  manifest_index base_dirs;
+  /* set for the records of base that are still in the tree */
+  unsigned char *seen;
+  /* previous directory state (MANIFEST_TYPE_DIRECTORY records), can be empty */
+  manifest_entry *state;
+  size_t nstate;
+  manifest_index state_names;
+  manifest_index state_dirs;
+  /* directory state of this run */
+  manifest_list newstate;
+} backup_incremental;
+
+
+typedef struct
+{
+  wchar_t *absname;
+  wchar_t *rel;
+  wchar_t type;
+  wchar_t *target;
+  size_t targetlen;
+} backup_link;
+
+/* Names of a file with several hard links, found by its file ID */
+typedef struct _backup_hardlink backup_hardlink;
+
+struct _backup_hardlink
+{
+  backup_hardlink *next;
+  unsigned long long volume;
+  unsigned char id[16];
+  unsigned int hash;
+  backup_link *names;
+  size_t count;
+  size_t capacity;
+};
+
+typedef struct
+{
+  wchar_t *basedir;
+  int dry;
+  int reljunc;
+  ntlink_task_group *group;
+  ntlink_io_queue *queue;
+  ntlink_throttle *throttle;
+  backup_incremental *inc;
+  CRITICAL_SECTION lock;
+  backup_link *links;
+  size_t count;
+  size_t capacity;
+  int nomem;
+  /* hard link groups by file ID, if they are backed up */
+  int hardlinks;
+  backup_hardlink **groups;
+  size_t nbuckets;
+  size_t ngroups;
+} backup_job;
+
+typedef struct
+{
+  backup_job *job;
+  wchar_t *absname;
+  wchar_t *rel;
+  /* last write time, if known */
+  FILETIME mtime;
+  int have_mtime;
+} backup_dir;
+
+typedef struct
+{
+  backup_job *job;
+  size_t first;
+  size_t last;
+} backup_batch;
+
+static wchar_t *
+join_path (const wchar_t *dir, const wchar_t *name)
+{
+  size_t dlen = wcslen (dir), nlen = wcslen (name);
+  wchar_t *result = (wchar_t *) malloc (sizeof (wchar_t) * (dlen + 1 + nlen + 1));
+  if (result == NULL)
+    return NULL;
+  memcpy (result, dir, sizeof (wchar_t) * dlen);
+  if (dlen > 0 && dir[dlen - 1] != L'\\' && dir[dlen - 1] != L'/')
+    result[dlen++] = L'\\';
+  memcpy (&result[dlen], name, sizeof (wchar_t) * (nlen + 1));
+  return result;
+}
+
+static void backup_scan_task (void *arg);
+
+static void
+backup_submit_dir (backup_job *job, wchar_t *absname, wchar_t *rel, const FILETIME *mtime)
+{
+  backup_dir *dir = (backup_dir *) malloc (sizeof (backup_dir));
+  if (dir == NULL)
+  {
+    free (absname);
+    free (rel);
+    job->nomem = 1;
+    return;
+  }
+  dir->job = job;
+  dir->absname = absname;
+  dir->rel = rel;
+  dir->have_mtime = mtime != NULL;
+  if (mtime != NULL)
+    dir->mtime = *mtime;
+  if (job->group == NULL || ntlink_io_submit (job->queue, job->group, 1, backup_scan_task, dir) != 0)
+    backup_scan_task (dir);
+}
+
+static unsigned int
+file_id_hash (unsigned long long volume, const unsigned char *id)
+{
+  unsigned int h = 2166136261U;
+  int i;
+  for (i = 0; i < 8; i++)
+  {
+    h ^= (unsigned char) (volume >> (i * 8));
+    h *= 16777619U;
+  }
+  for (i = 0; i < 16; i++)
+  {
+    h ^= id[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/*
+  Adds a file to its hard link group if it has more than one link.
+  Files are only stat'ed when hard links are backed up.
+ */
+static void
+backup_add_hardlink (backup_job *job, backup_dir *dir, const wchar_t *name)
+{
+  ntlink_statx st;
+  backup_hardlink *g;
+  wchar_t *absname, *rel;
+  unsigned int hash;
+
+  absname = join_path (dir->absname, name);
+  if (absname == NULL)
+  {
+    job->nomem = 1;
+    return;
+  }
+  if (ntlink_statxw (absname, NTLINK_STATX_FLAG_NOTHING, NTLINK_STATX_NLINK | NTLINK_STATX_INO, &st) != 0 ||
+      (st.stx_mask & (NTLINK_STATX_NLINK | NTLINK_STATX_INO)) != (NTLINK_STATX_NLINK | NTLINK_STATX_INO) ||
+      st.stx_nlink < 2)
+  {
+    free (absname);
+    return;
+  }
+  rel = dir->rel[0] == L'\0' ? wcsdup (name) : join_path (dir->rel, name);
+  if (rel == NULL)
+  {
+    free (absname);
+    job->nomem = 1;
+    return;
+  }
+  hash = file_id_hash (st.stx_volume_serial, st.stx_file_id);
+
+  EnterCriticalSection (&job->lock);
+  if (job->groups == NULL || job->ngroups >= job->nbuckets * 2)
+  {
+    size_t newbuckets = job->nbuckets == 0 ? 1024 : job->nbuckets * 4, i;
+    backup_hardlink **buckets = (backup_hardlink **) calloc (newbuckets, sizeof (backup_hardlink *));
+    if (buckets != NULL)
+    {
+      for (i = 0; i < job->nbuckets; i++)
+      {
+        while (job->groups[i] != NULL)
+        {
+          g = job->groups[i];
+          job->groups[i] = g->next;
+          g->next = buckets[g->hash & (newbuckets - 1)];
+          buckets[g->hash & (newbuckets - 1)] = g;
+        }
+      }
+      free (job->groups);
+      job->groups = buckets;
+      job->nbuckets = newbuckets;
+    }
+  }
+  g = NULL;
+  if (job->groups != NULL)
+  {
+    for (g = job->groups[hash & (job->nbuckets - 1)]; g != NULL; g = g->next)
+      if (g->hash == hash && g->volume == st.stx_volume_serial && memcmp (g->id, st.stx_file_id, 16) == 0)
+        break;
+    if (g == NULL && (g = (backup_hardlink *) calloc (1, sizeof (backup_hardlink))) != NULL)
+    {
+      g->volume = st.stx_volume_serial;
+      memcpy (g->id, st.stx_file_id, 16);
+      g->hash = hash;
+      g->next = job->groups[hash & (job->nbuckets - 1)];
+      job->groups[hash & (job->nbuckets - 1)] = g;
+      job->ngroups += 1;
+    }
+  }
+  if (g != NULL && g->count == g->capacity)
+  {
+    size_t newcap = g->capacity == 0 ? 2 : g->capacity * 2;
+    backup_link *names = (backup_link *) realloc (g->names, sizeof (backup_link) * newcap);
+    if (names != NULL)
+    {
+      g->names = names;
+      g->capacity = newcap;
+    }
+  }
+  if (g != NULL && g->count < g->capacity)
+  {
+    g->names[g->count].absname = absname;
+    g->names[g->count].rel = rel;
+    g->names[g->count].type = MANIFEST_TYPE_HARDLINK;
+    g->names[g->count].target = NULL;
+    g->names[g->count].targetlen = 0;
+    g->count += 1;
+    absname = rel = NULL;
+  }
+  else
+    job->nomem = 1;
+  LeaveCriticalSection (&job->lock);
+  free (absname);
+  free (rel);
+}
+
+static int backup_link_cmp (const void *a, const void *b);
+
+/*
+  Turns each hard link group into records: the first name of the group
+  (in manifest order) is kept as a file, the other names are recorded
+  as hard links to it. Names outside of the tree are not known, so a group
+  with one name in the tree is not recorded at all.
+ */
+static void
+backup_hardlink_records (backup_job *job)
+{
+  size_t i, j;
+  for (i = 0; i < job->nbuckets; i++)
+  {
+    while (job->groups[i] != NULL)
+    {
+      backup_hardlink *g = job->groups[i];
+      job->groups[i] = g->next;
+      if (g->count > 1)
+        qsort (g->names, g->count, sizeof (backup_link), backup_link_cmp);
+      for (j = 1; j < g->count; j++)
+      {
+        backup_link *l = &g->names[j];
+        l->target = wcsdup (g->names[0].rel);
+        l->targetlen = wcslen (g->names[0].rel);
+        if (l->target != NULL && job->count == job->capacity)
+        {
+          size_t newcap = job->capacity == 0 ? 1024 : job->capacity * 2;
+          backup_link *tmp = (backup_link *) realloc (job->links, sizeof (backup_link) * newcap);
+          if (tmp != NULL)
+          {
+            job->links = tmp;
+            job->capacity = newcap;
+          }
+        }
+        if (l->target == NULL || job->count == job->capacity)
+        {
+          job->nomem = 1;
+          free (l->absname);
+          free (l->rel);
+          free (l->target);
+          continue;
+        }
+        job->links[job->count++] = *l;
+      }
+      if (g->count > 0)
+      {
+        free (g->names[0].absname);
+        free (g->names[0].rel);
+      }
+      free (g->names);
+      free (g);
+    }
+  }
+  free (job->groups);
+  job->groups = NULL;
+  job->nbuckets = 0;
+  job->ngroups = 0;
+}
+
+/* The root of the tree has no name relative to itself; state records use "." */
+static const wchar_t *
+state_name (const wchar_t *rel)
+{
+  return rel[0] == L'\0' ? L"." : rel;
+}
+
+/*
+  Records the state of a directory for the next incremental backup.
+  Returns 1 if the directory did not change since the previous one.
+ */
+static int
+backup_dir_state (backup_job *job, backup_dir *dir)
+{
+  backup_incremental *inc = job->inc;
+  const wchar_t *name = state_name (dir->rel);
+  wchar_t mtime[17];
+  size_t n, first;
+  int r;
+
+  _snwprintf (mtime, 17, L"%08lX%08lX", (unsigned long) dir->mtime.dwHighDateTime, (unsigned long) dir->mtime.dwLowDateTime);
+  EnterCriticalSection (&job->lock);
+  r = manifest_list_add (&inc->newstate, MANIFEST_TYPE_DIRECTORY, name, wcslen (name), mtime, 16);
+  LeaveCriticalSection (&job->lock);
+  if (r != 0)
+    job->nomem = 1;
+
+  first = manifest_index_find (&inc->state_names, name, wcslen (name), &n);
+  if (n == 0)
+    return 0;
+  return inc->state[inc->state_names.order[first]].targetlen == 16 &&
+      memcmp (inc->state[inc->state_names.order[first]].target, mtime, sizeof (wchar_t) * 16) == 0;
+}
+
+/*
+  Takes the links of an unchanged directory from the previous manifest,
+  and queues its subdirectories from the previous state.
+ */
+static void
+backup_skip_dir (backup_job *job, backup_dir *dir)
+{
+  backup_incremental *inc = job->inc;
+  size_t rellen = wcslen (dir->rel);
+  size_t first, n, i;
+
+  first = manifest_index_find (&inc->base_dirs, dir->rel, rellen, &n);
+  for (i = 0; i < n; i++)
+    inc->seen[inc->base_dirs.order[first + i]] = 1;
+
+  first = manifest_index_find (&inc->state_dirs, dir->rel, rellen, &n);
+  for (i = 0; i < n; i++)
+  {
+    const manifest_entry *e = &inc->state[inc->state_dirs.order[first + i]];
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    wchar_t *absname, *rel;
+    if (e->linklen == 1 && e->link[0] == L'.')
+      continue;
+    rel = (wchar_t *) malloc (sizeof (wchar_t) * (e->linklen + 1));
+    if (rel == NULL)
+    {
+      job->nomem = 1;
+      continue;
+    }
+    memcpy (rel, e->link, sizeof (wchar_t) * e->linklen);
+    rel[e->linklen] = L'\0';
+    absname = join_path (dir->absname, rellen > 0 ? &rel[rellen + 1] : rel);
+    if (absname == NULL)
+    {
+      free (rel);
+      job->nomem = 1;
+      continue;
+    }
+    /* It can't be gone, or the parent would have changed, but be careful */
+    if (!ntlink_fs->get_file_attributes_ex (absname, GetFileExInfoStandard, &data) ||
+        !(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+        (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+    {
+      free (absname);
+      free (rel);
+      continue;
+    }
+    backup_submit_dir (job, absname, rel, &data.ftLastWriteTime);
+  }
+}
+
+static void
+backup_scan_dir (backup_dir *dir)
+{
+  backup_job *job = dir->job;
+  WIN32_FIND_DATAW finddata;
+  backup_link *found = NULL;
+  size_t nfound = 0, capfound = 0;
+  wchar_t *pattern;
+  HANDLE h = INVALID_HANDLE_VALUE;
+
+  if (job->inc != NULL)
+  {
+    if (!dir->have_mtime)
+    {
+      WIN32_FILE_ATTRIBUTE_DATA data;
+      if (ntlink_fs->get_file_attributes_ex (dir->absname, GetFileExInfoStandard, &data))
+      {
+        dir->mtime = data.ftLastWriteTime;
+        dir->have_mtime = 1;
+      }
+    }
+    if (dir->have_mtime && backup_dir_state (job, dir))
+    {
+      backup_skip_dir (job, dir);
+      free (dir->absname);
+      free (dir->rel);
+      free (dir);
+      return;
+    }
+  }
+
+  pattern = join_path (dir->absname, L"*");
+  if (pattern == NULL)
+    job->nomem = 1;
+  else
+  {
+    h = ntlink_fs->find_first_file_ex (pattern, FindExInfoBasic, &finddata, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    /* Basic info and large fetches are not available before Windows 7 */
+    if (h == INVALID_HANDLE_VALUE && GetLastError () == ERROR_INVALID_PARAMETER)
+      h = ntlink_fs->find_first_file_ex (pattern, FindExInfoStandard, &finddata, FindExSearchNameMatch, NULL, 0);
+    if (h == INVALID_HANDLE_VALUE)
+      fwprintf (stderr, L"warning: failed to list `%ls'\n", dir->absname);
+    free (pattern);
+  }
+  if (h == INVALID_HANDLE_VALUE)
+  {
+    free (dir->absname);
+    free (dir->rel);
+    free (dir);
+    return;
+  }
+
+  do
+  {
+    wchar_t *absname, *rel;
+    int islink;
+    if (wcscmp (finddata.cFileName, L".") == 0 || wcscmp (finddata.cFileName, L"..") == 0)
+      continue;
+    ntlink_throttle_charge (job->throttle, 1, sizeof (wchar_t) * wcslen (finddata.cFileName));
+    islink = (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+        (finddata.dwReserved0 == IO_REPARSE_TAG_SYMLINK || finddata.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT);
+    if (!islink && !(finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+      if (job->hardlinks && !(finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+      {
+        ntlink_io_add_cost (1);
+        backup_add_hardlink (job, dir, finddata.cFileName);
+      }
+      continue;
+    }
+    absname = join_path (dir->absname, finddata.cFileName);
+    rel = dir->rel[0] == L'\0' ? wcsdup (finddata.cFileName) : join_path (dir->rel, finddata.cFileName);
+    if (absname == NULL || rel == NULL)
+    {
+      free (absname);
+      free (rel);
+      job->nomem = 1;
+      continue;
+    }
+    if (!islink)
+    {
+      backup_submit_dir (job, absname, rel, &finddata.ftLastWriteTime);
+      continue;
+    }
+    if (nfound == capfound)
+    {
+      size_t newcap = capfound == 0 ? 16 : capfound * 2;
+      backup_link *tmp = (backup_link *) realloc (found, sizeof (backup_link) * newcap);
+      if (tmp == NULL)
+      {
+        free (absname);
+        free (rel);
+        job->nomem = 1;
+        continue;
+      }
+      found = tmp;
+      capfound = newcap;
+    }
+    found[nfound].absname = absname;
+    found[nfound].rel = rel;
+    found[nfound].type = finddata.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT ? L'j' :
+        (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? L'd' : L'f';
+    found[nfound].target = NULL;
+    found[nfound].targetlen = 0;
+    nfound += 1;
+  } while (ntlink_fs->find_next_file (h, &finddata));
+  ntlink_fs->find_close (h);
+
+  /* Hand the links of this directory over in one go */
+  if (nfound > 0)
+  {
+    EnterCriticalSection (&job->lock);
+    if (job->capacity - job->count < nfound)
+    {
+      size_t newcap = job->capacity == 0 ? 1024 : job->capacity;
+      backup_link *tmp;
+      while (newcap - job->count < nfound)
+        newcap *= 2;
+      tmp = (backup_link *) realloc (job->links, sizeof (backup_link) * newcap);
+      if (tmp != NULL)
+      {
+        job->links = tmp;
+        job->capacity = newcap;
+      }
+    }
+    if (job->capacity - job->count >= nfound)
+    {
+      memcpy (&job->links[job->count], found, sizeof (backup_link) * nfound);
+      job->count += nfound;
+      nfound = 0;
+    }
+    else
+      job->nomem = 1;
+    LeaveCriticalSection (&job->lock);
+  }
+  while (nfound-- > 0)
+  {
+    free (found[nfound].absname);
+    free (found[nfound].rel);
+  }
+  free (found);
+  free (dir->absname);
+  free (dir->rel);
+  free (dir);
+}
+
+static void
+backup_scan_task (void *arg)
+{
+  backup_dir *dir = (backup_dir *) arg;
+  ntlink_throttle *throttle = dir->job->throttle;
+  ntlink_throttle_begin (throttle);
+  backup_scan_dir (dir);
+  ntlink_throttle_end (throttle);
+}
+
+static void
+backup_read_task (void *arg)
+{
+  backup_batch *batch = (backup_batch *) arg;
+  backup_job *job = batch->job;
+  size_t i;
+  ntlink_throttle_begin (job->throttle);
+  for (i = batch->first; i < batch->last; i++)
+  {
+    backup_link *l = &job->links[i];
+    /* Hard links know their target already, and are plain files to remove */
+    if (l->type == MANIFEST_TYPE_HARDLINK)
+    {
+      if (!job->dry && !ntlink_fs->delete_file (l->absname))
+      {
+        free (l->target);
+        l->target = NULL;
+      }
+      ntlink_throttle_charge (job->throttle, 1, 0);
+      continue;
+    }
+    l->target = link_target (job->basedir, l->absname, l->type == L'j', job->reljunc, &l->targetlen);
+    ntlink_throttle_charge (job->throttle, 1, sizeof (wchar_t) * l->targetlen);
+    if (l->target != NULL && !job->dry && ntlink_unlinkw (l->absname) != 0)
+    {
+      free (l->target);
+      l->target = NULL;
+    }
+  }
+  ntlink_throttle_end (job->throttle);
+}
+
+static int
+backup_link_cmp (const void *a, const void *b)
+{
+  const backup_link *la = (const backup_link *) a;
+  const backup_link *lb = (const backup_link *) b;
+  int r = manifest_name_cmp (la->rel, wcslen (la->rel), lb->rel, wcslen (lb->rel));
+  return r != 0 ? r : wcscmp (la->rel, lb->rel);
+}
+
+void incremental_close (backup_incremental *inc)
+{
+  manifest_index_free (&inc->base_names);
+  manifest_index_free (&inc->base_dirs);
+  manifest_index_free (&inc->state_names);
+  manifest_index_free (&inc->state_dirs);
+  free (inc->seen);
+  free (inc->base);
+  free (inc->state);
+  manifest_map_close (inc->base_map);
+  manifest_map_close (inc->state_map);
+  manifest_list_clear (&inc->base_list);
+  manifest_list_clear (&inc->state_list);
+  manifest_list_clear (&inc->newstate);
+}
+
+/*
+  basefile - the previous manifest (or the result of applying deltas to it)
+  statefile - directory state written by the previous incremental backup,
+    can be NULL or not exist yet (then every directory is listed)
+  Returns 0 on success, non-zero values (reported to stderr) on failure.
+ */
+int incremental_open (backup_incremental *inc, wchar_t *basefile, wchar_t *statefile)
+{
+  int r;
+  memset (inc, 0, sizeof (backup_incremental));
+  r = load_manifest (basefile, &inc->base_map, &inc->base_list, &inc->base, &inc->nbase);
+  if (r != 0)
+  {
+    fwprintf (stderr, L"Failed to load the previous manifest `%ls': %d\n", basefile, r);
+    incremental_close (inc);
+    return 2;
+  }
+  if (statefile != NULL)
+  {
+    r = load_manifest (statefile, &inc->state_map, &inc->state_list, &inc->state, &inc->nstate);
+    if (r == 2 && errno == ENOENT)
+      r = 0;
+    if (r != 0)
+    {
+      fwprintf (stderr, L"Failed to load the backup state `%ls': %d\n", statefile, r);
+      incremental_close (inc);
+      return 2;
+    }
+  }
+  inc->seen = (unsigned char *) calloc (inc->nbase + 1, 1);
+  if (inc->seen == NULL ||
+      manifest_index_build (&inc->base_names, inc->base, inc->nbase, 0) != 0 ||
+      manifest_index_build (&inc->base_dirs, inc->base, inc->nbase, 1) != 0 ||
+      manifest_index_build (&inc->state_names, inc->state, inc->nstate, 0) != 0 ||
+      manifest_index_build (&inc->state_dirs, inc->state, inc->nstate, 1) != 0)
+  {
+    fwprintf (stderr, L"Out of memory\n");
+    incremental_close (inc);
+    return 2;
+  }
+  return 0;
+}
+
+/* Writes the directory state for the next incremental backup */
+int incremental_save_state (backup_incremental *inc, wchar_t *statefile)
+{
+  manifest_writer writer;
+  FILE *f;
+  size_t i;
+  int r = 0;
+  f = _wfopen (statefile, L"wb");
+  if (f == NULL || manifest_writer_init (&writer, f) != 0)
+  {
+    if (f != NULL)
+      fclose (f);
+    fwprintf (stderr, L"Failed to write the backup state `%ls'\n", statefile);
+    return 2;
+  }
+  manifest_list_sort (&inc->newstate);
+  for (i = 0; i < inc->newstate.count && r == 0; i++)
+    r = manifest_writer_add (&writer, &inc->newstate.items[i]);
+  if (r == 0)
+    r = manifest_writer_flush (&writer);
+  manifest_writer_free (&writer);
+  fclose (f);
+  if (r != 0)
+  {
+    fwprintf (stderr, L"Failed to write the backup state `%ls'\n", statefile);
+    return 2;
+  }
+  return 0;
+}
+
+static int
+manifest_entry_cmp (const void *a, const void *b)
+{
+  const manifest_entry *ea = (const manifest_entry *) a;
+  const manifest_entry *eb = (const manifest_entry *) b;
+  return manifest_name_cmp (ea->link, ea->linklen, eb->link, eb->linklen);
+}
+
+/*
+  Compares the links found in the tree (sorted) with the previous manifest.
+  Returns the delta records, sorted by name, in *delta (free it with free(),
+  the strings belong to links and to the previous manifest),
+  or -1 if out of memory.
+ */
+static int
+backup_diff (backup_job *job, const wchar_t *scope, manifest_entry **delta, size_t *ndelta)
+{
+  backup_incremental *inc = job->inc;
+  size_t scopelen = wcslen (scope);
+  size_t i, n = 0;
+  manifest_entry *d;
+
+  d = (manifest_entry *) malloc (sizeof (manifest_entry) * (job->count + inc->nbase + 1));
+  if (d == NULL)
+    return -1;
+  for (i = 0; i < job->count; i++)
+  {
+    backup_link *l = &job->links[i];
+    size_t rellen = wcslen (l->rel), found, first, j;
+    const manifest_entry *old = NULL;
+    first = manifest_index_find (&inc->base_names, l->rel, rellen, &found);
+    for (j = 0; j < found; j++)
+    {
+      inc->seen[inc->base_names.order[first + j]] = 1;
+      old = &inc->base[inc->base_names.order[first + j]];
+    }
+    /* A link that can't be read now is not reported as removed either */
+    if (l->target == NULL)
+      continue;
+    if (old != NULL && old->type == l->type && old->targetlen == l->targetlen &&
+        memcmp (old->target, l->target, sizeof (wchar_t) * l->targetlen) == 0)
+      continue;
+    d[n].type = l->type;
+    d[n].link = l->rel;
+    d[n].linklen = rellen;
+    d[n].target = l->target;
+    d[n].targetlen = l->targetlen;
+    n += 1;
+  }
+  for (i = 0; i < inc->nbase; i++)
+  {
+    if (inc->seen[i] || inc->base[i].type == MANIFEST_TYPE_REMOVED ||
+        !matches_prefix (&inc->base[i], scope, scopelen))
+      continue;
+    d[n] = inc->base[i];
+    d[n].type = MANIFEST_TYPE_REMOVED;
+    n += 1;
+  }
+  qsort (d, n, sizeof (manifest_entry), manifest_entry_cmp);
+  *delta = d;
+  *ndelta = n;
+  return 0;
+}
+
+/*
+  absname - absolute name of a directory under basedir
+  inc - previous manifest and state for an incremental backup, or NULL.
+    Incremental backups never remove links.
+  hardlinks - also record files with several names in the tree; every name
+    but the first one becomes a MANIFEST_TYPE_HARDLINK record (and is removed)
+  nthreads - at most that many tasks run at once on the shared pool, 0 or less
+    means as many as it has threads
+  throttle - if not NULL, the tree is scanned and the links are read in the
+    background, at its rates (entries listed and links read are operations)
+ */
+int backup_tree (wchar_t *basedir, wchar_t *absname, manifest_writer *out, manifest_list *collect, backup_incremental *inc, int dry, int reljunc, int hardlinks, int nthreads, ntlink_throttle *throttle)
+{
+  backup_job job;
+  backup_batch *batches = NULL;
+  size_t nbatches, i;
+  wchar_t *librel, *rel, *root, *scope;
+  int r = 0;
+
+  if (GetRelNameW (absname, &librel, basedir) < 0)
+    return 0;
+  /* The job frees its names with free() */
+  root = wcsdup (absname);
+  rel = wcsdup (librel);
+  scope = wcsdup (librel);
+  ntlink_free (librel);
+  if (root == NULL || rel == NULL || scope == NULL)
+  {
+    free (root);
+    free (rel);
+    free (scope);
+    return -5;
+  }
+  memset (&job, 0, sizeof (job));
+  job.basedir = basedir;
+  job.dry = dry || inc != NULL;
+  job.reljunc = reljunc;
+  job.inc = inc;
+  job.hardlinks = hardlinks;
+  job.throttle = throttle;
+  InitializeCriticalSection (&job.lock);
+  if (nthreads != 1)
+    job.group = ntlink_task_group_new (NULL, nthreads);
+  job.queue = ntlink_io_queue_get (absname);
+
+  backup_submit_dir (&job, root, rel, NULL);
+  if (job.group != NULL)
+    ntlink_task_group_wait (job.group);
+  if (job.groups != NULL)
+    backup_hardlink_records (&job);
+
+  nbatches = (job.count + BACKUP_LINK_BATCH - 1) / BACKUP_LINK_BATCH;
+  if (nbatches > 0)
+    batches = (backup_batch *) malloc (sizeof (backup_batch) * nbatches);
+  if (batches == NULL)
+  {
+    /* Nothing to do, or no memory to split the work */
+    backup_batch all;
+    all.job = &job;
+    all.first = 0;
+    all.last = job.count;
+    backup_read_task (&all);
+  }
+  for (i = 0; batches != NULL && i < nbatches; i++)
+  {
+    batches[i].job = &job;
+    batches[i].first = i * BACKUP_LINK_BATCH;
+    batches[i].last = batches[i].first + BACKUP_LINK_BATCH < job.count ? batches[i].first + BACKUP_LINK_BATCH : job.count;
+    if (job.group == NULL || ntlink_io_submit (job.queue, job.group, batches[i].last - batches[i].first, backup_read_task, &batches[i]) != 0)
+      backup_read_task (&batches[i]);
+  }
+  if (job.group != NULL)
+    ntlink_task_group_free (job.group);
+  free (batches);
+  DeleteCriticalSection (&job.lock);
+
+  qsort (job.links, job.count, sizeof (backup_link), backup_link_cmp);
+  if (inc != NULL)
+  {
+    manifest_entry *delta;
+    size_t ndelta;
+    if (backup_diff (&job, scope, &delta, &ndelta) != 0)
+      r = -5;
+    else
+    {
+      for (i = 0; r == 0 && i < ndelta; i++)
+        r = add_record (out, collect, delta[i].type, delta[i].link, delta[i].linklen, delta[i].target, delta[i].targetlen);
+      free (delta);
+    }
+  }
+  for (i = 0; i < job.count; i++)
+  {
+    backup_link *l = &job.links[i];
+    if (inc == NULL && r == 0 && l->target != NULL)
+      r = add_record (out, collect, l->type, l->rel, wcslen (l->rel), l->target, l->targetlen);
+    free (l->absname);
+    free (l->rel);
+    free (l->target);
+  }
+  free (job.links);
+  free (scope);
+  if (r == 0 && job.nomem)
+    r = -5;
+  return r;
+}
+
+/*
+  basedir - root of the tree
+  name - absolute or relative to basedir
+  out - buffered text manifest writer
+  collect - if not NULL, records are added to it instead of being written to out
+  inc - makes a recursive backup of a directory incremental, see backup_tree()
+  hardlinks - record the hard link groups of a recursive backup
+  nthreads - number of threads for a recursive backup
+  throttle - rate limits and background mode for a recursive backup, can be NULL
+ */
+int backup_links (wchar_t *basedir, wchar_t *name, manifest_writer *out, manifest_list *collect, backup_incremental *inc, int dry, int recursive, int reljunc, int hardlinks, int nthreads, ntlink_throttle *throttle)
+{
+  wchar_t *absname;
+  int r = 0;
+  int islink, isdir, isdirlnk, isjunc;
+  struct stat s;
+  r = GetAbsNameW (name, &absname, basedir, 2);
+  if (r != 0)
+    return r;
+  r = ntlink_lstatw (absname, &s);
+  if (r < 0)
+  {
+    ntlink_free (absname);
+    return 0;
+  }
+  islink = S_ISLNK (s.st_mode);
+  isdirlnk = S_ISDIRLNK (s.st_mode);
+  isdir = S_ISDIR (s.st_mode);
+  isjunc = S_ISJUN (s.st_mode);
+  r = 0;
+  if (islink || isdirlnk || isjunc)
+  {
+    wchar_t *rel;
+    if (GetRelNameW (absname, &rel, basedir) >= 0)
+    {
+      size_t linklen;
+      wchar_t *tmpptr = link_target (basedir, absname, isjunc, reljunc, &linklen);
+      if (tmpptr != NULL)
+      {
+        if (dry || ntlink_unlinkw(absname) == 0)
+          r = add_record (out, collect, isdirlnk ? L'd' : isjunc ? L'j' : L'f', rel, wcslen (rel), tmpptr, linklen);
+        free (tmpptr);
+      }
+      ntlink_free (rel);
+    }
+  }
+  else if (isdir && recursive)
+    r = backup_tree (basedir, absname, out, collect, inc, dry, reljunc, hardlinks, nthreads, throttle);
+  ntlink_free (absname);
+  return r;
+}
+
+/*
+  Makes link another name of the file target (relative to basedir).
+  If link exists (a copy of the file, in a fresh checkout), it is replaced:
+  the new name is created next to it and renamed over it.
+ */
+static int
+restore_hardlink (wchar_t *basedir, wchar_t *link, wchar_t *target, int exists)
+{
+  wchar_t *primary, *tmp = NULL;
+  size_t len = wcslen (link);
+  DWORD err = 0;
+  primary = join_path (basedir, target);
+  if (primary != NULL && exists)
+    tmp = (wchar_t *) malloc (sizeof (wchar_t) * (len + 2));
+  if (primary == NULL || (exists && tmp == NULL))
+  {
+    free (primary);
+    errno = ENOMEM;
+    return -1;
+  }
+  if (!exists)
+  {
+    if (!ntlink_fs->create_hard_link (link, primary, NULL))
+      err = GetLastError ();
+  }
+  else
+  {
+    memcpy (tmp, link, sizeof (wchar_t) * len);
+    tmp[len] = L'~';
+    tmp[len + 1] = L'\0';
+    if (!ntlink_fs->create_hard_link (tmp, primary, NULL))
+      err = GetLastError ();
+    else if (!ntlink_fs->move_file_ex (tmp, link, MOVEFILE_REPLACE_EXISTING))
+    {
+      err = GetLastError ();
+      ntlink_fs->delete_file (tmp);
+    }
+  }
+  free (tmp);
+  free (primary);
+  if (err != 0)
+  {
+    errno = Win32ErrorToErrno (err);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  cache - directory listings to check the link name against, NULL to check
+    it with PathExistsW()
+  Returns 0 on success, -1 on failure with errno set (EEXIST if the link
+  name is already taken, ENOTDIR if the path to it goes through a link)
+ */
+int restore_link (wchar_t *basedir, wchar_t linktype, wchar_t *link, wchar_t *target, int dry, ntlink_dircache *cache)
+{
+  WIN32_FIND_DATAW finddata;
+  DWORD attributes = 0;
+  int r;
+  /* Nothing to restore for a link that a delta manifest marks as removed */
+  if (linktype == MANIFEST_TYPE_REMOVED)
+    return 0;
+  if (dry)
+  {
+    fwprintf (stdout, L"%c %ls -> %ls\n", linktype, link, target);
+    return 0;
+  }
+  /* the link name must exist in the link-less tree */
+  if (cache != NULL)
+    r = ntlink_dircache_exists (cache, link, &attributes);
+  else
+  {
+    r = PathExistsW (link, &finddata, PATH_EXISTS_FLAG_DONT_FOLLOW_SYMLINKS);
+    attributes = finddata.dwFileAttributes;
+  }
+  /* A hard link may take the place of a plain file */
+  if (linktype == MANIFEST_TYPE_HARDLINK &&
+      (r == 0 || (r == 1 && !(attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)))))
+  {
+    r = restore_hardlink (basedir, link, target, r == 1);
+    if (r == 0 && cache != NULL)
+      ntlink_dircache_add (cache, link, FILE_ATTRIBUTE_NORMAL);
+    return r;
+  }
+  /* zero means that the link name does not exist yet, and that we haven't had
+   * any problems checking that (access restriction), and that the path to it
+   * does not contain links; note that the absolute path MIGHT contain links, but
+   * we only test relative path here.
+   */
+  if (r == 0)
+  {
+    switch (linktype)
+    {
+      /* Use blind linking to be able to create relative links (otherwise a call
+       * to PathExistsW() will break on paths relative to the link instead of %CD% */
+    case L'd':
+      r = ntlink_blind_symlinkw (target, link, BLIND_SYMLINK_DIR, basedir);
+      break;
+    case L'f':
+      r = ntlink_blind_symlinkw (target, link, BLIND_SYMLINK_FILE, basedir);
+      break;
+    case L'j':
+      r = ntlink_blind_symlinkw (target, link, BLIND_JUNCTION, basedir);
+      break;
+    default:
+      errno = EINVAL;
+      r = -1;
+      break;
+    }
+    if (r != 0)
+      return -1;
+    /* Links restored later may be under this one */
+    if (cache != NULL)
+      ntlink_dircache_add (cache, link, FILE_ATTRIBUTE_REPARSE_POINT | (linktype == L'f' ? 0 : FILE_ATTRIBUTE_DIRECTORY));
+    return 0;
+  }
+  errno = r == 1 ? EEXIST : r == -2 ? ENOTDIR : r == -5 ? ELOOP : EACCES;
+  return -1;
+}
+
+/*
+  Converts name (absolute or relative to basedir) into the form used
+  for link names in the manifest. Returns an empty string if name is basedir
+  itself (i.e. everything matches).
+ */
+int manifest_prefix (wchar_t *basedir, wchar_t *name, wchar_t **prefix)
+{
+  wchar_t *absname, *rel;
+  int r;
+  r = GetAbsNameW (name, &absname, basedir, 2);
+  if (r != 0)
+    return r;
+  r = GetRelNameW (absname, &rel, basedir);
+  ntlink_free (absname);
+  if (r < 0)
+    return r;
+  /* Callers free() it */
+  *prefix = wcsdup (rel);
+  ntlink_free (rel);
+  return *prefix != NULL ? 0 : -2;
+}
+
+/* Same as restore_link(), for an entry whose strings are not NUL-terminated */
+int restore_entry (wchar_t *basedir, const manifest_entry *e, int dry, ntlink_dircache *cache)
+{
+  wchar_t *link, *target;
+  int r;
+  link = (wchar_t *) malloc (sizeof (wchar_t) * (e->linklen + 1 + e->targetlen + 1));
+  if (link == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy (link, e->link, sizeof (wchar_t) * e->linklen);
+  link[e->linklen] = L'\0';
+  target = &link[e->linklen + 1];
+  memcpy (target, e->target, sizeof (wchar_t) * e->targetlen);
+  target[e->targetlen] = L'\0';
+  r = restore_link (basedir, e->type, link, target, dry, cache);
+  free (link);
+  return r;
+}
+
+/*
+  A link that lies under another link of the same restore depends on it:
+  it is restored after its parent, and skipped if the parent failed.
+  Links without such a parent are independent and are restored concurrently.
+ */
+typedef struct _restore_job restore_job;
+typedef struct _restore_node restore_node;
+
+struct _restore_node
+{
+  restore_job *job;
+  const manifest_entry *entry;
+  restore_node *first_child;
+  restore_node *next_sibling;
+  int has_parent;
+  /* 0 - restored, errno value - failed, -1 - skipped because the parent failed */
+  int status;
+};
+
+struct _restore_job
+{
+  wchar_t *basedir;
+  int dry;
+  ntlink_task_group *group;
+  ntlink_io_queue *queue;
+  ntlink_dircache *cache;
+};
+
+static int
+restore_node_cmp (const void *a, const void *b)
+{
+  const manifest_entry *ea = (*(const restore_node **) a)->entry;
+  const manifest_entry *eb = (*(const restore_node **) b)->entry;
+  return manifest_name_cmp (ea->link, ea->linklen, eb->link, eb->linklen);
+}
+
+/* Finds a node by name in a sorted array, returns NULL if there's none */
+static restore_node *
+find_restore_node (restore_node **sorted, size_t count, const wchar_t *link, size_t linklen)
+{
+  size_t lo = 0, hi = count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    int r = manifest_name_cmp (sorted[mid]->entry->link, sorted[mid]->entry->linklen, link, linklen);
+    if (r == 0)
+      return sorted[mid];
+    if (r < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+static void
+skip_restore_node (restore_node *node)
+{
+  restore_node *child;
+  node->status = -1;
+  for (child = node->first_child; child != NULL; child = child->next_sibling)
+    skip_restore_node (child);
+}
+
+static void
+restore_task (void *arg)
+{
+  restore_node *node = (restore_node *) arg;
+  restore_job *job = node->job;
+  restore_node *child;
+
+  /* A link under another link of this restore is checked on disk: the
+   * cache would see the parent link and refuse it.
+   */
+  if (restore_entry (job->basedir, node->entry, job->dry, node->has_parent ? NULL : job->cache) != 0)
+    node->status = errno != 0 ? errno : EIO;
+  for (child = node->first_child; child != NULL; child = child->next_sibling)
+  {
+    if (node->status != 0)
+      skip_restore_node (child);
+    else if (job->group == NULL || ntlink_io_submit (job->queue, job->group, 1, restore_task, child) != 0)
+      restore_task (child);
+  }
+}
+
+/*
+  entries - links to restore
+  nthreads - at most that many tasks run at once on the shared pool, 0 or less
+    means as many as it has threads, 1 means restore in manifest order in this thread
+  Returns the number of links that were not restored, or -1 if out of memory.
+  Failures are reported to stderr.
+ */
+int restore_entries (wchar_t *basedir, const manifest_entry *entries, size_t count, int nthreads, int dry)
+{
+  restore_job job;
+  restore_node *nodes;
+  restore_node **sorted;
+  size_t i;
+  int failed = 0;
+
+  nodes = (restore_node *) calloc (count > 0 ? count : 1, sizeof (restore_node));
+  sorted = (restore_node **) malloc (sizeof (restore_node *) * (count > 0 ? count : 1));
+  if (nodes == NULL || sorted == NULL)
+  {
+    free (nodes);
+    free (sorted);
+    return -1;
+  }
+  job.basedir = basedir;
+  job.dry = dry;
+  job.group = NULL;
+  job.queue = ntlink_io_queue_get (basedir);
+  /* Each directory is listed once, instead of probing every link name */
+  job.cache = dry ? NULL : ntlink_dircache_new ();
+  for (i = 0; i < count; i++)
+  {
+    nodes[i].job = &job;
+    nodes[i].entry = &entries[i];
+    sorted[i] = &nodes[i];
+  }
+  qsort (sorted, count, sizeof (restore_node *), restore_node_cmp);
+
+  /* Attach each node to its nearest ancestor among the links. Children are
+   * attached in reverse, so that they are restored in manifest order.
+   */
+  for (i = count; i-- > 0; )
+  {
+    const manifest_entry *e = &entries[i];
+    size_t len = e->linklen;
+    restore_node *parent = NULL;
+    while (parent == NULL && len > 0)
+    {
+      for (len -= 1; len > 0 && e->link[len] != L'\\' && e->link[len] != L'/'; len--);
+      if (len > 0)
+        parent = find_restore_node (sorted, count, e->link, len);
+    }
+    if (parent != NULL)
+    {
+      nodes[i].next_sibling = parent->first_child;
+      nodes[i].has_parent = 1;
+      parent->first_child = &nodes[i];
+    }
+  }
+  free (sorted);
+
+  /* Dry runs print the links, keep them in order */
+  if (nthreads != 1 && !dry)
+    job.group = ntlink_task_group_new (NULL, nthreads);
+  for (i = 0; i < count; i++)
+  {
+    if (nodes[i].has_parent)
+      continue;
+    if (job.group == NULL || ntlink_io_submit (job.queue, job.group, 1, restore_task, &nodes[i]) != 0)
+      restore_task (&nodes[i]);
+  }
+  if (job.group != NULL)
+    ntlink_task_group_free (job.group);
+  ntlink_dircache_free (job.cache);
+
+  for (i = 0; i < count; i++)
+  {
+    const manifest_entry *e = &entries[i];
+    if (nodes[i].status == 0)
+      continue;
+    failed += 1;
+    if (nodes[i].status < 0)
+      fwprintf (stderr, L"Skipped `%.*ls': a link it is under was not restored\n", (int) e->linklen, e->link);
+    else
+      fwprintf (stderr, L"Failed to restore `%.*ls': %d - %hs\n", (int) e->linklen, e->link, nodes[i].status, strerror (nodes[i].status));
+  }
+  free (nodes);
+  return failed;
+}
+
+/*
+  Returns 0 if everything was restored, 3 if some links were not,
+  negative values if the manifest is malformed or out of memory
+ */
+int restore_links (wchar_t *basedir, wchar_t *name, FILE *f, int nthreads, int dry)
+{
+  manifest_reader reader;
+  manifest_list list = { NULL, 0, 0 };
+  manifest_entry e;
+  wchar_t *prefix;
+  size_t prefixlen;
+  int r;
+  if (f == NULL)
+    f = stdin;
+  r = manifest_prefix (basedir, name, &prefix);
+  if (r != 0)
+    return r;
+  prefixlen = wcslen (prefix);
+  while (prefixlen > 0 && (prefix[prefixlen - 1] == L'\\' || prefix[prefixlen - 1] == L'/'))
+    prefixlen -= 1;
+  if (manifest_reader_init (&reader, f) != 0)
+  {
+    free (prefix);
+    return -9;
+  }
+  while ((r = manifest_reader_next (&reader, &e)) > 0)
+  {
+    if (matches_prefix (&e, prefix, prefixlen) &&
+        manifest_list_add (&list, e.type, e.link, e.linklen, e.target, e.targetlen) != 0)
+    {
+      r = -9;
+      break;
+    }
+  }
+  manifest_reader_free (&reader);
+  free (prefix);
+  if (r == 0)
+  {
+    r = restore_entries (basedir, list.items, list.count, nthreads, dry);
+    r = r < 0 ? -9 : r > 0 ? 3 : 0;
+  }
+  manifest_list_clear (&list);
+  return r;
+}
+
+/* Restores the records for name (and everything under it) from a binary manifest */
+int restore_links_map (wchar_t *basedir, wchar_t *name, manifest_map *map, int nthreads, int dry)
+{
+  manifest_entry *entries;
+  wchar_t *prefix;
+  size_t prefixlen, first, last, count = 0, i;
+  int r;
+  r = manifest_prefix (basedir, name, &prefix);
+  if (r != 0)
+    return r;
+  prefixlen = wcslen (prefix);
+  while (prefixlen > 0 && (prefix[prefixlen - 1] == L'\\' || prefix[prefixlen - 1] == L'/'))
+    prefixlen -= 1;
+  manifest_map_range (map, prefix, &first, &last);
+  entries = (manifest_entry *) malloc (sizeof (manifest_entry) * (last - first + 1));
+  if (entries == NULL)
+  {
+    free (prefix);
+    return -9;
+  }
+  for (i = first; i < last; i++)
+  {
+    if (manifest_map_entry (map, i, &entries[count]) != 0)
+    {
+      free (entries);
+      free (prefix);
+      return -9;
+    }
+    /* The range also has siblings that share the name prefix */
+    if (matches_prefix (&entries[count], prefix, prefixlen))
+      count += 1;
+  }
+  free (prefix);
+  r = restore_entries (basedir, entries, count, nthreads, dry);
+  free (entries);
+  return r < 0 ? -9 : r > 0 ? 3 : 0;
+}
+
+/*
+  Verification compares a tree with a manifest without changing it:
+  1) the records are grouped by directory, and the directories that have
+     links in the manifest are listed in parallel; the listing tells which
+     names exist and whether they are links of the right type; a hard link
+     record is right if its name is the same file as its target
+  2) targets of the links that exist are read in parallel batches, the same
+     way a backup reads them
+  3) the results are reported in manifest order, links that are in the
+     listed directories but not in the manifest are reported after that
+  Directories without links in the manifest are not visited, so the time
+  it takes depends on the number of links, not on the size of the tree.
+  The other side of that is that extra links are only found in directories
+  that have at least one link in the manifest.
+ */
+typedef enum
+{
+  VERIFY_MISSING = 0,
+  VERIFY_OK,
+  VERIFY_RETARGETED,
+  VERIFY_WRONG_TYPE,
+  VERIFY_FAILED
+} VerifyStatus;
+
+typedef struct
+{
+  VerifyStatus status;
+  /* type of what was found under the link name, L'-' if it's not a link */
+  wchar_t found;
+  /* link in verify_job::links, for VERIFY_RETARGETED */
+  size_t link;
+  int error;
+} verify_result;
+
+typedef struct
+{
+  wchar_t *absname;
+  /* link name, for extra links only */
+  wchar_t *rel;
+  wchar_t type;
+  wchar_t *target;
+  size_t targetlen;
+  int error;
+  /* records with this name are names.order[first] ... names.order[first + n - 1],
+   * n is 0 for extra links
+   */
+  size_t first;
+  size_t n;
+} verify_link;
+
+typedef struct
+{
+  wchar_t *basedir;
+  int reljunc;
+  const wchar_t *prefix;
+  size_t prefixlen;
+  ntlink_task_group *group;
+  ntlink_io_queue *queue;
+  ntlink_throttle *throttle;
+  const manifest_entry *entries;
+  manifest_index names;
+  manifest_index dirs;
+  verify_result *results;
+  CRITICAL_SECTION lock;
+  verify_link *links;
+  size_t count;
+  size_t capacity;
+  int nomem;
+} verify_job;
+
+typedef struct
+{
+  verify_job *job;
+  /* records of the directory are dirs.order[first] ... dirs.order[first + n - 1] */
+  size_t first;
+  size_t n;
+} verify_dir;
+
+typedef struct
+{
+  verify_job *job;
+  size_t first;
+  size_t last;
+} verify_batch;
+
+/* Length of the directory part of a link name, without the separator */
+static size_t
+link_parent_length (const manifest_entry *e)
+{
+  size_t len = e->linklen;
+  while (len > 0 && e->link[len - 1] != L'\\' && e->link[len - 1] != L'/')
+    len--;
+  return len > 0 ? len - 1 : 0;
+}
+
+static int
+verify_add_link (verify_job *job, verify_link *l)
+{
+  int r = 0;
+  EnterCriticalSection (&job->lock);
+  if (job->count == job->capacity)
+  {
+    size_t newcap = job->capacity == 0 ? 1024 : job->capacity * 2;
+    verify_link *tmp = (verify_link *) realloc (job->links, sizeof (verify_link) * newcap);
+    if (tmp == NULL)
+      r = -1;
+    else
+    {
+      job->links = tmp;
+      job->capacity = newcap;
+    }
+  }
+  if (r == 0)
+    job->links[job->count++] = *l;
+  else
+    job->nomem = 1;
+  LeaveCriticalSection (&job->lock);
+  return r;
+}
+
+/*
+  A hard link record is right if its name is the same file (same volume
+  and file ID) as its target, the first name of the group
+ */
+static void
+verify_hardlink (verify_job *job, const manifest_entry *e, const wchar_t *rel, verify_result *res)
+{
+  ntlink_statx st, primaryst;
+  wchar_t *link, *target, *primary = NULL;
+
+  link = join_path (job->basedir, rel);
+  target = (wchar_t *) malloc (sizeof (wchar_t) * (e->targetlen + 1));
+  if (target != NULL)
+  {
+    memcpy (target, e->target, sizeof (wchar_t) * e->targetlen);
+    target[e->targetlen] = L'\0';
+    primary = join_path (job->basedir, target);
+  }
+  if (link == NULL || primary == NULL)
+  {
+    res->status = VERIFY_FAILED;
+    res->error = ENOMEM;
+  }
+  else if (ntlink_statxw (link, NTLINK_STATX_FLAG_NOTHING, NTLINK_STATX_INO, &st) != 0 ||
+      ntlink_statxw (primary, NTLINK_STATX_FLAG_NOTHING, NTLINK_STATX_INO, &primaryst) != 0)
+  {
+    res->status = VERIFY_FAILED;
+    res->error = errno != 0 ? errno : EIO;
+  }
+  else if (!(st.stx_mask & primaryst.stx_mask & NTLINK_STATX_INO))
+  {
+    res->status = VERIFY_FAILED;
+    res->error = ENOSYS;
+  }
+  else if (st.stx_volume_serial != primaryst.stx_volume_serial || memcmp (st.stx_file_id, primaryst.stx_file_id, 16) != 0)
+    res->status = VERIFY_RETARGETED;
+  else
+    res->status = VERIFY_OK;
+  free (link);
+  free (target);
+  free (primary);
+}
+
+static void
+verify_dir_list (verify_dir *dir)
+{
+  verify_job *job = dir->job;
+  const manifest_entry *first = &job->entries[job->dirs.order[dir->first]];
+  size_t parentlen = link_parent_length (first), i;
+  WIN32_FIND_DATAW finddata;
+  wchar_t *parent, *absdir = NULL, *pattern = NULL;
+  HANDLE h = INVALID_HANDLE_VALUE;
+  DWORD err = 0;
+
+  parent = (wchar_t *) malloc (sizeof (wchar_t) * (parentlen + 1));
+  if (parent != NULL)
+  {
+    memcpy (parent, first->link, sizeof (wchar_t) * parentlen);
+    parent[parentlen] = L'\0';
+    absdir = parentlen > 0 ? join_path (job->basedir, parent) : wcsdup (job->basedir);
+  }
+  if (absdir != NULL)
+    pattern = join_path (absdir, L"*");
+  if (pattern == NULL)
+    err = ERROR_NOT_ENOUGH_MEMORY;
+  else
+  {
+    h = ntlink_fs->find_first_file_ex (pattern, FindExInfoBasic, &finddata, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    /* Basic info and large fetches are not available before Windows 7 */
+    if (h == INVALID_HANDLE_VALUE && GetLastError () == ERROR_INVALID_PARAMETER)
+      h = ntlink_fs->find_first_file_ex (pattern, FindExInfoStandard, &finddata, FindExSearchNameMatch, NULL, 0);
+    if (h == INVALID_HANDLE_VALUE)
+      err = GetLastError ();
+    free (pattern);
+  }
+
+  /* No directory means that none of its links exist */
+  if (h == INVALID_HANDLE_VALUE && err != ERROR_FILE_NOT_FOUND &&
+      err != ERROR_PATH_NOT_FOUND && err != ERROR_DIRECTORY)
+  {
+    for (i = dir->first; i < dir->first + dir->n; i++)
+    {
+      job->results[job->dirs.order[i]].status = VERIFY_FAILED;
+      job->results[job->dirs.order[i]].error = err == ERROR_NOT_ENOUGH_MEMORY ? ENOMEM : Win32ErrorToErrno (err);
+    }
+  }
+  while (h != INVALID_HANDLE_VALUE)
+  {
+    verify_link l;
+    manifest_entry e;
+    wchar_t *rel;
+    size_t at, n;
+    int islink, read = 0;
+    if (wcscmp (finddata.cFileName, L".") == 0 || wcscmp (finddata.cFileName, L"..") == 0)
+    {
+      if (!ntlink_fs->find_next_file (h, &finddata))
+        break;
+      continue;
+    }
+    ntlink_throttle_charge (job->throttle, 1, sizeof (wchar_t) * wcslen (finddata.cFileName));
+    islink = (finddata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+        (finddata.dwReserved0 == IO_REPARSE_TAG_SYMLINK || finddata.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT);
+    memset (&l, 0, sizeof (l));
+    l.type = !islink ? L'-' : finddata.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT ? L'j' :
+        (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? L'd' : L'f';
+    rel = parentlen > 0 ? join_path (parent, finddata.cFileName) : wcsdup (finddata.cFileName);
+    if (rel == NULL)
+      job->nomem = 1;
+    else
+    {
+      e.link = rel;
+      e.linklen = wcslen (rel);
+      at = manifest_index_find (&job->names, rel, e.linklen, &n);
+      for (i = 0; i < n; i++)
+      {
+        const manifest_entry *me = &job->entries[job->names.order[at + i]];
+        verify_result *res = &job->results[job->names.order[at + i]];
+        res->found = l.type;
+        if (me->type == MANIFEST_TYPE_HARDLINK)
+        {
+          /* Hard links are plain files, compared by their file IDs */
+          if (islink || (finddata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            res->status = VERIFY_WRONG_TYPE;
+          else
+            verify_hardlink (job, me, rel, res);
+          continue;
+        }
+        res->status = l.type == me->type ? VERIFY_OK : VERIFY_WRONG_TYPE;
+        read |= res->status == VERIFY_OK;
+      }
+      /* Targets are compared once they are read */
+      if (islink && (read || (n == 0 && matches_prefix (&e, job->prefix, job->prefixlen))))
+      {
+        l.absname = join_path (absdir, finddata.cFileName);
+        l.first = at;
+        l.n = n;
+        if (n == 0)
+        {
+          l.rel = rel;
+          rel = NULL;
+        }
+        if (l.absname == NULL || verify_add_link (job, &l) != 0)
+        {
+          job->nomem = 1;
+          free (l.absname);
+          free (l.rel);
+        }
+      }
+      free (rel);
+    }
+    if (!ntlink_fs->find_next_file (h, &finddata))
+      break;
+  }
+  if (h != INVALID_HANDLE_VALUE)
+    ntlink_fs->find_close (h);
+  free (absdir);
+  free (parent);
+}
+
+static void
+verify_dir_task (void *arg)
+{
+  verify_dir *dir = (verify_dir *) arg;
+  ntlink_throttle_begin (dir->job->throttle);
+  verify_dir_list (dir);
+  ntlink_throttle_end (dir->job->throttle);
+}
+
+static void
+verify_read_task (void *arg)
+{
+  verify_batch *batch = (verify_batch *) arg;
+  verify_job *job = batch->job;
+  size_t i;
+  ntlink_throttle_begin (job->throttle);
+  for (i = batch->first; i < batch->last; i++)
+  {
+    verify_link *l = &job->links[i];
+    errno = 0;
+    l->target = link_target (job->basedir, l->absname, l->type == L'j', job->reljunc, &l->targetlen);
+    if (l->target == NULL)
+      l->error = errno != 0 ? errno : EIO;
+    ntlink_throttle_charge (job->throttle, 1, sizeof (wchar_t) * l->targetlen);
+  }
+  ntlink_throttle_end (job->throttle);
+}
+
+static int
+verify_extra_cmp (const void *a, const void *b)
+{
+  const verify_link *la = *(const verify_link **) a;
+  const verify_link *lb = *(const verify_link **) b;
+  return manifest_name_cmp (la->rel, wcslen (la->rel), lb->rel, wcslen (lb->rel));
+}
+
+/*
+  entries - records to check (links only)
+  prefix - only links under it are reported as extra
+  throttle - if not NULL, directories are listed and links are read in the
+    background, at its rates
+  Returns 0 if the tree matches, 4 if it does not, 5 if it might, but some
+  of the links could not be checked, -9 if out of memory.
+ */
+int verify_entries (wchar_t *basedir, const wchar_t *prefix, const manifest_entry *entries, size_t count, int nthreads, int reljunc, ntlink_throttle *throttle)
+{
+  verify_job job;
+  verify_dir *dirs = NULL;
+  verify_batch *batches = NULL;
+  verify_link **extras = NULL;
+  size_t ndirs = 0, nbatches, nextras = 0, i, j;
+  size_t missing = 0, retargeted = 0, wrongtype = 0, failed = 0;
+  int r;
+
+  memset (&job, 0, sizeof (job));
+  job.basedir = basedir;
+  job.reljunc = reljunc;
+  job.throttle = throttle;
+  job.prefix = prefix;
+  job.prefixlen = wcslen (prefix);
+  while (job.prefixlen > 0 && (prefix[job.prefixlen - 1] == L'\\' || prefix[job.prefixlen - 1] == L'/'))
+    job.prefixlen -= 1;
+  job.entries = entries;
+  job.results = (verify_result *) calloc (count > 0 ? count : 1, sizeof (verify_result));
+  if (job.results == NULL)
+    return -9;
+  if (manifest_index_build (&job.names, entries, count, 0) != 0)
+  {
+    free (job.results);
+    return -9;
+  }
+  if (manifest_index_build (&job.dirs, entries, count, 1) != 0)
+  {
+    manifest_index_free (&job.names);
+    free (job.results);
+    return -9;
+  }
+  InitializeCriticalSection (&job.lock);
+  if (nthreads != 1)
+    job.group = ntlink_task_group_new (NULL, nthreads);
+  job.queue = ntlink_io_queue_get (basedir);
+
+  /* One task per directory; the index keeps the records of a directory together */
+  for (i = 0; i < count; i = j)
+  {
+    const manifest_entry *e = &entries[job.dirs.order[i]];
+    size_t n;
+    manifest_index_find (&job.dirs, e->link, link_parent_length (e), &n);
+    j = i + n;
+    ndirs += 1;
+  }
+  dirs = (verify_dir *) malloc (sizeof (verify_dir) * (ndirs > 0 ? ndirs : 1));
+  if (dirs == NULL)
+    job.nomem = 1;
+  for (i = 0, ndirs = 0; dirs != NULL && i < count; i = j)
+  {
+    const manifest_entry *e = &entries[job.dirs.order[i]];
+    size_t n;
+    manifest_index_find (&job.dirs, e->link, link_parent_length (e), &n);
+    j = i + n;
+    dirs[ndirs].job = &job;
+    dirs[ndirs].first = i;
+    dirs[ndirs].n = n;
+    if (job.group == NULL || ntlink_io_submit (job.queue, job.group, n, verify_dir_task, &dirs[ndirs]) != 0)
+      verify_dir_task (&dirs[ndirs]);
+    ndirs += 1;
+  }
+  if (job.group != NULL)
+    ntlink_task_group_wait (job.group);
+
+  nbatches = (job.count + BACKUP_LINK_BATCH - 1) / BACKUP_LINK_BATCH;
+  if (nbatches > 0)
+    batches = (verify_batch *) malloc (sizeof (verify_batch) * nbatches);
+  if (batches == NULL)
+  {
+    /* Nothing to do, or no memory to split the work */
+    verify_batch all;
+    all.job = &job;
+    all.first = 0;
+    all.last = job.count;
+    verify_read_task (&all);
+  }
+  for (i = 0; batches != NULL && i < nbatches; i++)
+  {
+    batches[i].job = &job;
+    batches[i].first = i * BACKUP_LINK_BATCH;
+    batches[i].last = batches[i].first + BACKUP_LINK_BATCH < job.count ? batches[i].first + BACKUP_LINK_BATCH : job.count;
+    if (job.group == NULL || ntlink_io_submit (job.queue, job.group, batches[i].last - batches[i].first, verify_read_task, &batches[i]) != 0)
+      verify_read_task (&batches[i]);
+  }
+  if (job.group != NULL)
+    ntlink_task_group_free (job.group);
+  free (batches);
+  free (dirs);
+  DeleteCriticalSection (&job.lock);
+
+  extras = (verify_link **) malloc (sizeof (verify_link *) * (job.count > 0 ? job.count : 1));
+  if (extras == NULL)
+    job.nomem = 1;
+  for (i = 0; i < job.count; i++)
+  {
+    verify_link *l = &job.links[i];
+    if (l->n == 0)
+    {
+      if (extras != NULL)
+        extras[nextras++] = l;
+      continue;
+    }
+    for (j = l->first; j < l->first + l->n; j++)
+    {
+      const manifest_entry *e = &entries[job.names.order[j]];
+      verify_result *res = &job.results[job.names.order[j]];
+      if (res->status != VERIFY_OK)
+        continue;
+      if (l->target == NULL)
+      {
+        res->status = VERIFY_FAILED;
+        res->error = l->error;
+      }
+      else if (l->targetlen != e->targetlen || _wcsnicmp (l->target, e->target, e->targetlen) != 0)
+      {
+        res->status = VERIFY_RETARGETED;
+        res->link = i;
+      }
+    }
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    const manifest_entry *e = &entries[i];
+    verify_result *res = &job.results[i];
+    switch (res->status)
+    {
+    case VERIFY_MISSING:
+      missing += 1;
+      fwprintf (stdout, L"missing %c %.*ls -> %.*ls\n", e->type, (int) e->linklen, e->link, (int) e->targetlen, e->target);
+      break;
+    case VERIFY_RETARGETED:
+      retargeted += 1;
+      if (e->type == MANIFEST_TYPE_HARDLINK)
+        fwprintf (stdout, L"retargeted %c %.*ls -> %.*ls (not the same file)\n", e->type, (int) e->linklen, e->link,
+            (int) e->targetlen, e->target);
+      else
+        fwprintf (stdout, L"retargeted %c %.*ls -> %.*ls (expected %.*ls)\n", e->type, (int) e->linklen, e->link,
+          (int) job.links[res->link].targetlen, job.links[res->link].target, (int) e->targetlen, e->target);
+      break;
+    case VERIFY_WRONG_TYPE:
+      wrongtype += 1;
+      if (res->found == L'-' && e->type == MANIFEST_TYPE_HARDLINK)
+        fwprintf (stdout, L"wrong type %c %.*ls: a directory\n", e->type, (int) e->linklen, e->link);
+      else if (res->found == L'-')
+        fwprintf (stdout, L"wrong type %c %.*ls: not a link\n", e->type, (int) e->linklen, e->link);
+      else
+        fwprintf (stdout, L"wrong type %c %.*ls: found %c\n", e->type, (int) e->linklen, e->link, res->found);
+      break;
+    case VERIFY_FAILED:
+      failed += 1;
+      fwprintf (stderr, L"Failed to check `%.*ls': %d - %hs\n", (int) e->linklen, e->link, res->error, strerror (res->error));
+      break;
+    default:
+      break;
+    }
+  }
+  if (extras != NULL)
+  {
+    qsort (extras, nextras, sizeof (verify_link *), verify_extra_cmp);
+    for (i = 0; i < nextras; i++)
+    {
+      if (extras[i]->target == NULL)
+        fwprintf (stdout, L"extra %c %ls\n", extras[i]->type, extras[i]->rel);
+      else
+        fwprintf (stdout, L"extra %c %ls -> %.*ls\n", extras[i]->type, extras[i]->rel, (int) extras[i]->targetlen, extras[i]->target);
+    }
+  }
+  fwprintf (stderr, L"%lu links checked: %lu missing, %lu retargeted, %lu of a wrong type, %lu extra, %lu failed\n",
+      (unsigned long) count, (unsigned long) missing, (unsigned long) retargeted, (unsigned long) wrongtype,
+      (unsigned long) nextras, (unsigned long) failed);
+
+  for (i = 0; i < job.count; i++)
+  {
+    free (job.links[i].absname);
+    free (job.links[i].rel);
+    free (job.links[i].target);
+  }
+  free (job.links);
+  free (extras);
+  manifest_index_free (&job.names);
+  manifest_index_free (&job.dirs);
+  free (job.results);
+  if (job.nomem)
+    return -9;
+  if (missing > 0 || retargeted > 0 || wrongtype > 0 || nextras > 0)
+    r = 4;
+  else
+    r = failed > 0 ? 5 : 0;
+  return r;
+}
+
+/*
+  Verifies the records for name (and everything under it) from a text
+  manifest (f) or a binary one (map), hard link records included. Removal
+  and directory state records are ignored.
+ */
+int verify_links (wchar_t *basedir, wchar_t *name, FILE *f, manifest_map *map, int nthreads, int reljunc, ntlink_throttle *throttle)
+{
+  manifest_list list = { NULL, 0, 0 };
+  manifest_reader reader;
+  manifest_entry *entries = NULL;
+  manifest_entry e;
+  wchar_t *prefix;
+  size_t prefixlen, count = 0, first, last, i;
+  int r;
+  r = manifest_prefix (basedir, name, &prefix);
+  if (r != 0)
+    return r;
+  prefixlen = wcslen (prefix);
+  while (prefixlen > 0 && (prefix[prefixlen - 1] == L'\\' || prefix[prefixlen - 1] == L'/'))
+    prefixlen -= 1;
+  if (map != NULL)
+  {
+    manifest_map_range (map, prefix, &first, &last);
+    entries = (manifest_entry *) malloc (sizeof (manifest_entry) * (last - first + 1));
+    if (entries == NULL)
+      r = -9;
+    for (i = first; r == 0 && i < last; i++)
+    {
+      if (manifest_map_entry (map, i, &e) != 0)
+        r = -9;
+      /* The range also has siblings that share the name prefix */
+      else if ((e.type == L'f' || e.type == L'd' || e.type == L'j' || e.type == MANIFEST_TYPE_HARDLINK) && matches_prefix (&e, prefix, prefixlen))
+        entries[count++] = e;
+    }
+  }
+  else if (manifest_reader_init (&reader, f != NULL ? f : stdin) != 0)
+    r = -9;
+  else
+  {
+    while ((r = manifest_reader_next (&reader, &e)) > 0)
+    {
+      if ((e.type == L'f' || e.type == L'd' || e.type == L'j' || e.type == MANIFEST_TYPE_HARDLINK) && matches_prefix (&e, prefix, prefixlen) &&
+          manifest_list_add (&list, e.type, e.link, e.linklen, e.target, e.targetlen) != 0)
+      {
+        r = -9;
+        break;
+      }
+    }
+    manifest_reader_free (&reader);
+    entries = list.items;
+    count = list.count;
+  }
+  if (r == 0)
+    r = verify_entries (basedir, prefix, entries, count, nthreads, reljunc, throttle);
+  if (map != NULL)
+    free (entries);
+  manifest_list_clear (&list);
+  free (prefix);
+  return r;
+}
+
+/* Prints the record for a single link */
+int lookup_link (wchar_t *basedir, wchar_t *name, wchar_t *filename, manifest_map *map)
+{
+  wchar_t *link;
+  manifest_entry e;
+  int r;
+  r = manifest_prefix (basedir, name, &link);
+  if (r != 0)
+    return r;
+  if (map != NULL)
+  {
+    long long rec = manifest_map_lookup (map, link);
+    r = rec < 0 ? 1 : manifest_map_entry (map, (size_t) rec, &e);
+  }
+  else
+  {
+    FILE *f = filename != NULL ? _wfopen (filename, L"rb") : stdin;
+    manifest_reader reader;
+    size_t len = wcslen (link);
+    if (f == NULL || manifest_reader_init (&reader, f) != 0)
+    {
+      if (f != NULL && filename != NULL)
+        fclose (f);
+      free (link);
+      return 2;
+    }
+    /* No index in a text manifest, scan it */
+    r = 1;
+    while (manifest_reader_next (&reader, &e) > 0)
+    {
+      if (manifest_name_cmp (e.link, e.linklen, link, len) == 0)
+      {
+        r = 0;
+        break;
+      }
+    }
+    if (r == 0)
+      fwprintf (stdout, L"%c %.*ls -> %.*ls\n", e.type, (int) e.linklen, e.link, (int) e.targetlen, e.target);
+    manifest_reader_free (&reader);
+    if (filename != NULL)
+      fclose (f);
+  }
+  if (map != NULL && r == 0)
+    fwprintf (stdout, L"%c %.*ls -> %.*ls\n", e.type, (int) e.linklen, e.link, (int) e.targetlen, e.target);
+  if (r != 0)
+    fwprintf (stderr, L"`%ls' is not in the manifest\n", link);
+  free (link);
+  return r;
+}
+
+/*
+  Applies the delta manifest deltafile on top of filename and writes the
+  result to output, in the format of filename
+ */
+int apply_delta (wchar_t *filename, wchar_t *deltafile, wchar_t *output)
+{
+  manifest_map *basemap = NULL, *deltamap = NULL;
+  manifest_list baselist = { NULL, 0, 0 }, deltalist = { NULL, 0, 0 }, result = { NULL, 0, 0 };
+  manifest_entry *base = NULL, *delta = NULL;
+  size_t nbase, ndelta, i;
+  FILE *out = NULL;
+  int r;
+
+  r = load_manifest (filename, &basemap, &baselist, &base, &nbase);
+  if (r == 0)
+    r = load_manifest (deltafile, &deltamap, &deltalist, &delta, &ndelta);
+  if (r == 0)
+    r = manifest_merge (base, nbase, delta, ndelta, &result);
+  if (r == 0)
+  {
+    out = _wfopen (output, L"wb");
+    r = out == NULL ? 2 : 0;
+  }
+  if (r == 0 && basemap != NULL)
+    r = manifest_write_binary (out, &result);
+  else if (r == 0)
+  {
+    manifest_writer writer;
+    r = manifest_writer_init (&writer, out);
+    for (i = 0; r == 0 && i < result.count; i++)
+      r = manifest_writer_add (&writer, &result.items[i]);
+    if (r == 0)
+      r = manifest_writer_flush (&writer);
+    manifest_writer_free (&writer);
+  }
+  if (out != NULL)
+    fclose (out);
+  free (base);
+  free (delta);
+  manifest_map_close (basemap);
+  manifest_map_close (deltamap);
+  manifest_list_clear (&baselist);
+  manifest_list_clear (&deltalist);
+  manifest_list_clear (&result);
+  return r;
+}
+
+/* Converts a text manifest into a binary one and vice versa */
+int convert_manifest (wchar_t *filename, manifest_map *map, wchar_t *output)
+{
+  FILE *out;
+  int r = 0;
+  if (map != NULL)
+  {
+    manifest_writer writer;
+    size_t i;
+    out = _wfopen (output, L"wb");
+    if (out == NULL)
+      return 2;
+    if (manifest_writer_init (&writer, out) != 0)
+    {
+      fclose (out);
+      return -1;
+    }
+    for (i = 0; i < manifest_map_count (map) && r == 0; i++)
+    {
+      manifest_entry e;
+      r = manifest_map_entry (map, i, &e);
+      if (r == 0)
+        r = manifest_writer_add (&writer, &e);
+    }
+    if (r == 0)
+      r = manifest_writer_flush (&writer);
+    manifest_writer_free (&writer);
+  }
+  else
+  {
+    manifest_list list = { NULL, 0, 0 };
+    FILE *in = _wfopen (filename, L"rb");
+    if (in == NULL)
+      return 2;
+    r = manifest_read_text (in, &list);
+    fclose (in);
+    if (r != 0)
+    {
+      manifest_list_clear (&list);
+      return r;
+    }
+    out = _wfopen (output, L"wb");
+    if (out == NULL)
+    {
+      manifest_list_clear (&list);
+      return 2;
+    }
+    r = manifest_write_binary (out, &list);
+    manifest_list_clear (&list);
+  }
+  fclose (out);
+  return r;
+}
+
+/* Creates the temporary files of an external sort in %TEMP% */
+static FILE *
+spill_file (void *data)
+{
+  wchar_t dir[MAX_PATH + 1], name[MAX_PATH + 1];
+  DWORD len = GetTempPathW (MAX_PATH + 1, dir);
+  if (len == 0 || len > MAX_PATH || GetTempFileNameW (dir, L"tl", 0, name) == 0)
+    return NULL;
+  /* 'D' makes the file go away when it's closed */
+  return _wfopen (name, L"w+bD");
+}
+
+/* Feeds all records of a manifest (of either format) into a sorter */
+int sort_manifest (wchar_t *filename, manifest_sorter *sorter)
+{
+  manifest_map *map;
+  manifest_entry e;
+  size_t i;
+  int r;
+  r = manifest_map_open (filename, &map);
+  if (r == 0)
+  {
+    for (i = 0; r == 0 && i < manifest_map_count (map); i++)
+    {
+      r = manifest_map_entry (map, i, &e);
+      if (r == 0)
+        r = manifest_sorter_add (sorter, &e);
+    }
+    manifest_map_close (map);
+  }
+  else if (r == -2)
+  {
+    manifest_reader reader;
+    FILE *f = _wfopen (filename, L"rb");
+    if (f == NULL)
+      return 2;
+    if (manifest_reader_init (&reader, f) != 0)
+    {
+      fclose (f);
+      return -9;
+    }
+    while ((r = manifest_reader_next (&reader, &e)) > 0)
+    {
+      r = manifest_sorter_add (sorter, &e);
+      if (r != 0)
+        break;
+    }
+    manifest_reader_free (&reader);
+    fclose (f);
+  }
+  else
+    return r == -1 ? 2 : r;
+  if (r == 0)
+    r = manifest_sorter_finish (sorter);
+  return r;
+}
+
+/* The next record of a sorted manifest, removal records are skipped */
+static int
+next_link (manifest_sorter *sorter, manifest_entry *e)
+{
+  int r;
+  while ((r = manifest_sorter_next (sorter, e)) > 0 && e->type == MANIFEST_TYPE_REMOVED);
+  return r;
+}
+
+/*
+  Joins two manifests in the order of link names, with at most memory bytes
+  of records in memory (the rest is sorted in temporary files):
+  diff != 0 - writes a delta manifest that turns first into second:
+    records of second that are not in first or differ from it, and
+    removal records for the links of first that are not in second
+  diff == 0 - writes the merged manifest: second is applied on top of first,
+    like a delta (its removal records delete links of first)
+  When a manifest has several records for a link, the last one counts.
+  The output is a sorted text manifest.
+ */
+int join_manifests (wchar_t *first, wchar_t *second, wchar_t *output, size_t memory, int diff)
+{
+  manifest_sorter a, b;
+  manifest_writer writer;
+  manifest_entry ea, eb;
+  FILE *out;
+  int ra, rb, r;
+
+  manifest_sorter_init (&a, memory / 2, 1, spill_file, NULL);
+  manifest_sorter_init (&b, memory / 2, 1, spill_file, NULL);
+  r = sort_manifest (first, &a);
+  if (r == 0)
+    r = sort_manifest (second, &b);
+  out = r == 0 ? _wfopen (output, L"wb") : NULL;
+  if (r == 0 && out == NULL)
+    r = 2;
+  if (r == 0 && manifest_writer_init (&writer, out) != 0)
+  {
+    fclose (out);
+    out = NULL;
+    r = -9;
+  }
+  if (r != 0)
+  {
+    manifest_sorter_free (&a);
+    manifest_sorter_free (&b);
+    return r;
+  }
+
+  ra = next_link (&a, &ea);
+  rb = manifest_sorter_next (&b, &eb);
+  while (r == 0 && (ra > 0 || rb > 0))
+  {
+    int c = ra <= 0 ? 1 : rb <= 0 ? -1 : manifest_name_cmp (ea.link, ea.linklen, eb.link, eb.linklen);
+    if (c < 0)
+    {
+      if (diff)
+        ea.type = MANIFEST_TYPE_REMOVED;
+      r = manifest_writer_add (&writer, &ea);
+      ra = next_link (&a, &ea);
+    }
+    else if (c > 0)
+    {
+      if (eb.type != MANIFEST_TYPE_REMOVED)
+        r = manifest_writer_add (&writer, &eb);
+      rb = manifest_sorter_next (&b, &eb);
+    }
+    else
+    {
+      if (diff && eb.type == MANIFEST_TYPE_REMOVED)
+      {
+        ea.type = MANIFEST_TYPE_REMOVED;
+        r = manifest_writer_add (&writer, &ea);
+      }
+      else if (eb.type != MANIFEST_TYPE_REMOVED && (!diff || ea.type != eb.type ||
+          manifest_name_cmp (ea.target, ea.targetlen, eb.target, eb.targetlen) != 0))
+        r = manifest_writer_add (&writer, &eb);
+      ra = next_link (&a, &ea);
+      rb = manifest_sorter_next (&b, &eb);
+    }
+    if (r == 0 && (ra < 0 || rb < 0))
+      r = ra < 0 ? ra : rb;
+  }
+  if (r == 0)
+    r = manifest_writer_flush (&writer);
+  manifest_writer_free (&writer);
+  fclose (out);
+  manifest_sorter_free (&a);
+  manifest_sorter_free (&b);
+  return r;
+}
+
+void usage (wchar_t **argv)
+{
+  fwprintf (stderr,
+L"\
+Usage: %s <operation> <base directory> <file or directory name> [option [option argument] ...]\n\
+Operations:\n\
+  b - backup\n\
+  r - restore <file or directory name> and everything under it\n\
+  l - look up the link <file or directory name> and print its record\n\
+  c - convert a text manifest into a binary one or vice versa (needs 'f' and 'o'),\n\
+  or apply a delta manifest to it (with 'a')\n\
+  v - verify that the links under <file or directory name> match the manifest;\n\
+  prints missing, retargeted, wrong type and extra links (a hard link name is\n\
+  retargeted if it is not the same file as the first name of its group),\n\
+  exits with 0 if the tree matches, 4 if it does not, 5 if some links could\n\
+  not be checked\n\
+  d - write the differences between the manifests 'f' (old) and 'n' (new) into 'o'\n\
+  as a delta manifest (it turns 'f' into 'n', see 'a')\n\
+  m - apply the manifest 'n' on top of 'f' (its records replace those of 'f',\n\
+  its removal records delete them) and write the result into 'o'\n\
+  'd' and 'm' work on manifests of any size and always write sorted text manifests\n\
+Options:\n\
+  j - make junction point paths relative when packing them up (they are always absolute);\n\
+  for 'v', the manifest was made with 'j'\n\
+  r - when backing up a directory examine its contents as well\n\
+  d - dry run: do not remove/restore links, print only\n\
+  f <filename> - read/append backup information from/to <filename>\n\
+  (otherwise - read/write backup information from/to stdin/stdout)\n\
+  h - when backing up a directory with 'r', also record files that have several\n\
+  names in it: all names but one become hard link records (and are removed),\n\
+  restore recreates them, replacing plain copies (needs every file to be stat'ed)\n\
+  B - write a binary (indexed) manifest when backing up, needs 'f';\n\
+  (binary manifests can't be appended to, <filename> is overwritten)\n\
+  o <filename> - output file for 'c'\n\
+  a <filename> - delta manifest for 'c' to apply\n\
+  n <filename> - the second manifest for 'd' and 'm'\n\
+  m <megabytes> - memory to sort manifests in for 'd' and 'm' (default: 64);\n\
+  records that don't fit are sorted in temporary files in %%TEMP%%\n\
+  i <filename> - incremental backup: write only the links that were added,\n\
+  retargeted or removed since the manifest <filename> (links are not removed)\n\
+  s <filename> - directory state for incremental backups; directories that\n\
+  did not change since the previous backup with the same state are skipped\n\
+  S - print call counts and latencies to stderr at exit\n\
+  T <filename> - record the calls made into <filename>, for replay\n\
+  t <number> - number of threads to back up, restore or verify links with\n\
+  (default: one per CPU); links under other links are always restored after them,\n\
+  backups are sorted by link name regardless of the number of threads\n\
+  L - back up or verify in the background (low I/O priority), so that other\n\
+  programs using the same disks are not slowed down\n\
+  R <ops>[:<bytes>] - back up or verify at most <ops> directory entries and\n\
+  links per second and, optionally, at most <bytes> bytes of names and link\n\
+  targets per second\n\
+Binary manifests are recognized automatically when reading.\n\
+", argv[0]);
+}
+
+/* NULL if nothing was asked for */
+static ntlink_throttle *
+new_throttle (const ntlink_throttle_settings *settings)
+{
+  ntlink_throttle *throttle;
+  if (!settings->background && settings->ops_per_sec <= 0 && settings->bytes_per_sec <= 0)
+    return NULL;
+  throttle = ntlink_throttle_new (settings);
+  if (throttle == NULL)
+    fwprintf (stderr, L"warning: failed to set up throttling, running at full speed\n");
+  return throttle;
+}
+
+static void
+print_stats (void)
+{
+  ntlink_stats_print (stderr);
+  ntlink_io_print_stats (stderr);
+}
+
+static void
+stop_trace (void)
+{
+  if (ntlink_trace_stop () != 0)
+    fwprintf (stderr, L"Failed to write the trace\n");
+}
+
+#ifdef TRANSLINK_NO_MAIN
+/* bench/workload.c runs translink operations in its own process */
+#define wmain translink_wmain
+#endif
+
+int wmain (int argc, wchar_t **argv);
+
+#if defined(TRANSLINK_NO_MAIN)
+#elif defined(__MINGW32__) && !defined(__MINGW64__)
+int
+main (int argc, char **argv)
+{
+   LPWSTR *szArglist;
+   int nArgs;
+   int r;
+
+   szArglist = CommandLineToArgvW(GetCommandLineW(), &nArgs);
+   if( NULL == szArglist )
+   {
+      fwprintf(stderr, L"CommandLineToArgvW failed\n");
+      return -1;
+   }
+   else
+     r = wmain (nArgs, szArglist);
+
+   LocalFree(szArglist);
+
+   return r;
+}
+#elif !defined(_WIN32)
+/* Built against the filesystem simulator: arguments are in the locale encoding */
+int
+main (int argc, char **argv)
+{
+  wchar_t **wargv;
+  int i, r = -1;
+
+  setlocale (LC_ALL, "");
+  wargv = calloc (argc + 1, sizeof (wchar_t *));
+  if (wargv == NULL)
+    return -1;
+  for (i = 0; i < argc; i++)
+  {
+    size_t len = mbstowcs (NULL, argv[i], 0);
+    if (len == (size_t) -1)
+    {
+      fprintf (stderr, "Can't convert argument %d\n", i);
+      goto out;
+    }
+    wargv[i] = malloc ((len + 1) * sizeof (wchar_t));
+    if (wargv[i] == NULL)
+      goto out;
+    mbstowcs (wargv[i], argv[i], len + 1);
+  }
+  r = wmain (argc, wargv);
+out:
+  for (i = 0; i < argc; i++)
+    free (wargv[i]);
+  free (wargv);
+  return r;
+}
+#endif
+
+int
+wmain (int argc, wchar_t **argv)
+{
+  FILE *f = NULL;
+  wchar_t *filename = NULL;
+  wchar_t *output = NULL;
+  wchar_t *deltafile = NULL;
+  wchar_t *basefile = NULL;
+  wchar_t *statefile = NULL;
+  wchar_t *secondfile = NULL;
+  wchar_t *tracefile = NULL;
+  size_t memory = 0;
+  backup_incremental inc;
+  manifest_map *map = NULL;
+  int dry = 0;
+  int recursive = 0;
+  int reljunc = 0;
+  int binary = 0;
+  int hardlinks = 0;
+  int nthreads = 0;
+  int stats = 0;
+  ntlink_throttle_settings throttling;
+  ntlink_throttle *throttle = NULL;
+  int r;
+  memset (&throttling, 0, sizeof (throttling));
+  if (argc < 4)
+  {
+    fwprintf (stderr, L"Must have at least 3 arguments\n");
+    if (argc > 0)
+      usage (argv);
+    return 1;
+  }
+  if (wcscmp (argv[1], L"b") != 0 && wcscmp (argv[1], L"r") != 0 &&
+      wcscmp (argv[1], L"l") != 0 && wcscmp (argv[1], L"c") != 0 &&
+      wcscmp (argv[1], L"v") != 0 && wcscmp (argv[1], L"d") != 0 &&
+      wcscmp (argv[1], L"m") != 0)
+  {
+    fwprintf (stderr, L"Unknown operation `%ls'\n", argv[1]);
+    usage (argv);
+    return 1;
+  }
+  if (argc > 4)
+  {
+    int i;
+    for (i = 4; i < argc; i++)
+    {
+      if (wcscmp (argv[i], L"r") == 0)
+        recursive = 1;
+      else if (wcscmp (argv[i], L"d") == 0)
+        dry = 1;
+      else if (wcscmp (argv[i], L"j") == 0)
+        reljunc = 1;
+      else if (wcscmp (argv[i], L"B") == 0)
+        binary = 1;
+      else if (wcscmp (argv[i], L"h") == 0)
+        hardlinks = 1;
+      else if (wcscmp (argv[i], L"S") == 0)
+        stats = 1;
+      else if (wcscmp (argv[i], L"L") == 0)
+        throttling.background = 1;
+      else if (wcscmp (argv[i], L"R") == 0)
+      {
+        wchar_t *end;
+        if (i + 1 >= argc)
+        {
+          fwprintf (stderr, L"Option 'R' requires extra argument\n");
+          usage (argv);
+          return 1;
+        }
+        throttling.ops_per_sec = wcstod (argv[i + 1], &end);
+        if (*end == L':')
+          throttling.bytes_per_sec = wcstod (end + 1, &end);
+        if (*end != L'\0' || throttling.ops_per_sec < 0 || throttling.bytes_per_sec < 0)
+        {
+          fwprintf (stderr, L"Invalid rate `%ls'\n", argv[i + 1]);
+          usage (argv);
+          return 1;
+        }
+        i += 1;
+      }
+      else if (wcscmp (argv[i], L"t") == 0)
+      {
+        if (i + 1 >= argc)
+        {
+          fwprintf (stderr, L"Option 't' requires extra argument\n");
+          usage (argv);
+          return 1;
+        }
+        nthreads = _wtoi (argv[i + 1]);
+        i += 1;
+      }
+      else if (wcscmp (argv[i], L"m") == 0)
+      {
+        if (i + 1 >= argc)
+        {
+          fwprintf (stderr, L"Option 'm' requires extra argument\n");
+          usage (argv);
+          return 1;
+        }
+        memory = (size_t) _wtoi (argv[i + 1]) * 1024 * 1024;
+        i += 1;
+      }
+      else if (wcscmp (argv[i], L"f") == 0 || wcscmp (argv[i], L"o") == 0 ||
+          wcscmp (argv[i], L"a") == 0 || wcscmp (argv[i], L"i") == 0 ||
+          wcscmp (argv[i], L"s") == 0 || wcscmp (argv[i], L"n") == 0 ||
+          wcscmp (argv[i], L"T") == 0)
+      {
+        if (i + 1 >= argc)
+        {
+          fwprintf (stderr, L"Option '%ls' requires extra argument\n", argv[i]);
+          usage (argv);
+          return 1;
+        }
+        switch (argv[i][0])
+        {
+        case L'f':
+          filename = argv[i + 1];
+          break;
+        case L'o':
+          output = argv[i + 1];
+          break;
+        case L'a':
+          deltafile = argv[i + 1];
+          break;
+        case L'i':
+          basefile = argv[i + 1];
+          break;
+        case L'n':
+          secondfile = argv[i + 1];
+          break;
+        case L'T':
+          tracefile = argv[i + 1];
+          break;
+        default:
+          statefile = argv[i + 1];
+          break;
+        }
+        i += 1;
+      }
+    }
+  }
+  if (stats && ntlink_stats_enable (1) == 0)
+    atexit (print_stats);
+  if (tracefile != NULL)
+  {
+    if (ntlink_trace_start (tracefile, 0) != 0)
+    {
+      fwprintf (stderr, L"Failed to start tracing into `%ls'\n", tracefile);
+      return 2;
+    }
+    atexit (stop_trace);
+  }
+  if (binary && (filename == NULL || wcscmp (argv[1], L"b") != 0))
+  {
+    fwprintf (stderr, L"Option 'B' is only valid for backup, with 'f'\n");
+    usage (argv);
+    return 1;
+  }
+  if (hardlinks && (basefile != NULL || wcscmp (argv[1], L"b") != 0))
+  {
+    /* Unchanged directories are not listed, their groups would be incomplete */
+    fwprintf (stderr, L"Option 'h' is only valid for backup, and not with 'i'\n");
+    usage (argv);
+    return 1;
+  }
+  if ((throttling.background || throttling.ops_per_sec > 0 || throttling.bytes_per_sec > 0) &&
+      wcscmp (argv[1], L"b") != 0 && wcscmp (argv[1], L"v") != 0)
+  {
+    fwprintf (stderr, L"Options 'L' and 'R' are only valid for backup and verify\n");
+    usage (argv);
+    return 1;
+  }
+  if (wcscmp (argv[1], L"c") == 0 && (filename == NULL || output == NULL))
+  {
+    fwprintf (stderr, L"Operation 'c' requires options 'f' and 'o'\n");
+    usage (argv);
+    return 1;
+  }
+
+  if (wcscmp (argv[1], L"d") == 0 || wcscmp (argv[1], L"m") == 0)
+  {
+    if (filename == NULL || secondfile == NULL || output == NULL)
+    {
+      fwprintf (stderr, L"Operation '%ls' requires options 'f', 'n' and 'o'\n", argv[1]);
+      usage (argv);
+      return 1;
+    }
+    r = join_manifests (filename, secondfile, output, memory, wcscmp (argv[1], L"d") == 0);
+    if (r != 0)
+      fwprintf (stderr, L"Failed to %ls `%ls' and `%ls': %d\n", wcscmp (argv[1], L"d") == 0 ? L"compare" : L"merge", filename, secondfile, r);
+    return r;
+  }
+
+  if (filename != NULL && wcscmp (argv[1], L"b") != 0)
+  {
+    /* Map the manifest if it's a binary one, otherwise read it as text */
+    r = manifest_map_open (filename, &map);
+    if (r == -3)
+    {
+      fwprintf (stderr, L"`%ls' is a corrupted or unsupported binary manifest\n", filename);
+      return 2;
+    }
+    else if (r == -1)
+    {
+      fwprintf (stderr, L"Failed to open file `%ls': %d - %hs\n", filename, errno, strerror (errno));
+      return 2;
+    }
+    else if (r != 0)
+      map = NULL;
+  }
+
+  if (wcscmp (argv[1], L"c") == 0 && deltafile != NULL)
+  {
+    manifest_map_close (map);
+    r = apply_delta (filename, deltafile, output);
+    if (r != 0)
+      fwprintf (stderr, L"Failed to apply `%ls' to `%ls': %d\n", deltafile, filename, r);
+    return r;
+  }
+  else if (wcscmp (argv[1], L"l") == 0)
+  {
+    r = lookup_link (argv[2], argv[3], filename, map);
+    manifest_map_close (map);
+    return r;
+  }
+  else if (wcscmp (argv[1], L"c") == 0)
+  {
+    r = convert_manifest (filename, map, output);
+    manifest_map_close (map);
+    if (r != 0)
+      fwprintf (stderr, L"Failed to convert `%ls' into `%ls': %d\n", filename, output, r);
+    return r;
+  }
+  else if (wcscmp (argv[1], L"v") == 0 && map != NULL)
+  {
+    throttle = new_throttle (&throttling);
+    r = verify_links (argv[2], argv[3], NULL, map, nthreads, reljunc, throttle);
+    ntlink_throttle_free (throttle);
+    manifest_map_close (map);
+    return r;
+  }
+  else if (map != NULL)
+  {
+    r = restore_links_map (argv[2], argv[3], map, nthreads, dry);
+    manifest_map_close (map);
+    return r;
+  }
+
+  if (filename != NULL)
+  {
+    /* A delta only makes sense on its own */
+    const wchar_t *mode = wcscmp (argv[1], L"b") != 0 ? L"rb" : binary || basefile != NULL ? L"wb" : L"ab";
+    f = _wfopen (filename, mode);
+    if (f == NULL)
+    {
+      fwprintf (stderr, L"Failed to open file `%ls' with mode `%ls': %d - %hs\n", filename, mode, errno, strerror (errno));
+      return 2;
+    }
+  }
+  else
+  {
+    /* Manifests are UTF-16 with bare newlines, make sure they pass through
+     * stdin/stdout unchanged.
+     */
+    f = wcscmp (argv[1], L"b") != 0 ? stdin : stdout;
+    _setmode (_fileno (f), _O_BINARY);
+  }
+  throttle = new_throttle (&throttling);
+  if (wcscmp (argv[1],L"b") == 0)
+  {
+    if (basefile != NULL && incremental_open (&inc, basefile, statefile) != 0)
+    {
+      if (filename != NULL)
+        fclose (f);
+      ntlink_throttle_free (throttle);
+      return 2;
+    }
+    if (binary)
+    {
+      manifest_list list = { NULL, 0, 0 };
+      r = backup_links (argv[2], argv[3], NULL, &list, basefile != NULL ? &inc : NULL, dry, recursive, reljunc, hardlinks, nthreads, throttle);
+      if (r >= 0 && manifest_write_binary (f, &list) != 0)
+      {
+        fwprintf (stderr, L"Failed to write binary manifest `%ls'\n", filename);
+        r = 2;
+      }
+      manifest_list_clear (&list);
+    }
+    else
+    {
+      manifest_writer writer;
+      if (manifest_writer_init (&writer, f) != 0)
+        r = -1;
+      else
+      {
+        r = backup_links (argv[2], argv[3], &writer, NULL, basefile != NULL ? &inc : NULL, dry, recursive, reljunc, hardlinks, nthreads, throttle);
+        if (manifest_writer_flush (&writer) != 0)
+        {
+          fwprintf (stderr, L"Failed to write manifest\n");
+          r = 2;
+        }
+        manifest_writer_free (&writer);
+      }
+    }
+    if (basefile != NULL)
+    {
+      if (r == 0 && statefile != NULL)
+        r = incremental_save_state (&inc, statefile);
+      incremental_close (&inc);
+    }
+  }
+  else if (wcscmp (argv[1], L"v") == 0)
+    r = verify_links (argv[2], argv[3], f, NULL, nthreads, reljunc, throttle);
+  else
+    r = restore_links (argv[2], argv[3], f, nthreads, dry);
+  ntlink_throttle_free (throttle);
+  if (filename != NULL)
+    fclose (f);
+  return r;
+}